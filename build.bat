@@ -42,6 +42,14 @@ if %errorlevel% neq 0 goto fail
 ::cl %srcdir%r_gl.cpp /c %cFlags%
 ::if %errorlevel% neq 0 goto fail
 
+:: Software renderer, link r_soft.obj instead of r_d3d11.obj to use it
+::cl %srcdir%r_soft.cpp /c %cFlags%
+::if %errorlevel% neq 0 goto fail
+
+:: Null renderer for headless profiling, link r_null.obj instead of r_d3d11.obj to use it
+::cl %srcdir%r_null.cpp /c %cFlags%
+::if %errorlevel% neq 0 goto fail
+
 cl %srcdir%main.cpp %cFlags% /out:drawt.exe stb.obj resource.res os_windows.obj r_d3d11.obj
 if %errorlevel% neq 0 goto fail
 
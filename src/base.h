@@ -25,6 +25,7 @@ extern void logUnfreedMemory();
 #include "../dep/tl/include/tl/list.h"
 #include "../dep/tl/include/tl/thread.h"
 #include "../dep/tl/include/tl/console.h"
+#include "tiles.h"
 
 #define INV_ATLAS_TILE_SIZE 0.25f
 #define SV_TRIANGLE_SIZE 0.7f
@@ -198,6 +199,7 @@ struct ImageEntity : EntityBase {
 	v2f size = {};
 
 	f32 initialAspectRatio = 1;
+	bool sizePending = false; // Square placeholder until the file's header is read, see ImageImport
 
 	void *renderData = {};
 };
@@ -205,6 +207,7 @@ struct ImageEntity : EntityBase {
 struct CreateAction : ActionBase {
 	CreateAction() : ActionBase(Action_create) {}
 	EntityId targetId = invalidEntityId;
+	bool batched = false; // Undone and redone together with the previous action, not saved
 };
 
 struct TranslateAction : ActionBase {
@@ -386,8 +389,23 @@ struct Scene {
 
 	bool needResize = true;
 	bool needRepaint = true;
+	TileMask dirtyTiles; // Repainted when needRepaint is not set
+
+	// Entity that is being drawn or transformed. It is drawn over a cached layer
+	// with the rest of the scene, so every frame costs the same regardless of scene size.
+	EntityId liveEntityId = invalidEntityId;
+	bool liveEntityDirty = false;
+	bool staticLayerValid = false; // Set by the renderer when the layer is drawn
 	bool matrixSceneToNDCDirty = true;
 	bool drawColorDirty = true;
+
+	// Camera the canvas was last drawn with, set by the renderer.
+	// Moves by whole pixels since then are scrolled instead of repainted.
+	v2f canvasCameraPosition = {};
+	f32 canvasCameraDistance = 0;
+	// Scene point that stays on a whole pixel while the canvas scrolls. Renderers place geometry relative
+	// to it, so a scrolled canvas is the same as a redrawn one, see updateCanvasCamera.
+	v2f canvasOrigin = {};
 	bool constantBufferDirty = false;
 
 	bool initialized = false;
@@ -490,8 +508,52 @@ inline f32 getDrawThickness(Scene const *scene) { return scene->windowDrawThickn
 inline wchar *getFilename(std::wstring &path) {
 	return path.data() + path.rfind(L'\\') + 1;
 }
+// Draw color and thickness don't affect the canvas, they are uploaded with the next repaint.
+// Anything drawn outside the canvas, like the color menu swatch, must not read them from the scene.
+// drawColorDirty is consumed by the paint cursor and the live entity, see consumeDrawColorChange.
 inline bool shouldRepaint(Scene const *scene) {
-	return scene->drawColorDirty || scene->constantBufferDirty || scene->matrixSceneToNDCDirty || scene->needRepaint;
+	return scene->matrixSceneToNDCDirty || scene->needRepaint || scene->needResize || scene->dirtyTiles.any() || scene->liveEntityDirty
+		|| (scene->liveEntityId != invalidEntityId && !scene->staticLayerValid);
+}
+// Called once per frame after everything that follows the draw color has read drawColorDirty,
+// so a picked color is applied in one frame and the loop can go idle after it
+inline bool consumeDrawColorChange(Scene *scene) {
+	bool changed = scene->drawColorDirty;
+	scene->drawColorDirty = false;
+	return changed;
+}
+inline v2f sceneToCanvas(Scene const *scene, v2f p) { return (p - scene->cameraPosition) / scene->cameraDistance + (v2f)scene->dirtyTiles.canvasSize * 0.5f; }
+inline v2f canvasToScene(Scene const *scene, v2f p) { return (p - (v2f)scene->dirtyTiles.canvasSize * 0.5f) * scene->cameraDistance + scene->cameraPosition; }
+
+// Marks canvas area covered by scene space bounds for repaint
+inline void invalidateSceneBounds(Scene *scene, aabb<v2f> bounds) {
+	if (scene->needRepaint)
+		return;
+
+	// Antialiased edges go a bit outside of the bounds
+	v2f margin = V2f(2);
+	auto &tiles = scene->dirtyTiles;
+	tiles.add(sceneToCanvas(scene, bounds.min) - margin, sceneToCanvas(scene, bounds.max) + margin);
+
+	// Repainting most of the canvas clipped is slower than repainting all of it
+	if (tiles.dirtyCount * 2 > tiles.totalCount()) {
+		scene->needRepaint = true;
+	}
+}
+// Starts or stops (with invalidEntityId) editing of an entity
+inline void setLiveEntity(Scene *scene, EntityId id) {
+	if (scene->liveEntityId == id)
+		return;
+
+	// Canvas has the previous live entity on top of everything, put it back in its place
+	auto it = scene->entities.find(scene->liveEntityId);
+	if (it != scene->entities.end()) {
+		invalidateSceneBounds(scene, it->second.bounds);
+	}
+
+	scene->liveEntityId = id;
+	scene->liveEntityDirty = true;
+	scene->staticLayerValid = false;
 }
 inline v2u getUv(Tool tool) {
 	switch (tool) {
@@ -536,28 +598,53 @@ inline char const *toString(EntityType t) {
 	}
 }
 
-inline List<Line> getGridLines(GridEntity const &grid) {
-	List<Line> lines;
-	lines.reserve(grid.cellCount.x + grid.cellCount.y + 2);
+constexpr u32 maxGridCellCount = 1 << 16;
 
+inline u32 getGridLineCount(GridEntity const &grid) {
+	return grid.cellCount.x + grid.cellCount.y + 2;
+}
+
+// First cellCount.x + 1 lines are vertical, the rest are horizontal
+inline Line getGridLine(GridEntity const &grid, u32 index) {
 	Line line;
 	line.a.thickness = line.b.thickness = grid.thickness;
 
-	line.a.position.y = 0;
-	line.b.position.y = grid.size.y;
-	for (u32 i = 0; i <= grid.cellCount.x; ++i) {
-		line.a.position.x = line.b.position.x = (f32)i / grid.cellCount.x * grid.size.x;
-		lines.push_back(line);
+	if (index <= grid.cellCount.x) {
+		line.a.position.y = 0;
+		line.b.position.y = grid.size.y;
+		line.a.position.x = line.b.position.x = (f32)index / grid.cellCount.x * grid.size.x;
+	} else {
+		index -= grid.cellCount.x + 1;
+		line.a.position.x = 0;
+		line.b.position.x = grid.size.x;
+		line.a.position.y = line.b.position.y = (f32)index / grid.cellCount.y * grid.size.y;
 	}
 
-	line.a.position.x = 0;
-	line.b.position.x = grid.size.x;
-	for (u32 i = 0; i <= grid.cellCount.y; ++i) {
-		line.a.position.y = line.b.position.y = (f32)i / grid.cellCount.y * grid.size.y;
-		lines.push_back(line);
-	}
+	return line;
+}
 
-	return lines;
+// Distance from the point to the closest grid line, not counting thickness.
+// Point is relative to grid's position.
+inline f32 getGridLineDistance(GridEntity const &grid, v2f point) {
+	auto axisDistance = [&](u32 axis) {
+		u32 other = !axis;
+		f32 size = grid.size.s[axis];
+		f32 cellCount = (f32)grid.cellCount[axis];
+
+		f32 lineOffset = 0;
+		if (size != 0) {
+			lineOffset = clamp(TL::round(point.s[axis] / size * cellCount), 0.0f, cellCount) / cellCount * size;
+		}
+
+		f32 otherMin = min(grid.size.s[other], 0.0f);
+		f32 otherMax = max(grid.size.s[other], 0.0f);
+
+		v2f d;
+		d.s[axis] = point.s[axis] - lineOffset;
+		d.s[other] = max(max(point.s[other] - otherMax, otherMin - point.s[other]), 0.0f);
+		return length(d);
+	};
+	return min(axisDistance(0), axisDistance(1));
 }
 
 inline Array<Line, CircleEntity::LINE_COUNT> getCircleLines(CircleEntity const &circle) {
@@ -0,0 +1,227 @@
+#pragma once
+#include "stroke.h"
+#include "drawlist.h"
+#include "imageatlas.h"
+
+// Line-like entities of a scene (finished pencil strokes, lines and circles) are meshed into one pool.
+// Every vertex knows its entity's slot in an instance table, which holds per-entity color, position and
+// rotation. Slots are dense and reused after entities are removed, only entries that changed are uploaded.
+// Entities that are next to each other in the pool and in the draw list are drawn with one draw call.
+
+struct BatchVertex {
+	v2f center;
+	v2f offset;
+	u32 instance; // Slot of the entity
+};
+
+// Vertices of removed meshes point here, they are collapsed in the vertex shader
+constexpr u32 hiddenInstance = ~0u;
+
+struct EntityInstance {
+	v4f rotation;      // Upper left 2x2 of the entity's rotation matrix, in memory order
+	v3f color;
+	f32 thicknessMult; // Zero hides the entity
+	v2f position;
+	v2f pad_;
+};
+
+// Image drawn from an atlas page, see imageatlas.h
+struct AtlasImageInstance {
+	v4f rotation; // Same as EntityInstance::rotation
+	v2f position;
+	v2f size;
+	v2f uvMin;
+	v2f uvMax;
+	f32 maxLevel; // Last level of the page padded for the image
+};
+
+struct PoolRange {
+	u32 first;
+	u32 count;
+	u32 version;
+	u32 slot; // In the instance table
+};
+
+struct StrokePool {
+	List<BatchVertex> vertices;
+	std::unordered_map<EntityId, PoolRange> ranges;
+	f32 scale = 0;
+	u32 hiddenVertexCount = 0;
+
+	List<u32> freeSlots; // Of removed entities, reused before the table grows
+	u32 slotCount = 0;   // Size of the instance table
+
+	// Vertices that changed since last upload
+	u32 dirtyBegin = ~0u;
+	u32 dirtyEnd = 0;
+
+	void reset(f32 newScale) {
+		vertices.clear();
+		ranges.clear();
+		scale = newScale;
+		hiddenVertexCount = 0;
+		freeSlots.clear();
+		slotCount = 0;
+		dirtyBegin = ~0u;
+		dirtyEnd = 0;
+	}
+	void markDirty(u32 first, u32 count) {
+		dirtyBegin = min(dirtyBegin, first);
+		dirtyEnd = max(dirtyEnd, first + count);
+	}
+	void clearDirty() {
+		dirtyBegin = ~0u;
+		dirtyEnd = 0;
+	}
+	// Holes are left by meshes that changed size. Rebuilding the pool removes them.
+	bool needsCompaction() const {
+		return hiddenVertexCount > 4096 && hiddenVertexCount > vertices.size() / 2;
+	}
+	PoolRange const *find(EntityId id) const {
+		auto it = ranges.find(id);
+		return it == ranges.end() ? 0 : &it->second;
+	}
+	void hide(PoolRange const &range) {
+		for (u32 i = 0; i < range.count; ++i) {
+			vertices[range.first + i].instance = hiddenInstance;
+			vertices[range.first + i].offset = {};
+		}
+		hiddenVertexCount += range.count;
+		markDirty(range.first, range.count);
+	}
+	// Hides the mesh of a removed entity and frees its slot
+	auto remove(std::unordered_map<EntityId, PoolRange>::iterator it) {
+		hide(it->second);
+		freeSlots.push_back(it->second.slot);
+		return ranges.erase(it);
+	}
+	// Stores the mesh of an entity. Same sized meshes are overwritten in place,
+	// others are appended and the old range becomes a hole.
+	void put(EntityId id, u32 version, StrokeVertex const *mesh, u32 count) {
+		auto it = ranges.find(id);
+		PoolRange range;
+		if (it != ranges.end()) {
+			range.slot = it->second.slot;
+		} else if (freeSlots.size()) {
+			range.slot = freeSlots.back();
+			freeSlots.pop_back();
+		} else {
+			range.slot = slotCount++;
+		}
+		if (it != ranges.end() && it->second.count == count) {
+			range = it->second;
+		} else {
+			if (it != ranges.end()) {
+				hide(it->second);
+			}
+			range.first = (u32)vertices.size();
+			range.count = count;
+			vertices.resize(vertices.size() + count);
+		}
+		range.version = version;
+		for (u32 i = 0; i < count; ++i) {
+			vertices[range.first + i] = {mesh[i].center, mesh[i].offset, range.slot};
+		}
+		markDirty(range.first, count);
+		ranges[id] = range;
+	}
+};
+
+// Meshes entities that can be pooled, returns false for others
+inline bool meshEntity(List<StrokeVertex> &mesh, Entity const &e, f32 pixelsPerUnit) {
+	switch (e.type) {
+		case Entity_pencil: meshStroke(mesh, e.pencil.lines.data(), e.pencil.lines.size(), pixelsPerUnit); return true;
+		case Entity_line:   meshStroke(mesh, &e.line.line, 1, pixelsPerUnit); return true;
+		case Entity_circle: meshStroke(mesh, getCircleLines(e.circle).data(), CircleEntity::LINE_COUNT, pixelsPerUnit); return true;
+		default: return false;
+	}
+}
+
+enum DrawBatchKind : u8 {
+	DrawBatch_pooled,       // Run of pooled entities, parameters from the instance table
+	DrawBatch_pooledSingle, // One pooled entity with parameters from the entity constant buffer, e.g. hover highlight
+	DrawBatch_entity,       // Entity drawn on its own (images, grids, strokes being drawn)
+	DrawBatch_atlasImages,  // Run of images on one atlas page, parameters from the atlas instance table
+};
+
+struct DrawBatch {
+	DrawBatchKind kind;
+	u32 firstCommand;
+	u32 commandCount;
+	u32 firstVertex; // First instance of atlas images, they are numbered in command order
+	u32 vertexCount;
+	u32 atlasPage;
+};
+
+struct BatchPlan {
+	List<DrawBatch> batches;
+	u32 drawCount = 0;
+	u32 shaderChanges = 0;
+	u32 constantBufferUpdates = 0;
+	u32 atlasInstanceCount = 0;
+};
+
+// Groups entity commands of one scene into batches.
+// 'getRange' returns pool range of the command's entity, or null if the entity is not pooled.
+// 'getAtlasPage' returns atlas page of the command's image, or noAtlasPage if it's drawn on its own.
+template <class GetRange, class GetAtlasPage>
+BatchPlan planBatches(DrawCommand const *commands, umm commandCount, GetRange &&getRange, GetAtlasPage &&getAtlasPage) {
+	BatchPlan plan;
+	for (u32 i = 0; i < commandCount; ++i) {
+		auto &command = commands[i];
+		if (command.type != DrawCommand_entity)
+			continue;
+
+		// Highlight is drawn before the entity with the same geometry, so it can't share a batch
+		bool highlight = i + 1 < commandCount && commands[i + 1].type == DrawCommand_entity && commands[i + 1].entity.id == command.entity.id;
+
+		DrawBatch batch = {};
+		batch.firstCommand = i;
+		batch.commandCount = 1;
+
+		PoolRange const *range = getRange(command);
+		if (range) {
+			batch.kind = highlight ? DrawBatch_pooledSingle : DrawBatch_pooled;
+			batch.firstVertex = range->first;
+			batch.vertexCount = range->count;
+
+			if (batch.kind == DrawBatch_pooled && plan.batches.size()) {
+				auto &last = plan.batches.back();
+				if (last.kind == DrawBatch_pooled && last.firstVertex + last.vertexCount == batch.firstVertex && last.firstCommand + last.commandCount == i) {
+					last.vertexCount += batch.vertexCount;
+					last.commandCount += 1;
+					continue;
+				}
+			}
+		} else if (!highlight && (batch.atlasPage = getAtlasPage(command)) != noAtlasPage) {
+			batch.kind = DrawBatch_atlasImages;
+			batch.firstVertex = plan.atlasInstanceCount++;
+			batch.vertexCount = 6;
+
+			if (plan.batches.size()) {
+				auto &last = plan.batches.back();
+				if (last.kind == DrawBatch_atlasImages && last.atlasPage == batch.atlasPage && last.firstCommand + last.commandCount == i) {
+					last.vertexCount += batch.vertexCount;
+					last.commandCount += 1;
+					continue;
+				}
+			}
+		} else {
+			batch.kind = DrawBatch_entity;
+		}
+
+		// Pooled batches share shaders and buffers, atlas images share theirs, entities bind their own
+		if (!plan.batches.size() || batch.kind == DrawBatch_entity || plan.batches.back().kind == DrawBatch_entity ||
+			(batch.kind == DrawBatch_atlasImages) != (plan.batches.back().kind == DrawBatch_atlasImages)) {
+			plan.shaderChanges += 1;
+		}
+		plan.batches.push_back(batch);
+	}
+	plan.drawCount = (u32)plan.batches.size();
+	plan.constantBufferUpdates = (u32)plan.batches.size();
+	return plan;
+}
+template <class GetRange>
+BatchPlan planBatches(DrawCommand const *commands, umm commandCount, GetRange &&getRange) {
+	return planBatches(commands, commandCount, getRange, [](DrawCommand const &) { return noAtlasPage; });
+}
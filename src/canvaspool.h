@@ -0,0 +1,71 @@
+#pragma once
+#include "base.h"
+
+// Canvases of scenes are allocated by renderers when a scene is drawn and kept while they fit in the budget.
+// When they don't, canvases of least recently drawn scenes are released. Those scenes get needResize,
+// so they are repainted from their entities when they are shown again.
+
+constexpr u64 defaultCanvasBudget = 256 * 1024 * 1024;
+
+struct CanvasStats {
+	u64 budget = 0;
+	u64 bytes = 0; // Canvases and layers of resident scenes, including multisampled ones
+	u64 peakBytes = 0;
+	u32 residentCount = 0;
+	u64 allocationCount = 0; // Scenes whose canvas was allocated from nothing
+	u64 evictionCount = 0;
+};
+
+struct CanvasPool {
+	struct Entry {
+		u64 bytes = 0;
+		u64 lastUse = 0;
+	};
+
+	Entry entries[countof(scenes)];
+	u64 frame = 1;
+	CanvasStats stats = {defaultCanvasBudget};
+
+	// Scenes used in the current frame are never evicted
+	void beginFrame() {
+		++frame;
+	}
+	void use(Scene const *scene) {
+		entries[indexof(scene)].lastUse = frame;
+	}
+	// Called after a scene's canvas memory changed, 0 when it was released
+	void setBytes(Scene const *scene, u64 bytes) {
+		auto &entry = entries[indexof(scene)];
+		if (!entry.bytes && bytes) {
+			++stats.residentCount;
+			++stats.allocationCount;
+		} else if (entry.bytes && !bytes) {
+			--stats.residentCount;
+		}
+		stats.bytes = stats.bytes - entry.bytes + bytes;
+		stats.peakBytes = max(stats.peakBytes, stats.bytes);
+		entry.bytes = bytes;
+	}
+	// Releases least recently used canvases until the pool fits in the budget.
+	// 'release' frees the scene's canvas memory, the pool updates its size and the scene's flags.
+	template <class Release>
+	void trim(Release &&release) {
+		while (stats.bytes > stats.budget) {
+			Entry *oldest = 0;
+			for (auto &entry : entries) {
+				if (entry.bytes && entry.lastUse != frame && (!oldest || entry.lastUse < oldest->lastUse)) {
+					oldest = &entry;
+				}
+			}
+			if (!oldest)
+				break;
+
+			Scene *scene = scenes + (oldest - entries);
+			release(scene);
+			setBytes(scene, 0);
+			scene->needResize = true;
+			scene->staticLayerValid = false;
+			++stats.evictionCount;
+		}
+	}
+};
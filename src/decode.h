@@ -0,0 +1,213 @@
+#pragma once
+#include "base.h"
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+
+// Decodes images on one worker per core. Workers block on a condition variable while nothing is queued,
+// the queue is unbounded. Items with higher priority are decoded first, equal priorities in push order.
+// Priorities of queued items are recomputed when the camera moves, so images in view go before the rest.
+
+enum : u32 {
+	DecodePriority_otherScene, // Referenced only by scenes that are not shown
+	DecodePriority_offscreen,
+	DecodePriority_visible,
+};
+
+struct ImageDecodeStats {
+	u64 pushedCount = 0;
+	u64 decodedCount = 0;
+	u64 cancelledCount = 0; // Removed from the queue before a worker took them
+	u64 peakQueueSize = 0;
+	f64 busySeconds = 0; // Summed over workers
+};
+
+struct ImageDecodePool {
+	using Clock = std::chrono::steady_clock;
+
+	struct Entry {
+		void *item;
+		u32 priority;
+		u64 order;
+	};
+
+	static constexpr u32 maxWorkerCount = 64;
+
+	std::thread threads[maxWorkerCount];
+	u32 workerCount = 0;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	List<Entry> queue;
+	void *takenItems[maxWorkerCount] = {}; // Item each worker is decoding, null while it waits
+	u64 pushCounter = 0;
+	u32 busyCount = 0;
+	bool stopping = false;
+	ImageDecodeStats stats;
+
+	// Called on a worker without the pool's lock held
+	void (*decode)(void *context, void *item) = 0;
+	void *decodeContext = 0;
+
+	template <class Fn>
+	void init(u32 count, Fn *fn) {
+		decode = [](void *context, void *item) { (*(Fn *)context)(item); };
+		decodeContext = (void *)fn;
+		stopping = false;
+		workerCount = clamp(count, 1u, maxWorkerCount);
+		for (u32 i = 0; i < workerCount; ++i) {
+			threads[i] = std::thread([this, i] {
+				for (;;) {
+					void *item;
+					{
+						std::unique_lock lock(mutex);
+						wake.wait(lock, [&] { return stopping || queue.size(); });
+						if (stopping)
+							return;
+						item = popBest();
+						takenItems[i] = item;
+						++busyCount;
+					}
+
+					auto begin = Clock::now();
+					decode(decodeContext, item);
+					f64 seconds = std::chrono::duration<f64>(Clock::now() - begin).count();
+
+					std::unique_lock lock(mutex);
+					takenItems[i] = 0;
+					++stats.decodedCount;
+					stats.busySeconds += seconds;
+					if (--busyCount == 0 && !queue.size()) {
+						idle.notify_all();
+					}
+				}
+			});
+		}
+	}
+	// Queued items are dropped, items being decoded are finished
+	void deinit() {
+		{
+			std::unique_lock lock(mutex);
+			stopping = true;
+			queue.clear();
+		}
+		wake.notify_all();
+		for (u32 i = 0; i < workerCount; ++i) {
+			threads[i].join();
+		}
+		workerCount = 0;
+	}
+	void push(void *item, u32 priority) {
+		{
+			std::unique_lock lock(mutex);
+			queue.push_back({item, priority, pushCounter++});
+			++stats.pushedCount;
+			stats.peakQueueSize = max(stats.peakQueueSize, (u64)queue.size());
+		}
+		wake.notify_one();
+	}
+	// Drops 'item' if no worker took it yet. Returns true when a worker is decoding it, the caller leaves the item
+	// alive until that worker is done with it.
+	bool remove(void *item) {
+		std::unique_lock lock(mutex);
+		for (umm i = 0; i < queue.size(); ++i) {
+			if (queue[i].item == item) {
+				queue[i] = queue.back();
+				queue.resize(queue.size() - 1);
+				++stats.cancelledCount;
+				break;
+			}
+		}
+		if (!busyCount && !queue.size()) {
+			idle.notify_all();
+		}
+		return isTaken(item);
+	}
+	// An item is taken from when a worker pops it until 'decode' returns or calls finish. Items are taken before
+	// 'decode' runs, so callers can't miss one that was popped but not started yet. Items are not pushed again while
+	// they are taken.
+	bool isInFlight(void *item) {
+		std::unique_lock lock(mutex);
+		return isTaken(item);
+	}
+	// Called by 'decode' with its own lock held when it publishes its results, so holders of that lock see the item
+	// as done exactly when its results are there
+	void finish(void *item) {
+		std::unique_lock lock(mutex);
+		for (u32 i = 0; i < workerCount; ++i) {
+			if (takenItems[i] == item) {
+				takenItems[i] = 0;
+				break;
+			}
+		}
+	}
+	// 'getPriority' is called for every queued item with the pool's lock held
+	template <class GetPriority>
+	void reprioritize(GetPriority &&getPriority) {
+		std::unique_lock lock(mutex);
+		for (auto &entry : queue) {
+			entry.priority = getPriority(entry.item);
+		}
+	}
+	umm pendingCount() {
+		std::unique_lock lock(mutex);
+		return queue.size() + busyCount;
+	}
+	// Blocks until the queue is empty and no worker is decoding
+	void waitIdle() {
+		std::unique_lock lock(mutex);
+		idle.wait(lock, [&] { return !busyCount && !queue.size(); });
+	}
+	ImageDecodeStats getStats() {
+		std::unique_lock lock(mutex);
+		return stats;
+	}
+	// Called with the lock held
+	bool isTaken(void *item) const {
+		for (u32 i = 0; i < workerCount; ++i) {
+			if (takenItems[i] == item)
+				return true;
+		}
+		return false;
+	}
+	// Called with the lock held. Linear scan, reprioritize changes priorities in place so there is no heap to keep
+	void *popBest() {
+		umm best = 0;
+		for (umm i = 1; i < queue.size(); ++i) {
+			auto &a = queue[i];
+			auto &b = queue[best];
+			if (a.priority > b.priority || (a.priority == b.priority && a.order < b.order)) {
+				best = i;
+			}
+		}
+		void *item = queue[best].item;
+		queue[best] = queue.back();
+		queue.resize(queue.size() - 1);
+		return item;
+	}
+};
+
+// Scene rect shown in a window of 'viewSize' pixels
+inline aabb<v2f> getSceneView(Scene const *scene, v2f viewSize) {
+	v2f half = viewSize * 0.5f * scene->cameraDistance;
+	return aabbMinMax(scene->cameraPosition - half, scene->cameraPosition + half);
+}
+
+inline bool isInView(Entity const &e, aabb<v2f> view) {
+	return !(e.bounds.max.x < view.min.x || e.bounds.min.x > view.max.x || e.bounds.max.y < view.min.y || e.bounds.min.y > view.max.y);
+}
+
+// Raises priorities of items referenced by the scene's images, 'getItem' returns the queued item of an ImageEntity
+template <class GetItem>
+inline void collectImageDecodePriorities(std::unordered_map<void *, u32> &priorities, Scene const *scene, aabb<v2f> view, GetItem &&getItem) {
+	for (auto &[id, e] : scene->entities) {
+		if (e.type != Entity_image)
+			continue;
+		u32 priority = e.visible && isInView(e, view) ? DecodePriority_visible : DecodePriority_offscreen;
+		auto &current = priorities[getItem(e.image)];
+		current = max(current, priority);
+	}
+}
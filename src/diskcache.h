@@ -0,0 +1,239 @@
+#pragma once
+#include "platform.h"
+#include "mips.h"
+#include "virtualtexture.h"
+#include "hash.h"
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+
+// Decoded and downscaled images are stored in a directory, one file per image path, so opening a scene again maps
+// them instead of decoding. A file is used while the image file has the size and write time it was stored with,
+// or the same content hash when only the time changed. Levels are uploaded straight from the mapped file.
+// A file is replaced when a larger resolution is decoded. Least recently used files are deleted over the size limit.
+
+constexpr u64 defaultDiskImageCacheLimit = 1024ull * 1024 * 1024;
+
+struct DiskImageCacheHeader {
+	static constexpr u32 currentMagic = 0x43495744;
+	static constexpr u32 currentVersion = 1;
+	static constexpr u32 maxLevelCount = 32;
+
+	u32 magic;
+	u32 version;
+	u64 sourceFileSize;
+	u64 sourceWriteTime;
+	u64 contentHash;
+	v2u sourceSize;
+	u32 levelCount;
+	u32 pathLength;  // Image path follows the header, without a terminator
+	u64 texelOffset; // From the start of the file, aligned to 64 bytes
+	u64 texelCount;
+	MipLevel levels[maxLevelCount];
+};
+
+struct DiskImageCacheStats {
+	u64 limit = 0;
+	u64 bytes = 0;
+	u64 hitCount = 0;
+	u64 contentHitCount = 0; // Hits of files whose write time changed
+	u64 missCount = 0;
+	u64 writeCount = 0;
+	u64 evictionCount = 0;
+};
+
+struct DiskImageCache {
+	std::wstring directory; // Ends with a separator, empty when the cache is disabled
+	std::mutex mutex;
+	DiskImageCacheStats stats = {defaultDiskImageCacheLimit};
+	std::atomic<u32> tempFileCounter = 0;
+
+	bool init(std::wstring const &cacheDirectory) {
+		if (!platform_createDirectory(cacheDirectory.data())) {
+			LOGW(L"Image cache disabled, failed to create %", cacheDirectory.data());
+			directory.clear();
+			return false;
+		}
+		directory = cacheDirectory;
+		std::unique_lock lock(mutex);
+		stats.bytes = 0;
+		for (auto &entry : platform_listDirectory(directory.data())) {
+			stats.bytes += entry.size;
+		}
+		return true;
+	}
+	std::wstring getFilePath(wchar const *path) {
+		wchar name[32];
+		swprintf_s(name, countof(name), L"%016llx.pixels", hashBytes(path, wcslen(path) * sizeof(wchar)));
+		return directory + name;
+	}
+
+	// Chain of 'path' whose first level is at least 'targetSize' large, unless the stored one is full resolution.
+	// Images drawn from tiles get every level, see virtualtexture.h.
+	// Without 'contentHash' the image file has to have the size and write time the chain was stored with.
+	// The chain points into 'mapping', which the caller unmaps with platform_unmapFile when the chain is not needed.
+	// 'storedContentHash' is set to the hash of the image file the chain was stored with.
+	bool load(wchar const *path, FileInfo const &source, u64 const *contentHash, u32 targetSize, MipChain &mips, Span<u8 const> &mapping, u64 *storedContentHash = 0) {
+		if (!directory.size())
+			return false;
+
+		auto filePath = getFilePath(path);
+		auto view = platform_mapFile(filePath.data());
+		auto fail = [&] {
+			platform_unmapFile(view);
+			if (contentHash) {
+				std::unique_lock lock(mutex);
+				++stats.missCount;
+			}
+			return false;
+		};
+		if (view.size() < sizeof(DiskImageCacheHeader))
+			return fail();
+
+		auto &header = *(DiskImageCacheHeader const *)view.data();
+		umm pathLength = wcslen(path);
+		if (header.magic != DiskImageCacheHeader::currentMagic ||
+			header.version != DiskImageCacheHeader::currentVersion ||
+			header.levelCount == 0 || header.levelCount > DiskImageCacheHeader::maxLevelCount ||
+			header.pathLength != pathLength ||
+			sizeof(DiskImageCacheHeader) + pathLength * sizeof(wchar) > header.texelOffset ||
+			header.texelOffset > view.size() ||
+			header.texelCount > (view.size() - header.texelOffset) / sizeof(u32) ||
+			memcmp(&header + 1, path, pathLength * sizeof(wchar)) != 0)
+			return fail();
+
+		// Levels are stored one after another and have to lie within the texels, the chain is read without checks
+		u64 levelEnd = 0;
+		for (u32 i = 0; i < header.levelCount; ++i) {
+			auto &level = header.levels[i];
+			u64 texelCount = (u64)level.size.x * level.size.y;
+			if (!texelCount || level.offset < levelEnd || level.offset > header.texelCount || texelCount > header.texelCount - level.offset)
+				return fail();
+			levelEnd = level.offset + texelCount;
+		}
+
+		if (header.sourceFileSize != source.size)
+			return fail();
+		if (contentHash ? header.contentHash != *contentHash : header.sourceWriteTime != source.writeTime)
+			return fail();
+
+		auto largestSide = [&](u32 level) { return max(header.levels[level].size.x, header.levels[level].size.y); };
+		bool fullResolution = header.levels[0].size == header.sourceSize;
+		if (largestSide(0) < targetSize && !fullResolution)
+			return fail();
+
+		// Same level getMipSkipCount would start from
+		u32 first = 0;
+		while (!(fullResolution && needsVirtualTexture(header.sourceSize)) && first + 1 < header.levelCount && largestSide(first + 1) >= targetSize) {
+			++first;
+		}
+		umm firstOffset = header.levels[first].offset;
+
+		mips = {};
+		mips.sourceSize = header.sourceSize;
+		for (u32 i = first; i < header.levelCount; ++i) {
+			mips.levels.push_back({header.levels[i].offset - firstOffset, header.levels[i].size});
+		}
+		mips.mappedTexels = (u32 const *)(view.data() + header.texelOffset) + firstOffset;
+		mips.mappedTexelCount = header.texelCount - firstOffset;
+		mapping = view;
+		if (storedContentHash) {
+			*storedContentHash = header.contentHash;
+		}
+
+		// Write time orders files for eviction
+		platform_touchFile(filePath.data());
+
+		std::unique_lock lock(mutex);
+		++stats.hitCount;
+		if (contentHash) {
+			++stats.contentHitCount;
+		}
+		return true;
+	}
+	void store(wchar const *path, FileInfo const &source, u64 contentHash, MipChain const &mips) {
+		if (!directory.size() || !mips.levels.size() || mips.levels.size() > DiskImageCacheHeader::maxLevelCount)
+			return;
+
+		DiskImageCacheHeader header = {};
+		header.magic = DiskImageCacheHeader::currentMagic;
+		header.version = DiskImageCacheHeader::currentVersion;
+		header.sourceFileSize = source.size;
+		header.sourceWriteTime = source.writeTime;
+		header.contentHash = contentHash;
+		header.sourceSize = mips.sourceSize;
+		header.levelCount = (u32)mips.levels.size();
+		header.pathLength = (u32)wcslen(path);
+		header.texelOffset = (sizeof(header) + header.pathLength * sizeof(wchar) + 63) & ~(u64)63;
+		header.texelCount = mips.texelCount();
+		for (u32 i = 0; i < header.levelCount; ++i) {
+			header.levels[i] = mips.levels[i];
+		}
+		u64 fileSize = header.texelOffset + header.texelCount * sizeof(u32);
+
+		// Written under another name, so a file that is mapped or half written is never read
+		auto filePath = getFilePath(path);
+		auto tempPath = filePath + L".tmp" + std::to_wstring(tempFileCounter++);
+		auto file = _wfopen(tempPath.data(), L"wb");
+		if (!file) {
+			LOGW(L"Failed to open file for writing: %", tempPath.data());
+			return;
+		}
+		u8 padding[64] = {};
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(path, sizeof(wchar), header.pathLength, file);
+		fwrite(padding, 1, header.texelOffset - sizeof(header) - header.pathLength * sizeof(wchar), file);
+		fwrite(mips.texelData(), sizeof(u32), header.texelCount, file);
+		bool written = !ferror(file);
+		fclose(file);
+
+		FileInfo replaced = {};
+		platform_getFileInfo(filePath.data(), replaced);
+		_wremove(filePath.data());
+		if (!written || _wrename(tempPath.data(), filePath.data()) != 0) {
+			_wremove(tempPath.data());
+			return;
+		}
+
+		std::unique_lock lock(mutex);
+		stats.bytes = stats.bytes + fileSize - min(replaced.size, stats.bytes);
+		++stats.writeCount;
+		trim(filePath);
+	}
+	void setLimit(u64 bytes) {
+		std::unique_lock lock(mutex);
+		stats.limit = bytes;
+		trim({});
+	}
+	DiskImageCacheStats getStats() {
+		std::unique_lock lock(mutex);
+		return stats;
+	}
+
+	// Called with the lock held, deletes least recently used files except 'keep' until the cache fits in the limit
+	void trim(std::wstring const &keep) {
+		if (stats.bytes <= stats.limit)
+			return;
+
+		auto entries = platform_listDirectory(directory.data());
+		std::sort(entries.begin(), entries.end(), [](DirectoryEntry const &a, DirectoryEntry const &b) { return a.writeTime < b.writeTime; });
+		stats.bytes = 0;
+		for (auto &entry : entries) {
+			stats.bytes += entry.size;
+		}
+		for (auto &entry : entries) {
+			if (stats.bytes <= stats.limit)
+				break;
+			auto entryPath = directory + entry.name;
+			if (entryPath == keep)
+				continue;
+			// Fails for temporary files that are being written
+			if (_wremove(entryPath.data()) == 0) {
+				stats.bytes -= entry.size;
+				++stats.evictionCount;
+			}
+		}
+	}
+};
@@ -0,0 +1,461 @@
+#pragma once
+#include "base.h"
+#include "../dep/tl/include/tl/string.h"
+
+// A frame recorded as a flat list of commands. Renderers only execute it.
+// Commands are POD and refer to entities by id, so a list can be written to a file as is
+// and replayed later on top of the same scene.
+
+enum DrawCommandType : u8 {
+	DrawCommand_beginScene,     // Clear scene's canvas, following entity commands draw into it
+	DrawCommand_clipScene,      // Clear part of scene's canvas, following entity commands draw only there
+	DrawCommand_useStaticLayer, // Copy static layer to scene's canvas, live entity is drawn over it
+	DrawCommand_scrollScene,    // Move scene's canvas by whole pixels, exposed parts are repainted by clipScene commands
+	DrawCommand_entity,
+	DrawCommand_endScene,       // Resolve scene's canvas
+	DrawCommand_blitScene,      // Copy scene's canvas to the back buffer, scaled while zooming
+	DrawCommand_pieMenu,
+	DrawCommand_cursorCircle,
+	DrawCommand_quads,          // UI quads, range in DrawList::quads
+	DrawCommand_colorMenu,
+	DrawCommand_present,
+	DrawCommand_count,
+};
+
+struct DrawCommand {
+	DrawCommandType type;
+	union {
+		struct {
+			u32 sceneIndex;
+			v3f canvasColor;
+			bool partial;     // Canvas is not cleared, clipScene commands may follow
+			bool staticLayer; // Draw into the static layer instead of the canvas
+		} beginScene;
+		struct {
+			u32 sceneIndex;
+			v2u min; // Canvas pixels, bottom left origin
+			v2u max;
+		} clipScene;
+		struct {
+			u32 sceneIndex;
+			v2s offset; // Canvas pixels the contents move by
+		} scrollScene;
+		struct {
+			u32 sceneIndex;
+			EntityId id;
+			EntityType entityType;
+			bool outline;
+			bool drawBounds;
+			v2f position;
+			f32 rotation;
+			v3f color;
+			f32 thicknessMult;
+		} entity;
+		struct {
+			u32 sceneIndex;
+		} endScene, useStaticLayer;
+		struct {
+			u32 sceneIndex;
+			f32 viewportX;
+			f32 canvasScale;  // Window pixel p shows canvas pixel p * canvasScale + canvasOffset,
+			v2f canvasOffset; // identity unless the canvas was drawn at another zoom
+		} blitScene;
+		struct {
+			v2f position;
+			f32 angle;
+			f32 size;
+			f32 alpha;
+		} pieMenu;
+		struct {
+			u32 firstQuad;
+			u32 quadCount;
+		} quads;
+		struct {
+			v2f position;
+			f32 size;
+			f32 alpha;
+			v3f hueColor;
+			f32 hue;
+		} colorMenu;
+	};
+};
+
+struct DrawList {
+	List<DrawCommand> commands;
+	List<Quad> quads;
+
+	void clear() {
+		commands.clear();
+		quads.clear();
+	}
+	DrawCommand &push(DrawCommandType type) {
+		DrawCommand command;
+		memset(&command, 0, sizeof(command));
+		command.type = type;
+		commands.push_back(command);
+		return commands.back();
+	}
+	umm count(DrawCommandType type) const {
+		umm result = 0;
+		for (auto &command : commands) {
+			result += command.type == type;
+		}
+		return result;
+	}
+};
+
+// Everything the frame depends on that is not in base.h
+struct FrameInfo {
+	v2u clientSize;
+	v2s mousePosBL;
+	u32 minWindowDim;
+	bool needRepaint;
+	bool drawCursor;
+	bool drawCursorCircle;
+};
+
+inline void recordEntity(DrawList &list, Scene const *scene, Entity const &e) {
+	EntityId id = e.id;
+	auto pushEntity = [&](v3f color, f32 thicknessMult) -> DrawCommand & {
+		auto &command = list.push(DrawCommand_entity);
+		command.entity.sceneIndex = indexof(scene);
+		command.entity.id = id;
+		command.entity.entityType = e.type;
+		command.entity.position = e.position;
+		command.entity.rotation = e.rotation;
+		command.entity.color = color;
+		command.entity.thicknessMult = thicknessMult;
+		return command;
+	};
+
+	v3f color = {};
+	switch (e.type) {
+		case Entity_pencil: color = e.pencil.color; break;
+		case Entity_line:   color = e.line.color;   break;
+		case Entity_grid:   color = e.grid.color;   break;
+		case Entity_circle: color = e.circle.color; break;
+		case Entity_image: break;
+		default: INVALID_CODE_PATH();
+	}
+
+	// Hovered lines are highlighted with a thicker white copy underneath
+	f32 thicknessMult = 1.0f;
+	if (e.hovered && e.type != Entity_image) {
+		pushEntity(V3f(1), 1.0f);
+		thicknessMult = 0.8f;
+	}
+
+	auto &command = pushEntity(color, thicknessMult);
+	command.entity.outline = e.type == Entity_image && e.hovered;
+	command.entity.drawBounds = drawBounds;
+}
+
+// Records visible entities except the live one, or only those that touch 'clip' if it is not null
+inline void recordEntities(DrawList &list, Scene const *scene, aabb<v2f> const *clip) {
+	for (auto &[id, e] : scene->entities) {
+		if (!e.visible || id == scene->liveEntityId)
+			continue;
+		if (clip && (e.bounds.max.x < clip->min.x || e.bounds.min.x > clip->max.x || e.bounds.max.y < clip->min.y || e.bounds.min.y > clip->max.y))
+			continue;
+		recordEntity(list, scene, e);
+	}
+}
+
+// Called by renderers when the canvas is drawn. Origin is kept while the camera stays on its pixel grid.
+inline void updateCanvasCamera(Scene *scene) {
+	v2f offset = (scene->canvasOrigin - scene->cameraPosition) / scene->cameraDistance;
+	v2f rounded = round(offset);
+	if (scene->cameraDistance != scene->canvasCameraDistance || absolute(offset.x - rounded.x) > 0.001f || absolute(offset.y - rounded.y) > 0.001f) {
+		scene->canvasOrigin = scene->cameraPosition;
+	}
+	scene->canvasCameraPosition = scene->cameraPosition;
+	scene->canvasCameraDistance = scene->cameraDistance;
+}
+// Canvas pixels from the camera to canvasOrigin
+inline v2f getCanvasOriginOffset(Scene const *scene) {
+	return round((scene->canvasOrigin - scene->cameraPosition) / scene->cameraDistance);
+}
+
+// Offset of the canvas contents if the camera only moved by whole pixels since the canvas was drawn.
+// Zero offset means the canvas can't be scrolled.
+inline v2s getScrollOffset(Scene const *scene) {
+	bool live = scene->liveEntityId != invalidEntityId;
+	if (!scene->matrixSceneToNDCDirty || scene->needRepaint || scene->needResize || live || scene->dirtyTiles.any())
+		return {};
+	if (scene->cameraDistance != scene->canvasCameraDistance)
+		return {};
+
+	v2f offset = (scene->canvasCameraPosition - scene->cameraPosition) / scene->cameraDistance;
+	v2f rounded = round(offset);
+	if (absolute(offset.x - rounded.x) > 0.001f || absolute(offset.y - rounded.y) > 0.001f)
+		return {};
+	v2s result = (v2s)rounded;
+	v2s canvasSize = (v2s)scene->dirtyTiles.canvasSize;
+	if (absolute(result.x) >= canvasSize.x || absolute(result.y) >= canvasSize.y)
+		return {};
+	return result;
+}
+
+// Parts of the canvas that are not covered by the old contents after scrolling by offset
+inline List<CanvasRect> getExposedRects(v2u canvasSize, v2s offset) {
+	List<CanvasRect> result;
+	v2u keptMin = {(u32)max(offset.x, 0), (u32)max(offset.y, 0)};
+	v2u keptMax = {(u32)min((s32)canvasSize.x + offset.x, (s32)canvasSize.x), (u32)min((s32)canvasSize.y + offset.y, (s32)canvasSize.y)};
+	if (keptMin.x) result.push_back({{0, 0}, {keptMin.x, canvasSize.y}});
+	if (keptMax.x != canvasSize.x) result.push_back({{keptMax.x, 0}, {canvasSize.x, canvasSize.y}});
+	if (keptMin.y) result.push_back({{keptMin.x, 0}, {keptMax.x, keptMin.y}});
+	if (keptMax.y != canvasSize.y) result.push_back({{keptMin.x, keptMax.y}, {keptMax.x, canvasSize.y}});
+	return result;
+}
+
+// Repaints the whole canvas, or only dirty tiles if nothing else changed.
+// If the camera moved by whole pixels, the canvas is scrolled and only the exposed strips are repainted.
+// While an entity is edited everything else goes to the static layer, which is repainted the same way,
+// but only when something other than the live entity changed.
+inline void recordScene(DrawList &list, Scene const *scene) {
+	v2s scroll = getScrollOffset(scene);
+	bool scrolled = scroll.x || scroll.y;
+	bool live = scene->liveEntityId != invalidEntityId;
+	bool full = !scrolled && (scene->needRepaint || scene->needResize || scene->matrixSceneToNDCDirty || (live && !scene->staticLayerValid));
+	bool partial = !full && (scrolled || scene->dirtyTiles.any());
+
+	list.push(DrawCommand_beginScene).beginScene = {indexof(scene), scene->canvasColor, !full, live && (full || partial)};
+
+	auto recordRect = [&](CanvasRect rect) {
+		list.push(DrawCommand_clipScene).clipScene = {indexof(scene), rect.min, rect.max};
+
+		// One pixel more for antialiased edges of entities outside
+		aabb<v2f> clip;
+		clip.min = canvasToScene(scene, (v2f)rect.min) - scene->cameraDistance;
+		clip.max = canvasToScene(scene, (v2f)rect.max) + scene->cameraDistance;
+		recordEntities(list, scene, &clip);
+	};
+
+	if (scrolled) {
+		list.push(DrawCommand_scrollScene).scrollScene = {indexof(scene), scroll};
+		for (auto &rect : getExposedRects(scene->dirtyTiles.canvasSize, scroll)) {
+			recordRect(rect);
+		}
+	} else if (partial) {
+		for (auto &rect : scene->dirtyTiles.getRects()) {
+			recordRect(rect);
+		}
+	} else if (full) {
+		recordEntities(list, scene, 0);
+	}
+
+	if (live) {
+		list.push(DrawCommand_useStaticLayer).useStaticLayer.sceneIndex = indexof(scene);
+		auto it = scene->entities.find(scene->liveEntityId);
+		if (it != scene->entities.end() && it->second.visible) {
+			recordEntity(list, scene, it->second);
+		}
+	}
+
+	list.push(DrawCommand_endScene).endScene.sceneIndex = indexof(scene);
+}
+
+// While zoom animates, the last canvas is scaled instead of repainted, so frame time doesn't depend
+// on the scene. Canvas is repainted at full quality when the camera settles, or when anything else changes.
+inline bool shouldScaleCanvas(Scene const *scene) {
+	return scene->cameraDistance != scene->targetCameraDistance
+		&& scene->canvasCameraDistance != 0
+		&& !scene->needRepaint && !scene->needResize && !scene->liveEntityDirty && !scene->dirtyTiles.any()
+		&& scene->liveEntityId == invalidEntityId;
+}
+
+struct CanvasTransform {
+	f32 scale = 1;
+	v2f offset = {};
+};
+
+// Maps window pixels to pixels of the canvas drawn with canvasCameraPosition and canvasCameraDistance
+inline CanvasTransform getCanvasTransform(Scene const *scene) {
+	CanvasTransform result;
+	result.scale = scene->cameraDistance / scene->canvasCameraDistance;
+	result.offset = (v2f)scene->dirtyTiles.canvasSize * 0.5f * (1 - result.scale) + (scene->cameraPosition - scene->canvasCameraPosition) / scene->canvasCameraDistance;
+	return result;
+}
+
+inline void recordFrame(DrawList &list, FrameInfo const &info) {
+	list.clear();
+
+	// Scene shift animation blits whole canvases side by side, so only a single scene is scaled
+	bool scaleCanvas = !playingSceneShiftAnimation && shouldRepaint(currentScene) && shouldScaleCanvas(currentScene);
+
+	bool present = info.needRepaint || scaleCanvas;
+	if (shouldRepaint(currentScene) && !scaleCanvas) {
+		recordScene(list, currentScene);
+		present = true;
+	}
+	if (playingSceneShiftAnimation && shouldRepaint(previousScene)) {
+		recordScene(list, previousScene);
+		present = true;
+	}
+	if (!present)
+		return;
+
+	if (playingSceneShiftAnimation) {
+		f32 width = (f32)info.clientSize.x;
+		bool forward = currentScene > previousScene;
+		list.push(DrawCommand_blitScene).blitScene = {indexof(previousScene), forward ? lerp(0.0f, -width, sceneShiftT) : lerp(0.0f, width, sceneShiftT), 1};
+		list.push(DrawCommand_blitScene).blitScene = {indexof(currentScene), forward ? lerp(width, 0.0f, sceneShiftT) : lerp(-width, 0.0f, sceneShiftT), 1};
+	} else {
+		CanvasTransform transform;
+		if (scaleCanvas) {
+			transform = getCanvasTransform(currentScene);
+		}
+		list.push(DrawCommand_blitScene).blitScene = {indexof(currentScene), 0, transform.scale, transform.offset};
+	}
+
+	u32 firstQuad = (u32)list.quads.size();
+
+	auto makeQuad = [](v2f position, v2f size, v2u uv, v2u uvSize, v4f color) {
+		Quad q;
+		q.position = position;
+		q.position.y -= size.y;
+		q.size = size;
+		q.color = color;
+		setUv(q, uv, uvSize);
+		return q;
+	};
+	auto pushShadowedQuad = [&](v2f position, v2f size, v2u uv, v2u uvSize, v4f color) {
+		auto quad = makeQuad(position, size, uv, uvSize, color);
+		auto shadow = quad;
+		shadow.position += v2f{ 1,-2 };
+		shadow.color.xyz *= 0;
+		list.quads.push_back(shadow);
+		list.quads.push_back(quad);
+	};
+	auto pushQuad = [&](v2f position, v2f size, v2u uv, v2u uvSize, v4f color) {
+		list.quads.push_back(makeQuad(position, size, uv, uvSize, color));
+	};
+
+	PieMenu &menu = mainPieMenu;
+	if (menu.animValue) {
+		auto &command = list.push(DrawCommand_pieMenu);
+		command.pieMenu.position = menu.position;
+		command.pieMenu.angle = menu.angle;
+		command.pieMenu.size = pieMenuSize;
+		command.pieMenu.alpha = menu.animValue * menu.handAlphaValue;
+
+		for (u32 i = 0; i < menu.items.size(); ++i) {
+			v2f offset = m2::rotation(map(i, 0.0f, menu.items.size(), 0.0f, pi * 2)) * V2f(-pieMenuSize, 0);
+			auto& item = menu.items[i];
+			v2f size = V2f(toolImageSize);
+			v2f position = round(menu.position + offset * menu.animValue + v2f{ -1, 1 } *size * 0.5f);
+			v4f color = V4f(1, 1, 1, menu.animValue);
+
+			pushQuad(position - size * 0.5f * v2f{ 1,-1 }, size * 2, { 2, 2 }, { 2, 2 }, V4f(V3f(0.5f), menu.animValue));
+			pushShadowedQuad(position, size, item.uv, { 1,1 }, color);
+
+			if (item.type == PieMenuItem_toolColor) {
+				pushShadowedQuad(position, size, { 2, 0 }, { 1,1 }, color);
+			}
+			else if (item.type == PieMenuItem_canvasColor) {
+				pushShadowedQuad(position, size, { 3, 1 }, { 1,1 }, color);
+			}
+		}
+	}
+
+	if (info.drawCursorCircle) {
+		list.push(DrawCommand_cursorCircle);
+	}
+	if (info.drawCursor) {
+		pushShadowedQuad((v2f)info.mousePosBL, V2f(toolImageSize), getUv(currentScene->tool), { 1,1 }, V4f(1));
+	}
+	list.push(DrawCommand_quads).quads = {firstQuad, (u32)list.quads.size() - firstQuad};
+
+	if (colorMenuAnimValue) {
+		auto &command = list.push(DrawCommand_colorMenu);
+		command.colorMenu.size = info.minWindowDim * 0.2f;
+		command.colorMenu.position = v2f{ colorMenuPositionTL.x, info.clientSize.y - colorMenuPositionTL.y };
+		command.colorMenu.alpha = colorMenuAnimValue;
+		command.colorMenu.hueColor = hsvToRgb(colorMenuHue, 1, 1);
+		command.colorMenu.hue = colorMenuHue;
+	}
+
+	list.push(DrawCommand_present);
+}
+
+// Index of the scene the command draws, ~0 for commands that don't draw a scene
+inline u32 getSceneIndex(DrawCommand const &command) {
+	switch (command.type) {
+		case DrawCommand_beginScene:     return command.beginScene.sceneIndex;
+		case DrawCommand_clipScene:      return command.clipScene.sceneIndex;
+		case DrawCommand_useStaticLayer: return command.useStaticLayer.sceneIndex;
+		case DrawCommand_scrollScene:    return command.scrollScene.sceneIndex;
+		case DrawCommand_entity:         return command.entity.sceneIndex;
+		case DrawCommand_endScene:       return command.endScene.sceneIndex;
+		case DrawCommand_blitScene:      return command.blitScene.sceneIndex;
+		default: return ~0u;
+	}
+}
+
+// File format: magic, command count, quad count, commands, quads
+
+constexpr u32 drawListMagic = 'DRWL';
+
+inline StringBuilder<> writeDrawList(DrawList const &list) {
+	StringBuilder<> builder;
+	u32 commandCount = (u32)list.commands.size();
+	u32 quadCount = (u32)list.quads.size();
+	builder.appendBytes(drawListMagic);
+	builder.appendBytes(commandCount);
+	builder.appendBytes(quadCount);
+	builder.appendBytes(list.commands.data(), commandCount * sizeof(DrawCommand));
+	builder.appendBytes(list.quads.data(), quadCount * sizeof(Quad));
+	return builder;
+}
+
+inline bool readDrawList(Span<u8 const> data, DrawList &list) {
+	auto reader = [&] (void *dst, umm size, char const *name) {
+		if (size > data.size()) {
+			LOG("Failed to read %", name);
+			return false;
+		}
+		memcpy(dst, data.begin(), size);
+		data._begin += size;
+		return true;
+	};
+
+	u32 magic, commandCount, quadCount;
+	if (!reader(&magic, sizeof(magic), "magic")) return false;
+	if (magic != drawListMagic) {
+		LOG("Not a draw list");
+		return false;
+	}
+	if (!reader(&commandCount, sizeof(commandCount), "command count")) return false;
+	if (!reader(&quadCount, sizeof(quadCount), "quad count")) return false;
+
+	// Counts are checked before anything is allocated for them
+	if ((u64)commandCount * sizeof(DrawCommand) + (u64)quadCount * sizeof(Quad) > data.size()) {
+		LOG("Draw list is shorter than its counts");
+		return false;
+	}
+
+	DrawList result;
+	result.commands.resize(commandCount);
+	result.quads.resize(quadCount);
+	if (!reader(result.commands.data(), commandCount * sizeof(DrawCommand), "commands")) return false;
+	if (!reader(result.quads.data(), quadCount * sizeof(Quad), "quads")) return false;
+
+	for (auto &command : result.commands) {
+		if (command.type >= DrawCommand_count) {
+			LOG("Invalid draw command type %", (u32)command.type);
+			return false;
+		}
+		if (command.type == DrawCommand_quads && (umm)command.quads.firstQuad + command.quads.quadCount > quadCount) {
+			LOG("Draw command quad range is out of bounds");
+			return false;
+		}
+		u32 sceneIndex = getSceneIndex(command);
+		if (sceneIndex != ~0u && sceneIndex >= countof(scenes)) {
+			LOG("Draw command scene index % is out of bounds", sceneIndex);
+			return false;
+		}
+	}
+
+	list = std::move(result);
+	return true;
+}
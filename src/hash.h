@@ -0,0 +1,26 @@
+#pragma once
+#include "base.h"
+
+// Hash of file contents and paths for caches, 8 bytes per step. Not meant to resist collisions made on purpose.
+inline u64 hashBytes(void const *data, umm size, u64 seed = 0x0123456789ABCDEF) {
+	constexpr u64 multiplier = 0x9E3779B97F4A7C15;
+	u64 result = seed ^ (size * multiplier);
+	auto mix = [&](u64 word) {
+		result = (result ^ word) * multiplier;
+		result ^= result >> 29;
+	};
+
+	u8 const *bytes = (u8 const *)data;
+	for (; size >= 8; size -= 8, bytes += 8) {
+		u64 word;
+		memcpy(&word, bytes, 8);
+		mix(word);
+	}
+	if (size) {
+		u64 word = 0;
+		memcpy(&word, bytes, size);
+		mix(word);
+	}
+	result *= multiplier;
+	return result ^ (result >> 32);
+}
@@ -0,0 +1,325 @@
+#pragma once
+#include "base.h"
+#include "mips.h"
+#include <algorithm>
+
+// Small images are drawn from pages shared with other small images instead of textures of their own, so a scene
+// with many of them binds a few textures and draws runs of them with one draw call (see DrawBatch_atlasImages).
+// Images are placed by an online skyline packer as they are loaded and removed when they are released, a page
+// whose last image is removed starts over, a page where most of the placed area belongs to removed images is
+// compacted. Every level of a page is filled from the images' own chains.
+// An image is sampled from its first few levels only, fewer for smaller images. Its block is placed at multiples of
+// its last level's texel so it stays whole texels down to that level, and its edge texels are repeated into one
+// texel of padding at that level, so filtering does not blend in its neighbours.
+
+constexpr u32 imageAtlasPageSize = 2048;
+// Images whose texture is larger go into textures of their own
+constexpr u32 imageAtlasMaxImageSize = 512;
+constexpr u32 imageAtlasLevelCount = 5;
+constexpr umm imageAtlasPageBytes = (umm)imageAtlasPageSize * imageAtlasPageSize * sizeof(u32) * 4 / 3;
+constexpr u32 noAtlasPage = ~0u;
+
+inline bool fitsInImageAtlas(v2u size) {
+	return max(size.x, size.y) <= imageAtlasMaxImageSize;
+}
+// Levels the image is sampled from, its padding stays within an eighth of its smaller side.
+// Images shown smaller than their last level are drawn from it.
+inline u32 getAtlasLevelCount(v2u imageSize) {
+	u32 smallest = min(imageSize.x, imageSize.y);
+	u32 count = 1;
+	while (count < imageAtlasLevelCount && (8u << count) <= smallest) {
+		++count;
+	}
+	return count;
+}
+// One texel of the last level, blocks are aligned to it and padded with it on each side
+inline u32 getAtlasPadding(u32 levelCount) {
+	return 1u << (levelCount - 1);
+}
+inline u32 alignToAtlasTexel(u32 value, u32 alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+// Image with its padding, rounded up to the alignment
+inline v2u getAtlasBlockSize(v2u imageSize, u32 levelCount) {
+	u32 padding = getAtlasPadding(levelCount);
+	return {alignToAtlasTexel(imageSize.x + 2 * padding, padding), alignToAtlasTexel(imageSize.y + 2 * padding, padding)};
+}
+
+struct SkylineNode {
+	u32 x;
+	u32 y; // Top of the used space below this part of the page
+	u32 width;
+};
+
+// Places rectangles on the lowest part of the skyline they fit on. Space below the skyline is not reused
+// until the packer starts over, when its page is emptied or compacted.
+struct AtlasPacker {
+	v2u size = {};
+	List<SkylineNode> skyline; // From left to right, covers the whole width
+	List<SkylineNode> scratch;
+	u64 usedArea = 0;
+	u32 rectCount = 0;
+
+	void init(v2u newSize) {
+		size = newSize;
+		skyline.clear();
+		skyline.push_back({0, 0, size.x});
+		usedArea = 0;
+		rectCount = 0;
+	}
+	f32 occupancy() const {
+		return (f32)((f64)usedArea / ((f64)size.x * size.y));
+	}
+
+	// Position of the rectangle when it starts in skyline[index], rounded up to 'alignment'.
+	// False when it goes out of the page or the rounding moves it past that part.
+	bool fits(umm index, v2u rectSize, u32 alignment, v2u &position) const {
+		auto &node = skyline[index];
+		u32 x = alignToAtlasTexel(node.x, alignment);
+		if (x >= node.x + node.width || x + rectSize.x > size.x)
+			return false;
+		u32 y = 0;
+		for (umm i = index; i < skyline.size() && skyline[i].x < x + rectSize.x; ++i) {
+			y = max(y, skyline[i].y);
+		}
+		y = alignToAtlasTexel(y, alignment);
+		if (y + rectSize.y > size.y)
+			return false;
+		position = {x, y};
+		return true;
+	}
+	// Lowest bottom wins, ties go to the narrower part so wide ones stay free for wide rectangles
+	bool insert(v2u rectSize, v2u &position, u32 alignment = 1) {
+		if (!rectSize.x || !rectSize.y)
+			return false;
+
+		bool found = false;
+		u32 bestBottom = ~0u;
+		u32 bestWidth = ~0u;
+		for (umm i = 0; i < skyline.size(); ++i) {
+			v2u candidate;
+			if (!fits(i, rectSize, alignment, candidate))
+				continue;
+			u32 bottom = candidate.y + rectSize.y;
+			if (bottom < bestBottom || (bottom == bestBottom && skyline[i].width < bestWidth)) {
+				found = true;
+				position = candidate;
+				bestBottom = bottom;
+				bestWidth = skyline[i].width;
+			}
+		}
+		if (!found)
+			return false;
+
+		u32 right = position.x + rectSize.x;
+
+		// Parts under the rectangle are replaced by its top, neighbours of the same height are merged
+		scratch.clear();
+		auto push = [&](SkylineNode node) {
+			if (scratch.size() && scratch.back().y == node.y) {
+				scratch.back().width += node.width;
+			} else {
+				scratch.push_back(node);
+			}
+		};
+		bool pushedRect = false;
+		for (auto &node : skyline) {
+			u32 nodeRight = node.x + node.width;
+			if (node.x < position.x) {
+				push({node.x, node.y, min(nodeRight, position.x) - node.x});
+			}
+			if (!pushedRect && nodeRight > position.x) {
+				push({position.x, bestBottom, rectSize.x});
+				pushedRect = true;
+			}
+			if (nodeRight > right) {
+				u32 x = max(node.x, right);
+				push({x, node.y, nodeRight - x});
+			}
+		}
+		skyline.resize(scratch.size());
+		memcpy(skyline.data(), scratch.data(), scratch.size() * sizeof(SkylineNode));
+
+		usedArea += (u64)rectSize.x * rectSize.y;
+		++rectCount;
+		return true;
+	}
+};
+
+// Where an image is in the atlas, 'page' is noAtlasPage for images with textures of their own.
+// The atlas keeps a pointer to the placement of every image on it, placements are updated when pages are compacted.
+struct AtlasPlacement {
+	u32 page = noAtlasPage;
+	v2u position = {};  // Of the block, in texels of the first level
+	v2u blockSize = {};
+	v2u imageSize = {};
+	u32 levelCount = 0; // Sampled, see getAtlasLevelCount
+};
+
+// Part of the page the image is drawn from, in [0, 1] with y going down like texture coordinates
+inline aabb<v2f> getAtlasUvRect(AtlasPlacement const &placement) {
+	u32 padding = getAtlasPadding(placement.levelCount);
+	v2f min = (v2f)(placement.position + padding) / (f32)imageAtlasPageSize;
+	v2f max = (v2f)(placement.position + padding + placement.imageSize) / (f32)imageAtlasPageSize;
+	return aabbMinMax(min, max);
+}
+
+// Texels of 'level' of the page in the placement's block: that level of the image with its edges repeated around it.
+// Only levels below placement.levelCount are sampled. Chains shorter than those repeat their last level.
+inline void copyAtlasBlock(MipChain const &mips, AtlasPlacement const &placement, u32 level, List<u32> &texels) {
+	v2u blockSize = {placement.blockSize.x >> level, placement.blockSize.y >> level};
+	u32 padding = getAtlasPadding(placement.levelCount) >> level;
+	u32 source = min(level, (u32)mips.levels.size() - 1);
+	v2u size = mips.levels[source].size;
+	u32 const *pixels = mips.level(source);
+
+	texels.resize((umm)blockSize.x * blockSize.y);
+	for (u32 y = 0; y < blockSize.y; ++y) {
+		u32 const *row = pixels + (umm)min(y - min(y, padding), size.y - 1) * size.x;
+		u32 *dst = texels.data() + (umm)y * blockSize.x;
+		u32 x = 0;
+		for (; x < padding; ++x) {
+			dst[x] = row[0];
+		}
+		u32 copied = min(size.x, blockSize.x - padding);
+		memcpy(dst + x, row, copied * sizeof(u32));
+		x += copied;
+		for (; x < blockSize.x; ++x) {
+			dst[x] = row[size.x - 1];
+		}
+	}
+}
+
+struct ImageAtlasStats {
+	u32 pageCount = 0;  // With at least one image
+	u32 imageCount = 0;
+	u64 usedArea = 0;   // Texels of the first level under blocks, padding included
+	u64 liveArea = 0;   // Part of usedArea under blocks of images that were not removed
+	u64 packedArea = 0; // Texels of the first level of those pages
+	u64 compactionCount = 0;
+};
+
+struct AtlasPage {
+	AtlasPacker packer;
+	List<AtlasPlacement *> placements; // Of the images on the page
+	u64 liveArea = 0;
+};
+
+// Pages of the renderer's atlas, the renderer keeps a texture per page with images in it
+struct ImageAtlas {
+	List<AtlasPage> pages;
+	u64 compactionCount = 0;
+
+	// Finds room on the first page with enough of it, adds a page when none has. An image that was the first
+	// one placed on its page needs the page's texture created. 'placement' stays where it is until it's removed.
+	bool place(v2u imageSize, AtlasPlacement &placement) {
+		placement = {};
+		if (!fitsInImageAtlas(imageSize) || !imageSize.x || !imageSize.y)
+			return false;
+
+		placement.levelCount = getAtlasLevelCount(imageSize);
+		placement.blockSize = getAtlasBlockSize(imageSize, placement.levelCount);
+		placement.imageSize = imageSize;
+		for (u32 i = 0; i < pages.size() && placement.page == noAtlasPage; ++i) {
+			insert(i, placement);
+		}
+		if (placement.page == noAtlasPage) {
+			insert(addPage(), placement);
+		}
+		add(placement);
+		return true;
+	}
+	// Returns true when it was the last image of its page, whose texture can be released
+	bool remove(AtlasPlacement &placement) {
+		if (placement.page == noAtlasPage)
+			return false;
+		auto &page = pages[placement.page];
+		placement.page = noAtlasPage;
+		for (umm i = 0; i < page.placements.size(); ++i) {
+			if (page.placements[i] == &placement) {
+				page.placements[i] = page.placements.back();
+				page.placements.resize(page.placements.size() - 1);
+				break;
+			}
+		}
+		page.liveArea -= (u64)placement.blockSize.x * placement.blockSize.y;
+		if (page.placements.size())
+			return false;
+		page.packer.init(V2u(imageAtlasPageSize));
+		page.liveArea = 0;
+		return true;
+	}
+	// More than half of the area placed on the page belongs to removed images
+	bool needsCompaction(u32 pageIndex) const {
+		auto &page = pages[pageIndex];
+		return page.placements.size() && page.liveArea * 2 < page.packer.usedArea;
+	}
+	// Moves the page's images into room left on the other pages with images, the rest are packed again from the
+	// tallest on the emptied page. 'move(from, to)' copies an image's block from where it was to where it goes,
+	// blocks that stay on the page are moved to a new texture. Returns true when no image stayed on the page.
+	template <class Move>
+	bool compact(u32 pageIndex, Move &&move) {
+		List<AtlasPlacement *> moved;
+		for (auto placement : pages[pageIndex].placements) {
+			moved.push_back(placement);
+		}
+		pages[pageIndex].placements.clear();
+		pages[pageIndex].packer.init(V2u(imageAtlasPageSize));
+		pages[pageIndex].liveArea = 0;
+		++compactionCount;
+
+		std::sort(moved.begin(), moved.end(), [](AtlasPlacement const *a, AtlasPlacement const *b) {
+			return a->blockSize.y != b->blockSize.y ? a->blockSize.y > b->blockSize.y : a->blockSize.x > b->blockSize.x;
+		});
+		for (auto placement : moved) {
+			AtlasPlacement to = *placement;
+			to.page = noAtlasPage;
+			for (u32 i = 0; i < pages.size() && to.page == noAtlasPage; ++i) {
+				if (i != pageIndex && pages[i].placements.size()) {
+					insert(i, to);
+				}
+			}
+			if (to.page == noAtlasPage) {
+				insert(pageIndex, to);
+			}
+			// Skyline packing does not always fit the same blocks again
+			if (to.page == noAtlasPage) {
+				insert(addPage(), to);
+			}
+			move(*placement, to);
+			*placement = to;
+			add(*placement);
+		}
+		return !pages[pageIndex].placements.size();
+	}
+	ImageAtlasStats getStats() const {
+		ImageAtlasStats stats;
+		stats.compactionCount = compactionCount;
+		for (auto &page : pages) {
+			if (!page.placements.size())
+				continue;
+			++stats.pageCount;
+			stats.imageCount += (u32)page.placements.size();
+			stats.usedArea += page.packer.usedArea;
+			stats.liveArea += page.liveArea;
+			stats.packedArea += (u64)page.packer.size.x * page.packer.size.y;
+		}
+		return stats;
+	}
+
+	u32 addPage() {
+		pages.push_back({});
+		pages.back().packer.init(V2u(imageAtlasPageSize));
+		return (u32)pages.size() - 1;
+	}
+	void insert(u32 pageIndex, AtlasPlacement &placement) {
+		if (pages[pageIndex].packer.insert(placement.blockSize, placement.position, getAtlasPadding(placement.levelCount))) {
+			placement.page = pageIndex;
+		}
+	}
+	void add(AtlasPlacement &placement) {
+		auto &page = pages[placement.page];
+		page.placements.push_back(&placement);
+		page.liveArea += (u64)placement.blockSize.x * placement.blockSize.y;
+	}
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include "base.h"
+#include <algorithm>
+
+// Decoded images are kept while they fit in the budget. When they don't, least recently seen images that are
+// not in view are evicted: their textures are released and they are decoded again when they come into view.
+// Files with the same content share one image, see applyImageDuplicates.
+
+constexpr u64 defaultImageCacheBudget = 512 * 1024 * 1024;
+
+struct ImageCacheStats {
+	u64 budget = 0;
+	u64 bytes = 0; // Textures and CPU copies of resident images, and atlasBytes
+	u64 atlasBytes = 0; // Pages shared by small images, counted as a whole, see imageatlas.h
+	u64 peakBytes = 0;
+	u32 residentCount = 0;
+	u64 hitCount = 0;  // Images that came into view resident
+	u64 missCount = 0; // Images that came into view evicted or not decoded yet
+	u64 evictionCount = 0;
+	// Filled in by the owner of the images, which knows their files
+	u32 sharedCount = 0; // Image files whose content was already loaded from another path
+	u64 sharedBytes = 0; // What they would take if each one was loaded on its own
+};
+
+struct ImageCacheEntry {
+	u64 bytes = 0;
+	u64 lastUse = 0;
+};
+
+struct ImageCache {
+	u64 pass = 1;
+	ImageCacheStats stats = {defaultImageCacheBudget};
+
+	// Called before images in view are used, images used in the current pass are never evicted
+	void beginPass() {
+		++pass;
+	}
+	// Returns false when the image has to be decoded
+	bool use(ImageCacheEntry &entry) {
+		bool cameIntoView = entry.lastUse + 1 < pass;
+		entry.lastUse = pass;
+		if (cameIntoView && entry.bytes) {
+			++stats.hitCount;
+		} else if (cameIntoView) {
+			++stats.missCount;
+		}
+		return entry.bytes != 0;
+	}
+	// Called after an image was decoded, 0 when it was released
+	void setBytes(ImageCacheEntry &entry, u64 bytes) {
+		if (!entry.bytes && bytes) {
+			++stats.residentCount;
+		} else if (entry.bytes && !bytes) {
+			--stats.residentCount;
+		}
+		stats.bytes = stats.bytes - entry.bytes + bytes;
+		stats.peakBytes = max(stats.peakBytes, stats.bytes);
+		entry.bytes = bytes;
+	}
+	// Called when pages of the renderer's image atlas were added or released
+	void setAtlasBytes(u64 bytes) {
+		stats.bytes = stats.bytes - stats.atlasBytes + bytes;
+		stats.peakBytes = max(stats.peakBytes, stats.bytes);
+		stats.atlasBytes = bytes;
+	}
+	// Evicts least recently used images until the cache fits in the budget.
+	// 'images' have an ImageCacheEntry named 'cache', 'evict' releases an image's texture and pixels.
+	template <class Image, class Evict>
+	void trim(List<Image *> images, Evict &&evict) {
+		if (stats.bytes <= stats.budget)
+			return;
+
+		std::sort(images.begin(), images.end(), [](Image *a, Image *b) { return a->cache.lastUse < b->cache.lastUse; });
+		for (auto image : images) {
+			if (stats.bytes <= stats.budget)
+				break;
+			if (!image->cache.bytes || image->cache.lastUse == pass)
+				continue;
+			evict(image);
+			setBytes(image->cache, 0);
+			++stats.evictionCount;
+		}
+	}
+};
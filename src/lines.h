@@ -0,0 +1,479 @@
+#pragma once
+#include "simd.h"
+
+static_assert(sizeof(Line) == 6 * sizeof(f32));
+static_assert(sizeof(m2) == 4 * sizeof(f32));
+
+// Original implementation, kept as reference for the kernels below
+inline TransformedLine transformReference(Line line) {
+	TransformedLine result;
+	m2 rotation = m2::rotation(atan2(line.b.position - line.a.position));
+	result.a.transform = m2::scaling(line.a.thickness) * rotation;
+	result.b.transform = m2::scaling(line.b.thickness) * rotation;
+	result.a.position = line.a.position;
+	result.b.position = line.b.position;
+	return result;
+}
+
+// c and s are cosine and sine of the line's angle.
+// Matrix layout is the same as m2::rotation: {c, s, -s, c}
+FORCEINLINE void writeTransformedLine(TransformedLine &dst, Line const &src, f32 c, f32 s) {
+	__m128 rotation = _mm_setr_ps(c, s, -s, c);
+	_mm_storeu_ps((f32 *)&dst.a.transform, _mm_mul_ps(rotation, _mm_set1_ps(src.a.thickness)));
+	_mm_storeu_ps((f32 *)&dst.b.transform, _mm_mul_ps(rotation, _mm_set1_ps(src.b.thickness)));
+	dst.a.position = src.a.position;
+	dst.b.position = src.b.position;
+}
+
+// Rotation is built from the normalized direction instead of atan2 + sin/cos.
+// Zero-length lines get identity rotation, same as atan2(0, 0) does.
+inline TransformedLine transform(Line line) {
+	v2f direction = line.b.position - line.a.position;
+	f32 directionLength = sqrtf(direction.x * direction.x + direction.y * direction.y);
+	f32 c = 1, s = 0;
+	if (directionLength > 0) {
+		c = direction.x / directionLength;
+		s = direction.y / directionLength;
+	}
+	TransformedLine result;
+	writeTransformedLine(result, line, c, s);
+	return result;
+}
+
+inline void transformLinesScalar(TransformedLine *dst, Line const *src, umm count) {
+	for (umm i = 0; i < count; ++i) {
+		dst[i] = transform(src[i]);
+	}
+}
+
+inline void transformLinesSSE(TransformedLine *dst, Line const *src, umm count) {
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1);
+
+	umm i = 0;
+	for (; i + 4 <= count; i += 4) {
+		Line const *l = src + i;
+		__m128 ax = _mm_setr_ps(l[0].a.position.x, l[1].a.position.x, l[2].a.position.x, l[3].a.position.x);
+		__m128 ay = _mm_setr_ps(l[0].a.position.y, l[1].a.position.y, l[2].a.position.y, l[3].a.position.y);
+		__m128 bx = _mm_setr_ps(l[0].b.position.x, l[1].b.position.x, l[2].b.position.x, l[3].b.position.x);
+		__m128 by = _mm_setr_ps(l[0].b.position.y, l[1].b.position.y, l[2].b.position.y, l[3].b.position.y);
+
+		__m128 dx = _mm_sub_ps(bx, ax);
+		__m128 dy = _mm_sub_ps(by, ay);
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+		__m128 valid = _mm_cmpgt_ps(len, zero);
+		__m128 c = _mm_div_ps(dx, len);
+		__m128 s = _mm_div_ps(dy, len);
+		c = _mm_or_ps(_mm_and_ps(valid, c), _mm_andnot_ps(valid, one));
+		s = _mm_and_ps(valid, s);
+
+		alignas(16) f32 cs[4], ss[4];
+		_mm_store_ps(cs, c);
+		_mm_store_ps(ss, s);
+		for (u32 j = 0; j < 4; ++j) {
+			writeTransformedLine(dst[i + j], l[j], cs[j], ss[j]);
+		}
+	}
+	transformLinesScalar(dst + i, src + i, count - i);
+}
+
+TARGET_AVX2 inline void transformLinesAVX2(TransformedLine *dst, Line const *src, umm count) {
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1);
+
+	// Offsets of consecutive lines in floats
+	__m256i index = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+
+	umm i = 0;
+	for (; i + 8 <= count; i += 8) {
+		Line const *l = src + i;
+		f32 const *base = (f32 const *)l;
+		__m256 ax = _mm256_i32gather_ps(base + 1, index, 4);
+		__m256 ay = _mm256_i32gather_ps(base + 2, index, 4);
+		__m256 bx = _mm256_i32gather_ps(base + 4, index, 4);
+		__m256 by = _mm256_i32gather_ps(base + 5, index, 4);
+
+		__m256 dx = _mm256_sub_ps(bx, ax);
+		__m256 dy = _mm256_sub_ps(by, ay);
+		__m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+		__m256 valid = _mm256_cmp_ps(len, zero, _CMP_GT_OQ);
+		__m256 c = _mm256_blendv_ps(one, _mm256_div_ps(dx, len), valid);
+		__m256 s = _mm256_and_ps(valid, _mm256_div_ps(dy, len));
+
+		alignas(32) f32 cs[8], ss[8];
+		_mm256_store_ps(cs, c);
+		_mm256_store_ps(ss, s);
+		for (u32 j = 0; j < 8; ++j) {
+			writeTransformedLine(dst[i + j], l[j], cs[j], ss[j]);
+		}
+	}
+	transformLinesScalar(dst + i, src + i, count - i);
+}
+
+using TransformLinesProc = void (*)(TransformedLine *dst, Line const *src, umm count);
+
+inline TransformLinesProc getTransformLinesProc() {
+	static TransformLinesProc proc = getCpuFeatures().avx2 ? transformLinesAVX2 : transformLinesSSE;
+	return proc;
+}
+
+inline void transformLines(TransformedLine *dst, Line const *src, umm count) {
+	getTransformLinesProc()(dst, src, count);
+}
+
+// Original hover test from findHoveredEntity, kept as reference for the kernels below
+inline bool hoveringReference(Line l, v2f offset, v2f p) {
+	auto a = l.a.position + offset;
+	auto b = l.b.position + offset;
+	f32 t = dot(normalize(a - b), a - p) / length(a - b);
+
+	if (t > 1) {
+		return distance(p, b) < l.b.thickness * 0.5f;
+	} else if (t < 0) {
+		return distance(p, a) < l.a.thickness * 0.5f;
+	} else {
+		v2f c = cross(normalize(a - b));
+		f32 d = absolute(dot(c, a - p));
+		return d < lerp(l.a.thickness, l.b.thickness, clamp(t, 0, 1)) * 0.5f;
+	}
+}
+
+// Same math as hoveringReference, written out the way the kernels compute it.
+// Zero-length lines produce NaN and are never hovered, like in the reference.
+inline bool hovering(Line l, v2f offset, v2f p) {
+	f32 ax = l.a.position.x + offset.x;
+	f32 ay = l.a.position.y + offset.y;
+	f32 bx = l.b.position.x + offset.x;
+	f32 by = l.b.position.y + offset.y;
+
+	f32 dx = ax - bx;
+	f32 dy = ay - by;
+	f32 len = sqrtf(dx * dx + dy * dy);
+	f32 nx = dx / len;
+	f32 ny = dy / len;
+
+	f32 apx = ax - p.x;
+	f32 apy = ay - p.y;
+	f32 bpx = p.x - bx;
+	f32 bpy = p.y - by;
+	f32 t = (nx * apx + ny * apy) / len;
+
+	if (t > 1) {
+		return sqrtf(bpx * bpx + bpy * bpy) < l.b.thickness * 0.5f;
+	} else if (t < 0) {
+		return sqrtf(apx * apx + apy * apy) < l.a.thickness * 0.5f;
+	} else {
+		f32 tc = min(max(t, 0.0f), 1.0f);
+		f32 perpendicular = fabsf(nx * apy - ny * apx);
+		return perpendicular < (l.a.thickness + (l.b.thickness - l.a.thickness) * tc) * 0.5f;
+	}
+}
+
+// These return index of the first hovered line, or count if there is none.
+// Point and offset are in the same space, offset is added to line positions.
+
+inline umm findHoveredLineScalar(Line const *lines, umm count, v2f offset, v2f point) {
+	for (umm i = 0; i < count; ++i) {
+		if (hovering(lines[i], offset, point)) {
+			return i;
+		}
+	}
+	return count;
+}
+
+inline umm findHoveredLineSSE(Line const *lines, umm count, v2f offset, v2f point) {
+	__m128 offsetX = _mm_set1_ps(offset.x);
+	__m128 offsetY = _mm_set1_ps(offset.y);
+	__m128 px = _mm_set1_ps(point.x);
+	__m128 py = _mm_set1_ps(point.y);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	umm i = 0;
+	for (; i + 4 <= count; i += 4) {
+		Line const *l = lines + i;
+		__m128 ax = _mm_add_ps(_mm_setr_ps(l[0].a.position.x, l[1].a.position.x, l[2].a.position.x, l[3].a.position.x), offsetX);
+		__m128 ay = _mm_add_ps(_mm_setr_ps(l[0].a.position.y, l[1].a.position.y, l[2].a.position.y, l[3].a.position.y), offsetY);
+		__m128 bx = _mm_add_ps(_mm_setr_ps(l[0].b.position.x, l[1].b.position.x, l[2].b.position.x, l[3].b.position.x), offsetX);
+		__m128 by = _mm_add_ps(_mm_setr_ps(l[0].b.position.y, l[1].b.position.y, l[2].b.position.y, l[3].b.position.y), offsetY);
+		__m128 at = _mm_setr_ps(l[0].a.thickness, l[1].a.thickness, l[2].a.thickness, l[3].a.thickness);
+		__m128 bt = _mm_setr_ps(l[0].b.thickness, l[1].b.thickness, l[2].b.thickness, l[3].b.thickness);
+
+		__m128 dx = _mm_sub_ps(ax, bx);
+		__m128 dy = _mm_sub_ps(ay, by);
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+		__m128 nx = _mm_div_ps(dx, len);
+		__m128 ny = _mm_div_ps(dy, len);
+
+		__m128 apx = _mm_sub_ps(ax, px);
+		__m128 apy = _mm_sub_ps(ay, py);
+		__m128 bpx = _mm_sub_ps(px, bx);
+		__m128 bpy = _mm_sub_ps(py, by);
+		__m128 t = _mm_div_ps(_mm_add_ps(_mm_mul_ps(nx, apx), _mm_mul_ps(ny, apy)), len);
+
+		__m128 afterB  = _mm_cmpgt_ps(t, one);
+		__m128 beforeA = _mm_cmplt_ps(t, zero);
+
+		__m128 distanceA = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(apx, apx), _mm_mul_ps(apy, apy)));
+		__m128 distanceB = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(bpx, bpx), _mm_mul_ps(bpy, bpy)));
+		__m128 hitA = _mm_and_ps(beforeA, _mm_cmplt_ps(distanceA, _mm_mul_ps(at, half)));
+		__m128 hitB = _mm_and_ps(afterB,  _mm_cmplt_ps(distanceB, _mm_mul_ps(bt, half)));
+
+		__m128 tc = _mm_min_ps(_mm_max_ps(t, zero), one);
+		__m128 perpendicular = _mm_and_ps(_mm_sub_ps(_mm_mul_ps(nx, apy), _mm_mul_ps(ny, apx)), absMask);
+		__m128 thickness = _mm_mul_ps(_mm_add_ps(at, _mm_mul_ps(_mm_sub_ps(bt, at), tc)), half);
+		__m128 hitMiddle = _mm_andnot_ps(_mm_or_ps(afterB, beforeA), _mm_cmplt_ps(perpendicular, thickness));
+
+		u32 mask = _mm_movemask_ps(_mm_or_ps(_mm_or_ps(hitA, hitB), hitMiddle));
+		if (mask) {
+			for (u32 j = 0; j < 4; ++j) {
+				if (mask & (1 << j)) {
+					return i + j;
+				}
+			}
+		}
+	}
+	return i + findHoveredLineScalar(lines + i, count - i, offset, point);
+}
+
+TARGET_AVX2 inline umm findHoveredLineAVX2(Line const *lines, umm count, v2f offset, v2f point) {
+	__m256 offsetX = _mm256_set1_ps(offset.x);
+	__m256 offsetY = _mm256_set1_ps(offset.y);
+	__m256 px = _mm256_set1_ps(point.x);
+	__m256 py = _mm256_set1_ps(point.y);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1);
+	__m256 half = _mm256_set1_ps(0.5f);
+	__m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256i index = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+
+	umm i = 0;
+	for (; i + 8 <= count; i += 8) {
+		f32 const *base = (f32 const *)(lines + i);
+		__m256 at = _mm256_i32gather_ps(base + 0, index, 4);
+		__m256 ax = _mm256_add_ps(_mm256_i32gather_ps(base + 1, index, 4), offsetX);
+		__m256 ay = _mm256_add_ps(_mm256_i32gather_ps(base + 2, index, 4), offsetY);
+		__m256 bt = _mm256_i32gather_ps(base + 3, index, 4);
+		__m256 bx = _mm256_add_ps(_mm256_i32gather_ps(base + 4, index, 4), offsetX);
+		__m256 by = _mm256_add_ps(_mm256_i32gather_ps(base + 5, index, 4), offsetY);
+
+		__m256 dx = _mm256_sub_ps(ax, bx);
+		__m256 dy = _mm256_sub_ps(ay, by);
+		__m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+		__m256 nx = _mm256_div_ps(dx, len);
+		__m256 ny = _mm256_div_ps(dy, len);
+
+		__m256 apx = _mm256_sub_ps(ax, px);
+		__m256 apy = _mm256_sub_ps(ay, py);
+		__m256 bpx = _mm256_sub_ps(px, bx);
+		__m256 bpy = _mm256_sub_ps(py, by);
+		__m256 t = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(nx, apx), _mm256_mul_ps(ny, apy)), len);
+
+		__m256 afterB  = _mm256_cmp_ps(t, one, _CMP_GT_OQ);
+		__m256 beforeA = _mm256_cmp_ps(t, zero, _CMP_LT_OQ);
+
+		__m256 distanceA = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(apx, apx), _mm256_mul_ps(apy, apy)));
+		__m256 distanceB = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(bpx, bpx), _mm256_mul_ps(bpy, bpy)));
+		__m256 hitA = _mm256_and_ps(beforeA, _mm256_cmp_ps(distanceA, _mm256_mul_ps(at, half), _CMP_LT_OQ));
+		__m256 hitB = _mm256_and_ps(afterB,  _mm256_cmp_ps(distanceB, _mm256_mul_ps(bt, half), _CMP_LT_OQ));
+
+		__m256 tc = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+		__m256 perpendicular = _mm256_and_ps(_mm256_sub_ps(_mm256_mul_ps(nx, apy), _mm256_mul_ps(ny, apx)), absMask);
+		__m256 thickness = _mm256_mul_ps(_mm256_add_ps(at, _mm256_mul_ps(_mm256_sub_ps(bt, at), tc)), half);
+		__m256 hitMiddle = _mm256_andnot_ps(_mm256_or_ps(afterB, beforeA), _mm256_cmp_ps(perpendicular, thickness, _CMP_LT_OQ));
+
+		u32 mask = _mm256_movemask_ps(_mm256_or_ps(_mm256_or_ps(hitA, hitB), hitMiddle));
+		if (mask) {
+			for (u32 j = 0; j < 8; ++j) {
+				if (mask & (1 << j)) {
+					return i + j;
+				}
+			}
+		}
+	}
+	return i + findHoveredLineScalar(lines + i, count - i, offset, point);
+}
+
+using FindHoveredLineProc = umm (*)(Line const *lines, umm count, v2f offset, v2f point);
+
+inline FindHoveredLineProc getFindHoveredLineProc() {
+	static FindHoveredLineProc proc = getCpuFeatures().avx2 ? findHoveredLineAVX2 : findHoveredLineSSE;
+	return proc;
+}
+
+inline umm findHoveredLine(Line const *lines, umm count, v2f offset, v2f point) {
+	return getFindHoveredLineProc()(lines, count, offset, point);
+}
+
+// Bounds of lines rotated by 'rotation', including thickness.
+// For zero lines min is +INFINITY and max is -INFINITY, same as in calculateBounds.
+// Rotation is applied as a sum of matrix columns, so it doesn't depend on m2's layout.
+
+inline aabb<v2f> getLinesBoundsScalar(Line const *lines, umm count, m2 rotation) {
+	v2f i = rotation * v2f{1, 0};
+	v2f j = rotation * v2f{0, 1};
+
+	aabb<v2f> result;
+	result.min = V2f(+INFINITY);
+	result.max = V2f(-INFINITY);
+
+	auto update = [&](Point point) {
+		v2f p = i * point.position.x + j * point.position.y;
+		f32 r = point.thickness * 0.5f;
+		result.min = min(result.min, p - r);
+		result.max = max(result.max, p + r);
+	};
+	for (umm index = 0; index < count; ++index) {
+		update(lines[index].a);
+		update(lines[index].b);
+	}
+	return result;
+}
+
+inline aabb<v2f> combineBounds(aabb<v2f> a, aabb<v2f> b) {
+	aabb<v2f> result;
+	result.min = min(a.min, b.min);
+	result.max = max(a.max, b.max);
+	return result;
+}
+
+inline aabb<v2f> boundsFromLanes(f32 const *minXs, f32 const *minYs, f32 const *maxXs, f32 const *maxYs, u32 laneCount, aabb<v2f> result) {
+	for (u32 lane = 0; lane < laneCount; ++lane) {
+		result.min = min(result.min, v2f{minXs[lane], minYs[lane]});
+		result.max = max(result.max, v2f{maxXs[lane], maxYs[lane]});
+	}
+	return result;
+}
+
+inline aabb<v2f> getLinesBoundsSSE(Line const *lines, umm count, m2 rotation) {
+	v2f i = rotation * v2f{1, 0};
+	v2f j = rotation * v2f{0, 1};
+
+	__m128 ix = _mm_set1_ps(i.x);
+	__m128 iy = _mm_set1_ps(i.y);
+	__m128 jx = _mm_set1_ps(j.x);
+	__m128 jy = _mm_set1_ps(j.y);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 minX = _mm_set1_ps(+INFINITY);
+	__m128 minY = _mm_set1_ps(+INFINITY);
+	__m128 maxX = _mm_set1_ps(-INFINITY);
+	__m128 maxY = _mm_set1_ps(-INFINITY);
+
+	auto update = [&](__m128 px, __m128 py, __m128 thickness) {
+		__m128 r = _mm_mul_ps(thickness, half);
+		__m128 x = _mm_add_ps(_mm_mul_ps(ix, px), _mm_mul_ps(jx, py));
+		__m128 y = _mm_add_ps(_mm_mul_ps(iy, px), _mm_mul_ps(jy, py));
+		minX = _mm_min_ps(minX, _mm_sub_ps(x, r));
+		minY = _mm_min_ps(minY, _mm_sub_ps(y, r));
+		maxX = _mm_max_ps(maxX, _mm_add_ps(x, r));
+		maxY = _mm_max_ps(maxY, _mm_add_ps(y, r));
+	};
+
+	umm index = 0;
+	for (; index + 4 <= count; index += 4) {
+		Line const *l = lines + index;
+		update(
+			_mm_setr_ps(l[0].a.position.x, l[1].a.position.x, l[2].a.position.x, l[3].a.position.x),
+			_mm_setr_ps(l[0].a.position.y, l[1].a.position.y, l[2].a.position.y, l[3].a.position.y),
+			_mm_setr_ps(l[0].a.thickness,  l[1].a.thickness,  l[2].a.thickness,  l[3].a.thickness)
+		);
+		update(
+			_mm_setr_ps(l[0].b.position.x, l[1].b.position.x, l[2].b.position.x, l[3].b.position.x),
+			_mm_setr_ps(l[0].b.position.y, l[1].b.position.y, l[2].b.position.y, l[3].b.position.y),
+			_mm_setr_ps(l[0].b.thickness,  l[1].b.thickness,  l[2].b.thickness,  l[3].b.thickness)
+		);
+	}
+
+	alignas(16) f32 minXs[4], minYs[4], maxXs[4], maxYs[4];
+	_mm_store_ps(minXs, minX);
+	_mm_store_ps(minYs, minY);
+	_mm_store_ps(maxXs, maxX);
+	_mm_store_ps(maxYs, maxY);
+
+	aabb<v2f> tail = getLinesBoundsScalar(lines + index, count - index, rotation);
+	return boundsFromLanes(minXs, minYs, maxXs, maxYs, 4, tail);
+}
+
+TARGET_AVX2 inline aabb<v2f> getLinesBoundsAVX2(Line const *lines, umm count, m2 rotation) {
+	v2f i = rotation * v2f{1, 0};
+	v2f j = rotation * v2f{0, 1};
+
+	__m256 ix = _mm256_set1_ps(i.x);
+	__m256 iy = _mm256_set1_ps(i.y);
+	__m256 jx = _mm256_set1_ps(j.x);
+	__m256 jy = _mm256_set1_ps(j.y);
+	__m256 half = _mm256_set1_ps(0.5f);
+	__m256 minX = _mm256_set1_ps(+INFINITY);
+	__m256 minY = _mm256_set1_ps(+INFINITY);
+	__m256 maxX = _mm256_set1_ps(-INFINITY);
+	__m256 maxY = _mm256_set1_ps(-INFINITY);
+	__m256i index = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+
+	umm lineIndex = 0;
+	for (; lineIndex + 8 <= count; lineIndex += 8) {
+		f32 const *base = (f32 const *)(lines + lineIndex);
+
+		// Offset 0 is point a, offset 3 is point b
+		for (u32 pointOffset = 0; pointOffset <= 3; pointOffset += 3) {
+			__m256 thickness = _mm256_i32gather_ps(base + pointOffset + 0, index, 4);
+			__m256 px        = _mm256_i32gather_ps(base + pointOffset + 1, index, 4);
+			__m256 py        = _mm256_i32gather_ps(base + pointOffset + 2, index, 4);
+
+			__m256 r = _mm256_mul_ps(thickness, half);
+			__m256 x = _mm256_add_ps(_mm256_mul_ps(ix, px), _mm256_mul_ps(jx, py));
+			__m256 y = _mm256_add_ps(_mm256_mul_ps(iy, px), _mm256_mul_ps(jy, py));
+			minX = _mm256_min_ps(minX, _mm256_sub_ps(x, r));
+			minY = _mm256_min_ps(minY, _mm256_sub_ps(y, r));
+			maxX = _mm256_max_ps(maxX, _mm256_add_ps(x, r));
+			maxY = _mm256_max_ps(maxY, _mm256_add_ps(y, r));
+		}
+	}
+
+	alignas(32) f32 minXs[8], minYs[8], maxXs[8], maxYs[8];
+	_mm256_store_ps(minXs, minX);
+	_mm256_store_ps(minYs, minY);
+	_mm256_store_ps(maxXs, maxX);
+	_mm256_store_ps(maxYs, maxY);
+
+	aabb<v2f> tail = getLinesBoundsScalar(lines + lineIndex, count - lineIndex, rotation);
+	return boundsFromLanes(minXs, minYs, maxXs, maxYs, 8, tail);
+}
+
+using GetLinesBoundsProc = aabb<v2f> (*)(Line const *lines, umm count, m2 rotation);
+
+inline GetLinesBoundsProc getLinesBoundsProc() {
+	static GetLinesBoundsProc proc = getCpuFeatures().avx2 ? getLinesBoundsAVX2 : getLinesBoundsSSE;
+	return proc;
+}
+
+// Strokes longer than this are split between threadPool's threads
+constexpr umm parallelBoundsLineCount = 1 << 16;
+
+inline aabb<v2f> getLinesBounds(Line const *lines, umm count, m2 rotation) {
+	auto proc = getLinesBoundsProc();
+	if (count < parallelBoundsLineCount) {
+		return proc(lines, count, rotation);
+	}
+
+	constexpr u32 chunkCount = 8;
+	umm chunkSize = (count + chunkCount - 1) / chunkCount;
+	aabb<v2f> chunkBounds[chunkCount];
+
+	auto work = makeWorkQueue(&threadPool);
+	for (u32 chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex) {
+		work.push([&, chunkIndex] {
+			umm begin = min(chunkIndex * chunkSize, count);
+			umm end = min(begin + chunkSize, count);
+			chunkBounds[chunkIndex] = proc(lines + begin, end - begin, rotation);
+		});
+	}
+	work.waitForCompletion();
+
+	aabb<v2f> result = chunkBounds[0];
+	for (u32 chunkIndex = 1; chunkIndex < chunkCount; ++chunkIndex) {
+		result = combineBounds(result, chunkBounds[chunkIndex]);
+	}
+	return result;
+}
@@ -14,6 +14,7 @@
 #include <stdio.h>
 
 #include "../dep/stb/stb_image.h"
+#include "../dep/stb/stb_image_write.h"
 
 #define CURRENT_VERSION ((u16)0)
 
@@ -34,6 +35,17 @@
 #include "../dep/tl/include/tl/thread.h"
 
 #include "renderer.h"
+#include "lines.h"
+#include "stroke.h"
+#include "batch.h"
+#include "raster.h"
+#include "r_null.h"
+#include "schedule.h"
+#include "picking.h"
+#include "decode.h"
+#include "imagecache.h"
+#include "diskcache.h"
+#include "upload.h"
 
 Entity *getEntityById(Scene *scene, EntityId id) {
 	auto it = scene->entities.find(id);
@@ -68,10 +80,36 @@ enum ImageScalingAnchor {
 //	Net_stopAction,
 //};
 
+// Tile of an image drawn from tiles, see virtualtexture.h
+struct LoadedTile {
+	u64 key;
+	void *renderData;
+	u64 bytes;
+	u64 lastUse; // Pass of the image cache it was last in view
+};
+
 struct LoadedImage {
 	std::wstring path;
 	u32 refCount;
 	void *renderData;
+	List<u32> pixels; // Largest level of the texture for color picking, empty until loaded
+	v2u size;
+	u32 shownSize;       // Largest side in window pixels any entity was shown at, the texture is decoded for it
+	bool decodeQueued;
+	u32 uploading;       // Decode results waiting for their textures, the entry is not erased until they're applied
+	bool decodeFailed;   // Not decoded again when it comes into view
+	bool fullResolution; // Texture was not downscaled, zooming in does not decode it again
+	bool tiled;          // Drawn from tiles, the texture, 'pixels' and 'size' are of the base level
+	v2u sourceSize;      // Of a tiled image
+	u64 textureBytes;
+	List<LoadedTile> tiles;
+	List<u64> wantedTiles; // Keys of tiles in view, sorted
+	// Full resolution chain of a tiled image that the disk cache did not store, tiles are copied from it instead of
+	// decoding the file again. Freed when the image is evicted, not while a worker or an upload reads it.
+	MipChain tileSource;
+	u64 contentHash;     // Of the image file, 0 until it was read
+	bool duplicate;      // Content was loaded from another path, merged with it by applyImageDuplicates
+	ImageCacheEntry cache;
 	bool operator==(LoadedImage const &that) const {
 		return path == that.path;
 	}
@@ -88,10 +126,59 @@ struct hash<LoadedImage> {
 
 }
 
-static std::thread imageLoaderThread;
 static std::unordered_map<std::wstring, LoadedImage> allLoadedImages;
-static CircularQueue<LoadedImage *, 1024> imagesToLoad;
 static Mutex loadedImagesMutex;
+static ImageDecodePool imageDecodePool;
+static ImageCache imageCache; // Guarded by loadedImagesMutex
+
+// Taken by a decode worker, the entry is not erased and not queued again until it's done.
+// Called with loadedImagesMutex held, decodeLoadedImage finishes its image under it.
+static bool isDecoding(LoadedImage &image) {
+	return imageDecodePool.isInFlight(&image);
+}
+static DiskImageCache diskImageCache;
+static bool imageDecodePrioritiesDirty; // Images were queued or resized, see updateShownImages
+
+// Result of decodeLoadedImage, applied to its image by uploadDecodedImages when its textures are uploaded
+struct DecodedImage {
+	LoadedImage *image;
+	MipChain mips; // Points into 'mapping' when it came from the disk cache
+	Span<u8 const> mapping;
+	bool tiled;
+	MipChain base;    // Of a tiled image whose base level was not loaded
+	List<u32> pixels; // Largest level of the image's texture for color picking, empty when it's not replaced
+	List<MipChain> tileMips;
+	List<LoadedTile> tiles;
+	List<TextureUpload> uploads;
+	umm uploadIndex = 0;
+	bool released = false; // Image was released after it was decoded, its textures are not uploaded
+
+	~DecodedImage() {
+		platform_unmapFile(mapping);
+	}
+};
+static List<DecodedImage *> decodedImages;      // Guarded by loadedImagesMutex, in decode order
+static TextureUploadStats textureUploadStats; // Guarded by loadedImagesMutex
+
+// Path of an image file whose content was already loaded from another path, entities of both share one image
+struct SharedImagePath {
+	LoadedImage *image;
+	u32 refCount;
+};
+static std::unordered_map<std::wstring, SharedImagePath> sharedImagePaths; // Guarded by loadedImagesMutex
+static std::unordered_map<u64, LoadedImage *> loadedImagesByContent;      // Guarded by loadedImagesMutex
+static bool imageDuplicatesFound;                                          // Guarded by loadedImagesMutex
+
+// Dropped image file whose header is read on imageImportPool, see app_onDragAndDrop
+struct ImageImport {
+	Scene *scene;
+	EntityId entityId;
+	std::wstring path;
+	v2u size; // Zero when the header could not be read
+};
+static ImageDecodePool imageImportPool;
+static Mutex imageImportsMutex;
+static List<ImageImport *> finishedImageImports; // Guarded by imageImportsMutex
 
 ThreadPool<TL_DEFAULT_ALLOCATOR> threadPool;
 
@@ -99,6 +186,8 @@ Language language;
 Localization localizations[Language_count];
 
 Renderer *renderer;
+FrameScheduler frameScheduler;
+NullRendererStats *nullRendererStats;
 
 constexpr f32 minPencilLineLength = 4;
 
@@ -163,6 +252,9 @@ Entity *previousHoveredEntity = 0;
 
 bool drawBounds;
 bool debugPencil;
+bool captureNextFrame;
+
+wchar const *capturedFramePath = L"frame.drawlist";
 
 // net::Socket listener, connection;
 // MutexCircularQueue<Action, 1024> receivedActions;
@@ -183,30 +275,650 @@ bool smoothable(Tool tool) {
 	return tool == Tool_pencil;
 }
 
+// Called with loadedImagesMutex held
+void releaseImageTiles(LoadedImage &image) {
+	renderer->setImageTiles(image.renderData, 0, 0);
+	for (auto &tile : image.tiles) {
+		renderer->releaseImageData(tile.renderData);
+	}
+	image.tiles = {};
+}
+// Evicted or not decoded yet, the renderer draws its unloaded texture
+void unloadImage(LoadedImage &image) {
+	releaseImageTiles(image);
+	renderer->setUnloadedTexture(image.renderData);
+	image.pixels = {};
+	image.size = {};
+	image.fullResolution = false;
+	image.textureBytes = 0;
+	if (!image.uploading && !isDecoding(image)) {
+		image.tileSource = {};
+	}
+}
+LoadedTile *findTile(LoadedImage &image, u64 key) {
+	for (auto &tile : image.tiles) {
+		if (tile.key == key)
+			return &tile;
+	}
+	return 0;
+}
+bool hasMissingTiles(LoadedImage &image) {
+	for (auto key : image.wantedTiles) {
+		if (!findTile(image, key))
+			return true;
+	}
+	return false;
+}
+// Called with loadedImagesMutex held after tiles were loaded or went out of view. Tiles in view and the most
+// recently seen spare ones are kept, the rest are released. Finer tiles are drawn over coarser ones.
+void updateImageTiles(LoadedImage &image) {
+	auto &wanted = image.wantedTiles;
+	for (auto &tile : image.tiles) {
+		if (std::binary_search(wanted.begin(), wanted.end(), tile.key)) {
+			tile.lastUse = imageCache.pass;
+		}
+	}
+	std::sort(image.tiles.begin(), image.tiles.end(), [](LoadedTile const &a, LoadedTile const &b) { return a.lastUse > b.lastUse; });
+	umm keepCount = 0;
+	while (keepCount < image.tiles.size() && image.tiles[keepCount].lastUse == imageCache.pass) {
+		++keepCount;
+	}
+	keepCount = min(keepCount + virtualTextureSpareTileCount, image.tiles.size());
+	for (umm i = keepCount; i < image.tiles.size(); ++i) {
+		renderer->releaseImageData(image.tiles[i].renderData);
+	}
+	image.tiles.resize(keepCount);
+	std::sort(image.tiles.begin(), image.tiles.end(), [](LoadedTile const &a, LoadedTile const &b) { return getTileLevel(a.key) > getTileLevel(b.key); });
+
+	List<ImageTile> drawnTiles;
+	u64 tileBytes = 0;
+	for (auto &tile : image.tiles) {
+		drawnTiles.push_back({tile.renderData, getTileRect(image.sourceSize, tile.key)});
+		tileBytes += tile.bytes;
+	}
+	renderer->setImageTiles(image.renderData, drawnTiles.data(), drawnTiles.size());
+	imageCache.setBytes(image.cache, image.textureBytes + image.pixels.size() * sizeof(u32) + tileBytes + image.tileSource.bytes());
+}
+// Called with loadedImagesMutex held, after an image was decoded or the camera moved
+void trimImageCache() {
+	// Pages are released when their last image is evicted and compacted when many of their images are
+	auto updateAtlasBytes = [] {
+		imageCache.setAtlasBytes((u64)renderer->getImageAtlasStats().pageCount * imageAtlasPageBytes);
+	};
+	updateAtlasBytes();
+	if (imageCache.stats.bytes <= imageCache.stats.budget)
+		return;
+	List<LoadedImage *> images;
+	for (auto &[path, image] : allLoadedImages) {
+		images.push_back(&image);
+	}
+	imageCache.trim(images, [&](LoadedImage *image) {
+		unloadImage(*image);
+		updateAtlasBytes();
+	});
+}
+void setImageCacheBudget(u64 bytes) {
+	SCOPED_LOCK(loadedImagesMutex);
+	imageCache.stats.budget = bytes;
+	trimImageCache();
+}
+ImageCacheStats getImageCacheStats() {
+	SCOPED_LOCK(loadedImagesMutex);
+	auto stats = imageCache.stats;
+	for (auto &[path, shared] : sharedImagePaths) {
+		++stats.sharedCount;
+		stats.sharedBytes += shared.image->cache.bytes;
+	}
+	return stats;
+}
+// Called with loadedImagesMutex held. Image of 'path' or of the path it shares content with, null if not loaded
+LoadedImage *findLoadedImage(Span<wchar const> path) {
+	auto str = std::wstring(path.data(), path.size());
+	auto it = allLoadedImages.find(str);
+	if (it != allLoadedImages.end())
+		return &it->second;
+	auto shared = sharedImagePaths.find(str);
+	if (shared != sharedImagePaths.end())
+		return shared->second.image;
+	return 0;
+}
+// Called with loadedImagesMutex held
+void eraseLoadedImage(LoadedImage &image) {
+	auto owner = loadedImagesByContent.find(image.contentHash);
+	if (owner != loadedImagesByContent.end() && owner->second == &image) {
+		loadedImagesByContent.erase(owner);
+	}
+	allLoadedImages.erase(allLoadedImages.find(image.path));
+}
 void ungetImageData(Span<wchar> path) {
 	SCOPED_LOCK(loadedImagesMutex);
-	auto &img = allLoadedImages.at(std::wstring(path.data(), path.size()));
+	auto str = std::wstring(path.data(), path.size());
+	auto shared = sharedImagePaths.find(str);
+	if (shared != sharedImagePaths.end()) {
+		str = shared->second.image->path;
+		if (!--shared->second.refCount) {
+			sharedImagePaths.erase(shared);
+		}
+	}
+	auto it = allLoadedImages.find(str);
+	ASSERT(it != allLoadedImages.end(), "ungetImageData: image was not loaded");
+	auto &img = it->second;
 	--img.refCount;
 	if (!img.refCount) {
+		bool decoding = imageDecodePool.remove(&img);
+		if (img.uploading) {
+			for (auto decoded : decodedImages) {
+				if (decoded->image == &img) {
+					decoded->released = true;
+				}
+			}
+		}
+		releaseImageTiles(img);
 		renderer->releaseImageData(img.renderData);
+		imageCache.setBytes(img.cache, 0);
+		// A worker that is decoding it or uploadDecodedImages erase it when they're done
+		if (!decoding && !img.uploading) {
+			eraseLoadedImage(img);
+		} else {
+			img.pixels = {};
+			img.size = {};
+			img.decodeQueued = false;
+			img.fullResolution = false;
+		}
 	}
 }
-void *getOrLoadImageData(Span<wchar const> path) {
+// Larger side of the image in window pixels at the scene's zoom
+u32 getShownSize(Scene const *scene, ImageEntity const &image) {
+	return (u32)ceilf(max(absolute(image.size.x), absolute(image.size.y)) / scene->cameraDistance);
+}
+void *getOrLoadImageData(Span<wchar const> path, u32 shownSize) {
 	SCOPED_LOCK(loadedImagesMutex);
 
 	auto str = std::wstring(path.data(), path.size());
+	auto shared = sharedImagePaths.find(str);
+	if (shared != sharedImagePaths.end()) {
+		++shared->second.refCount;
+		str = shared->second.image->path;
+	}
 	auto &img = allLoadedImages[str];
+	img.shownSize = max(img.shownSize, shownSize);
 	if (!img.refCount) {
 		if (!img.path.size())
 			img.path = str;
 		img.renderData = renderer->createImageData();
 		renderer->setUnloadedTexture(img.renderData);
-		imagesToLoad.push(&img);
+		// Released and loaded again while a worker decodes it, that decode is applied to the new renderData
+		if (!isDecoding(img)) {
+			img.decodeQueued = true;
+			imageDecodePool.push(&img, DecodePriority_offscreen);
+			imageDecodePrioritiesDirty = true;
+		}
 	}
 	++img.refCount;
 	return img.renderData;
 }
 
+// Mips of the image file from the disk cache, or decoded, halved until it is about 'targetSize' large and stored there.
+// Images drawn from tiles keep the full resolution. Cached mips point into 'mapping', which is unmapped when they are
+// not needed. Returns an empty chain on failure.
+// 'contentHash' is set once the file's content is known, 0 if it could not be read. When 'isContentLoaded' returns
+// true for it, the image is loaded from another path already and an empty chain is returned without decoding.
+template <class IsContentLoaded>
+MipChain loadImageMips(DiskImageCache &cache, wchar const *path, u32 targetSize, Span<u8 const> &mapping, u64 &contentHash, IsContentLoaded &&isContentLoaded) {
+	MipChain mips;
+	contentHash = 0;
+	FileInfo info;
+	if (!platform_getFileInfo(path, info)) {
+		LOGW(L"platform_getFileInfo failed: %", path);
+		return {};
+	}
+	if (cache.load(path, info, 0, targetSize, mips, mapping, &contentHash)) {
+		if (!isContentLoaded(contentHash))
+			return mips;
+		platform_unmapFile(mapping);
+		mapping = {};
+		return {};
+	}
+
+	auto imageBuffer = readEntireFile(path);
+	if (!imageBuffer) {
+		LOGW(L"readEntireFile failed: %", path);
+		return {};
+	}
+	DEFER { free(imageBuffer); };
+
+	contentHash = hashBytes(imageBuffer.data(), imageBuffer.size());
+	if (isContentLoaded(contentHash))
+		return {};
+
+	// Copied or touched files keep their cached mips
+	if (cache.load(path, info, &contentHash, targetSize, mips, mapping))
+		return mips;
+
+	int width, height;
+	stbi_uc *pixels = stbi_load_from_memory((stbi_uc *)imageBuffer.data(), imageBuffer.size(), &width, &height, 0, 4);
+	if (!pixels) {
+		LOGW(L"%: stbi_load_from_memory failed: %", path, stbi_failure_reason());
+		return {};
+	}
+	v2u fullSize = {(u32)width, (u32)height};
+	mips = buildMipChain((u32 *)pixels, fullSize, needsVirtualTexture(fullSize) ? 0 : getMipSkipCount(fullSize, targetSize));
+	stbi_image_free(pixels);
+
+	LOGW(L"%: decoded %x%, kept %x% for % pixels with % levels, % KB instead of % KB", path,
+		fullSize.x, fullSize.y, mips.size().x, mips.size().y, targetSize, mips.levels.size(), mips.bytes() / 1024, mips.sourceBytes() / 1024);
+
+	cache.store(path, info, contentHash, mips);
+
+	// Full resolution chain is read back from the mapping, so it does not stay in memory
+	MipChain mapped;
+	if (isVirtualTexture(mips) && cache.load(path, info, &contentHash, targetSize, mapped, mapping))
+		return mapped;
+	return mips;
+}
+// Runs on imageDecodePool's workers. Path of a queued image does not change and the image is not erased
+// while it is decoding, the rest is read under the lock. Tiled images load their missing tiles in view, from the
+// disk cache or from their tileSource.
+// Textures are uploaded on the main thread, see uploadDecodedImages.
+void decodeLoadedImage(void *item) {
+	auto image = (LoadedImage *)item;
+	u32 targetSize;
+	List<u64> missingTiles;
+	MipChain const *tileSource = 0;
+	u64 contentHash;
+	{
+		SCOPED_LOCK(loadedImagesMutex);
+		image->decodeQueued = false;
+		if (image->tileSource.levels.size()) {
+			tileSource = &image->tileSource;
+			contentHash = image->contentHash;
+		}
+		targetSize = max((u32)(image->shownSize * imageResolutionHeadroom), minImageResolution);
+		for (auto key : image->wantedTiles) {
+			if (!findTile(*image, key)) {
+				missingTiles.push_back(key);
+			}
+		}
+	}
+
+	// Content that another path loaded already is not decoded again
+	auto isContentLoaded = [&](u64 contentHash) {
+		SCOPED_LOCK(loadedImagesMutex);
+		auto owner = loadedImagesByContent.find(contentHash);
+		return owner != loadedImagesByContent.end() && owner->second != image;
+	};
+	auto decoded = new DecodedImage;
+	decoded->image = image;
+	if (tileSource) {
+		decoded->mips = viewMipChain(*tileSource);
+	} else {
+		decoded->mips = loadImageMips(diskImageCache, image->path.data(), targetSize, decoded->mapping, contentHash, isContentLoaded);
+	}
+	auto &mips = decoded->mips;
+
+	// Not stored in the disk cache, kept with the image so its next tiles are not decoded from the file again
+	if (isVirtualTexture(mips) && !mips.mappedTexels) {
+		SCOPED_LOCK(loadedImagesMutex);
+		if (!image->tileSource.levels.size()) {
+			image->tileSource = std::move(mips);
+			mips = viewMipChain(image->tileSource);
+		}
+	}
+
+	// Tiles are copied out of the mapping and pixels for color picking are copied without the lock held
+	decoded->tiled = isVirtualTexture(mips);
+	if (decoded->tiled) {
+		for (auto key : missingTiles) {
+			if (getTileLevel(key) >= mips.levels.size())
+				continue;
+			decoded->tileMips.push_back(copyTile(mips, key));
+			decoded->tiles.push_back({key, renderer->createImageData(), decoded->tileMips.back().bytes()});
+		}
+	} else if (mips.levels.size()) {
+		v2u size = mips.size();
+		decoded->pixels.resize(size.x * size.y);
+		memcpy(decoded->pixels.data(), mips.level(0), size.x * size.y * sizeof(u32));
+	}
+	auto discard = [&] {
+		for (auto &tile : decoded->tiles) {
+			renderer->releaseImageData(tile.renderData);
+		}
+		delete decoded;
+	};
+
+	{
+		SCOPED_LOCK(loadedImagesMutex);
+		imageDecodePool.finish(image);
+		// Released while it was decoding
+		if (!image->refCount) {
+			discard();
+			if (!image->uploading) {
+				eraseLoadedImage(*image);
+			}
+			return;
+		}
+
+		// File changed since it was loaded, or was not read
+		if (contentHash != image->contentHash) {
+			auto owner = loadedImagesByContent.find(image->contentHash);
+			if (owner != loadedImagesByContent.end() && owner->second == image) {
+				loadedImagesByContent.erase(owner);
+			}
+			image->contentHash = contentHash;
+		}
+		auto owner = loadedImagesByContent.find(contentHash);
+		if (contentHash && owner != loadedImagesByContent.end() && owner->second != image) {
+			// Same content is loaded from another path, applyImageDuplicates moves this image's entities to it
+			discard();
+			image->duplicate = true;
+			imageDuplicatesFound = true;
+			frameScheduler.wake();
+			return;
+		}
+		if (!mips.levels.size()) {
+			discard();
+			image->decodeFailed = true;
+			return;
+		}
+		if (contentHash) {
+			loadedImagesByContent[contentHash] = image;
+		}
+
+		if (decoded->tiled) {
+			if (!image->pixels.size()) {
+				decoded->base = getVirtualTextureBase(mips);
+				v2u size = decoded->base.size();
+				decoded->pixels.resize(size.x * size.y);
+				memcpy(decoded->pixels.data(), decoded->base.level(0), size.x * size.y * sizeof(u32));
+				decoded->uploads.push_back({image->renderData, &decoded->base});
+			}
+			for (umm i = 0; i < decoded->tiles.size(); ++i) {
+				decoded->uploads.push_back({decoded->tiles[i].renderData, &decoded->tileMips[i]});
+			}
+		} else {
+			// Small images share atlas pages, so many of them are drawn with a few textures
+			decoded->uploads.push_back({image->renderData, &mips, 0, 0, fitsInImageAtlas(mips.size())});
+		}
+		++image->uploading;
+		decodedImages.push_back(decoded);
+	}
+
+	frameScheduler.wake();
+}
+// Called with loadedImagesMutex held after the textures of 'decoded' were uploaded
+void applyDecodedImage(DecodedImage &decoded) {
+	auto image = decoded.image;
+	--image->uploading;
+	// Released while it was uploading, its textures were not. It may have been loaded again since.
+	if (decoded.released) {
+		for (auto &tile : decoded.tiles) {
+			renderer->releaseImageData(tile.renderData);
+		}
+		if (!image->refCount && !isDecoding(*image) && !image->uploading) {
+			eraseLoadedImage(*image);
+		}
+		return;
+	}
+
+	if (decoded.tiled) {
+		if (decoded.base.levels.size()) {
+			image->pixels = std::move(decoded.pixels);
+			image->size = decoded.base.size();
+			image->textureBytes = decoded.base.bytes();
+			image->fullResolution = true;
+			// Tiles in view are found by updateShownImages
+			if (!image->tiled) {
+				image->tiled = true;
+				image->sourceSize = decoded.mips.sourceSize;
+				imageDecodePrioritiesDirty = true;
+			}
+		}
+		for (auto &tile : decoded.tiles) {
+			tile.lastUse = imageCache.pass;
+			image->tiles.push_back(tile);
+		}
+		updateImageTiles(*image);
+
+		// Moved while it was loading
+		if (!image->decodeQueued && !isDecoding(*image) && hasMissingTiles(*image)) {
+			image->decodeQueued = true;
+			imageDecodePool.push(image, DecodePriority_visible);
+		}
+	} else {
+		auto &mips = decoded.mips;
+		v2u size = mips.size();
+		image->pixels = std::move(decoded.pixels);
+		image->size = size;
+		// Atlas pages are counted as a whole by trimImageCache
+		image->textureBytes = fitsInImageAtlas(size) ? 0 : mips.bytes();
+		image->fullResolution = size == mips.sourceSize;
+		imageCache.setBytes(image->cache, image->textureBytes + image->pixels.size() * sizeof(u32));
+
+		// Zoomed in while it was decoding
+		if (!image->fullResolution && !image->decodeQueued && !isDecoding(*image) && image->shownSize > max(size.x, size.y)) {
+			image->decodeQueued = true;
+			imageDecodePool.push(image, DecodePriority_visible);
+		}
+	}
+	trimImageCache();
+
+	// Only the entities that show it are repainted, the live entity is drawn over the cached layer
+	for (auto &scene : scenes) {
+		for (auto &[id, e] : scene.entities) {
+			if (e.type != Entity_image || e.image.renderData != image->renderData)
+				continue;
+			if (id == scene.liveEntityId) {
+				scene.liveEntityDirty = true;
+			} else {
+				invalidateSceneBounds(&scene, e.bounds);
+			}
+		}
+	}
+}
+// Called by the main loop every frame. Textures of decoded images are uploaded in order, piece by piece, until the
+// frame's budget is used up, images are applied when all of their textures are uploaded. Without 'withinBudget'
+// every decoded image is uploaded.
+void uploadDecodedImages(bool withinBudget = true) {
+	SCOPED_LOCK(loadedImagesMutex);
+	auto &stats = textureUploadStats;
+	auto begin = std::chrono::high_resolution_clock::now();
+	auto elapsedSeconds = [&] { return std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count(); };
+
+	u64 bytes = 0;
+	umm appliedCount = 0;
+	bool overBudget = false;
+	for (auto decoded : decodedImages) {
+		// Textures of released images are not uploaded
+		while (!decoded->released && decoded->uploadIndex < decoded->uploads.size()) {
+			// At least one piece is uploaded each frame
+			overBudget = withinBudget && bytes && (bytes >= stats.bytesPerFrame || elapsedSeconds() >= stats.secondsPerFrame);
+			if (overBudget)
+				break;
+			auto &upload = decoded->uploads[decoded->uploadIndex];
+			bytes += uploadTexturePiece(renderer, upload);
+			if (upload.done()) {
+				++decoded->uploadIndex;
+				++stats.uploadedCount;
+			}
+		}
+		if (overBudget)
+			break;
+		applyDecodedImage(*decoded);
+		delete decoded;
+		++appliedCount;
+	}
+	for (umm i = appliedCount; i < decodedImages.size(); ++i) {
+		decodedImages[i - appliedCount] = decodedImages[i];
+	}
+	decodedImages.resize(decodedImages.size() - appliedCount);
+
+	stats.lastFrameBytes = bytes;
+	stats.lastFrameSeconds = bytes ? elapsedSeconds() : 0;
+	stats.peakFrameSeconds = max(stats.peakFrameSeconds, stats.lastFrameSeconds);
+	stats.uploadedBytes += bytes;
+	stats.backlogCount = (u32)decodedImages.size();
+	stats.backlogBytes = 0;
+	for (auto decoded : decodedImages) {
+		for (umm i = decoded->uploadIndex; i < decoded->uploads.size(); ++i) {
+			stats.backlogBytes += decoded->uploads[i].remainingBytes();
+		}
+	}
+	// Rest is uploaded next frame
+	if (decodedImages.size()) {
+		frameScheduler.wake();
+	}
+}
+void setTextureUploadBudget(u64 bytesPerFrame, f64 secondsPerFrame) {
+	SCOPED_LOCK(loadedImagesMutex);
+	textureUploadStats.bytesPerFrame = bytesPerFrame;
+	textureUploadStats.secondsPerFrame = secondsPerFrame;
+}
+TextureUploadStats getTextureUploadStats() {
+	SCOPED_LOCK(loadedImagesMutex);
+	return textureUploadStats;
+}
+// Called when the camera or the shown scene changes. Images in view are marked as used in the image cache and
+// decoded again if they were evicted. Images shown larger than their texture are decoded at a larger resolution,
+// tiled images load tiles of the level matching the zoom that are in view.
+void updateShownImages(Scene const *scene) {
+	SCOPED_LOCK(loadedImagesMutex);
+	auto view = getSceneView(scene, (v2f)clientSize);
+	imageCache.beginPass();
+	for (auto &[path, image] : allLoadedImages) {
+		image.wantedTiles.clear();
+	}
+	for (auto &[id, e] : scene->entities) {
+		if (e.type != Entity_image)
+			continue;
+		auto found = findLoadedImage(e.image.path);
+		if (!found)
+			continue;
+		auto &image = *found;
+		u32 shownSize = getShownSize(scene, e.image);
+		bool shownLarger = shownSize > image.shownSize;
+		image.shownSize = max(image.shownSize, shownSize);
+
+		bool evicted = false;
+		if (e.visible && isInView(e, view)) {
+			evicted = !imageCache.use(image.cache) && !image.uploading && !image.decodeFailed && !image.duplicate;
+			u32 level = getVirtualTextureLevel(image.sourceSize, shownSize);
+			if (image.tiled && level < getVirtualTextureBaseLevel(image.sourceSize)) {
+				getTilesInRect(image.wantedTiles, image.sourceSize, level, getImageViewRect(e, view));
+			}
+		}
+		bool tooSmall = shownLarger && !image.fullResolution && image.pixels.size() && image.shownSize > max(image.size.x, image.size.y);
+		// Queued decodes read the new size when they start, a decode that already started is checked by applyDecodedImage
+		if (!image.decodeQueued && (evicted || tooSmall) && !isDecoding(image)) {
+			image.decodeQueued = true;
+			imageDecodePool.push(&image, DecodePriority_visible);
+			imageDecodePrioritiesDirty = true;
+		}
+	}
+	for (auto &[path, image] : allLoadedImages) {
+		if (!image.tiled || !image.pixels.size())
+			continue;
+		std::sort(image.wantedTiles.begin(), image.wantedTiles.end());
+		image.wantedTiles.resize(std::unique(image.wantedTiles.begin(), image.wantedTiles.end()) - image.wantedTiles.begin());
+		updateImageTiles(image);
+		// Image is queued again when the tiles that are loading are applied
+		if (!image.decodeQueued && !image.uploading && hasMissingTiles(image) && !isDecoding(image)) {
+			image.decodeQueued = true;
+			imageDecodePool.push(&image, DecodePriority_visible);
+			imageDecodePrioritiesDirty = true;
+		}
+	}
+	trimImageCache();
+}
+// Queued images in view of 'scene' are decoded first, then the rest of its images, then images of other scenes
+void updateImageDecodePriorities(Scene const *scene) {
+	std::unordered_map<void *, u32> priorities;
+	{
+		SCOPED_LOCK(loadedImagesMutex);
+		collectImageDecodePriorities(priorities, scene, getSceneView(scene, (v2f)clientSize), [](ImageEntity const &image) -> void * {
+			return findLoadedImage(image.path);
+		});
+	}
+	imageDecodePool.reprioritize([&](void *item) {
+		auto it = priorities.find(item);
+		return it == priorities.end() ? (u32)DecodePriority_otherScene : it->second;
+	});
+}
+// Entities of images whose content was loaded from another path are moved to the image of that path, and their
+// own image is released. The image of each path is counted in its shared path's refCount, see ungetImageData.
+void applyImageDuplicates() {
+	SCOPED_LOCK(loadedImagesMutex);
+	if (!imageDuplicatesFound)
+		return;
+	imageDuplicatesFound = false;
+
+	for (auto it = allLoadedImages.begin(); it != allLoadedImages.end();) {
+		auto &duplicate = it->second;
+		if (!duplicate.duplicate) {
+			++it;
+			continue;
+		}
+		auto owner = loadedImagesByContent.find(duplicate.contentHash);
+		if (owner == loadedImagesByContent.end()) {
+			// Other image was released meanwhile, this one is decoded when it is in view
+			duplicate.duplicate = false;
+			++it;
+			continue;
+		}
+		// Decoded again, a worker is done with it soon. Dropped from the queue otherwise.
+		if (duplicate.uploading || imageDecodePool.remove(&duplicate)) {
+			imageDuplicatesFound = true;
+			++it;
+			continue;
+		}
+
+		auto &image = *owner->second;
+		for (auto &scene : scenes) {
+			for (auto &[id, e] : scene.entities) {
+				if (e.type == Entity_image && e.image.renderData == duplicate.renderData) {
+					e.image.renderData = image.renderData;
+					scene.needRepaint = true;
+				}
+			}
+		}
+		LOGW(L"% has the same content as %", it->first.data(), image.path.data());
+		sharedImagePaths[it->first] = {&image, duplicate.refCount};
+		image.refCount += duplicate.refCount;
+		renderer->releaseImageData(duplicate.renderData);
+		it = allLoadedImages.erase(it);
+		imageDecodePrioritiesDirty = true;
+	}
+}
+
+// Sets draw color to the color under 'point', see pickSceneColor
+void pickColor(Scene *scene, v2f point) {
+	SCOPED_LOCK(loadedImagesMutex);
+	scene->drawColor = pickSceneColor(scene, point, [](ImageEntity const &image) {
+		ImagePixels result;
+		auto loaded = findLoadedImage(image.path);
+		if (loaded && loaded->pixels.size()) {
+			result.pixels = loaded->pixels.data();
+			result.size = loaded->size;
+		}
+		return result;
+	});
+	scene->drawColorDirty = true;
+}
+
+// While zoom does not change, the camera moves by whole pixels relative to the drawn canvas,
+// so the canvas is scrolled instead of repainted, see getScrollOffset
+void snapCameraToCanvasPixels(Scene *scene) {
+	if (scene->cameraDistance != scene->canvasCameraDistance)
+		return;
+	auto snap = [&](v2f position) {
+		return scene->canvasCameraPosition + round((position - scene->canvasCameraPosition) / scene->cameraDistance) * scene->cameraDistance;
+	};
+	scene->targetCameraPosition = snap(scene->targetCameraPosition);
+	scene->cameraPosition = snap(scene->cameraPosition);
+	if (scene->cameraPosition != scene->canvasCameraPosition) {
+		scene->matrixSceneToNDCDirty = true;
+	}
+}
+
 void cleanup(Entity &e) {
 	LOG("cleanup(%{%})", toString(e.type), e.id);
 	renderer->releaseEntity(e);
@@ -275,25 +987,163 @@ Entity *pushEntity(Scene *scene, Entity &&e) {
 	return &scene->entities.at(id);
 }
 
-bool loadImageInfo(ImageEntity &image) {
-	auto imageFile = _wfopen(nullTerminate(image.path).data(), L"rb");
+bool loadImageInfo(wchar const *path, v2u &size) {
+	auto imageFile = _wfopen(path, L"rb");
 	if (!imageFile) {
-		LOGW(L"Failed to load file: %", image.path);
+		LOGW(L"Failed to load file: %", path);
 		return false;
 	}
 	DEFER { fclose(imageFile); };
 
 	int width, height;
 	if (!stbi_info_from_file(imageFile, &width, &height, 0)) {
-		LOGW(L"Failed stbi_info_from_file: %", image.path);
+		LOGW(L"Failed stbi_info_from_file: %", path);
 		return false;
 	}
 
-	image.size.x = width;
-	image.size.y = height;
-	image.initialAspectRatio = image.size.x / image.size.y;
+	size = {(u32)width, (u32)height};
 	return true;
 }
+// Runs on imageImportPool's workers, results are applied on the main thread by applyImageImports
+void readImageImport(void *item) {
+	auto import = (ImageImport *)item;
+	if (!loadImageInfo(import->path.data(), import->size)) {
+		import->size = {};
+	}
+	{
+		SCOPED_LOCK(imageImportsMutex);
+		finishedImageImports.push_back(import);
+	}
+	frameScheduler.wake();
+}
+bool isBatched(Action const &action) {
+	return action.type == Action_create && action.create.batched;
+}
+// Removes an entity and the actions that target it from the scene's history
+void removeEntity(Scene *scene, EntityId id) {
+	List<Action> kept;
+	bool removedBatchStart = false;
+	for (umm i = 0; i < scene->actions.size(); ++i) {
+		auto &action = scene->actions[i];
+		EntityId targetId = invalidEntityId;
+		switch (action.type) {
+			case Action_create:    targetId = action.create.targetId; break;
+			case Action_translate: targetId = action.translate.targetId; break;
+			case Action_rotate:    targetId = action.rotate.targetId; break;
+			case Action_scale:     targetId = action.scale.targetId; break;
+			default: INVALID_CODE_PATH();
+		}
+		if (targetId != id) {
+			// Next action of a batch starts it
+			if (removedBatchStart && isBatched(action)) {
+				action.create.batched = false;
+			}
+			removedBatchStart = false;
+			kept.push_back(std::move(action));
+			continue;
+		}
+
+		removedBatchStart = action.type == Action_create && !isBatched(action);
+		umm keptIndex = kept.size();
+		// Redoing the other creates counts up to the largest id again
+		if (action.type == Action_create && keptIndex >= scene->postLastVisibleActionIndex) {
+			++scene->entityIdCounter;
+		}
+		if (keptIndex < scene->postLastVisibleActionIndex)         --scene->postLastVisibleActionIndex;
+		if (keptIndex < scene->savedPostLastVisibleActionIndex)    --scene->savedPostLastVisibleActionIndex;
+		if (keptIndex < scene->modifiedPostLastVisibleActionIndex) --scene->modifiedPostLastVisibleActionIndex;
+	}
+	scene->actions = std::move(kept);
+
+	auto &e = scene->entities.at(id);
+	for (Entity **pointer : {&currentEntity, &draggingEntity, &rotatingEntity, &hoveredEntity, &previousHoveredEntity}) {
+		if (*pointer == &e) {
+			*pointer = 0;
+		}
+	}
+	if (scalingImage == &e.image) {
+		scalingImage = 0;
+	}
+	cleanup(e);
+	scene->entities.erase(id);
+	scene->needRepaint = true;
+}
+// Gives placeholders of dropped images their size, placeholders of files that could not be read are removed
+void applyImageImports() {
+	List<ImageImport *> imports;
+	{
+		SCOPED_LOCK(imageImportsMutex);
+		std::swap(imports, finishedImageImports);
+	}
+	for (auto import : imports) {
+		DEFER { delete import; };
+
+		// Removed, or the scene was loaded over
+		auto e = getEntityById(import->scene, import->entityId);
+		if (!e || e->type != Entity_image || !e->image.sizePending || std::wstring(e->image.path.data(), e->image.path.size()) != import->path)
+			continue;
+
+		auto &image = e->image;
+		image.sizePending = false;
+		if (!import->size.x || !import->size.y) {
+			removeEntity(import->scene, import->entityId);
+			continue;
+		}
+
+		// Placeholder's larger side and flips are kept, it may have been scaled already
+		v2f size = (v2f)import->size;
+		f32 largest = max(absolute(image.size.x), absolute(image.size.y));
+		image.size.x = copysignf(size.x / max(size.x, size.y) * largest, image.size.x);
+		image.size.y = copysignf(size.y / max(size.x, size.y) * largest, image.size.y);
+		image.initialAspectRatio = size.x / size.y;
+		calculateBounds(*e);
+		import->scene->needRepaint = true;
+		imageDecodePrioritiesDirty = true;
+	}
+}
+// Called before a scene is saved, so no placeholder sizes are written
+void finishImageImports() {
+	imageImportPool.waitIdle();
+	applyImageImports();
+}
+
+void saveCapturedFrame() {
+	auto file = _wfopen(capturedFramePath, L"wb");
+	if (!file) {
+		LOGW(L"Failed to open file for writing: %", capturedFramePath);
+		return;
+	}
+	DEFER { fclose(file); };
+
+	writeDrawList(renderer->getLastFrame()).stream([&] (char *data, umm size) {
+		fwrite(data, 1, size, file);
+	});
+	LOGW(L"Captured frame: '%'", capturedFramePath);
+}
+
+void replayCapturedFrame() {
+	auto file = readEntireFile(capturedFramePath);
+	if (!file) {
+		LOGW(L"Failed to open '%'", capturedFramePath);
+		return;
+	}
+	DEFER { free(file); };
+
+	DrawList list;
+	if (!readDrawList({(u8 *)file.begin(), (u8 *)file.end()}, list)) {
+		LOGW(L"Failed to read captured frame '%'", capturedFramePath);
+		return;
+	}
+	// Renderers index scenes by the commands, scenes that were not opened since have nothing to draw into
+	for (auto &command : list.commands) {
+		u32 sceneIndex = getSceneIndex(command);
+		if (sceneIndex != ~0u && !scenes[sceneIndex].renderData) {
+			LOGW(L"Captured frame '%' draws scene % which is not open", capturedFramePath, sceneIndex);
+			return;
+		}
+	}
+	renderer->execute(list);
+}
 
 void app_onWindowClose() {
 	app_tryExit();
@@ -316,6 +1166,7 @@ void app_onWindowMove() {
 	}
 }
 void app_onDragAndDrop(Span<Span<wchar>> paths) {
+	bool batched = false;
 	for (auto path : paths) {
 		bool freePath = true;
 		DEFER {
@@ -339,19 +1190,28 @@ void app_onDragAndDrop(Span<Span<wchar>> paths) {
 
 			freePath = false;
 
+			// Placeholder is shown right away, its size comes from the header read on imageImportPool
 			ImageEntity image;
 			image.path = path;
-			if (loadImageInfo(image)) {
-				image.size /= max(image.size.x, image.size.y);
-				image.size *= currentScene->cameraDistance * min(clientSize.x, clientSize.y) * 0.5f;
-				image.position = mouseScenePos;
-				image.renderData = getOrLoadImageData(image.path);
-				if (image.renderData) {
-					currentScene->needRepaint = true;
-				}
-				
-				calculateBounds(*pushEntity(currentScene, std::move(image)));
+			image.size = V2f(currentScene->cameraDistance * min(clientSize.x, clientSize.y) * 0.5f);
+			image.sizePending = true;
+			image.position = mouseScenePos;
+			image.renderData = getOrLoadImageData(image.path, getShownSize(currentScene, image));
+			if (image.renderData) {
+				currentScene->needRepaint = true;
 			}
+
+			auto e = pushEntity(currentScene, std::move(image));
+			calculateBounds(*e);
+			// Images dropped together are undone together
+			currentScene->actions.back().create.batched = batched;
+			batched = true;
+
+			auto import = new ImageImport;
+			import->scene = currentScene;
+			import->entityId = e->id;
+			import->path = std::wstring(e->image.path.data(), e->image.path.size());
+			imageImportPool.push(import, DecodePriority_visible);
 		} else {
 			LOGW(L"Unknown file format: %", path.data());
 		}
@@ -727,6 +1587,8 @@ void closeScene(Scene *scene) {
 }
 
 StringBuilder<> app_writeScene(Scene *scene) {
+	finishImageImports();
+
 	StringBuilder<> builder;
 	auto appender = [&](void *data, umm size, char const *name) {
 		builder.appendBytes(data, size);
@@ -842,7 +1704,7 @@ void generateGfxData(Scene *scene) {
 				break;
 			case Entity_image: {
 				auto& image = e.image;
-				image.renderData = getOrLoadImageData(image.path);
+				image.renderData = getOrLoadImageData(image.path, getShownSize(scene, image));
 			} break;
 		}
 		renderer->initEntityData(scene, e);
@@ -968,46 +1830,16 @@ void start(Span<wchar *> args) {
 	}
 
 	createWindow();
+	frameScheduler.waitForEvents = platform_waitForEvents;
+	frameScheduler.wakeUp = platform_wakeUp;
 	
 	renderer = createRenderer();
 	
-	imageLoaderThread = std::thread([&]{
-		while (running) {
-			loopUntil([&] {
-				lock(loadedImagesMutex);
-				if (imagesToLoad.size()) {
-					LoadedImage *image = imagesToLoad.front();
-					imagesToLoad.pop();
-					unlock(loadedImagesMutex);
-
-					auto imageBuffer = readEntireFile(image->path.data());
-
-					if (imageBuffer) {
-						DEFER { free(imageBuffer); };
-
-						int width, height;
-						stbi_uc *pixels = 0;
-
-						pixels = stbi_load_from_memory((stbi_uc *)imageBuffer.data(), imageBuffer.size(), &width, &height, 0, 4);
-						
-						if (pixels) {
-							DEFER { stbi_image_free(pixels); };
-							renderer->setTexture(image->renderData, pixels, width, height);
-							currentScene->needRepaint = true;
-						} else {							
-							LOGW(L"%: stbi_load_from_memory failed: %", image->path.data(), stbi_failure_reason());
-						}
-					} else {
-						LOGW(L"readEntireFile failed: %", image->path.data());
-					}
-					return true;
-				} else {
-					unlock(loadedImagesMutex);
-				}
-				return !running;
-			});
-		}
-	});
+	diskImageCache.init(executableDirectory + L"image_cache\\");
+	static auto decodeImage = [](void *item) { decodeLoadedImage(item); };
+	imageDecodePool.init(getRasterWorkerCount(), &decodeImage);
+	static auto readImport = [](void *item) { readImageImport(item); };
+	imageImportPool.init(getRasterWorkerCount(), &readImport);
 
 	initializeScene(currentScene);
 	
@@ -1039,7 +1871,7 @@ void updateAsterisk(Scene *scene) {
 		updateWindowText = true;
 	}
 }
-void undo() {
+void undoLastAction() {
 	if (!currentScene->postLastVisibleActionIndex)
 		return;
 
@@ -1077,11 +1909,12 @@ void undo() {
 			target->position   = scale.startPosition;
 			target->image.size = scale.startSize;
 			calculateBounds(*target);
+			imageDecodePrioritiesDirty = true;
 		} break;
 	}
 	updateAsterisk(currentScene);
 }
-void redo() {
+void redoNextAction() {
 	if (currentScene->postLastVisibleActionIndex >= currentScene->actions.size())
 		return;
 	
@@ -1120,11 +1953,30 @@ void redo() {
 			target->position   = scale.endPosition;
 			target->image.size = scale.endSize;
 			calculateBounds(*target);
+			imageDecodePrioritiesDirty = true;
 		} break;
 	}
 	updateAsterisk(currentScene);
 }
 
+// Batched actions are undone and redone together, see CreateAction::batched
+void undo() {
+	while (currentScene->postLastVisibleActionIndex) {
+		bool batched = isBatched(currentScene->actions[currentScene->postLastVisibleActionIndex - 1]);
+		undoLastAction();
+		if (!batched)
+			break;
+	}
+}
+void redo() {
+	if (currentScene->postLastVisibleActionIndex >= currentScene->actions.size())
+		return;
+	redoNextAction();
+	while (currentScene->postLastVisibleActionIndex < currentScene->actions.size() && isBatched(currentScene->actions[currentScene->postLastVisibleActionIndex])) {
+		redoNextAction();
+	}
+}
+
 void calculateBounds(EntityBase &e) {
 	e.bounds.min = V2f(+INFINITY);
 	e.bounds.max = V2f(-INFINITY);
@@ -1144,10 +1996,7 @@ void calculateBounds(EntityBase &e) {
 	{
 		case Entity_pencil: {
 			auto &pencil = *(PencilEntity*)&e;
-			for (auto &l : pencil.lines) {
-				updr(rotation * l.a.position, l.a.thickness * 0.5f);
-				updr(rotation * l.b.position, l.b.thickness * 0.5f);
-			}
+			e.bounds = getLinesBounds(pencil.lines.data(), pencil.lines.size(), rotation);
 			e.bounds.min += pencil.position;
 			e.bounds.max += pencil.position;
 		} break;
@@ -1201,6 +2050,32 @@ void calculateBounds(EntityBase &e) {
 			break;
 	}
 }
+// Repaints canvas area the entity covered before and covers now.
+// Live entity is drawn over the cached layer every frame, canvas tiles stay clean.
+void invalidateEntity(Scene *scene, EntityBase &e) {
+	if (e.id == scene->liveEntityId) {
+		calculateBounds(e);
+		scene->liveEntityDirty = true;
+		return;
+	}
+	invalidateSceneBounds(scene, e.bounds);
+	calculateBounds(e);
+	invalidateSceneBounds(scene, e.bounds);
+}
+// Repaints canvas area of some lines of an entity, e.g. a new segment of a stroke.
+// Entity's bounds grow to include them, so partial repaints don't skip it.
+void invalidateLines(Scene *scene, EntityBase &e, Line const *lines, umm count) {
+	auto bounds = getLinesBounds(lines, count, m2::rotation(-e.rotation));
+	bounds.min += e.position;
+	bounds.max += e.position;
+	e.bounds.min = min(e.bounds.min, bounds.min);
+	e.bounds.max = max(e.bounds.max, bounds.max);
+	if (e.id == scene->liveEntityId) {
+		scene->liveEntityDirty = true;
+	} else {
+		invalidateSceneBounds(scene, bounds);
+	}
+}
 
 void findHoveredEntity() {
 	if (!hoveredEntity) {
@@ -1216,22 +2091,6 @@ void findHoveredEntity() {
 		for (auto ptr : candidates) {
 			auto &e = *ptr;
 			auto mouseRelativePos = m2::rotation(e.rotation) * (mouseScenePos - e.position) + e.position;
-			auto hovering = [&](Line l, v2f offset) {
-				auto a = l.a.position + offset;
-				auto b = l.b.position + offset;
-				auto p = mouseRelativePos;
-				f32 t = dot(normalize(a - b), a - p) / length(a - b);
-
-				if (t > 1) {
-					return distance(p, b) < l.b.thickness * 0.5f;
-				} else if (t < 0) {
-					return distance(p, a) < l.a.thickness * 0.5f;
-				} else {
-					v2f c = cross(normalize(a - b));
-					f32 d = absolute(dot(c, a - p));
-					return d < lerp(l.a.thickness, l.b.thickness, clamp(t, 0, 1)) * 0.5f;
-				}
-			};
 
 			switch (e.type) {
 				case Entity_image: {
@@ -1245,38 +2104,31 @@ void findHoveredEntity() {
 				} break;
 				case Entity_pencil: {
 					PencilEntity &pencil = e.pencil;
-					for (auto l : pencil.lines) {
-						if (hovering(l, pencil.position)) {
-							hoveredEntity = &e;
-							return;
-						}
+					if (findHoveredLine(pencil.lines.data(), pencil.lines.size(), pencil.position, mouseRelativePos) != pencil.lines.size()) {
+						hoveredEntity = &e;
+						return;
 					}
 				} break;
 				case Entity_line: {
 					LineEntity &line = e.line;
-					if (hovering(line.line, line.position)) {
+					if (findHoveredLine(&line.line, 1, line.position, mouseRelativePos) != 1) {
 						hoveredEntity = &e;
 						return;
 					}
 				} break;
 				case Entity_grid: {
 					GridEntity &grid = e.grid;
-					auto lines = getGridLines(grid);
-					for (auto l : lines) {
-						if (hovering(l, grid.position)) {
-							hoveredEntity = &e;
-							return;
-						}
+					if (getGridLineDistance(grid, mouseRelativePos - grid.position) < grid.thickness * 0.5f) {
+						hoveredEntity = &e;
+						return;
 					}
 				} break;
 				case Entity_circle: {
 					CircleEntity &circle = e.circle;
 					auto lines = getCircleLines(circle);
-					for (auto l : lines) {
-						if (hovering(l, circle.position)) {
-							hoveredEntity = &e;
-							return;
-						}
+					if (findHoveredLine(lines.data(), CircleEntity::LINE_COUNT, circle.position, mouseRelativePos) != CircleEntity::LINE_COUNT) {
+						hoveredEntity = &e;
+						return;
 					}
 				} break;
 				default: {
@@ -1359,6 +2211,14 @@ void app_onKeyDown(u8 key) {
 				drawBounds = !drawBounds;
 			} else if (key == Key_f7) {
 				debugPencil = !debugPencil;
+			} else if (key == Key_f8) {
+				if (keyHeld(Key_shift)) {
+					replayCapturedFrame();
+				} else {
+					captureNextFrame = true;
+					needRepaint = true;
+					currentScene->needRepaint = true;
+				}
 			//} else if (key == Key_f8) {
 			//	renderer->debugSaveRenderTarget();
 #if 0
@@ -1595,155 +2455,2578 @@ struct f32c {
 				}
 			}
 		}
-		
-		// Step 9:
-		// Drop the highest bit of the mantissa, and pack sign, biased exponent, and mantissa together. 
-		f32c r;
-		r.u = ((u32)s.negative << 31) | ((u32)((s.exponent + exponentBias) & exponentMask) << 23) | (s.mantissa & mantissaMask);
-		return r;
+		
+		// Step 9:
+		// Drop the highest bit of the mantissa, and pack sign, biased exponent, and mantissa together. 
+		f32c r;
+		r.u = ((u32)s.negative << 31) | ((u32)((s.exponent + exponentBias) & exponentMask) << 23) | (s.mantissa & mantissaMask);
+		return r;
+	}
+
+	union {
+		u32 u;
+		f32 f;
+	};
+	f32c() {}
+	f32c(f32 f) : f(f) {}
+	friend f32c operator+(f32c a, f32c b) {
+	beginning:
+		f32c check = a.f + b.f;
+		
+		// Step 1: 
+		// Determine if any of the operands is an Infinity or a Not-A-Number. 
+		// In this case, look up the IEEE 754 standard and determine the result accordingly.
+
+
+		s as = getS(a);
+		s bs = getS(b);
+		s cs = getS(check);
+
+		if (as.isNan || bs.isNan) {
+			return NAN;
+		}
+
+		//ASSERT(make(as).u == a.u);
+		//ASSERT(make(bs).u == b.u);
+		//ASSERT(make(cs).u == check.u);
+		
+		// Step 3:
+		// Make sure the exponents are the same.
+		// If one number has an exponent that is smaller by k, then shift that numbers mantissa to the right by k bit positions.
+		// If k is greater than 3, then set the last bit of the mantissa to 1 if any non-zero bits were shifted out. 
+		// If k is so large that all mantissa bits would be shifted out then set the mantissa to zero, and don't try to shift by some huge amount.
+		if (as.exponent != bs.exponent) {
+			s *min, *max;
+			if (as.exponent > bs.exponent) {
+				min = &bs;
+				max = &as;
+			} else {
+				min = &as;
+				max = &bs;
+			}
+
+			u32 k = max->exponent - min->exponent;
+			if (k >= 27) {
+				min->mantissa = 0;
+			} else if (k > 3) {
+				bool hasBits = min->mantissa & ((1 << k) - 1);
+				min->mantissa >>= k;
+				if (hasBits) {
+					min->mantissa |= 1;
+				}
+			} else {
+				min->mantissa >>= k;
+			}
+			min->exponent = max->exponent;
+		}
+
+		// Step 4: 
+		// If the operands have different signs and the second mantissa is larger then exchange the operands. 
+		// Add or subtract the mantissas, depending on the sign bits.
+		s rs;
+		if (as.negative != bs.negative && bs.mantissa > as.mantissa) {
+			std::swap(as, bs);
+		}
+		if (as.negative == bs.negative) {
+			rs.mantissa = as.mantissa + bs.mantissa;
+		} else {
+			if (as.mantissa == bs.mantissa && as.exponent == bs.exponent) {
+				return 0.0f;
+			}
+			rs.mantissa = as.mantissa - bs.mantissa;
+		}
+		rs.negative = as.negative;
+
+		// Step 5: 
+		// If you added the mantissas and there was a carry, then increase the exponent, and shift the mantissa one bit position to the right.
+		// If the bit that is shifted out is non-zero, then set the last bit of the mantissa.
+		rs.exponent = as.exponent;
+		if (rs.mantissa & (mantissaCarryBit << 3)) {
+			++rs.exponent;
+			u32 lastBit = rs.mantissa & 1;
+			rs.mantissa >>= 1;
+			rs.mantissa |= lastBit;
+		}
+
+		// Step 6:
+		// If you subtracted the mantissas then count the number of leading zero bits in the mantissa.
+		// If all mantissa bits are zero then set the biased exponent to 1.
+		// Otherwise, shift the mantissa to the left and decrease the exponent, making sure that the biased exponent doesn't get smaller than 1.
+		if (as.negative != bs.negative) {
+			u32 lzc = countLeadingZeros(rs.mantissa) - 5;
+			if (rs.mantissa == 0) {
+				rs.exponent = 129;
+			} else if (lzc) {
+				if (rs.exponent > lzc) {
+					rs.mantissa <<= lzc;
+					rs.exponent -= lzc;
+				} else {
+					rs.mantissa <<= lzc - rs.exponent;
+					rs.exponent = 1;
+				}
+			}
+		}
+
+		f32c result = make(rs);
+
+		if (result.u != check.u) {
+			DEBUG_BREAK;
+			goto beginning;
+		}
+
+		return result;
+	}
+};
+
+void f32test() {
+	f32c fa;
+	f32c fb;
+	f32c fc;
+	fa = -522975.969f;
+	fb = 66674.0625f;
+	fc = fa + fb;
+	fa = -321593.813;
+	fb = 323737.875;
+	fc = fa + fb;
+	fa = 124659.813;
+	fb = -124659.813;
+	fc = fa + fb;
+	fa = -1.95598008e+10f;
+	fb = 4.73311009e-18f;
+	fc = fa + fb;
+	fa = -8.23324077e-20f;
+	fb = 1.01678475e-12f;
+	fc = fa + fb;
+
+	std::mt19937 mt{};
+	for (u32 i = 0; i < 0x1000; ++i) {
+		fa.u = mt();
+		fb.u = mt();
+		fc = fa + fb;
+	}
+}
+
+void transformLinesTest() {
+	showConsoleWindow();
+
+	std::mt19937 mt{};
+	std::uniform_real_distribution<f32> positionDistribution(-4096, 4096);
+	std::uniform_real_distribution<f32> thicknessDistribution(0.5f, 256);
+
+	List<Line> lines;
+	lines.resize(1 << 20);
+	for (auto &line : lines) {
+		line.a.position = {positionDistribution(mt), positionDistribution(mt)};
+		line.b.position = {positionDistribution(mt), positionDistribution(mt)};
+		line.a.thickness = thicknessDistribution(mt);
+		line.b.thickness = thicknessDistribution(mt);
+	}
+	// Zero-length lines, like the first segment of a pencil stroke
+	for (u32 i = 0; i < lines.size(); i += 97) {
+		lines[i].b.position = lines[i].a.position;
+	}
+
+	List<TransformedLine> reference, result;
+	reference.resize(lines.size());
+	result.resize(lines.size());
+	for (umm i = 0; i < lines.size(); ++i) {
+		reference[i] = transformReference(lines[i]);
+	}
+
+	struct Kernel {
+		char const *name;
+		TransformLinesProc proc;
+		bool supported;
+	};
+	Kernel kernels[] {
+		{"scalar", transformLinesScalar, true},
+		{"sse",    transformLinesSSE,    true},
+		{"avx2",   transformLinesAVX2,   getCpuFeatures().avx2},
+	};
+
+	for (auto &kernel : kernels) {
+		if (!kernel.supported) {
+			LOG("transformLines %: not supported", kernel.name);
+			continue;
+		}
+
+		// Compare against atan2 + sin/cos version. Matrices are scaled by thickness,
+		// so allow a few ulps relative to it.
+		kernel.proc(result.data(), lines.data(), lines.size());
+		f32 maxError = 0;
+		for (umm i = 0; i < lines.size(); ++i) {
+			f32 const *a = (f32 const *)&reference[i];
+			f32 const *b = (f32 const *)&result[i];
+			f32 scale = max(lines[i].a.thickness, lines[i].b.thickness);
+			for (u32 j = 0; j < sizeof(TransformedLine) / sizeof(f32); ++j) {
+				maxError = max(maxError, absolute(a[j] - b[j]) / scale);
+			}
+		}
+		ASSERT(maxError < 1e-5f, "transformLines result differs from reference");
+
+		constexpr u32 iterations = 16;
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (u32 i = 0; i < iterations; ++i) {
+			kernel.proc(result.data(), lines.data(), lines.size());
+		}
+		f64 seconds = (std::chrono::high_resolution_clock::now() - begin).count() / 1000000000.0;
+		LOG("transformLines %: max error %, % Mlines/s", kernel.name, maxError, lines.size() * iterations / seconds / 1000000);
+	}
+}
+
+void findHoveredLineTest() {
+	showConsoleWindow();
+
+	std::mt19937 mt{};
+	std::uniform_real_distribution<f32> unitDistribution(-1, 1);
+	std::uniform_real_distribution<f32> thicknessDistribution(1, 64);
+
+	// Random walk, like a pencil stroke
+	List<Line> lines;
+	lines.resize(1 << 16);
+	v2f position = {};
+	f32 thickness = 16;
+	for (auto &line : lines) {
+		line.a.position = position;
+		line.a.thickness = thickness;
+		position += v2f{unitDistribution(mt), unitDistribution(mt)} * 32;
+		thickness = thicknessDistribution(mt);
+		line.b.position = position;
+		line.b.thickness = thickness;
+	}
+	for (u32 i = 0; i < lines.size(); i += 61) {
+		lines[i].b.position = lines[i].a.position;
+	}
+
+	v2f offset = {123.5f, -77.25f};
+
+	struct Kernel {
+		char const *name;
+		FindHoveredLineProc proc;
+		bool supported;
+	};
+	Kernel kernels[] {
+		{"scalar", findHoveredLineScalar, true},
+		{"sse",    findHoveredLineSSE,    true},
+		{"avx2",   findHoveredLineAVX2,   getCpuFeatures().avx2},
+	};
+
+	// Query points are placed around random lines, so both hits and misses are tested
+	constexpr u32 queryCount = 4096;
+	u32 mismatches = 0;
+	for (u32 query = 0; query < queryCount; ++query) {
+		Line const &target = lines[mt() % lines.size()];
+		v2f point = lerp(target.a.position, target.b.position, unitDistribution(mt) * 0.5f + 0.5f) + offset;
+		point += v2f{unitDistribution(mt), unitDistribution(mt)} * 16;
+
+		umm expected = lines.size();
+		for (umm i = 0; i < lines.size(); ++i) {
+			if (hoveringReference(lines[i], offset, point)) {
+				expected = i;
+				break;
+			}
+		}
+		for (auto &kernel : kernels) {
+			if (kernel.supported && kernel.proc(lines.data(), lines.size(), offset, point) != expected) {
+				++mismatches;
+			}
+		}
+	}
+	LOG("findHoveredLine: % mismatches in % queries", mismatches, queryCount);
+	ASSERT(mismatches == 0, "findHoveredLine: SIMD kernels should hover the same line as the reference");
+
+	// Point that hovers nothing, so every kernel has to test all lines
+	v2f farPoint = V2f(1e9f);
+	for (auto &kernel : kernels) {
+		if (!kernel.supported) {
+			LOG("findHoveredLine %: not supported", kernel.name);
+			continue;
+		}
+		constexpr u32 iterations = 256;
+		umm result = 0;
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (u32 i = 0; i < iterations; ++i) {
+			result += kernel.proc(lines.data(), lines.size(), offset, farPoint);
+		}
+		f64 seconds = (std::chrono::high_resolution_clock::now() - begin).count() / 1000000000.0;
+		ASSERT(result == lines.size() * iterations, "findHoveredLine: far point should not hover anything");
+		LOG("findHoveredLine %: % Mlines/s", kernel.name, lines.size() * iterations / seconds / 1000000);
+	}
+}
+
+void calculateBoundsTest() {
+	showConsoleWindow();
+
+	std::mt19937 mt{};
+	std::uniform_real_distribution<f32> unitDistribution(-1, 1);
+	std::uniform_real_distribution<f32> thicknessDistribution(1, 64);
+
+	// Million-segment random walk
+	List<Line> lines;
+	lines.resize(1 << 20);
+	v2f position = {};
+	f32 thickness = 16;
+	for (auto &line : lines) {
+		line.a.position = position;
+		line.a.thickness = thickness;
+		position += v2f{unitDistribution(mt), unitDistribution(mt)} * 32;
+		thickness = thicknessDistribution(mt);
+		line.b.position = position;
+		line.b.thickness = thickness;
+	}
+
+	m2 rotation = m2::rotation(0.7f);
+
+	// Same loop calculateBounds used before
+	auto reference = [&] {
+		aabb<v2f> result;
+		result.min = V2f(+INFINITY);
+		result.max = V2f(-INFINITY);
+		for (auto &l : lines) {
+			result.min = min(result.min, rotation * l.a.position - l.a.thickness * 0.5f);
+			result.max = max(result.max, rotation * l.a.position + l.a.thickness * 0.5f);
+			result.min = min(result.min, rotation * l.b.position - l.b.thickness * 0.5f);
+			result.max = max(result.max, rotation * l.b.position + l.b.thickness * 0.5f);
+		}
+		return result;
+	};
+
+	struct Kernel {
+		char const *name;
+		GetLinesBoundsProc proc;
+		bool supported;
+	};
+	Kernel kernels[] {
+		{"scalar",   getLinesBoundsScalar, true},
+		{"sse",      getLinesBoundsSSE,    true},
+		{"avx2",     getLinesBoundsAVX2,   getCpuFeatures().avx2},
+		{"parallel", getLinesBounds,       true},
+	};
+
+	constexpr u32 iterations = 16;
+
+	aabb<v2f> expected = {};
+	auto begin = std::chrono::high_resolution_clock::now();
+	for (u32 i = 0; i < iterations; ++i) {
+		expected = reference();
+	}
+	f64 seconds = (std::chrono::high_resolution_clock::now() - begin).count() / 1000000000.0;
+	LOG("getLinesBounds reference: % Mlines/s", lines.size() * iterations / seconds / 1000000);
+
+	for (auto &kernel : kernels) {
+		if (!kernel.supported) {
+			LOG("getLinesBounds %: not supported", kernel.name);
+			continue;
+		}
+		aabb<v2f> result = {};
+		begin = std::chrono::high_resolution_clock::now();
+		for (u32 i = 0; i < iterations; ++i) {
+			result = kernel.proc(lines.data(), lines.size(), rotation);
+		}
+		seconds = (std::chrono::high_resolution_clock::now() - begin).count() / 1000000000.0;
+
+		// Rotation is summed in a different order, allow for rounding
+		f32 error = max(
+			max(absolute(result.min.x - expected.min.x), absolute(result.min.y - expected.min.y)),
+			max(absolute(result.max.x - expected.max.x), absolute(result.max.y - expected.max.y))
+		);
+		LOG("getLinesBounds %: % Mlines/s, error %", kernel.name, lines.size() * iterations / seconds / 1000000, error);
+
+		// A few ulps of the largest coordinate
+		f32 magnitude = max(
+			max(absolute(expected.min.x), absolute(expected.min.y)),
+			max(absolute(expected.max.x), absolute(expected.max.y))
+		);
+		ASSERT(error <= magnitude * 1e-5f, "getLinesBounds: kernel should match the reference bounds");
+	}
+}
+
+// Triangles of a line as the line shader draws them (HALF macro): a quad and two 16-segment half-disks
+void appendReferenceLineTriangles(List<v2f> &triangles, Line line) {
+	v2f direction = isDegenerate(line) ? v2f{1, 0} : normalize(line.b.position - line.a.position);
+	v2f normal = {-direction.y, direction.x};
+	f32 ra = line.a.thickness * 0.5f;
+	f32 rb = line.b.thickness * 0.5f;
+
+	triangles.push_back(line.a.position - normal * ra);
+	triangles.push_back(line.a.position + normal * ra);
+	triangles.push_back(line.b.position - normal * rb);
+	triangles.push_back(line.b.position - normal * rb);
+	triangles.push_back(line.a.position + normal * ra);
+	triangles.push_back(line.b.position + normal * rb);
+
+	auto half = [&](v2f center, f32 radius, v2f forward) {
+		v2f side = {-forward.y, forward.x};
+		for (u32 i = 0; i < 16; ++i) {
+			f32 a0 = pi * i / 16;
+			f32 a1 = pi * (i + 1) / 16;
+			triangles.push_back(center);
+			triangles.push_back(center + (side * cosf(a0) + forward * sinf(a0)) * radius);
+			triangles.push_back(center + (side * cosf(a1) + forward * sinf(a1)) * radius);
+		}
+	};
+	half(line.a.position, ra, -direction);
+	half(line.b.position, rb, direction);
+}
+
+// Marks pixels whose centers are inside any of the triangles. Winding does not matter.
+void rasterizeTriangles(List<u8> &pixels, v2u size, v2f origin, f32 pixelsPerUnit, v2f const *vertices, umm vertexCount) {
+	for (umm i = 0; i + 3 <= vertexCount; i += 3) {
+		v2f p[3];
+		for (u32 j = 0; j < 3; ++j) {
+			p[j] = (vertices[i + j] - origin) * pixelsPerUnit;
+		}
+		s32 x0 = max((s32)floorf(min(min(p[0].x, p[1].x), p[2].x)), 0);
+		s32 y0 = max((s32)floorf(min(min(p[0].y, p[1].y), p[2].y)), 0);
+		s32 x1 = min((s32)ceilf(max(max(p[0].x, p[1].x), p[2].x)), (s32)size.x - 1);
+		s32 y1 = min((s32)ceilf(max(max(p[0].y, p[1].y), p[2].y)), (s32)size.y - 1);
+		for (s32 y = y0; y <= y1; ++y) {
+			for (s32 x = x0; x <= x1; ++x) {
+				v2f c = {x + 0.5f, y + 0.5f};
+				f32 e0 = cross(p[1] - p[0], c - p[0]);
+				f32 e1 = cross(p[2] - p[1], c - p[1]);
+				f32 e2 = cross(p[0] - p[2], c - p[2]);
+				if ((e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0)) {
+					pixels[y * size.x + x] = 1;
+				}
+			}
+		}
+	}
+}
+
+void strokeMesherTest() {
+	showConsoleWindow();
+
+	std::mt19937 mt{};
+	std::uniform_real_distribution<f32> unitDistribution(-1, 1);
+
+	// Random walk with smoothly changing thickness, like a pencil stroke
+	auto makeStroke = [&](u32 lineCount, f32 step, f32 thicknessStep, f32 turn) {
+		List<Line> lines;
+		lines.resize(lineCount);
+		v2f position = {};
+		f32 angle = 0;
+		f32 thickness = 16;
+		for (auto &line : lines) {
+			line.a.position = position;
+			line.a.thickness = thickness;
+			angle += unitDistribution(mt) * turn;
+			position += v2f{cosf(angle), sinf(angle)} * step;
+			thickness = clamp(thickness + unitDistribution(mt) * thicknessStep, 2.0f, 64.0f);
+			line.b.position = position;
+			line.b.thickness = thickness;
+		}
+		return lines;
+	};
+
+	struct Case {
+		char const *name;
+		List<Line> lines;
+	};
+	Case cases[] {
+		{"smooth",     makeStroke(256, 4, 0.5f, 0.2f)},
+		{"short",      makeStroke(256, 1, 0.5f, 0.5f)},
+		{"sharp",      makeStroke(64, 24, 0.5f, 3.0f)},
+		{"thickness",  makeStroke(128, 8, 16, 0.5f)},
+		{"dots",       makeStroke(64, 16, 0.5f, 1.0f)},
+	};
+
+	// Every other line is a dot and every 8th is moved away, so caps between pieces are tested too
+	for (u32 i = 0; i < cases[4].lines.size(); ++i) {
+		auto &line = cases[4].lines[i];
+		if (i % 2) {
+			line.b = line.a;
+		}
+		if (i % 8 == 0) {
+			line.a.position += v2f{20, 0};
+			line.b.position += v2f{20, 0};
+		}
+	}
+
+	constexpr u32 resolution = 1024;
+	for (auto &c : cases) {
+		auto bounds = getLinesBounds(c.lines.data(), c.lines.size(), m2::rotation(0));
+		v2f extent = bounds.max - bounds.min;
+		f32 pixelsPerUnit = (resolution - 2) / max(extent.x, extent.y);
+		v2f origin = bounds.min - 1 / pixelsPerUnit;
+		v2u size = V2u(resolution);
+
+		List<v2f> reference;
+		for (auto &line : c.lines) {
+			appendReferenceLineTriangles(reference, line);
+		}
+
+		List<StrokeVertex> mesh;
+		meshStroke(mesh, c.lines.data(), c.lines.size(), pixelsPerUnit);
+		List<v2f> meshPositions;
+		for (auto &vertex : mesh) {
+			meshPositions.push_back(vertex.center + vertex.offset);
+		}
+
+		List<u8> referencePixels, meshPixels;
+		referencePixels.resize(size.x * size.y);
+		meshPixels.resize(size.x * size.y);
+		memset(referencePixels.data(), 0, referencePixels.size());
+		memset(meshPixels.data(), 0, meshPixels.size());
+		rasterizeTriangles(referencePixels, size, origin, pixelsPerUnit, reference.data(), reference.size());
+		rasterizeTriangles(meshPixels, size, origin, pixelsPerUnit, meshPositions.data(), meshPositions.size());
+
+		u32 referenceArea = 0, missing = 0, extra = 0;
+		for (u32 i = 0; i < referencePixels.size(); ++i) {
+			referenceArea += referencePixels[i];
+			missing += referencePixels[i] && !meshPixels[i];
+			extra += !referencePixels[i] && meshPixels[i];
+		}
+
+		// Reference half-disks have only 16 segments, so edge pixels may differ a bit
+		f32 mismatch = (f32)(missing + extra) / referenceArea;
+		LOG("meshStroke %: % lines, % triangles (was %), % missing and % extra pixels of %, mismatch %",
+			c.name, c.lines.size(), mesh.size() / 3, c.lines.size() * 32, missing, extra, referenceArea, mismatch);
+		ASSERT(mismatch < 0.01f, "meshStroke: coverage differs from line geometry");
+	}
+
+	// Throughput on a long stroke at 1 pixel per unit
+	List<Line> lines = makeStroke(1 << 20, 4, 0.5f, 0.2f);
+	List<StrokeVertex> mesh;
+	constexpr u32 iterations = 4;
+	auto begin = std::chrono::high_resolution_clock::now();
+	for (u32 i = 0; i < iterations; ++i) {
+		mesh.clear();
+		meshStroke(mesh, lines.data(), lines.size(), 1);
+	}
+	f64 seconds = (std::chrono::high_resolution_clock::now() - begin).count() / 1000000000.0;
+	LOG("meshStroke: % Mlines/s, % triangles per line (was 32)", lines.size() * iterations / seconds / 1000000, (f32)mesh.size() / 3 / lines.size());
+}
+
+// Records frames of a sample scene without a renderer and checks the commands
+void drawListTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "drawListTest: last scene is in use");
+
+	Scene *oldCurrentScene = currentScene;
+	bool oldPlayingSceneShiftAnimation = playingSceneShiftAnimation;
+	f32 oldPieMenuAnimValue = mainPieMenu.animValue;
+	f32 oldColorMenuAnimValue = colorMenuAnimValue;
+	currentScene = &scene;
+	playingSceneShiftAnimation = false;
+	mainPieMenu.animValue = 0;
+	colorMenuAnimValue = 0;
+
+	auto addEntity = [&](Entity &&e, bool visible, bool hovered) {
+		e.id = scene.entityIdCounter++;
+		e.visible = visible;
+		e.hovered = hovered;
+		scene.entities.emplace(e.id, std::move(e));
+	};
+
+	PencilEntity pencil;
+	pencil.color = {1, 0, 0};
+	pencil.lines.push_back({{4, {0, 0}}, {4, {10, 10}}});
+	addEntity(std::move(pencil), true, false);
+
+	LineEntity line;
+	line.color = {0, 1, 0};
+	line.line = {{2, {0, 0}}, {2, {0, 10}}};
+	addEntity(std::move(line), true, true);
+
+	CircleEntity circle;
+	circle.radius = {5, 5};
+	addEntity(std::move(circle), false, false);
+
+	ImageEntity image;
+	image.size = {16, 16};
+	addEntity(std::move(image), true, true);
+
+	FrameInfo info = {};
+	info.clientSize = {800, 600};
+	info.minWindowDim = 600;
+	info.mousePosBL = {100, 100};
+
+	scene.needRepaint = false;
+	scene.needResize = false;
+	scene.matrixSceneToNDCDirty = false;
+	scene.drawColorDirty = false;
+	scene.constantBufferDirty = false;
+
+	DrawList list;
+
+	// Nothing changed
+	recordFrame(list, info);
+	ASSERT(list.commands.size() == 0, "drawListTest: idle frame should be empty");
+
+	// Cursor moved, scene is not repainted
+	info.needRepaint = true;
+	info.drawCursor = true;
+	recordFrame(list, info);
+	ASSERT(list.count(DrawCommand_beginScene) == 0, "drawListTest: scene should not be repainted");
+	ASSERT(list.count(DrawCommand_blitScene) == 1, "drawListTest: expected one blit");
+	ASSERT(list.count(DrawCommand_present) == 1, "drawListTest: expected one present");
+	ASSERT(list.quads.size() == 2, "drawListTest: expected cursor quad and its shadow");
+
+	// Scene repaint
+	scene.needRepaint = true;
+	recordFrame(list, info);
+	ASSERT(list.commands[0].type == DrawCommand_beginScene, "drawListTest: frame should start with the scene");
+	ASSERT(list.count(DrawCommand_endScene) == 1, "drawListTest: expected one scene");
+	// Pencil, line with its highlight and image. Circle is invisible.
+	ASSERT(list.count(DrawCommand_entity) == 4, "drawListTest: wrong entity command count");
+	for (umm i = 0; i < list.commands.size(); ++i) {
+		auto &command = list.commands[i];
+		if (command.type != DrawCommand_entity)
+			continue;
+		ASSERT(command.entity.entityType != Entity_circle, "drawListTest: invisible entity recorded");
+		if (command.entity.entityType == Entity_line && command.entity.thicknessMult == 1.0f) {
+			auto &next = list.commands[i + 1];
+			ASSERT(command.entity.color == V3f(1), "drawListTest: highlight should be white");
+			ASSERT(next.type == DrawCommand_entity && next.entity.id == command.entity.id && next.entity.thicknessMult == 0.8f, "drawListTest: highlight should be followed by the line");
+		}
+		if (command.entity.entityType == Entity_image) {
+			ASSERT(command.entity.outline, "drawListTest: hovered image should be outlined");
+		}
+	}
+
+	// Serialization round trip
+	List<u8> file;
+	writeDrawList(list).stream([&] (char *data, umm size) {
+		for (umm i = 0; i < size; ++i) {
+			file.push_back((u8)data[i]);
+		}
+	});
+	DrawList readList;
+	ASSERT(readDrawList({file.data(), file.data() + file.size()}, readList), "drawListTest: failed to read written list");
+	ASSERT(readList.commands.size() == list.commands.size() && memequ(readList.commands.data(), list.commands.data(), list.commands.size() * sizeof(DrawCommand)), "drawListTest: commands differ after round trip");
+	ASSERT(readList.quads.size() == list.quads.size() && memequ(readList.quads.data(), list.quads.data(), list.quads.size() * sizeof(Quad)), "drawListTest: quads differ after round trip");
+	ASSERT(!readDrawList({file.data(), file.data() + file.size() - 1}, readList), "drawListTest: truncated list should not be read");
+
+	// Corrupt lists are rejected before anything is allocated or executed
+	auto corrupt = [&](auto &&change) {
+		List<u8> copy;
+		copy.resize(file.size());
+		memcpy(copy.data(), file.data(), file.size());
+		change(copy);
+		return !readDrawList({copy.data(), copy.data() + copy.size()}, readList);
+	};
+	ASSERT(corrupt([](List<u8> &copy) { u32 count = 0x7FFFFFFF; memcpy(copy.data() + sizeof(u32), &count, sizeof(count)); }), "drawListTest: huge command count should not be read");
+	ASSERT(corrupt([](List<u8> &copy) { u32 count = 0x7FFFFFFF; memcpy(copy.data() + sizeof(u32) * 2, &count, sizeof(count)); }), "drawListTest: huge quad count should not be read");
+	ASSERT(corrupt([](List<u8> &copy) {
+		auto command = (DrawCommand *)(copy.data() + sizeof(u32) * 3);
+		command->beginScene.sceneIndex = countof(scenes);
+	}), "drawListTest: scene index out of bounds should not be read");
+
+	LOG("drawListTest: % commands, % quads, % bytes", list.commands.size(), list.quads.size(), file.size());
+
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+	scene.needRepaint = true;
+	scene.needResize = true;
+	scene.matrixSceneToNDCDirty = true;
+	scene.drawColorDirty = true;
+	currentScene = oldCurrentScene;
+	playingSceneShiftAnimation = oldPlayingSceneShiftAnimation;
+	mainPieMenu.animValue = oldPieMenuAnimValue;
+	colorMenuAnimValue = oldColorMenuAnimValue;
+}
+
+// Plans batches for entity commands over a stroke pool without a renderer
+void batchPlannerTest() {
+	showConsoleWindow();
+
+	constexpr u32 strokeCount = 1000;
+
+	List<StrokeVertex> mesh;
+	Line line = {{2, {0, 0}}, {2, {10, 0}}};
+	meshStroke(mesh, &line, 1, 1);
+	u32 meshSize = (u32)mesh.size();
+
+	StrokePool pool;
+	pool.reset(1);
+	for (EntityId id = 0; id < strokeCount; ++id) {
+		pool.put(id, 1, mesh.data(), meshSize);
+	}
+	ASSERT(pool.vertices.size() == strokeCount * meshSize, "batchPlannerTest: wrong pool size");
+
+	List<DrawCommand> commands;
+	auto pushEntity = [&](EntityId id, f32 thicknessMult) {
+		DrawCommand command;
+		memset(&command, 0, sizeof(command));
+		command.type = DrawCommand_entity;
+		command.entity.id = id;
+		command.entity.thicknessMult = thicknessMult;
+		commands.push_back(command);
+	};
+	auto plan = [&] {
+		return planBatches(commands.data(), commands.size(), [&](DrawCommand const &command) { return pool.find(command.entity.id); });
+	};
+	auto report = [&](char const *name, BatchPlan const &plan) {
+		LOG("batchPlannerTest: %: % entity commands, % draws, % shader changes", name, commands.size(), plan.drawCount, plan.shaderChanges);
+	};
+
+	// Same order as in the pool
+	for (EntityId id = 0; id < strokeCount; ++id) {
+		pushEntity(id, 1);
+	}
+	auto result = plan();
+	report("pool order", result);
+	ASSERT(result.drawCount == 1 && result.shaderChanges == 1, "batchPlannerTest: pooled strokes should be one draw");
+	ASSERT(result.batches[0].vertexCount == pool.vertices.size(), "batchPlannerTest: batch should cover the pool");
+
+	// Hovered stroke gets its own draw for the highlight, the rest is still pooled
+	commands.clear();
+	for (EntityId id = 0; id < strokeCount; ++id) {
+		if (id == 500) {
+			pushEntity(id, 1);
+			pushEntity(id, 0.8f);
+		} else {
+			pushEntity(id, 1);
+		}
+	}
+	result = plan();
+	report("hover", result);
+	ASSERT(result.drawCount == 3 && result.shaderChanges == 1, "batchPlannerTest: highlight should split the batch once");
+	ASSERT(result.batches[1].kind == DrawBatch_pooledSingle && result.batches[1].firstVertex == 500 * meshSize, "batchPlannerTest: highlight should use the pooled mesh");
+
+	// Entity that is not pooled, like an image, needs its own shaders
+	commands.clear();
+	for (EntityId id = 0; id < strokeCount; ++id) {
+		if (id == 300) {
+			pushEntity(strokeCount, 1);
+		}
+		pushEntity(id, 1);
+	}
+	result = plan();
+	report("image", result);
+	ASSERT(result.drawCount == 3 && result.shaderChanges == 3, "batchPlannerTest: image should split the batch");
+	ASSERT(result.batches[1].kind == DrawBatch_entity, "batchPlannerTest: image should be drawn on its own");
+
+	// Images on atlas pages are drawn in runs, one per page
+	commands.clear();
+	for (EntityId id = 0; id < 100; ++id) {
+		pushEntity(strokeCount + id, 1);
+	}
+	auto planAtlas = [&](u32 pageCount) {
+		return planBatches(commands.data(), commands.size(), [&](DrawCommand const &command) { return pool.find(command.entity.id); },
+			[&](DrawCommand const &command) { return (u32)(command.entity.id - strokeCount) * pageCount / 100; });
+	};
+	result = planAtlas(1);
+	report("atlas images", result);
+	ASSERT(result.drawCount == 1 && result.shaderChanges == 1, "batchPlannerTest: images on one page should be one draw");
+	ASSERT(result.atlasInstanceCount == 100 && result.batches[0].vertexCount == 600, "batchPlannerTest: every image should be an instance");
+	result = planAtlas(4);
+	report("atlas images on 4 pages", result);
+	ASSERT(result.drawCount == 4 && result.shaderChanges == 1, "batchPlannerTest: pages should only change the texture");
+	ASSERT(result.batches[3].firstVertex == 75 && result.batches[3].atlasPage == 3, "batchPlannerTest: instances should follow command order");
+
+	// Reverse order can't be merged
+	commands.clear();
+	for (EntityId id = strokeCount; id--;) {
+		pushEntity(id, 1);
+	}
+	result = plan();
+	report("reverse order", result);
+	ASSERT(result.drawCount == strokeCount, "batchPlannerTest: reversed strokes should not be merged");
+
+	// Same sized mesh is replaced in place
+	pool.clearDirty();
+	pool.put(200, 2, mesh.data(), meshSize);
+	ASSERT(pool.find(200)->first == 200 * meshSize && pool.find(200)->version == 2, "batchPlannerTest: mesh should be replaced in place");
+	ASSERT(pool.dirtyBegin == 200 * meshSize && pool.dirtyEnd == 201 * meshSize, "batchPlannerTest: only replaced mesh should be uploaded");
+
+	// Bigger mesh is appended and leaves a hole
+	meshStroke(mesh, &line, 1, 1);
+	pool.put(700, 2, mesh.data(), (u32)mesh.size());
+	ASSERT(pool.hiddenVertexCount == meshSize, "batchPlannerTest: old mesh should be hidden");
+	ASSERT(pool.vertices[700 * meshSize].instance == hiddenInstance, "batchPlannerTest: old mesh should point to hidden instance");
+
+	commands.clear();
+	for (EntityId id = 0; id < strokeCount; ++id) {
+		pushEntity(id, 1);
+	}
+	result = plan();
+	report("remeshed", result);
+	ASSERT(result.drawCount == 3, "batchPlannerTest: moved mesh should split the batch");
+	ASSERT(pool.find(700)->slot == 700 && pool.vertices[pool.find(700)->first].instance == 700, "batchPlannerTest: remeshed entity should keep its slot");
+
+	// Slots of removed entities are reused instead of growing the instance table
+	u32 removedSlot = pool.find(300)->slot;
+	pool.remove(pool.ranges.find(300));
+	pool.put(strokeCount + 5, 1, mesh.data(), (u32)mesh.size());
+	ASSERT(pool.find(strokeCount + 5)->slot == removedSlot && pool.slotCount == strokeCount, "batchPlannerTest: new entity should reuse the freed slot");
+}
+
+// Counts entities recorded per frame in common interactions, with full and tiled repaint
+void dirtyRegionTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "dirtyRegionTest: last scene is in use");
+
+	Scene *oldCurrentScene = currentScene;
+	bool oldPlayingSceneShiftAnimation = playingSceneShiftAnimation;
+	currentScene = &scene;
+	playingSceneShiftAnimation = false;
+
+	FrameInfo info = {};
+	info.clientSize = {1280, 720};
+	info.minWindowDim = 720;
+
+	scene.cameraPosition = {};
+	scene.cameraDistance = 1;
+	scene.dirtyTiles.resize(info.clientSize);
+
+	// Grid of short strokes covering the canvas
+	v2u strokeCount = {32, 18};
+	for (u32 y = 0; y < strokeCount.y; ++y) {
+		for (u32 x = 0; x < strokeCount.x; ++x) {
+			PencilEntity pencil;
+			pencil.id = scene.entityIdCounter++;
+			pencil.visible = true;
+			pencil.position = (v2f{(f32)x, (f32)y} + 0.5f) * 40 - (v2f)info.clientSize * 0.5f;
+			pencil.lines.push_back({{4, {-10, -10}}, {4, {10, 0}}});
+			pencil.lines.push_back({{4, {10, 0}}, {4, {-10, 10}}});
+			calculateBounds(pencil);
+			scene.entities.emplace(pencil.id, std::move(pencil));
+		}
+	}
+
+	DrawList list;
+
+	// Records a frame and resets the scene like the renderer would
+	auto recordEntities = [&] {
+		scene.needResize = false;
+		scene.matrixSceneToNDCDirty = false;
+		recordFrame(list, info);
+		scene.needRepaint = false;
+		scene.dirtyTiles.clear();
+		return (u32)list.count(DrawCommand_entity);
+	};
+	auto recordFull = [&] {
+		scene.needRepaint = true;
+		return recordEntities();
+	};
+
+	u32 fullFrame = recordFull();
+	ASSERT(fullFrame == strokeCount.x * strokeCount.y, "dirtyRegionTest: full repaint should record every entity");
+	ASSERT(recordEntities() == 0, "dirtyRegionTest: nothing changed");
+
+	auto &hovered = scene.entities.at(strokeCount.x * 9 + 16);
+
+	// Hover
+	hovered.hovered = true;
+	invalidateSceneBounds(&scene, hovered.bounds);
+	u32 hoverTiled = recordEntities();
+	u32 hoverFull = recordFull();
+	ASSERT(hoverTiled && hoverTiled * 10 < hoverFull, "dirtyRegionTest: hover should repaint only nearby entities");
+	LOG("dirtyRegionTest: hover: % entities, was %", hoverTiled, hoverFull);
+
+	// Dragging
+	u32 dragTiled = 0, dragFull = 0;
+	constexpr u32 dragFrameCount = 20;
+	for (u32 i = 0; i < dragFrameCount; ++i) {
+		hovered.position += v2f{3, 1};
+		invalidateEntity(&scene, hovered);
+		dragTiled += recordEntities();
+		dragFull += recordFull();
+	}
+	ASSERT(dragTiled * 10 < dragFull, "dirtyRegionTest: dragging should repaint only nearby entities");
+	LOG("dirtyRegionTest: dragging: % entities per frame, was %", (f32)dragTiled / dragFrameCount, (f32)dragFull / dragFrameCount);
+	hovered.hovered = false;
+
+	// Drawing a stroke
+	PencilEntity stroke;
+	stroke.id = scene.entityIdCounter++;
+	stroke.visible = true;
+	stroke.position = {-300, -200};
+	stroke.bounds.min = V2f(+INFINITY);
+	stroke.bounds.max = V2f(-INFINITY);
+	auto &pencil = scene.entities.emplace(stroke.id, std::move(stroke)).first->second.pencil;
+
+	u32 strokeTiled = 0, strokeFull = 0;
+	constexpr u32 strokeFrameCount = 100;
+	for (u32 i = 0; i < strokeFrameCount; ++i) {
+		Line line;
+		line.a = {8, {i * 6.0f, sinf(i * 0.1f) * 50}};
+		line.b = {8, {(i + 1) * 6.0f, sinf((i + 1) * 0.1f) * 50}};
+		pencil.lines.push_back(line);
+		invalidateLines(&scene, pencil, &line, 1);
+		u32 tiled = recordEntities();
+		ASSERT(list.count(DrawCommand_entity) && tiled <= fullFrame, "dirtyRegionTest: stroke frame should be partial");
+
+		bool strokeRecorded = false;
+		for (auto &command : list.commands) {
+			strokeRecorded |= command.type == DrawCommand_entity && command.entity.id == pencil.id;
+		}
+		ASSERT(strokeRecorded, "dirtyRegionTest: stroke being drawn should be repainted");
+
+		strokeTiled += tiled;
+		strokeFull += recordFull();
+	}
+	ASSERT(strokeTiled * 10 < strokeFull, "dirtyRegionTest: drawing should repaint only nearby entities");
+	LOG("dirtyRegionTest: drawing: % entities per frame, was %", (f32)strokeTiled / strokeFrameCount, (f32)strokeFull / strokeFrameCount);
+
+	// Picking a color only updates the paint cursor, frames after it record and present nothing
+	pickColor(&scene, hovered.position);
+	ASSERT(consumeDrawColorChange(&scene), "dirtyRegionTest: picked color should reach the paint cursor");
+	ASSERT(recordEntities() == 0, "dirtyRegionTest: picked color should not repaint the canvas");
+	for (u32 i = 0; i < 3; ++i) {
+		ASSERT(!consumeDrawColorChange(&scene) && !shouldRepaint(&scene), "dirtyRegionTest: idle frame after a color pick should not update anything");
+		recordEntities();
+		ASSERT(list.commands.size() == 0, "dirtyRegionTest: idle frame after a color pick should not be presented");
+	}
+
+	// Big change falls back to full repaint
+	for (auto &[id, e] : scene.entities) {
+		invalidateSceneBounds(&scene, e.bounds);
+	}
+	ASSERT(scene.needRepaint, "dirtyRegionTest: mostly dirty canvas should be repainted fully");
+	recordEntities();
+	ASSERT(list.count(DrawCommand_clipScene) == 0, "dirtyRegionTest: full repaint should not be clipped");
+
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+	scene.needRepaint = true;
+	scene.needResize = true;
+	scene.matrixSceneToNDCDirty = true;
+	scene.drawColorDirty = true;
+	currentScene = oldCurrentScene;
+	playingSceneShiftAnimation = oldPlayingSceneShiftAnimation;
+}
+
+// Counts entities recorded per frame while one entity is dragged, for different scene sizes
+void staticLayerTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "staticLayerTest: last scene is in use");
+
+	Scene *oldCurrentScene = currentScene;
+	bool oldPlayingSceneShiftAnimation = playingSceneShiftAnimation;
+	currentScene = &scene;
+	playingSceneShiftAnimation = false;
+
+	FrameInfo info = {};
+	info.clientSize = {1280, 720};
+	info.minWindowDim = 720;
+
+	scene.cameraPosition = {};
+	scene.cameraDistance = 1;
+	scene.dirtyTiles.resize(info.clientSize);
+
+	DrawList list;
+
+	// Records a frame and resets the scene like the renderer would
+	auto recordEntities = [&] {
+		scene.needResize = false;
+		scene.matrixSceneToNDCDirty = false;
+		recordFrame(list, info);
+		scene.needRepaint = false;
+		scene.liveEntityDirty = false;
+		scene.dirtyTiles.clear();
+		for (auto &command : list.commands) {
+			if (command.type == DrawCommand_beginScene && command.beginScene.staticLayer) {
+				scene.staticLayerValid = true;
+			}
+		}
+		return (u32)list.count(DrawCommand_entity);
+	};
+
+	for (u32 entityCount : {100u, 1000u, 10000u}) {
+		for (u32 i = 0; i < entityCount; ++i) {
+			PencilEntity pencil;
+			pencil.id = scene.entityIdCounter++;
+			pencil.visible = true;
+			pencil.position = {(f32)(i * 37 % 1200) - 600, (f32)(i * 53 % 700) - 350};
+			pencil.lines.push_back({{4, {-10, -10}}, {4, {10, 0}}});
+			pencil.lines.push_back({{4, {10, 0}}, {4, {-10, 10}}});
+			calculateBounds(pencil);
+			scene.entities.emplace(pencil.id, std::move(pencil));
+		}
+		scene.needRepaint = true;
+		recordEntities();
+
+		auto &dragged = scene.entities.at(entityCount / 2);
+		dragged.hovered = true;
+		setLiveEntity(&scene, dragged.id);
+
+		// First frame draws the static layer
+		u32 firstFrame = recordEntities();
+		ASSERT(firstFrame == entityCount + 1, "staticLayerTest: first frame should draw everything once");
+
+		constexpr u32 frameCount = 30;
+		u32 liveTotal = 0;
+		for (u32 i = 0; i < frameCount; ++i) {
+			dragged.position += v2f{5, 2};
+			invalidateEntity(&scene, dragged);
+			u32 recorded = recordEntities();
+			ASSERT(recorded == 2, "staticLayerTest: only the live entity and its highlight should be drawn");
+			ASSERT(list.count(DrawCommand_useStaticLayer) == 1, "staticLayerTest: live frame should reuse the static layer");
+			liveTotal += recorded;
+		}
+
+		// Picked color is applied to the live entity once, then nothing is drawn until the next change
+		pickColor(&scene, dragged.position);
+		if (consumeDrawColorChange(&scene)) {
+			invalidateEntity(&scene, dragged);
+		}
+		ASSERT(recordEntities() == 2, "staticLayerTest: picked color should redraw only the live entity");
+		ASSERT(!consumeDrawColorChange(&scene) && !shouldRepaint(&scene), "staticLayerTest: picked color should be consumed in one frame");
+		recordEntities();
+		ASSERT(list.commands.size() == 0, "staticLayerTest: idle frame after a color pick should not be presented");
+
+		// Change to other content updates the static layer only where it happened
+		auto &other = scene.entities.at(0);
+		other.position += v2f{1, 0};
+		invalidateEntity(&scene, other);
+		u32 staticUpdate = recordEntities();
+		ASSERT(staticUpdate < entityCount / 2 + 2 && list.count(DrawCommand_clipScene), "staticLayerTest: static layer should be updated partially");
+
+		// Dropping the entity repaints its area in the canvas
+		dragged.hovered = false;
+		setLiveEntity(&scene, invalidEntityId);
+		u32 dropFrame = recordEntities();
+		ASSERT(list.count(DrawCommand_useStaticLayer) == 0 && list.count(DrawCommand_clipScene), "staticLayerTest: drop should repaint tiles of the entity");
+
+		LOG("staticLayerTest: % entities: % per frame while dragging, was %; static layer update %, drop %", entityCount, (f32)liveTotal / frameCount, entityCount + 1, staticUpdate, dropFrame);
+
+		scene.entities.clear();
+		scene.entityIdCounter = 0;
+	}
+
+	scene.needRepaint = true;
+	scene.needResize = true;
+	scene.matrixSceneToNDCDirty = true;
+	scene.drawColorDirty = true;
+	scene.staticLayerValid = false;
+	currentScene = oldCurrentScene;
+	playingSceneShiftAnimation = oldPlayingSceneShiftAnimation;
+}
+
+// Random walks, similar to strokes drawn by hand, spread over [-extent, extent]
+void addRandomStrokes(Scene &scene, u32 count, v2f extent, std::mt19937 &mt) {
+	std::uniform_real_distribution<f32> unitDistribution(-1, 1);
+	std::uniform_real_distribution<f32> thicknessDistribution(2, 24);
+
+	for (u32 i = 0; i < count; ++i) {
+		PencilEntity pencil;
+		pencil.id = scene.entityIdCounter++;
+		pencil.visible = true;
+		pencil.color = V3f(unitDistribution(mt), unitDistribution(mt), unitDistribution(mt)) * 0.5f + 0.5f;
+		pencil.position = v2f{unitDistribution(mt), unitDistribution(mt)} * extent;
+		v2f position = {};
+		f32 thickness = thicknessDistribution(mt);
+		for (u32 j = 0; j < 32; ++j) {
+			Line line;
+			line.a = {thickness, position};
+			position += v2f{unitDistribution(mt), unitDistribution(mt)} * 16;
+			line.b = {thickness, position};
+			pencil.lines.push_back(line);
+		}
+		calculateBounds(pencil);
+		scene.entities.emplace(pencil.id, std::move(pencil));
+	}
+}
+
+// Draws scene commands of a list into 'canvas' the same way r_soft.cpp does, without a renderer.
+// Flags are cleared like renderers do in beginScene.
+void executeSceneCommands(RasterPool &pool, RasterPass &pass, Scene &scene, DrawList const &list, RasterSurface &canvas) {
+	RasterView view;
+	for (auto &command : list.commands) {
+		switch (command.type) {
+			case DrawCommand_beginScene: {
+				scene.needRepaint = false;
+				scene.matrixSceneToNDCDirty = false;
+				scene.dirtyTiles.clear();
+				updateCanvasCamera(&scene);
+				view = getRasterView(&scene, canvas.size);
+				pass.begin(pool, canvas);
+				if (!command.beginScene.partial) {
+					pass.pushFill(packColor(scene.canvasColor));
+				}
+			} break;
+			case DrawCommand_scrollScene: {
+				pass.flush(pool);
+				scrollSurface(canvas, command.scrollScene.offset);
+			} break;
+			case DrawCommand_clipScene: {
+				pass.setClip(command.clipScene.min, command.clipScene.max);
+				pass.pushFill(packColor(scene.canvasColor));
+			} break;
+			case DrawCommand_entity: {
+				pushEntity(pass, view, scene.entities.at(command.entity.id), command, 0, false);
+			} break;
+		}
+	}
+	pass.flush(pool);
+	pass.resetClip();
+}
+
+// Frame time of the software rasterizer drawing a full 1080p frame, with 1 to all cores
+void softRasterizerBenchmark() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "softRasterizerBenchmark: last scene is in use");
+
+	v2u canvasSize = {1920, 1080};
+	scene.cameraPosition = {};
+	scene.cameraDistance = 1;
+	scene.dirtyTiles.resize(canvasSize);
+
+	std::mt19937 mt{};
+	std::uniform_real_distribution<f32> unitDistribution(-1, 1);
+	addRandomStrokes(scene, 2000, (v2f)canvasSize * 0.5f, mt);
+
+	RasterTexture texture;
+	texture.size = {512, 512};
+	texture.texels.resize(texture.size.x * texture.size.y);
+	for (u32 y = 0; y < texture.size.y; ++y) {
+		for (u32 x = 0; x < texture.size.x; ++x) {
+			texture.texels[y * texture.size.x + x] = ((x ^ y) & 32) ? 0xFFC08040 : 0xFF4080C0;
+		}
+	}
+	for (u32 i = 0; i < 16; ++i) {
+		ImageEntity image;
+		image.id = scene.entityIdCounter++;
+		image.visible = true;
+		image.size = {400, 300};
+		image.position = v2f{unitDistribution(mt), unitDistribution(mt)} * (v2f)canvasSize * 0.5f;
+		image.rotation = unitDistribution(mt) * pi;
+		calculateBounds(image);
+		scene.entities.emplace(image.id, std::move(image));
+	}
+
+	DrawList list;
+	recordScene(list, &scene);
+
+	RasterView view = getRasterView(&scene, canvasSize);
+
+	RasterSurface canvas;
+	canvas.resize(canvasSize);
+
+	u32 maxWorkerCount = getRasterWorkerCount();
+	for (u32 workerCount = 1;; workerCount = min(workerCount * 2, maxWorkerCount)) {
+		RasterPool pool;
+		pool.init(workerCount);
+
+		RasterPass pass;
+		constexpr u32 frameCount = 32;
+		List<f64> frameTimes;
+		for (u32 frame = 0; frame < frameCount; ++frame) {
+			auto begin = std::chrono::high_resolution_clock::now();
+			pass.begin(pool, canvas);
+			pass.pushFill(packColor(scene.canvasColor));
+			for (auto &command : list.commands) {
+				if (command.type != DrawCommand_entity)
+					continue;
+				auto &e = scene.entities.at(command.entity.id);
+				pushEntity(pass, view, e, command, e.type == Entity_image ? &texture : 0, false);
+			}
+			pass.flush(pool);
+			frameTimes.push_back((std::chrono::high_resolution_clock::now() - begin).count() / 1000000.0);
+		}
+		pool.deinit();
+
+		std::sort(frameTimes.begin(), frameTimes.end());
+		f64 total = 0;
+		for (auto time : frameTimes) {
+			total += time;
+		}
+		LOG("softRasterizerBenchmark: % workers: average % ms, p95 % ms, % shapes, % tiles, % steals per frame",
+			workerCount, total / frameCount, frameTimes[frameCount * 95 / 100], pass.stats.shapeCount / frameCount, pass.stats.tileCount / frameCount, pass.stats.stealCount / frameCount);
+
+		if (workerCount == maxWorkerCount)
+			break;
+	}
+
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+	scene.needRepaint = true;
+	scene.needResize = true;
+	scene.matrixSceneToNDCDirty = true;
+}
+
+// Renderer calls, uploads and leaks over a scene's lifetime, needs the null renderer (r_null.cpp)
+void nullRendererTest() {
+	showConsoleWindow();
+	if (!nullRendererStats) {
+		LOG("nullRendererTest: link r_null.obj instead of r_d3d11.obj to run it");
+		return;
+	}
+	auto &stats = *nullRendererStats;
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "nullRendererTest: last scene is in use");
+
+	Scene *oldCurrentScene = currentScene;
+	bool oldPlayingSceneShiftAnimation = playingSceneShiftAnimation;
+	currentScene = &scene;
+	playingSceneShiftAnimation = false;
+
+	stats.reset();
+	umm aliveBefore = stats.allocations.size();
+	u64 bufferBytesBefore = stats.bufferBytes;
+
+	initializeScene(&scene);
+
+	constexpr u32 pencilCount = 1000;
+	constexpr u32 linesPerPencil = 16;
+	constexpr u32 circleCount = 100;
+	for (u32 i = 0; i < pencilCount; ++i) {
+		PencilEntity pencil;
+		pencil.id = scene.entityIdCounter++;
+		pencil.visible = true;
+		pencil.position = {(f32)(i * 37 % 1200) - 600, (f32)(i * 53 % 700) - 350};
+		for (u32 j = 0; j < linesPerPencil; ++j) {
+			pencil.lines.push_back({{4, {(f32)j, 0}}, {4, {(f32)j + 1, 1}}});
+		}
+		calculateBounds(pencil);
+		scene.entities.emplace(pencil.id, std::move(pencil));
+	}
+	for (u32 i = 0; i < circleCount; ++i) {
+		CircleEntity circle;
+		circle.id = scene.entityIdCounter++;
+		circle.visible = true;
+		circle.radius = V2f(10);
+		circle.thickness = 2;
+		calculateBounds(circle);
+		scene.entities.emplace(circle.id, std::move(circle));
+	}
+	generateGfxData(&scene);
+
+	u64 expectedUpload = (pencilCount * linesPerPencil + circleCount * CircleEntity::LINE_COUNT) * sizeof(TransformedLine);
+	ASSERT(stats.allocations.size() == aliveBefore + 1 + pencilCount + circleCount, "nullRendererTest: every entity should have renderData");
+	ASSERT(stats.uploadedBytes == expectedUpload, "nullRendererTest: loading should upload every line once");
+
+	// First frame draws everything, unchanged frames should record nothing
+	FrameInfo info = {};
+	info.clientSize = {1280, 720};
+	info.minWindowDim = 720;
+	info.needRepaint = true;
+	DrawList list;
+	constexpr u32 frameCount = 30;
+	for (u32 i = 0; i < frameCount; ++i) {
+		recordFrame(list, info);
+		renderer->execute(list);
+		info.needRepaint = false;
+	}
+	ASSERT(stats.frameCount == 1 && stats.emptyFrameCount == frameCount - 1, "nullRendererTest: idle frames should be empty");
+
+	// Stroke drawn like Tool_pencil does it, long enough to grow the line buffer once
+	PencilEntity stroke;
+	stroke.id = scene.entityIdCounter++;
+	stroke.visible = true;
+	renderer->initPencilEntity(stroke);
+	renderer->initDynamicLineArray(stroke.renderData, 0, pencilLineBufferDefElemCount);
+	u64 createdBefore = stats.createdBufferCount;
+	for (u32 i = 0; i < pencilLineBufferDefElemCount + 1; ++i) {
+		Line line = {{4, {(f32)i, 0}}, {4, {(f32)i + 1, 0}}};
+		stroke.lines.push_back(line);
+		renderer->onLinePushed(stroke, line);
+		renderer->resizePencilLineArray(stroke);
+		renderer->updateLastElement(stroke);
+	}
+	renderer->freeze(stroke);
+	ASSERT(stats.createdBufferCount == createdBefore + 1, "nullRendererTest: stroke buffer should grow once");
+	calculateBounds(stroke);
+	scene.entities.emplace(stroke.id, std::move(stroke));
+
+	for (auto &[id, e] : scene.entities) {
+		cleanup(e);
+	}
+	scene.entities.clear();
+	renderer->releaseScene(&scene);
+
+	stats.log();
+	umm leakCount = stats.logLeaks();
+	ASSERT(stats.allocations.size() == aliveBefore && !leakCount, "nullRendererTest: renderData leaked");
+	ASSERT(stats.bufferBytes == bufferBytesBefore, "nullRendererTest: buffers leaked");
+	ASSERT(!stats.invalidReleaseCount, "nullRendererTest: renderData released twice");
+
+	scene.initialized = false;
+	scene.entityIdCounter = 0;
+	scene.needRepaint = true;
+	scene.needResize = true;
+	scene.matrixSceneToNDCDirty = true;
+	scene.drawColorDirty = true;
+	scene.staticLayerValid = false;
+	currentScene = oldCurrentScene;
+	playingSceneShiftAnimation = oldPlayingSceneShiftAnimation;
+}
+
+// Idle time and wake latency of the frame scheduler, compared to polling every 16 ms.
+// Another thread posts events at random intervals, every event needs one frame.
+// Also checks that a draw color change presents one frame and then lets the loop block.
+void frameSchedulerTest() {
+	showConsoleWindow();
+
+	constexpr u32 eventCount = 100;
+	for (bool polling : {true, false}) {
+		FrameScheduler scheduler;
+		std::atomic<bool> done = false;
+		std::atomic<u32> pendingEvents = 0;
+
+		std::thread producer([&] {
+			std::mt19937 mt{};
+			std::uniform_int_distribution<u32> delay(5, 40);
+			for (u32 i = 0; i < eventCount; ++i) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(delay(mt)));
+				++pendingEvents;
+				scheduler.wake();
+			}
+			done = true;
+			scheduler.wake();
+		});
+
+		u32 handledFrames = 0;
+		u32 handledEvents = 0;
+		u32 loopCount = 0;
+		while (!done || pendingEvents) {
+			scheduler.beginFrame();
+			++loopCount;
+			u32 events = pendingEvents.exchange(0);
+			bool presented = events != 0;
+			handledEvents += events;
+			handledFrames += presented;
+			if (polling) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(16));
+			} else {
+				scheduler.endFrame(presented, false);
+			}
+		}
+		producer.join();
+
+		auto &stats = scheduler.stats;
+		LOG("frameSchedulerTest: %: % loops for % frames, wake latency average % ms, max % ms",
+			polling ? "Sleep(16) polling" : "event driven", loopCount, handledFrames, stats.averageWakeLatency() * 1000, stats.wakeLatencyMax * 1000);
+		ASSERT(handledEvents == eventCount, "frameSchedulerTest: every event should be handled");
+		if (!polling) {
+			LOG("frameSchedulerTest: blocked % of the time in % waits", stats.idleFraction(), stats.idleWaitCount);
+			// Counts and ordering only, timings depend on how busy the machine is
+			ASSERT(stats.timedWaitCount == 0, "frameSchedulerTest: nothing should wait on a timer");
+			ASSERT(stats.idleWaitCount == loopCount - handledFrames, "frameSchedulerTest: every frame without events should wait");
+			ASSERT(stats.idleWaitCount <= eventCount + 1, "frameSchedulerTest: every wait should be ended by a wake of its own");
+			ASSERT(stats.wakeCount && stats.wakeCount <= stats.frameCount, "frameSchedulerTest: wakes should be handled by frames");
+			ASSERT(stats.wakeLatencyMax >= 0, "frameSchedulerTest: frames should start after the wakes they handle");
+		}
+	}
+
+	// Color changed, then nothing happens: one frame is presented, the next one blocks
+	{
+		Scene &scene = scenes[countof(scenes) - 1];
+		ASSERT(!scene.initialized, "frameSchedulerTest: last scene is in use");
+
+		Scene *oldCurrentScene = currentScene;
+		bool oldPlayingSceneShiftAnimation = playingSceneShiftAnimation;
+		currentScene = &scene;
+		playingSceneShiftAnimation = false;
+
+		FrameInfo info = {};
+		info.clientSize = {1280, 720};
+		info.minWindowDim = 720;
+		scene.dirtyTiles.resize(info.clientSize);
+		scene.dirtyTiles.clear();
+		scene.needRepaint = false;
+		scene.needResize = false;
+		scene.matrixSceneToNDCDirty = false;
+
+		FrameScheduler scheduler;
+		DrawList list;
+		scene.drawColorDirty = true;
+		for (u32 i = 0; i < 4; ++i) {
+			scheduler.beginFrame();
+			// Same as the main loop, the paint cursor repaints the window when the color changes
+			info.needRepaint = consumeDrawColorChange(&scene);
+			recordFrame(list, info);
+			bool presented = list.commands.size() != 0;
+			ASSERT(presented == (i == 0), "frameSchedulerTest: only the frame with the color change should be presented");
+			if (!presented) {
+				// Keeps the test from blocking, the wait is still counted
+				scheduler.wake();
+			}
+			scheduler.endFrame(presented, false);
+		}
+		ASSERT(scheduler.stats.idleWaitCount == 3 && scheduler.stats.timedWaitCount == 0, "frameSchedulerTest: loop should block after the color change");
+
+		scene.needRepaint = true;
+		scene.needResize = true;
+		scene.matrixSceneToNDCDirty = true;
+		scene.drawColorDirty = true;
+		currentScene = oldCurrentScene;
+		playingSceneShiftAnimation = oldPlayingSceneShiftAnimation;
+	}
+}
+
+// Cost of a pan frame on a large scene, scrolling the canvas against repainting it fully.
+// Camera moves by whole pixels, final canvases must match exactly.
+void scrollPanTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "scrollPanTest: last scene is in use");
+
+	v2u canvasSize = {1920, 1080};
+	scene.dirtyTiles.resize(canvasSize);
+	scene.needResize = false;
+
+	std::mt19937 mt{};
+	addRandomStrokes(scene, 20000, (v2f)canvasSize * 4, mt);
+
+	RasterPool pool;
+	pool.init(getRasterWorkerCount());
+	RasterPass pass;
+	auto execute = [&](DrawList const &list, RasterSurface &canvas) {
+		executeSceneCommands(pool, pass, scene, list, canvas);
+	};
+
+	constexpr u32 frameCount = 64;
+	for (f32 distance : {1.0f, 1.7f}) {
+		RasterSurface canvases[2];
+		for (bool scroll : {true, false}) {
+			auto &canvas = canvases[scroll];
+			canvas.resize(canvasSize);
+
+			scene.cameraDistance = distance;
+			scene.cameraPosition = {0.3f, -0.6f};
+			scene.canvasOrigin = scene.cameraPosition;
+			scene.needRepaint = true;
+
+			DrawList list;
+			recordScene(list, &scene);
+			execute(list, canvas);
+
+			std::mt19937 panMt{};
+			std::uniform_int_distribution<s32> panDistribution(-40, 40);
+			u64 entityCount = 0;
+			u64 pixelCount = 0;
+			f64 seconds = 0;
+			for (u32 frame = 0; frame < frameCount; ++frame) {
+				v2f pan = {(f32)panDistribution(panMt), (f32)panDistribution(panMt)};
+				if (pan == v2f{}) {
+					pan.x = 1;
+				}
+				scene.cameraPosition += pan * scene.cameraDistance;
+				scene.matrixSceneToNDCDirty = true;
+				scene.needRepaint = !scroll;
+
+				auto begin = std::chrono::high_resolution_clock::now();
+				list.clear();
+				recordScene(list, &scene);
+				execute(list, canvas);
+				seconds += std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count();
+
+				bool scrolled = false;
+				for (auto &command : list.commands) {
+					switch (command.type) {
+						case DrawCommand_entity: ++entityCount; break;
+						case DrawCommand_scrollScene: scrolled = true; break;
+						case DrawCommand_clipScene: {
+							v2u size = command.clipScene.max - command.clipScene.min;
+							pixelCount += size.x * size.y;
+						} break;
+					}
+				}
+				ASSERT(scrolled == scroll, "scrollPanTest: whole pixel pan should scroll the canvas");
+				if (!scroll) {
+					pixelCount += canvasSize.x * canvasSize.y;
+				}
+			}
+			LOG("scrollPanTest: distance %, %: % ms, % entities, % pixels per frame", distance, scroll ? "scroll" : "full repaint",
+				seconds * 1000 / frameCount, entityCount / frameCount, pixelCount / frameCount);
+		}
+
+		u32 differentCount = 0;
+		for (u32 y = 0; y < canvasSize.y; ++y) {
+			differentCount += !memequ(canvases[0].row(y), canvases[1].row(y), canvasSize.x * sizeof(u32));
+		}
+		ASSERT(!differentCount, "scrollPanTest: scrolled canvas differs from repainted one");
+	}
+	pool.deinit();
+
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+	scene.cameraPosition = {};
+	scene.cameraDistance = 1;
+	scene.canvasOrigin = {};
+	scene.needRepaint = true;
+	scene.needResize = true;
+	scene.matrixSceneToNDCDirty = true;
+}
+
+// Replays a zoom sequence with the camera animated like in the main loop and reports the cost of each frame,
+// scaling the last canvas while zoom animates against repainting every frame. Final frames must match.
+void zoomReplayTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "zoomReplayTest: last scene is in use");
+
+	v2u canvasSize = {1920, 1080};
+	scene.dirtyTiles.resize(canvasSize);
+	scene.needResize = false;
+
+	std::mt19937 mt{};
+	addRandomStrokes(scene, 20000, (v2f)canvasSize * 4, mt);
+
+	RasterPool pool;
+	pool.init(getRasterWorkerCount());
+	RasterPass pass;
+
+	// Mouse wheel steps, positive zooms in, 0 lets the camera settle.
+	// Zoom ends away from where it last settled, otherwise the canvas would be scrolled instead of repainted.
+	s32 const wheelSteps[] = {1, 1, 1, 0, 1, 1, 0, -1, -1, -1, -1, -1, -1, 0, -1, 1, 1, 0};
+	v2f mousePos = {1400, 700};
+	u32 const settleFrames = 40;
+
+	RasterSurface windows[2];
+	for (bool interactive : {true, false}) {
+		auto &window = windows[interactive];
+		window.resize(canvasSize);
+		RasterSurface canvas;
+		canvas.resize(canvasSize);
+
+		scene.cameraPosition = scene.targetCameraPosition = {};
+		scene.cameraDistance = scene.targetCameraDistance = 1;
+		scene.canvasCameraDistance = 0;
+		scene.needRepaint = true;
+
+		DrawList list;
+		List<f64> frameTimes;
+		u32 repaintCount = 0;
+		u32 scaledCount = 0;
+		f64 maxScaledTime = 0;
+		auto frame = [&] {
+			if (!shouldRepaint(&scene))
+				return;
+
+			auto begin = std::chrono::high_resolution_clock::now();
+			bool scaled = interactive && shouldScaleCanvas(&scene);
+			pass.begin(pool, window);
+			if (scaled) {
+				auto transform = getCanvasTransform(&scene);
+				pass.pushScaledCopy(canvas, transform.scale, transform.offset, packColor(scene.canvasColor));
+				pass.flush(pool);
+				++scaledCount;
+			} else {
+				list.clear();
+				recordScene(list, &scene);
+				executeSceneCommands(pool, pass, scene, list, canvas);
+				pass.begin(pool, window);
+				pass.pushCopy(canvas, 0);
+				pass.flush(pool);
+				++repaintCount;
+			}
+			f64 time = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count() * 1000;
+			frameTimes.push_back(time);
+			if (scaled) {
+				maxScaledTime = max(maxScaledTime, time);
+			}
+		};
+
+		// Same camera animation as the main loop
+		auto animate = [&] {
+			f32 oldCameraDistance = scene.cameraDistance;
+			if (distance(scene.cameraDistance, scene.targetCameraDistance) < scene.cameraDistance * 0.001f) {
+				scene.cameraDistance = scene.targetCameraDistance;
+			} else {
+				scene.cameraDistance = lerp(scene.cameraDistance, scene.targetCameraDistance, cameraMoveSpeed);
+			}
+			scene.cameraPosition = lerp(scene.cameraPosition, scene.targetCameraPosition, cameraMoveSpeed);
+			snapCameraToCanvasPixels(&scene);
+			if (distanceSqr(scene.cameraPosition, scene.targetCameraPosition) > scene.cameraDistance || scene.cameraDistance != oldCameraDistance) {
+				scene.matrixSceneToNDCDirty = true;
+			}
+		};
+
+		frame();
+		for (s32 wheel : wheelSteps) {
+			if (wheel) {
+				v2f mouseScenePos = canvasToScene(&scene, mousePos);
+				f32 oldTargetCameraDistance = scene.targetCameraDistance;
+				scene.targetCameraDistance = clamp(scene.targetCameraDistance / pow(1.1f, (f32)wheel), 1.0f / 8, 64);
+				scene.targetCameraPosition = lerp(mouseScenePos, scene.targetCameraPosition, scene.targetCameraDistance / oldTargetCameraDistance);
+				animate();
+				frame();
+				animate();
+				frame();
+			} else {
+				for (u32 i = 0; i < settleFrames; ++i) {
+					animate();
+					frame();
+				}
+			}
+		}
+
+		f64 total = 0;
+		for (auto time : frameTimes) {
+			total += time;
+		}
+		std::sort(frameTimes.begin(), frameTimes.end());
+		LOG("zoomReplayTest: %: % frames, % repainted, % scaled, average % ms, p95 % ms, max % ms, max scaled % ms",
+			interactive ? "interactive" : "full quality", frameTimes.size(), repaintCount, scaledCount,
+			total / frameTimes.size(), frameTimes[frameTimes.size() * 95 / 100], frameTimes.back(), maxScaledTime);
+		ASSERT(scene.cameraDistance == scene.targetCameraDistance, "zoomReplayTest: zoom should settle");
+		ASSERT(!shouldRepaint(&scene), "zoomReplayTest: settled camera should not repaint");
+	}
+
+	u32 differentCount = 0;
+	for (u32 y = 0; y < canvasSize.y; ++y) {
+		differentCount += !memequ(windows[0].row(y), windows[1].row(y), canvasSize.x * sizeof(u32));
+	}
+	ASSERT(!differentCount, "zoomReplayTest: settled frame should be repainted at full quality");
+	pool.deinit();
+
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+	scene.cameraPosition = scene.targetCameraPosition = {};
+	scene.cameraDistance = scene.targetCameraDistance = 1;
+	scene.canvasOrigin = {};
+	scene.needRepaint = true;
+	scene.needResize = true;
+	scene.matrixSceneToNDCDirty = true;
+}
+
+// Scenes visited in turn with a budget of three canvases, evictions must follow the order of use
+void canvasPoolTest() {
+	showConsoleWindow();
+
+	bool oldNeedResize[countof(scenes)];
+	bool oldStaticLayerValid[countof(scenes)];
+	for (u32 i = 0; i < countof(scenes); ++i) {
+		oldNeedResize[i] = scenes[i].needResize;
+		oldStaticLayerValid[i] = scenes[i].staticLayerValid;
+	}
+
+	constexpr u64 canvasBytes = 1920 * 1080 * sizeof(u32);
+	CanvasPool pool;
+	pool.stats.budget = canvasBytes * 3;
+
+	bool resident[countof(scenes)] = {};
+	auto release = [&](Scene *scene) {
+		ASSERT(resident[indexof(scene)], "canvasPoolTest: released a canvas that was not allocated");
+		resident[indexof(scene)] = false;
+	};
+	// Same as renderers do in beginScene
+	auto draw = [&](u32 index) {
+		Scene *scene = scenes + index;
+		pool.use(scene);
+		if (!resident[index]) {
+			resident[index] = true;
+			pool.setBytes(scene, canvasBytes);
+			pool.trim(release);
+		}
+	};
+
+	for (u32 round = 0; round < 2; ++round) {
+		for (u32 i = 0; i < countof(scenes); ++i) {
+			pool.beginFrame();
+			draw(i);
+			ASSERT(pool.stats.bytes <= pool.stats.budget, "canvasPoolTest: pool is over budget");
+			// The three most recently drawn scenes stay
+			for (u32 j = 0; j < countof(scenes); ++j) {
+				bool recent = j <= i ? i - j < 3 : round && i + countof(scenes) - j < 3;
+				ASSERT(resident[j] == recent, "canvasPoolTest: least recently used canvas should be evicted");
+				if (!recent && (round || j < i)) {
+					ASSERT(scenes[j].needResize, "canvasPoolTest: evicted scene should be reallocated when drawn");
+				}
+			}
+		}
+	}
+	ASSERT(pool.stats.residentCount == 3, "canvasPoolTest: wrong resident count");
+	ASSERT(pool.stats.evictionCount == 2 * countof(scenes) - 3, "canvasPoolTest: wrong eviction count");
+
+	// Scenes of the current frame are kept even over budget, as during the scene shift animation
+	pool.stats.budget = canvasBytes;
+	pool.beginFrame();
+	draw(0);
+	draw(1);
+	ASSERT(resident[0] && resident[1] && pool.stats.residentCount == 2, "canvasPoolTest: scenes of the current frame should be kept");
+	pool.beginFrame();
+	draw(1);
+	pool.trim(release);
+	ASSERT(!resident[0] && resident[1] && pool.stats.bytes == canvasBytes, "canvasPoolTest: pool should fit in the budget on the next frame");
+
+	LOG("canvasPoolTest: % allocations, % evictions, peak % MB", pool.stats.allocationCount, pool.stats.evictionCount, pool.stats.peakBytes / (1024 * 1024));
+
+	for (u32 i = 0; i < countof(scenes); ++i) {
+		scenes[i].needResize = oldNeedResize[i];
+		scenes[i].staticLayerValid = oldStaticLayerValid[i];
+	}
+}
+
+// Picks colors from a small scene without a renderer: overlapping strokes, live entity and an image with alpha
+void pickColorTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "pickColorTest: last scene is in use");
+
+	v3f oldCanvasColor = scene.canvasColor;
+	scene.canvasColor = {0.1f, 0.2f, 0.3f};
+
+	PencilEntity pencil;
+	pencil.id = scene.entityIdCounter++;
+	pencil.visible = true;
+	pencil.color = {1, 0, 0};
+	pencil.lines.push_back({{10, {-50, 0}}, {10, {50, 0}}});
+	calculateBounds(pencil);
+	EntityId pencilId = pencil.id;
+	scene.entities.emplace(pencil.id, std::move(pencil));
+
+	LineEntity line;
+	line.id = scene.entityIdCounter++;
+	line.visible = true;
+	line.color = {0, 1, 0};
+	line.line = {{10, {0, -50}}, {10, {0, 50}}};
+	calculateBounds(line);
+	scene.entities.emplace(line.id, std::move(line));
+
+	ImageEntity image;
+	image.id = scene.entityIdCounter++;
+	image.visible = true;
+	image.position = {200, 0};
+	image.size = {100, 100};
+	calculateBounds(image);
+	scene.entities.emplace(image.id, std::move(image));
+
+	// Top row: opaque blue, half transparent white. Bottom row: opaque white and black
+	u32 pixels[] = {0xFFFF0000, 0x80FFFFFF, 0xFFFFFFFF, 0xFF000000};
+	bool loaded = true;
+	auto getPixels = [&](ImageEntity const &) {
+		ImagePixels result;
+		if (loaded) {
+			result.pixels = pixels;
+			result.size = {2, 2};
+		}
+		return result;
+	};
+
+	auto check = [&](v2f point, v3f expected, char const *what) {
+		v3f color = pickSceneColor(&scene, point, getPixels);
+		if (distance(color, expected) >= 0.001f) {
+			LOG("pickColorTest: %", what);
+			ASSERT(false, "pickColorTest: wrong color");
+		}
+	};
+	check({0, 0}, {0, 1, 0}, "newer line should be over the pencil");
+	check({-40, 0}, {1, 0, 0}, "pencil");
+	check({-40, 20}, scene.canvasColor, "empty point should be canvas color");
+	check({175, 25}, {0, 0, 1}, "opaque image pixel");
+	check({175, -25}, {1, 1, 1}, "bottom row of the image");
+	f32 alpha = 0x80 / 255.0f;
+	check({225, 25}, V3f(alpha) + scene.canvasColor * (1 - alpha), "transparent pixel should blend with what is under it");
+
+	loaded = false;
+	check({175, 25}, scene.canvasColor, "loading image should be skipped");
+
+	scene.liveEntityId = pencilId;
+	check({0, 0}, {1, 0, 0}, "live entity should be over everything");
+	scene.liveEntityId = invalidEntityId;
+
+	u32 const queryCount = 100000;
+	std::mt19937 mt{};
+	std::uniform_real_distribution<f32> unitDistribution(-1, 1);
+	auto begin = std::chrono::high_resolution_clock::now();
+	v3f sum = {};
+	for (u32 i = 0; i < queryCount; ++i) {
+		sum += pickSceneColor(&scene, v2f{unitDistribution(mt), unitDistribution(mt)} * 250, getPixels);
+	}
+	f64 seconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count();
+	LOG("pickColorTest: % us per pick, checksum %", seconds / queryCount * 1000000, sum.x + sum.y + sum.z);
+
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+	scene.canvasColor = oldCanvasColor;
+}
+
+// Halving against a per channel reference on odd sizes, and the memory a downscaled 48 megapixel photo keeps
+void mipChainTest() {
+	showConsoleWindow();
+
+	std::mt19937 mt{};
+	for (u32 height = 1; height < 8; ++height) {
+		for (u32 width = 1; width < 40; ++width) {
+			List<u32> source;
+			source.resize(width * height);
+			for (auto &texel : source) {
+				texel = mt();
+			}
+			v2u halfSize = getHalfSize({width, height});
+			List<u32> halved;
+			halved.resize(halfSize.x * halfSize.y);
+			halveImage(source.data(), {width, height}, halved.data());
+
+			for (u32 y = 0; y < halfSize.y; ++y) {
+				for (u32 x = 0; x < halfSize.x; ++x) {
+					u32 x0 = min(x * 2, width - 1), x1 = min(x * 2 + 1, width - 1);
+					u32 y0 = min(y * 2, height - 1), y1 = min(y * 2 + 1, height - 1);
+					for (u32 shift = 0; shift < 32; shift += 8) {
+						u32 sum = 0;
+						for (u32 texel : {source[y0 * width + x0], source[y0 * width + x1], source[y1 * width + x0], source[y1 * width + x1]}) {
+							sum += (texel >> shift) & 0xFF;
+						}
+						ASSERT(((halved[y * halfSize.x + x] >> shift) & 0xFF) == (sum + 2) / 4, "mipChainTest: halved texel differs from the reference");
+					}
+				}
+			}
+		}
 	}
 
-	union {
-		u32 u;
-		f32 f;
+	ASSERT(getMipSkipCount({8000, 6000}, 8000) == 0, "mipChainTest: full resolution should not be skipped");
+	ASSERT(getMipSkipCount({8000, 6000}, 4001) == 0, "mipChainTest: level should not be smaller than the target");
+	ASSERT(getMipSkipCount({8000, 6000}, 4000) == 1, "mipChainTest: wrong skip count");
+	ASSERT(getMipSkipCount({8000, 6000}, 1) == 12, "mipChainTest: wrong skip count for 1x1");
+
+	v2u photoSize = {8000, 6000};
+	List<u32> photo;
+	photo.resize(photoSize.x * photoSize.y);
+	for (auto &texel : photo) {
+		texel = mt() | 0xFF000000;
+	}
+	for (u32 shownSize : {256u, 1000u, 4000u, 8000u}) {
+		auto begin = std::chrono::high_resolution_clock::now();
+		MipChain chain = buildMipChain(photo.data(), photoSize, getMipSkipCount(photoSize, (u32)(shownSize * imageResolutionHeadroom)));
+		f64 seconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count();
+
+		ASSERT(chain.levels.back().size == v2u{1, 1}, "mipChainTest: chain should end at 1x1");
+		LOG("mipChainTest: shown at %: kept %x%, % levels, % MB instead of % MB, built in % ms",
+			shownSize, chain.size().x, chain.size().y, chain.levels.size(), chain.bytes() / (1024 * 1024), chain.sourceBytes() / (1024 * 1024), seconds * 1000);
+	}
+}
+
+// Images of two scenes pass through a cache that fits three of them, as updateShownImages and decode workers use it
+void imageCacheTest() {
+	showConsoleWindow();
+
+	struct TestImage {
+		ImageCacheEntry cache;
+		bool resident = false;
+	};
+	constexpr u64 imageBytes = 4 * 1024 * 1024;
+	TestImage images[8];
+	List<TestImage *> imagePointers;
+	for (auto &image : images) {
+		imagePointers.push_back(&image);
+	}
+
+	ImageCache cache;
+	cache.stats.budget = imageBytes * 3;
+	u32 decodeCount = 0;
+
+	// Images in view are used, evicted ones are decoded again
+	auto show = [&](std::initializer_list<u32> inView) {
+		cache.beginPass();
+		for (u32 index : inView) {
+			auto &image = images[index];
+			if (!cache.use(image.cache)) {
+				++decodeCount;
+				image.resident = true;
+				cache.setBytes(image.cache, imageBytes);
+			}
+		}
+		cache.trim(imagePointers, [&](TestImage *image) {
+			ASSERT(image->resident, "imageCacheTest: evicted an image that was not resident");
+			image->resident = false;
+		});
+		ASSERT(cache.stats.bytes <= cache.stats.budget || cache.stats.residentCount == inView.size(), "imageCacheTest: cache is over budget");
+		for (u32 index : inView) {
+			ASSERT(images[index].resident, "imageCacheTest: image in view was evicted");
+		}
 	};
-	f32c() {}
-	f32c(f32 f) : f(f) {}
-	friend f32c operator+(f32c a, f32c b) {
-	beginning:
-		f32c check = a.f + b.f;
-		
-		// Step 1: 
-		// Determine if any of the operands is an Infinity or a Not-A-Number. 
-		// In this case, look up the IEEE 754 standard and determine the result accordingly.
 
+	show({0, 1});
+	show({0, 1});
+	ASSERT(cache.stats.missCount == 2 && cache.stats.hitCount == 0, "imageCacheTest: images staying in view should not be counted again");
+	show({2});
+	ASSERT(images[0].resident && images[1].resident && images[2].resident, "imageCacheTest: images that fit should stay");
+	show({3});
+	ASSERT(images[0].resident != images[1].resident && images[2].resident, "imageCacheTest: least recently used image should be evicted");
+	show({2, 3});
+	ASSERT(cache.stats.hitCount == 1, "imageCacheTest: resident image coming back into view should be a hit");
+
+	// Switching to another scene and back
+	show({4, 5, 6});
+	ASSERT(!images[2].resident && !images[3].resident, "imageCacheTest: images of the inactive scene should be evicted");
+	u32 decodesBefore = decodeCount;
+	show({2, 3});
+	ASSERT(decodeCount == decodesBefore + 2, "imageCacheTest: evicted images should be decoded again");
+
+	// Images in view are kept even over budget
+	show({0, 1, 2, 3, 4});
+	ASSERT(cache.stats.residentCount == 5, "imageCacheTest: images in view should be kept over budget");
+	show({7});
+	ASSERT(cache.stats.bytes <= cache.stats.budget, "imageCacheTest: cache should fit in the budget after the view changed");
+
+	cache.setBytes(images[7].cache, 0);
+	LOG("imageCacheTest: % hits, % misses, % evictions, % decodes, peak % MB",
+		cache.stats.hitCount, cache.stats.missCount, cache.stats.evictionCount, decodeCount, cache.stats.peakBytes / (1024 * 1024));
+}
 
-		s as = getS(a);
-		s bs = getS(b);
-		s cs = getS(check);
+// Decodes a scene of 500 images from memory the way start() does: once with a single worker in push order, as the
+// old loader thread did, then with a worker per core and priorities. Reports when every image in view was decoded.
+void imageDecodeBenchmark() {
+	showConsoleWindow();
 
-		if (as.isNan || bs.isNan) {
-			return NAN;
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "imageDecodeBenchmark: last scene is in use");
+
+	constexpr u32 imageCount = 500;
+	constexpr u32 columnCount = 25;
+	v2u imageSize = {384, 288};
+	v2f viewSize = {1920, 1080};
+	scene.cameraPosition = {};
+	scene.cameraDistance = 1;
+
+	// Noise does not compress, so decoding costs about as much as for photos
+	std::mt19937 mt{};
+	List<List<u8>> encoded;
+	List<u32> texels;
+	texels.resize(imageSize.x * imageSize.y);
+	for (u32 i = 0; i < imageCount; ++i) {
+		for (auto &texel : texels) {
+			texel = mt() | 0xFF000000;
 		}
+		encoded.push_back({});
+		stbi_write_png_to_func([](void *context, void *data, int size) {
+			auto &file = *(List<u8> *)context;
+			umm offset = file.size();
+			file.resize(offset + size);
+			memcpy(file.data() + offset, data, size);
+		}, &encoded.back(), imageSize.x, imageSize.y, 4, texels.data(), imageSize.x * sizeof(u32));
+
+		// Images are 200x150 scene units in a 25x20 grid around the camera, 88 of them are in view
+		ImageEntity image;
+		image.id = scene.entityIdCounter++;
+		image.visible = true;
+		image.size = {200, 150};
+		image.position = (v2f{(f32)(i % columnCount), (f32)(i / columnCount)} - v2f{(f32)columnCount, (f32)(imageCount / columnCount)} * 0.5f + 0.5f) * v2f{210, 160};
+		image.renderData = (void *)(umm)(i + 1);
+		calculateBounds(image);
+		scene.entities.emplace(image.id, std::move(image));
+	}
 
-		//ASSERT(make(as).u == a.u);
-		//ASSERT(make(bs).u == b.u);
-		//ASSERT(make(cs).u == check.u);
-		
-		// Step 3:
-		// Make sure the exponents are the same.
-		// If one number has an exponent that is smaller by k, then shift that numbers mantissa to the right by k bit positions.
-		// If k is greater than 3, then set the last bit of the mantissa to 1 if any non-zero bits were shifted out. 
-		// If k is so large that all mantissa bits would be shifted out then set the mantissa to zero, and don't try to shift by some huge amount.
-		if (as.exponent != bs.exponent) {
-			s *min, *max;
-			if (as.exponent > bs.exponent) {
-				min = &bs;
-				max = &as;
-			} else {
-				min = &as;
-				max = &bs;
-			}
+	std::unordered_map<void *, u32> priorities;
+	collectImageDecodePriorities(priorities, &scene, getSceneView(&scene, viewSize), [](ImageEntity const &image) { return image.renderData; });
+	u32 visibleCount = 0;
+	for (auto &[item, priority] : priorities) {
+		visibleCount += priority == DecodePriority_visible;
+	}
 
-			u32 k = max->exponent - min->exponent;
-			if (k >= 27) {
-				min->mantissa = 0;
-			} else if (k > 3) {
-				bool hasBits = min->mantissa & ((1 << k) - 1);
-				min->mantissa >>= k;
-				if (hasBits) {
-					min->mantissa |= 1;
-				}
-			} else {
-				min->mantissa >>= k;
+	// Scene loading pushes images in entity order
+	List<void *> pushOrder;
+	for (auto &[id, e] : scene.entities) {
+		pushOrder.push_back(e.image.renderData);
+	}
+
+	struct Run {
+		u32 workerCount;
+		bool prioritize;
+	};
+	u32 maxWorkerCount = getRasterWorkerCount();
+	Run runs[] = {{1, false}, {maxWorkerCount, false}, {maxWorkerCount, true}};
+	for (auto run : runs) {
+		using Clock = std::chrono::high_resolution_clock;
+		std::atomic<u32> decodedVisibleCount = 0;
+		std::atomic<Clock::rep> allVisibleTime = 0;
+		Clock::time_point begin;
+
+		auto decode = [&](void *item) {
+			auto &file = encoded[(umm)item - 1];
+			int width, height;
+			stbi_uc *pixels = stbi_load_from_memory(file.data(), file.size(), &width, &height, 0, 4);
+			ASSERT(pixels, "imageDecodeBenchmark: decoding failed");
+			stbi_image_free(pixels);
+			if (priorities.at(item) == DecodePriority_visible && decodedVisibleCount.fetch_add(1) + 1 == visibleCount) {
+				allVisibleTime = (Clock::now() - begin).count();
 			}
-			min->exponent = max->exponent;
+		};
+
+		ImageDecodePool pool;
+		pool.init(run.workerCount, &decode);
+
+		begin = Clock::now();
+		for (auto item : pushOrder) {
+			pool.push(item, DecodePriority_offscreen);
 		}
+		// Next frame of the main loop
+		if (run.prioritize) {
+			pool.reprioritize([&](void *item) { return priorities.at(item); });
+		}
+		pool.waitIdle();
+		f64 totalSeconds = std::chrono::duration<f64>(Clock::now() - begin).count();
+		auto stats = pool.getStats();
+		pool.deinit();
+
+		ASSERT(stats.decodedCount == imageCount, "imageDecodeBenchmark: not every image was decoded");
+		LOG("imageDecodeBenchmark: % workers, %: all % visible in % ms, all % in % ms, worker utilization % percent",
+			run.workerCount, run.prioritize ? "prioritized" : "push order", visibleCount, std::chrono::duration<f64>(Clock::duration(allVisibleTime)).count() * 1000,
+			imageCount, totalSeconds * 1000, stats.busySeconds / (totalSeconds * run.workerCount) * 100);
+	}
 
-		// Step 4: 
-		// If the operands have different signs and the second mantissa is larger then exchange the operands. 
-		// Add or subtract the mantissas, depending on the sign bits.
-		s rs;
-		if (as.negative != bs.negative && bs.mantissa > as.mantissa) {
-			std::swap(as, bs);
+	// A popped item is in flight before its decode starts, until decode finishes it
+	{
+		std::atomic<bool> started = false;
+		std::atomic<bool> release = false;
+		ImageDecodePool *current = 0;
+		auto hold = [&](void *item) {
+			started = true;
+			while (!release) {
+				std::this_thread::yield();
+			}
+			current->finish(item);
+		};
+		ImageDecodePool pool;
+		current = &pool;
+		pool.init(1, &hold);
+		void *item = (void *)1;
+		pool.push(item, DecodePriority_visible);
+		while (!started) {
+			std::this_thread::yield();
 		}
-		if (as.negative == bs.negative) {
-			rs.mantissa = as.mantissa + bs.mantissa;
-		} else {
-			if (as.mantissa == bs.mantissa && as.exponent == bs.exponent) {
-				return 0.0f;
+		ASSERT(pool.isInFlight(item) && pool.remove(item), "imageDecodeBenchmark: item being decoded should be in flight");
+		release = true;
+		pool.waitIdle();
+		ASSERT(!pool.isInFlight(item) && !pool.remove(item), "imageDecodeBenchmark: finished item should not be in flight");
+		pool.deinit();
+	}
+
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+}
+
+// Opens 64 photo sized images twice through a disk cache in a temporary directory: cold, when every image is
+// decoded and stored, and warm, when the stored mips are mapped. Images are shown as 512 pixel thumbnails.
+void diskImageCacheBenchmark() {
+	showConsoleWindow();
+
+	std::wstring directory = executableDirectory + L"disk_cache_benchmark\\";
+	std::wstring imageDirectory = directory + L"images\\";
+	std::wstring cacheDirectory = directory + L"cache\\";
+	platform_createDirectory(directory.data());
+	platform_createDirectory(imageDirectory.data());
+
+	// Smooth gradients with some noise compress about as well as photos
+	constexpr u32 imageCount = 64;
+	v2u imageSize = {1600, 1200};
+	std::mt19937 mt{};
+	List<u32> texels;
+	texels.resize(imageSize.x * imageSize.y);
+	List<std::wstring> paths;
+	u64 fileBytes = 0;
+	for (u32 i = 0; i < imageCount; ++i) {
+		for (u32 y = 0; y < imageSize.y; ++y) {
+			for (u32 x = 0; x < imageSize.x; ++x) {
+				u32 r = (x + i * 16) & 0xF8;
+				u32 g = (y + i * 8) & 0xF8;
+				u32 b = (x + y) / 8 & 0xF8;
+				u32 noise = mt() & 0x070707;
+				texels[y * imageSize.x + x] = ((r | (g << 8) | (b << 16)) + noise) | 0xFF000000;
 			}
-			rs.mantissa = as.mantissa - bs.mantissa;
 		}
-		rs.negative = as.negative;
+		paths.push_back(imageDirectory + std::to_wstring(i) + L".png");
+		auto file = _wfopen(paths.back().data(), L"wb");
+		ASSERT(file, "diskImageCacheBenchmark: failed to write an image");
+		stbi_write_png_to_func([](void *context, void *data, int size) {
+			fwrite(data, 1, size, (FILE *)context);
+		}, file, imageSize.x, imageSize.y, 4, texels.data(), imageSize.x * sizeof(u32));
+		fileBytes += ftell(file);
+		fclose(file);
+	}
 
-		// Step 5: 
-		// If you added the mantissas and there was a carry, then increase the exponent, and shift the mantissa one bit position to the right.
-		// If the bit that is shifted out is non-zero, then set the last bit of the mantissa.
-		rs.exponent = as.exponent;
-		if (rs.mantissa & (mantissaCarryBit << 3)) {
-			++rs.exponent;
-			u32 lastBit = rs.mantissa & 1;
-			rs.mantissa >>= 1;
-			rs.mantissa |= lastBit;
+	DiskImageCache cache;
+	cache.init(cacheDirectory);
+	for (auto &entry : platform_listDirectory(cacheDirectory.data())) {
+		_wremove((cacheDirectory + entry.name).data());
+	}
+	cache.init(cacheDirectory);
+
+	for (char const *run : {"cold", "warm"}) {
+		std::atomic<u64> texelCount = 0;
+		auto load = [&](void *item) {
+			Span<u8 const> mapping;
+			u64 contentHash;
+			MipChain mips = loadImageMips(cache, paths[(umm)item - 1].data(), 512, mapping, contentHash, [](u64) { return false; });
+			ASSERT(mips.levels.size(), "diskImageCacheBenchmark: failed to load an image");
+			texelCount += mips.texelCount();
+			platform_unmapFile(mapping);
+		};
+		ImageDecodePool pool;
+		pool.init(getRasterWorkerCount(), &load);
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (umm i = 0; i < paths.size(); ++i) {
+			pool.push((void *)(i + 1), DecodePriority_visible);
 		}
+		pool.waitIdle();
+		f64 seconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count();
+		pool.deinit();
 
-		// Step 6:
-		// If you subtracted the mantissas then count the number of leading zero bits in the mantissa.
-		// If all mantissa bits are zero then set the biased exponent to 1.
-		// Otherwise, shift the mantissa to the left and decrease the exponent, making sure that the biased exponent doesn't get smaller than 1.
-		if (as.negative != bs.negative) {
-			u32 lzc = countLeadingZeros(rs.mantissa) - 5;
-			if (rs.mantissa == 0) {
-				rs.exponent = 129;
-			} else if (lzc) {
-				if (rs.exponent > lzc) {
-					rs.mantissa <<= lzc;
-					rs.exponent -= lzc;
-				} else {
-					rs.mantissa <<= lzc - rs.exponent;
-					rs.exponent = 1;
+		auto stats = cache.getStats();
+		LOG("diskImageCacheBenchmark: %: % images (% MB of PNG) in % ms, % MB of mips, % hits, % misses, cache is % MB",
+			run, imageCount, fileBytes / (1024 * 1024), seconds * 1000, texelCount * sizeof(u32) / (1024 * 1024), stats.hitCount, stats.missCount, stats.bytes / (1024 * 1024));
+	}
+	ASSERT(cache.getStats().hitCount == imageCount, "diskImageCacheBenchmark: every image should be mapped on the warm run");
+
+	// Files whose levels point past their texels are not mapped
+	{
+		FileInfo info;
+		ASSERT(platform_getFileInfo(paths[0].data(), info), "diskImageCacheBenchmark: image is missing");
+		auto filePath = cache.getFilePath(paths[0].data());
+		auto file = _wfopen(filePath.data(), L"r+b");
+		ASSERT(file, "diskImageCacheBenchmark: stored file is missing");
+		DiskImageCacheHeader header;
+		fread(&header, sizeof(header), 1, file);
+		header.levels[header.levelCount - 1].offset = header.texelCount;
+		fseek(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, file);
+		fclose(file);
+
+		MipChain mips;
+		Span<u8 const> mapping;
+		ASSERT(!cache.load(paths[0].data(), info, 0, 0, mips, mapping), "diskImageCacheBenchmark: level past the texels should not be mapped");
+	}
+
+	// A small limit keeps only the most recently used files
+	cache.setLimit(cache.getStats().bytes / 4);
+	LOG("diskImageCacheBenchmark: % files evicted to fit in % MB", cache.getStats().evictionCount, cache.getStats().limit / (1024 * 1024));
+
+	for (auto &entry : platform_listDirectory(cacheDirectory.data())) {
+		_wremove((cacheDirectory + entry.name).data());
+	}
+	for (auto &path : paths) {
+		_wremove(path.data());
+	}
+	_wrmdir(cacheDirectory.data());
+	_wrmdir(imageDirectory.data());
+	_wrmdir(directory.data());
+}
+
+// Tiles a gigapixel image is drawn from while the camera zooms in on it and pans across, as updateShownImages
+// finds them. Tiles in view should stay about as many as the window needs, whatever the image size.
+void virtualTextureTest() {
+	showConsoleWindow();
+
+	ASSERT(!needsVirtualTexture({minVirtualTextureSize, 100}) && needsVirtualTexture({minVirtualTextureSize + 1, 100}), "virtualTextureTest: wrong size limit");
+	ASSERT(getTileIndex(makeTileKey(5, {123, 456})) == v2u{123, 456} && getTileLevel(makeTileKey(5, {123, 456})) == 5, "virtualTextureTest: key should round trip");
+
+	// Tiles are copied from their level
+	std::mt19937 mt{};
+	v2u smallSize = {1500, 1000};
+	List<u32> texels;
+	texels.resize(smallSize.x * smallSize.y);
+	for (auto &texel : texels) {
+		texel = mt();
+	}
+	MipChain chain = buildMipChain(texels.data(), smallSize, 0);
+	MipChain tile = copyTile(chain, makeTileKey(0, {2, 1}));
+	ASSERT(tile.size() == v2u{1500 - 1024, 1000 - 512}, "virtualTextureTest: edge tile should be cut at the image border");
+	ASSERT(tile.level(0)[0] == texels[512 * smallSize.x + 1024] && tile.level(0)[tile.size().x - 1] == texels[512 * smallSize.x + 1499], "virtualTextureTest: tile texels differ");
+
+	// Chains kept in memory are read by later decodes without a copy
+	MipChain view = viewMipChain(chain);
+	ASSERT(view.level(3) == chain.level(3) && view.bytes() == chain.bytes() && !view.texels.size(), "virtualTextureTest: view should read the chain's texels");
+	ASSERT(copyTile(view, makeTileKey(0, {2, 1})).level(0)[0] == tile.level(0)[0], "virtualTextureTest: tiles of a view differ");
+	auto rect = getTileRect(smallSize, makeTileKey(0, {2, 1}));
+	ASSERT(rect.min.x == 1024.0f / 1500 && rect.max.x == 1 && rect.min.y == 0 && rect.max.y == 1 - 512.0f / 1000, "virtualTextureTest: wrong tile rect");
+
+	v2f windowSize = {1920, 1080};
+	for (v2u sourceSize : {v2u{20000, 15000}, v2u{80000, 60000}}) {
+		ImageEntity image;
+		image.visible = true;
+		image.size = {(f32)sourceSize.x, (f32)sourceSize.y};
+		Entity e = std::move(image);
+		u32 baseLevel = getVirtualTextureBaseLevel(sourceSize);
+		ASSERT(max(getMipLevelSize(sourceSize, baseLevel).x, getMipLevelSize(sourceSize, baseLevel).y) <= virtualTextureBaseSize, "virtualTextureTest: base level is too large");
+
+		Scene scene;
+		umm maxTileCount = 0;
+		u64 maxTileBytes = 0;
+		for (f32 cameraDistance = sourceSize.x / windowSize.x; cameraDistance > 0.25f; cameraDistance *= 0.5f) {
+			for (f32 pan = -0.5f; pan <= 0.5f; pan += 0.125f) {
+				scene.cameraDistance = cameraDistance;
+				scene.cameraPosition = v2f{pan, pan * 0.5f} * e.image.size;
+				auto view = getSceneView(&scene, windowSize);
+				u32 level = getVirtualTextureLevel(sourceSize, getShownSize(&scene, e.image));
+				List<u64> keys;
+				if (level < baseLevel) {
+					getTilesInRect(keys, sourceSize, level, getImageViewRect(e, view));
+				}
+
+				// Tiles cover the part of the image in view
+				auto viewRect = getImageViewRect(e, view);
+				if (keys.size()) {
+					aabb<v2f> covered = getTileRect(sourceSize, keys[0]);
+					for (auto key : keys) {
+						auto tileRect = getTileRect(sourceSize, key);
+						covered = aabbMinMax(TL::min(covered.min, tileRect.min), TL::max(covered.max, tileRect.max));
+					}
+					ASSERT(covered.min.x <= viewRect.min.x && covered.min.y <= viewRect.min.y && covered.max.x >= viewRect.max.x && covered.max.y >= viewRect.max.y,
+						"virtualTextureTest: tiles should cover the view");
 				}
+				maxTileCount = max(maxTileCount, keys.size());
+				maxTileBytes = max(maxTileBytes, (u64)keys.size() * virtualTextureTileSize * virtualTextureTileSize * sizeof(u32) * 4 / 3);
 			}
 		}
+		u32 windowTileCount = (u32)(ceilf(windowSize.x / virtualTextureTileSize) + 1) * (u32)(ceilf(windowSize.y / virtualTextureTileSize) + 1);
+		ASSERT(maxTileCount <= windowTileCount * 4, "virtualTextureTest: tiles in view should be bounded by the window size");
+		LOG("virtualTextureTest: %x% image, % MB at full resolution, at most % tiles in view, % MB",
+			sourceSize.x, sourceSize.y, (u64)sourceSize.x * sourceSize.y * sizeof(u32) / (1024 * 1024), maxTileCount, maxTileBytes / (1024 * 1024));
+	}
+}
 
-		f32c result = make(rs);
+// Drops 200 small images and a file that is not an image on the last scene. Placeholders should be pushed before
+// any header is read, the broken one should be removed from the history, and one undo should remove the whole drop.
+void imageImportTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "imageImportTest: last scene is in use");
+	Scene *previousScene = currentScene;
+	currentScene = &scene;
+	scene.cameraPosition = {};
+	scene.cameraDistance = 1;
+
+	std::wstring directory = executableDirectory + L"import_test\\";
+	platform_createDirectory(directory.data());
+
+	constexpr u32 imageCount = 200;
+	List<std::wstring> paths;
+	List<u32> texels;
+	for (u32 i = 0; i < imageCount; ++i) {
+		v2u size = {16 + i % 7 * 8, 16 + i % 5 * 8};
+		texels.resize(size.x * size.y);
+		for (auto &texel : texels) {
+			texel = 0xFF000000 | (i * 0x010305);
+		}
+		paths.push_back(directory + std::to_wstring(i) + L".png");
+		auto file = _wfopen(paths.back().data(), L"wb");
+		ASSERT(file, "imageImportTest: failed to write an image");
+		stbi_write_png_to_func([](void *context, void *data, int size) {
+			fwrite(data, 1, size, (FILE *)context);
+		}, file, size.x, size.y, 4, texels.data(), size.x * sizeof(u32));
+		fclose(file);
+	}
+	paths.push_back(directory + L"broken.png");
+	{
+		auto file = _wfopen(paths.back().data(), L"wb");
+		ASSERT(file, "imageImportTest: failed to write a file");
+		fputs("not an image", file);
+		fclose(file);
+	}
 
-		if (result.u != check.u) {
-			DEBUG_BREAK;
-			goto beginning;
+	// The drop handler takes ownership of the paths, as it does of the ones from the platform layer
+	List<Span<wchar>> dropped;
+	for (auto &path : paths) {
+		Span<wchar> copy = {ALLOCATE_T(TL_DEFAULT_ALLOCATOR, wchar, path.size(), 0), path.size()};
+		memcpy(copy.data(), path.data(), path.size() * sizeof(wchar));
+		dropped.push_back(copy);
+	}
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	app_onDragAndDrop(dropped);
+	f64 dropSeconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count();
+	ASSERT(scene.entities.size() == paths.size(), "imageImportTest: every file should get a placeholder");
+
+	begin = std::chrono::high_resolution_clock::now();
+	finishImageImports();
+	f64 importSeconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - begin).count();
+	LOG("imageImportTest: % placeholders in % ms, headers read in % ms more", paths.size(), dropSeconds * 1000, importSeconds * 1000);
+
+	ASSERT(scene.entities.size() == imageCount && scene.actions.size() == imageCount, "imageImportTest: broken file should be removed");
+	ASSERT(!scene.actions[0].create.batched, "imageImportTest: drop should start a batch");
+	for (auto &[id, e] : scene.entities) {
+		auto &image = e.image;
+		ASSERT(!image.sizePending, "imageImportTest: size should be read");
+		u32 i = std::stoul(std::wstring(image.path.data(), image.path.size()).substr(directory.size()));
+		v2f size = {(f32)(16 + i % 7 * 8), (f32)(16 + i % 5 * 8)};
+		ASSERT(absolute(image.size.x / image.size.y - size.x / size.y) < 0.001f, "imageImportTest: wrong aspect ratio");
+	}
+
+	undo();
+	ASSERT(scene.postLastVisibleActionIndex == 0, "imageImportTest: one undo should remove the drop");
+	for (auto &[id, e] : scene.entities) {
+		ASSERT(!e.visible, "imageImportTest: image should be hidden after undo");
+	}
+	redo();
+	ASSERT(scene.postLastVisibleActionIndex == imageCount, "imageImportTest: one redo should bring the drop back");
+	for (auto &[id, e] : scene.entities) {
+		ASSERT(e.visible, "imageImportTest: image should be visible after redo");
+	}
+
+	for (auto &[id, e] : scene.entities) {
+		cleanup(e);
+	}
+	scene.entities.clear();
+	scene.actions.clear();
+	scene.postLastVisibleActionIndex = 0;
+	scene.savedPostLastVisibleActionIndex = 0;
+	scene.modifiedPostLastVisibleActionIndex = 0;
+	scene.entityIdCounter = 0;
+	currentScene = previousScene;
+
+	imageDecodePool.waitIdle();
+	uploadDecodedImages(false);
+	for (auto &path : paths) {
+		_wremove(path.data());
+	}
+	_wrmdir(directory.data());
+}
+
+// Loads three image files, two of them with the same content, on the last scene. Entities of the copies should
+// end up with one texture, the other one should keep its own, and the saving should show in the cache stats.
+void imageDedupTest() {
+	showConsoleWindow();
+
+	Scene &scene = scenes[countof(scenes) - 1];
+	ASSERT(!scene.initialized, "imageDedupTest: last scene is in use");
+	scene.cameraPosition = {};
+	scene.cameraDistance = 1;
+
+	std::wstring directory = executableDirectory + L"dedup_test\\";
+	platform_createDirectory(directory.data());
+
+	v2u imageSize = {640, 480};
+	List<u32> texels;
+	texels.resize(imageSize.x * imageSize.y);
+	std::wstring paths[] = {directory + L"original.png", directory + L"copy.png", directory + L"other.png"};
+	for (u32 i = 0; i < countof(paths); ++i) {
+		// Copy is written from the same texels, so its bytes are the same
+		u32 seed = i == 2 ? 2 : 1;
+		for (u32 t = 0; t < texels.size(); ++t) {
+			texels[t] = 0xFF000000 | (t * seed * 0x010203);
 		}
+		auto file = _wfopen(paths[i].data(), L"wb");
+		ASSERT(file, "imageDedupTest: failed to write an image");
+		stbi_write_png_to_func([](void *context, void *data, int size) {
+			fwrite(data, 1, size, (FILE *)context);
+		}, file, imageSize.x, imageSize.y, 4, texels.data(), imageSize.x * sizeof(u32));
+		fclose(file);
+	}
 
-		return result;
+	auto addImage = [&](std::wstring const &path) {
+		ImageEntity image;
+		image.id = scene.entityIdCounter++;
+		image.visible = true;
+		image.size = {640, 480};
+		image.path = {ALLOCATE_T(TL_DEFAULT_ALLOCATOR, wchar, path.size(), 0), path.size()};
+		memcpy(image.path.data(), path.data(), path.size() * sizeof(wchar));
+		image.renderData = getOrLoadImageData(image.path, getShownSize(&scene, image));
+		calculateBounds(image);
+		auto id = image.id;
+		scene.entities.emplace(id, std::move(image));
+		return &scene.entities.at(id).image;
+	};
+	auto original = addImage(paths[0]);
+	auto copy = addImage(paths[1]);
+	auto other = addImage(paths[2]);
+	ASSERT(original->renderData != copy->renderData, "imageDedupTest: content is not known before the files are read");
+
+	imageDecodePool.waitIdle();
+	uploadDecodedImages(false);
+	applyImageDuplicates();
+	ASSERT(original->renderData == copy->renderData, "imageDedupTest: copies should share one image");
+	ASSERT(original->renderData != other->renderData, "imageDedupTest: different content should not be shared");
+
+	// Shared path gets the shared image right away
+	auto secondCopy = addImage(paths[1]);
+	ASSERT(secondCopy->renderData == original->renderData, "imageDedupTest: path of a copy should resolve to the shared image");
+
+	auto stats = getImageCacheStats();
+	ASSERT(stats.sharedCount == 1 && stats.sharedBytes, "imageDedupTest: sharing should show in the stats");
+	LOG("imageDedupTest: % shared image files, % KB not loaded twice, % KB resident", stats.sharedCount, stats.sharedBytes / 1024, stats.bytes / 1024);
+
+	for (auto &[id, e] : scene.entities) {
+		cleanup(e);
+	}
+	scene.entities.clear();
+	scene.entityIdCounter = 0;
+	{
+		SCOPED_LOCK(loadedImagesMutex);
+		ASSERT(sharedImagePaths.empty(), "imageDedupTest: shared paths should be released with their entities");
+		for (auto &path : paths) {
+			ASSERT(!findLoadedImage(Span<wchar const>{path.data(), path.size()}), "imageDedupTest: images should be released with their entities");
+		}
 	}
-};
 
-void f32test() {
-	f32c fa;
-	f32c fb;
-	f32c fc;
-	fa = -522975.969f;
-	fb = 66674.0625f;
-	fc = fa + fb;
-	fa = -321593.813;
-	fb = 323737.875;
-	fc = fa + fb;
-	fa = 124659.813;
-	fb = -124659.813;
-	fc = fa + fb;
-	fa = -1.95598008e+10f;
-	fb = 4.73311009e-18f;
-	fc = fa + fb;
-	fa = -8.23324077e-20f;
-	fb = 1.01678475e-12f;
-	fc = fa + fb;
+	imageDecodePool.waitIdle();
+	uploadDecodedImages(false);
+	for (auto &path : paths) {
+		_wremove(path.data());
+	}
+	_wrmdir(directory.data());
+}
+
+// Uploads a 4096x4096 texture with its mips piece by piece, as uploadDecodedImages does, and reports the longest
+// piece against the whole upload, which is what a frame waited for when workers created textures directly.
+void textureUploadTest() {
+	showConsoleWindow();
 
+	v2u size = {4096, 4096};
+	List<u32> texels;
+	texels.resize(size.x * size.y);
 	std::mt19937 mt{};
-	for (u32 i = 0; i < 0x1000; ++i) {
-		fa.u = mt();
-		fb.u = mt();
-		fc = fa + fb;
+	for (auto &texel : texels) {
+		texel = mt() | 0xFF000000;
+	}
+	MipChain mips = buildMipChain(texels.data(), size, 0);
+
+	using Clock = std::chrono::high_resolution_clock;
+	void *renderData = renderer->createImageData();
+	TextureUpload upload = {renderData, &mips};
+	u64 bytes = 0;
+	u32 pieceCount = 0;
+	f64 longestPieceSeconds = 0;
+	auto begin = Clock::now();
+	while (!upload.done()) {
+		ASSERT(upload.remainingBytes() == mips.bytes() - bytes, "textureUploadTest: wrong remaining bytes");
+		auto pieceBegin = Clock::now();
+		u64 pieceBytes = uploadTexturePiece(renderer, upload);
+		longestPieceSeconds = max(longestPieceSeconds, std::chrono::duration<f64>(Clock::now() - pieceBegin).count());
+		ASSERT(pieceBytes <= textureUploadPieceBytes + size.x * sizeof(u32), "textureUploadTest: piece is too large");
+		bytes += pieceBytes;
+		++pieceCount;
+	}
+	f64 totalSeconds = std::chrono::duration<f64>(Clock::now() - begin).count();
+	ASSERT(bytes == mips.bytes(), "textureUploadTest: every texel should be uploaded once");
+	renderer->releaseImageData(renderData);
+
+	u32 frameCount = (u32)((bytes + defaultTextureUploadBytesPerFrame - 1) / defaultTextureUploadBytesPerFrame);
+	LOG("textureUploadTest: % MB in % pieces, longest % ms, all of them % ms, about % frames at the default budget",
+		bytes / (1024 * 1024), pieceCount, longestPieceSeconds * 1000, totalSeconds * 1000, frameCount);
+}
+
+// Packs random small images into atlas pages, checks that blocks don't overlap and reports occupancy and speed
+void imageAtlasTest() {
+	showConsoleWindow();
+
+	using Clock = std::chrono::high_resolution_clock;
+	std::mt19937 mt{};
+
+	// One page filled with icon sized images until nothing fits
+	AtlasPacker packer;
+	packer.init(V2u(imageAtlasPageSize));
+	List<aabb<v2u>> blocks;
+	List<u32> alignments;
+	u32 failCount = 0;
+	auto begin = Clock::now();
+	while (failCount < 1000) {
+		v2u imageSize = {16 + mt() % 240, 16 + mt() % 240};
+		u32 levelCount = getAtlasLevelCount(imageSize);
+		v2u blockSize = getAtlasBlockSize(imageSize, levelCount);
+		v2u position;
+		if (packer.insert(blockSize, position, getAtlasPadding(levelCount))) {
+			blocks.push_back(aabbMinMax(position, position + blockSize));
+			alignments.push_back(getAtlasPadding(levelCount));
+		} else {
+			++failCount;
+		}
+	}
+	f64 pageSeconds = std::chrono::duration<f64>(Clock::now() - begin).count();
+	for (umm i = 0; i < blocks.size(); ++i) {
+		auto &a = blocks[i];
+		ASSERT(a.max.x <= imageAtlasPageSize && a.max.y <= imageAtlasPageSize, "imageAtlasTest: block is out of the page");
+		ASSERT(a.min.x % alignments[i] == 0 && a.min.y % alignments[i] == 0, "imageAtlasTest: block is not aligned");
+		for (umm j = i + 1; j < blocks.size(); ++j) {
+			auto &b = blocks[j];
+			ASSERT(a.max.x <= b.min.x || b.max.x <= a.min.x || a.max.y <= b.min.y || b.max.y <= a.min.y, "imageAtlasTest: blocks overlap");
+		}
+	}
+	ASSERT(packer.occupancy() > 0.8f, "imageAtlasTest: page should be mostly used");
+	LOG("imageAtlasTest: % blocks on one page, % occupancy, % skyline nodes, % ms with % failed inserts",
+		blocks.size(), packer.occupancy(), packer.skyline.size(), pageSeconds * 1000, failCount);
+
+	// Mood board of small images, placed and removed like scenes load and close
+	ImageAtlas atlas;
+	List<AtlasPlacement> placements;
+	placements.resize(10000);
+	begin = Clock::now();
+	for (auto &placement : placements) {
+		bool placed = atlas.place({8 + mt() % 248, 8 + mt() % 248}, placement);
+		ASSERT(placed, "imageAtlasTest: small image should be placed");
+	}
+	f64 placeSeconds = std::chrono::duration<f64>(Clock::now() - begin).count();
+	auto stats = atlas.getStats();
+	f64 occupancy = (f64)stats.usedArea / stats.packedArea;
+	ASSERT(stats.imageCount == placements.size(), "imageAtlasTest: every image should be counted");
+	ASSERT(occupancy > 0.8, "imageAtlasTest: pages should be mostly used");
+	LOG("imageAtlasTest: % images on % pages, % occupancy, % us per image",
+		stats.imageCount, stats.pageCount, occupancy, placeSeconds * 1e6 / placements.size());
+
+	for (auto &placement : placements) {
+		atlas.remove(placement);
+	}
+	ASSERT(atlas.getStats().pageCount == 0, "imageAtlasTest: pages should be empty");
+	AtlasPlacement large;
+	ASSERT(!atlas.place(V2u(imageAtlasMaxImageSize + 1), large), "imageAtlasTest: large image should get its own texture");
+
+	// Padding stays small next to icons, they are sampled from fewer levels
+	for (u32 size : {8u, 16u, 64u, 256u}) {
+		u32 levelCount = getAtlasLevelCount(V2u(size));
+		v2u blockSize = getAtlasBlockSize(V2u(size), levelCount);
+		ASSERT((f64)blockSize.x * blockSize.y <= 1.6 * size * size, "imageAtlasTest: padding should not be larger than the image");
+		ASSERT(levelCount == imageAtlasLevelCount || (8u << levelCount) > size, "imageAtlasTest: image should be sampled from every level its padding allows");
+	}
+
+	// Images come and go while the same number stays loaded, fragmented pages are compacted so pages don't pile up
+	{
+		ImageAtlas churn;
+		List<AtlasPlacement> loaded;
+		loaded.resize(3000);
+		for (auto &placement : loaded) {
+			churn.place({8 + mt() % 120, 8 + mt() % 120}, placement);
+		}
+		u32 peakPageCount = 0;
+		for (u32 i = 0; i < 60000; ++i) {
+			auto &placement = loaded[mt() % loaded.size()];
+			u32 page = placement.page;
+			if (!churn.remove(placement) && churn.needsCompaction(page)) {
+				churn.compact(page, [](AtlasPlacement const &from, AtlasPlacement const &to) {
+					ASSERT(from.blockSize == to.blockSize && from.levelCount == to.levelCount, "imageAtlasTest: moved block should keep its size");
+				});
+			}
+			churn.place({8 + mt() % 120, 8 + mt() % 120}, placement);
+			peakPageCount = max(peakPageCount, churn.getStats().pageCount);
+		}
+		auto churnStats = churn.getStats();
+		for (umm i = 0; i < loaded.size(); ++i) {
+			for (umm j = i + 1; j < loaded.size(); ++j) {
+				auto &a = loaded[i];
+				auto &b = loaded[j];
+				ASSERT(a.page != b.page || a.position.x + a.blockSize.x <= b.position.x || b.position.x + b.blockSize.x <= a.position.x ||
+					a.position.y + a.blockSize.y <= b.position.y || b.position.y + b.blockSize.y <= a.position.y, "imageAtlasTest: compacted blocks overlap");
+			}
+		}
+		ASSERT(churnStats.imageCount == loaded.size() && churnStats.compactionCount, "imageAtlasTest: fragmented pages should be compacted");
+		ASSERT(churnStats.liveArea * 3 > churnStats.packedArea, "imageAtlasTest: pages should stay mostly used by loaded images");
+		LOG("imageAtlasTest: % images on % pages (% at most) after churn, % of them used by loaded images, % compactions",
+			churnStats.imageCount, churnStats.pageCount, peakPageCount, (f64)churnStats.liveArea / churnStats.packedArea, churnStats.compactionCount);
+	}
+
+	// Edges of the image are repeated into the padding at every level
+	List<u32> texels;
+	texels.resize(40 * 24);
+	for (auto &texel : texels) {
+		texel = mt() | 0xFF000000;
+	}
+	MipChain mips = buildMipChain(texels.data(), {40, 24}, 0);
+	AtlasPlacement placement;
+	atlas.place(mips.size(), placement);
+	List<u32> block;
+	ASSERT(placement.levelCount == 2, "imageAtlasTest: image should be sampled from two levels");
+	for (u32 level = 0; level < placement.levelCount; ++level) {
+		copyAtlasBlock(mips, placement, level, block);
+		u32 padding = getAtlasPadding(placement.levelCount) >> level;
+		u32 source = min(level, (u32)mips.levels.size() - 1);
+		v2u size = mips.levels[source].size;
+		u32 blockWidth = placement.blockSize.x >> level;
+		ASSERT(block.size() == (umm)blockWidth * (placement.blockSize.y >> level), "imageAtlasTest: wrong block size");
+		ASSERT(block[0] == mips.level(source)[0], "imageAtlasTest: corner should repeat the first texel");
+		ASSERT(block[(umm)padding * blockWidth + padding] == mips.level(source)[0], "imageAtlasTest: image should start after the padding");
+		ASSERT(block[(umm)padding * blockWidth + padding + size.x - 1] == mips.level(source)[size.x - 1], "imageAtlasTest: wrong last texel of a row");
+		ASSERT(block[block.size() - 1] == mips.level(source)[(umm)size.x * size.y - 1], "imageAtlasTest: corner should repeat the last texel");
 	}
+	auto uvRect = getAtlasUvRect(placement);
+	ASSERT(uvRect.max.x - uvRect.min.x == 40.0f / imageAtlasPageSize, "imageAtlasTest: uv rect should cover the image");
 }
 
 int wmain(int argc, wchar **argv) {
@@ -1754,8 +5037,34 @@ int wmain(int argc, wchar **argv) {
 	start(args);
 
 	//f32test();
+	//transformLinesTest();
+	//findHoveredLineTest();
+	//calculateBoundsTest();
+	//strokeMesherTest();
+	//drawListTest();
+	//batchPlannerTest();
+	//dirtyRegionTest();
+	//staticLayerTest();
+	//softRasterizerBenchmark();
+	//nullRendererTest();
+	//frameSchedulerTest();
+	//scrollPanTest();
+	//zoomReplayTest();
+	//canvasPoolTest();
+	//pickColorTest();
+	//imageDecodeBenchmark();
+	//mipChainTest();
+	//imageCacheTest();
+	//diskImageCacheBenchmark();
+	//virtualTextureTest();
+	//imageImportTest();
+	//imageDedupTest();
+	//textureUploadTest();
+	//imageAtlasTest();
 
 	while (running) {
+		frameScheduler.beginFrame();
+
 		mouseDelta = {};
 		mouseWheel = {};
 		memset(keysDownRep, 0, sizeof(keysDownRep));
@@ -1862,12 +5171,8 @@ int wmain(int argc, wchar **argv) {
 								u32 dimIndex = !keyHeld(Key_shift);
 								displayGridSize[dimIndex] = 
 									currentEntity->grid.cellCount[dimIndex] = 
-									(u32)max((s32)currentEntity->grid.cellCount[dimIndex] + mouseWheel, 1);
+									(u32)clamp((s32)currentEntity->grid.cellCount[dimIndex] + mouseWheel, 1, (s32)maxGridCellCount);
 								updateWindowText = true;
-								renderer->reinitDynamicLineArray(
-									currentEntity->grid.renderData, 0, 
-									currentEntity->grid.cellCount.x + currentEntity->grid.cellCount.y + 2
-								);
 								gridCellCountChanged = true;
 							} break;
 						}
@@ -1926,9 +5231,24 @@ int wmain(int argc, wchar **argv) {
 		}
 		v2f prevCameraPosition = currentScene->cameraPosition;
 		currentScene->cameraPosition = lerp(currentScene->cameraPosition, currentScene->targetCameraPosition, cameraMoveSpeed);
+		snapCameraToCanvasPixels(currentScene);
 		if (distanceSqr(currentScene->cameraPosition, currentScene->targetCameraPosition) > currentScene->cameraDistance) {
 			currentScene->matrixSceneToNDCDirty = true;
 		}
+
+		uploadDecodedImages();
+		applyImageImports();
+		applyImageDuplicates();
+
+		static Scene *decodePriorityScene;
+		if (imageDecodePrioritiesDirty || currentScene != decodePriorityScene || currentScene->matrixSceneToNDCDirty || scalingImage) {
+			updateShownImages(currentScene);
+			if (imageDecodePool.pendingCount()) {
+				updateImageDecodePriorities(currentScene);
+			}
+			imageDecodePrioritiesDirty = false;
+			decodePriorityScene = currentScene;
+		}
 		
 		mouseScenePos = clientToScenePos(mousePosBL);
 		
@@ -1980,10 +5300,7 @@ int wmain(int argc, wchar **argv) {
 		if (draggingEntity) {
 			draggingEntity->position = mouseScenePos - draggingEntityOffset;
 			draggingEntity->hovered = true;
-			currentScene->needRepaint = true;
-			if (drawBounds) {
-				calculateBounds(*draggingEntity);
-			}
+			invalidateEntity(currentScene, *draggingEntity);
 		}
 		if (rotatingEntity) {
 			targetImageRotation = rotatingEntityInitialAngle - atan2(mouseScenePos - rotatingEntity->position);
@@ -1996,10 +5313,7 @@ int wmain(int argc, wchar **argv) {
 			rotatingEntity->rotation = lerpWrap(rotatingEntity->rotation, targetImageRotation, 0.5f, pi * 2);
 
 			rotatingEntity->hovered = true;
-			currentScene->needRepaint = true;
-			if (drawBounds) {
-				calculateBounds(*rotatingEntity);
-			}
+			invalidateEntity(currentScene, *rotatingEntity);
 		}
 		if (scalingImage) {
 			m2 toGlobal = m2::rotation(-scalingImage->rotation);
@@ -2093,10 +5407,7 @@ int wmain(int argc, wchar **argv) {
 		end:
 			scalingImage->position = (anchor.global + target) * 0.5f;
 			scalingImage->hovered = true;
-			currentScene->needRepaint = true;
-			if (drawBounds) {
-				calculateBounds(*scalingImage);
-			}
+			invalidateEntity(currentScene, *scalingImage);
 		}
 		if (colorMenuSelectingH) {
 			if (mouseButtonUp(0)) {
@@ -2156,6 +5467,7 @@ int wmain(int argc, wchar **argv) {
 					calculateBounds(*draggingEntity);
 					draggingEntity->hovered = false;
 					draggingEntity = 0;
+					setLiveEntity(currentScene, invalidEntityId);
 					currentAction = 0;
 				}
 				if (scalingImage) {
@@ -2164,6 +5476,7 @@ int wmain(int argc, wchar **argv) {
 					calculateBounds(*scalingImage);
 					scalingImage->hovered = false;
 					scalingImage = 0;
+					setLiveEntity(currentScene, invalidEntityId);
 					currentAction = 0;
 				}
 				if (rotatingEntity) {
@@ -2172,6 +5485,7 @@ int wmain(int argc, wchar **argv) {
 					calculateBounds(*rotatingEntity);
 					rotatingEntity->hovered = false;
 					rotatingEntity = 0;
+					setLiveEntity(currentScene, invalidEntityId);
 					currentAction = 0;
 				}
 			}
@@ -2253,6 +5567,7 @@ int wmain(int argc, wchar **argv) {
 									if (mouseButtonDown(0)) {
 										if (keyHeld(Key_shift)) {
 											rotatingEntity = hoveredEntity;
+											setLiveEntity(currentScene, rotatingEntity->id);
 											rotatingEntityInitialAngle = rotatingEntity->rotation + atan2(mouseScenePos - rotatingEntity->position);
 
 											RotateAction rotateAction;
@@ -2263,6 +5578,7 @@ int wmain(int argc, wchar **argv) {
 										} else {
 											if (inCenter) {
 												draggingEntity = hoveredEntity;
+												setLiveEntity(currentScene, draggingEntity->id);
 												draggingEntityOffset = mouseScenePos - hoveredImage->position;
 
 												TranslateAction translateAction;
@@ -2272,6 +5588,7 @@ int wmain(int argc, wchar **argv) {
 												currentAction = pushAction(currentScene, std::move(translateAction));
 											} else {
 												scalingImage = hoveredImage;
+												setLiveEntity(currentScene, scalingImage->id);
 								
 												ScaleAction scaleAction;
 												scaleAction.targetId = hoveredImage->id;
@@ -2290,6 +5607,7 @@ int wmain(int argc, wchar **argv) {
 									if (mouseButtonDown(0)) {
 										if (keyHeld(Key_shift)) {
 											rotatingEntity = hoveredEntity;
+											setLiveEntity(currentScene, rotatingEntity->id);
 											rotatingEntityInitialAngle = rotatingEntity->rotation + atan2(mouseScenePos - rotatingEntity->position);
 
 											RotateAction rotateAction;
@@ -2299,6 +5617,7 @@ int wmain(int argc, wchar **argv) {
 											currentAction = pushAction(currentScene, std::move(rotateAction));
 										} else {
 											draggingEntity = hoveredEntity;
+											setLiveEntity(currentScene, draggingEntity->id);
 											draggingEntityOffset = mouseScenePos - hoveredEntity->position;
 
 											TranslateAction translateAction;
@@ -2314,14 +5633,17 @@ int wmain(int argc, wchar **argv) {
 						if (previousHoveredEntity != hoveredEntity) {
 							if (previousHoveredEntity) {
 								previousHoveredEntity->hovered = false;
+								invalidateSceneBounds(currentScene, previousHoveredEntity->bounds);
+							}
+							if (hoveredEntity) {
+								invalidateSceneBounds(currentScene, hoveredEntity->bounds);
 							}
-							currentScene->needRepaint = true;
 						}
 						previousHoveredEntity = hoveredEntity;
 					} else {
 						if (previousHoveredEntity) {
 							previousHoveredEntity->hovered = false;
-							currentScene->needRepaint = true;
+							invalidateSceneBounds(currentScene, previousHoveredEntity->bounds);
 							previousHoveredEntity = 0;
 						}
 					}
@@ -2348,6 +5670,10 @@ int wmain(int argc, wchar **argv) {
 								pencil.newLineStartPoint.position = {};
 								pencil.color = currentScene->drawColor;
 
+								// Grows with every segment until the stroke is finished
+								pencil.bounds.min = V2f(+INFINITY);
+								pencil.bounds.max = V2f(-INFINITY);
+
 								renderer->initDynamicLineArray(pencil.renderData, 0, pencilLineBufferDefElemCount);
 								currentEntity = pushEntity(currentScene, std::move(pencil));
 
@@ -2387,7 +5713,6 @@ int wmain(int argc, wchar **argv) {
 								grid.thickness = getDrawThickness(currentScene);
 								grid.cellCount = displayGridSize = {4, 4};
 								updateWindowText = true;
-								renderer->initDynamicLineArray(grid.renderData, 0, grid.cellCount.x + grid.cellCount.y + 2);
 								currentEntity = pushEntity(currentScene, std::move(grid));
 							} break;
 							case Tool_circle: {
@@ -2406,12 +5731,15 @@ int wmain(int argc, wchar **argv) {
 							} break;
 							default: INVALID_CODE_PATH();
 						}
+						if (currentEntity) {
+							setLiveEntity(currentScene, currentEntity->id);
+						}
 					} 
 					if (mouseButtonHeld(0)) {
 						switch (currentScene->tool) {
 							case Tool_dropper: {
 								if (mousePosChanged || mouseButtonDown(0)) {
-									renderer->pickColor();
+									pickColor(currentScene, mouseScenePos);
 								}
 							} break;
 							case Tool_hand: {
@@ -2426,6 +5754,7 @@ int wmain(int argc, wchar **argv) {
 											auto &pencil = currentEntity->pencil;
 											if (smoothMousePosChanged || thicknessChanged || currentScene->drawColorDirty) {
 												if (pencil.popNextTime) {
+													invalidateLines(currentScene, pencil, &pencil.lines.back(), 1);
 													pencil.lines.pop_back();
 													renderer->onLinePopped(pencil);
 												}
@@ -2512,7 +5841,7 @@ int wmain(int argc, wchar **argv) {
 													renderer->resizePencilLineArray(pencil);
 													renderer->updateLastElement(pencil);
 
-													currentScene->needRepaint = true;
+													invalidateLines(currentScene, pencil, &newLine, 1);
 												}
 												//if (!pencil.popNextTime) {
 												//	if (connection) {
@@ -2534,13 +5863,11 @@ int wmain(int argc, wchar **argv) {
 											if (endpoint) {
 												line.line.a = *endpoint;
 												line.line.a.position -= line.position;
-												currentScene->needRepaint = true;
 												updateLine = true;
 											} 
 											if (keyUp(Key_control)) {
 												line.line.a.position = line.initialPosition;
 												line.line.a.thickness = line.initialThickness;
-												currentScene->needRepaint = true;
 												updateLine = true;
 											}
 											if (updateLine) {
@@ -2549,7 +5876,7 @@ int wmain(int argc, wchar **argv) {
 												// act.line.b.color = currentScene->drawColor;
 
 												renderer->updateLines(line.renderData, &line.line, 1, 0);
-												currentScene->needRepaint = true;
+												invalidateEntity(currentScene, line);
 											}
 										} break;
 										case Entity_grid: {
@@ -2565,8 +5892,7 @@ int wmain(int argc, wchar **argv) {
 												grid.thickness = getDrawThickness(currentScene);
 
 												renderer->updateGridLines(grid);
-
-												currentScene->needRepaint = true;
+												invalidateEntity(currentScene, grid);
 											}
 										} break;
 										case Entity_circle: {
@@ -2583,14 +5909,13 @@ int wmain(int argc, wchar **argv) {
 												circle.thickness = getDrawThickness(currentScene);
 
 												renderer->updateCircleLines(circle);
-												currentScene->needRepaint = true;
+												invalidateEntity(currentScene, circle);
 											}
 										} break;
 										default: INVALID_CODE_PATH();
 									}
 									if (drawBounds) {
-										calculateBounds(*currentEntity);
-										currentScene->needRepaint = true;
+										invalidateEntity(currentScene, *currentEntity);
 									}
 								}
 							} break;
@@ -2643,6 +5968,7 @@ int wmain(int argc, wchar **argv) {
 							//	net::sendBytes(connection, Net_stopAction);
 							//}
 							currentEntity = 0;
+							setLiveEntity(currentScene, invalidEntityId);
 							if (drawBounds) {
 								currentScene->needRepaint = true;
 							}
@@ -2726,7 +6052,7 @@ int wmain(int argc, wchar **argv) {
 
 		updatePieMenu(mainPieMenu);
 		
-		if (smoothMousePosChanged || currentScene->drawColorDirty || thicknessChanged) {
+		if (consumeDrawColorChange(currentScene) || smoothMousePosChanged || thicknessChanged) {
 			needRepaint = true;
 			renderer->updatePaintCursor(currentScene, smoothMousePos, currentScene->drawColor, currentScene->windowDrawThickness);
 		}
@@ -2751,6 +6077,10 @@ int wmain(int argc, wchar **argv) {
 
 		bool drawCursor = mouseHovering && !hoveringColorMenu && !cursorVisible;
 		renderer->repaint(drawCursor, drawCursor && currentScene->tool != Tool_hand);
+		if (captureNextFrame) {
+			captureNextFrame = false;
+			saveCapturedFrame();
+		}
 		for (auto &sc : scenes) {
 			if (sc.initialized) {
 				sc.extraActionsToDraw.clear();
@@ -2779,7 +6109,30 @@ int wmain(int argc, wchar **argv) {
 			setWindowTitle(builder.getNullTerminated().data());
 		}
 		previousMouseHovering = mouseHovering;
+
+		// Input wakes the loop up, only changes that happen without it keep it running
+		bool animating = debugPencil || cameraPanning || playingSceneShiftAnimation || cameraVelocity.x || cameraVelocity.y;
+		for (u32 i = 0; i < countof(mouseButtons); ++i) {
+			animating |= mouseButtons[i];
+		}
+		frameScheduler.endFrame(renderer->getLastFrame().commands.size() != 0, animating);
+	}
+
+	imageImportPool.waitIdle();
+	imageImportPool.deinit();
+	for (auto import : finishedImageImports) {
+		delete import;
+	}
+	imageDecodePool.deinit();
+	// Images that were not uploaded yet are dropped
+	for (auto decoded : decodedImages) {
+		for (auto &tile : decoded->tiles) {
+			renderer->releaseImageData(tile.renderData);
+		}
+		--decoded->image->uploading;
+		delete decoded;
 	}
+	decodedImages.clear();
 
 	for (auto &scene : scenes) {
 		if (!scene.initialized)
@@ -2791,7 +6144,6 @@ int wmain(int argc, wchar **argv) {
 	}
 
 	deinitThreadPool(&threadPool);
-	imageLoaderThread.join();
 
 	renderer->shutdown();
 
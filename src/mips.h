@@ -0,0 +1,144 @@
+#pragma once
+#include "base.h"
+#include <emmintrin.h>
+
+// Mip chains of images, built on the image decode workers (decode.h) instead of the GPU.
+// Images are decoded at full resolution and halved right away until they are about as large as they are
+// shown, so only a downscaled chain stays in memory. Halving is a 2x2 box filter, 4 pixels at a time with SSE2.
+
+// Images are kept at least this much larger than they are shown, so small zooms don't need a new decode
+constexpr f32 imageResolutionHeadroom = 1.5f;
+// Images shown smaller are kept at this size, so zooming out and back does not decode them again
+constexpr u32 minImageResolution = 256;
+
+struct MipLevel {
+	umm offset = 0; // In texels
+	v2u size = {};
+};
+
+struct MipChain {
+	List<u32> texels; // RGBA, levels from the largest, rows go from the top
+	List<MipLevel> levels;
+	v2u sourceSize = {}; // Decoded size, before the skipped levels
+
+	// Texels of a chain read from a mapped cache file (see diskcache.h) or of another chain, instead of 'texels'
+	u32 const *mappedTexels = 0;
+	umm mappedTexelCount = 0;
+
+	u32 const *texelData() const { return mappedTexels ? mappedTexels : texels.data(); }
+	umm texelCount() const { return mappedTexels ? mappedTexelCount : texels.size(); }
+	u32 const *level(u32 index) const { return texelData() + levels[index].offset; }
+	v2u size() const { return levels.size() ? levels[0].size : v2u{}; }
+	umm bytes() const { return texelCount() * sizeof(u32); }
+	// Full resolution chain, as it was stored before images were downscaled
+	umm sourceBytes() const { return (umm)sourceSize.x * sourceSize.y * sizeof(u32) * 4 / 3; }
+};
+
+// Reads the texels of 'chain' without copying them, 'chain' has to outlive it and stay unchanged
+inline MipChain viewMipChain(MipChain const &chain) {
+	MipChain view;
+	view.sourceSize = chain.sourceSize;
+	for (auto &level : chain.levels) {
+		view.levels.push_back(level);
+	}
+	view.mappedTexels = chain.texelData();
+	view.mappedTexelCount = chain.texelCount();
+	return view;
+}
+
+inline v2u getHalfSize(v2u size) {
+	return {max(size.x / 2, 1u), max(size.y / 2, 1u)};
+}
+
+// Halvings that keep the larger side of 'size' at least 'targetSize', 0 keeps the full resolution
+inline u32 getMipSkipCount(v2u size, u32 targetSize) {
+	u32 largest = max(size.x, size.y);
+	targetSize = max(targetSize, 1u);
+	u32 skip = 0;
+	while ((largest >> (skip + 1)) >= targetSize) {
+		++skip;
+	}
+	return skip;
+}
+
+// Averages 2x2 blocks of 'source' into 'destination' of getHalfSize(sourceSize). Odd last rows and columns are repeated.
+inline void halveImage(u32 const *source, v2u sourceSize, u32 *destination) {
+	v2u size = getHalfSize(sourceSize);
+	// Columns whose both source pixels exist
+	u32 simdWidth = (sourceSize.x / 2) & ~3u;
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i two = _mm_set1_epi16(2);
+	auto sumPairs = [&](__m128i sum) {
+		// Two adjacent pixels in 16 bit channels are added into the low half
+		return _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+	};
+
+	for (u32 y = 0; y < size.y; ++y) {
+		u32 const *row0 = source + (umm)min(y * 2, sourceSize.y - 1) * sourceSize.x;
+		u32 const *row1 = source + (umm)min(y * 2 + 1, sourceSize.y - 1) * sourceSize.x;
+		u32 *dst = destination + (umm)y * size.x;
+
+		u32 x = 0;
+		for (; x < simdWidth; x += 4) {
+			__m128i a0 = _mm_loadu_si128((__m128i const *)(row0 + x * 2));
+			__m128i a1 = _mm_loadu_si128((__m128i const *)(row0 + x * 2 + 4));
+			__m128i b0 = _mm_loadu_si128((__m128i const *)(row1 + x * 2));
+			__m128i b1 = _mm_loadu_si128((__m128i const *)(row1 + x * 2 + 4));
+
+			__m128i p0 = sumPairs(_mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero)));
+			__m128i p1 = sumPairs(_mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero)));
+			__m128i p2 = sumPairs(_mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero)));
+			__m128i p3 = sumPairs(_mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero)));
+
+			__m128i p01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(p0, p1), two), 2);
+			__m128i p23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(p2, p3), two), 2);
+			_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(p01, p23));
+		}
+		for (; x < size.x; ++x) {
+			u32 x0 = min(x * 2, sourceSize.x - 1);
+			u32 x1 = min(x * 2 + 1, sourceSize.x - 1);
+			u32 a = row0[x0], b = row0[x1], c = row1[x0], d = row1[x1];
+			u32 result = 0;
+			for (u32 shift = 0; shift < 32; shift += 8) {
+				u32 sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+				result |= ((sum + 2) >> 2) << shift;
+			}
+			dst[x] = result;
+		}
+	}
+}
+
+// Chain down to 1x1 whose first level is 'pixels' halved 'skip' times
+inline MipChain buildMipChain(u32 const *pixels, v2u size, u32 skip) {
+	MipChain chain;
+	chain.sourceSize = size;
+
+	// Skipped levels go through two scratch buffers, each one a quarter of the previous
+	List<u32> scratch[2];
+	u32 const *source = pixels;
+	for (u32 i = 0; i < skip; ++i) {
+		auto &halved = scratch[i & 1];
+		v2u halfSize = getHalfSize(size);
+		halved.resize((umm)halfSize.x * halfSize.y);
+		halveImage(source, size, halved.data());
+		source = halved.data();
+		size = halfSize;
+	}
+
+	umm texelCount = 0;
+	for (v2u levelSize = size;; levelSize = getHalfSize(levelSize)) {
+		chain.levels.push_back({texelCount, levelSize});
+		texelCount += (umm)levelSize.x * levelSize.y;
+		if (levelSize.x == 1 && levelSize.y == 1)
+			break;
+	}
+	chain.texels.resize(texelCount);
+
+	memcpy(chain.texels.data(), source, (umm)size.x * size.y * sizeof(u32));
+	for (umm i = 1; i < chain.levels.size(); ++i) {
+		auto &previous = chain.levels[i - 1];
+		halveImage(chain.texels.data() + previous.offset, previous.size, chain.texels.data() + chain.levels[i].offset);
+	}
+	return chain;
+}
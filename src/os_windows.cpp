@@ -420,6 +420,21 @@ void platform_beginFrame() {
 	}
 }
 
+void platform_waitForEvents(f64 timeoutSeconds) {
+	// Cursor leaving the window sends nothing by itself
+	TRACKMOUSEEVENT track = {};
+	track.cbSize = sizeof(track);
+	track.dwFlags = TME_LEAVE;
+	track.hwndTrack = mainWindow;
+	TrackMouseEvent(&track);
+
+	DWORD timeout = timeoutSeconds < 0 ? INFINITE : (DWORD)ceil(timeoutSeconds * 1000);
+	MsgWaitForMultipleObjectsEx(0, 0, timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+}
+void platform_wakeUp() {
+	PostMessageW(mainWindow, WM_NULL, 0, 0);
+}
+
 v2s getMousePos() {
 	POINT cursorPos;
 	GetCursorPos(&cursorPos);
@@ -432,3 +447,72 @@ v2s getMousePos() {
 void setWindowTitle(wchar const *title) {
 	SetWindowTextW(mainWindow, title);
 }
+
+static u64 toU64(FILETIME time) {
+	return ((u64)time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+bool platform_getFileInfo(wchar const *path, FileInfo &info) {
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExW(path, GetFileExInfoStandard, &data))
+		return false;
+	info.size = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	info.writeTime = toU64(data.ftLastWriteTime);
+	return true;
+}
+Span<u8 const> platform_mapFile(wchar const *path) {
+	// Deleting a mapped file succeeds, it goes away when the view is unmapped
+	HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, 0, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return {};
+	DEFER { CloseHandle(file); };
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || !size.QuadPart)
+		return {};
+
+	HANDLE mapping = CreateFileMappingW(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mapping)
+		return {};
+	DEFER { CloseHandle(mapping); };
+
+	// The view keeps the mapping alive after its handle is closed
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+		return {};
+	return {(u8 const *)view, (umm)size.QuadPart};
+}
+void platform_unmapFile(Span<u8 const> view) {
+	if (view.data()) {
+		UnmapViewOfFile(view.data());
+	}
+}
+bool platform_createDirectory(wchar const *path) {
+	return CreateDirectoryW(path, 0) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+List<DirectoryEntry> platform_listDirectory(wchar const *directory) {
+	List<DirectoryEntry> result;
+	WIN32_FIND_DATAW data;
+	HANDLE find = FindFirstFileW((std::wstring(directory) + L"*").data(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return result;
+	DEFER { FindClose(find); };
+	do {
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		DirectoryEntry entry;
+		entry.name = data.cFileName;
+		entry.size = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		entry.writeTime = toU64(data.ftLastWriteTime);
+		result.push_back(std::move(entry));
+	} while (FindNextFileW(find, &data));
+	return result;
+}
+void platform_touchFile(wchar const *path) {
+	HANDLE file = CreateFileW(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, 0, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	SetFileTime(file, 0, 0, &now);
+	CloseHandle(file);
+}
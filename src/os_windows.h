@@ -99,6 +99,29 @@ bool platform_messageBox(wchar const *text, wchar const *caption, MessageBoxType
 void platform_emergencySave(bool const *unsavedScenes);
 
 void platform_beginFrame();
+// Blocks until input or platform_wakeUp, negative timeout waits forever
+void platform_waitForEvents(f64 timeoutSeconds);
+void platform_wakeUp();
+
+// Files of the decoded image cache, see diskcache.h. Times are in 100 ns units of the OS.
+struct FileInfo {
+	u64 size = 0;
+	u64 writeTime = 0;
+};
+struct DirectoryEntry {
+	std::wstring name;
+	u64 size = 0;
+	u64 writeTime = 0;
+};
+bool platform_getFileInfo(wchar const *path, FileInfo &info);
+// Read only view of the whole file, empty if it could not be mapped
+Span<u8 const> platform_mapFile(wchar const *path);
+void platform_unmapFile(Span<u8 const> view);
+bool platform_createDirectory(wchar const *path);
+// Files directly in 'directory', which ends with a separator
+List<DirectoryEntry> platform_listDirectory(wchar const *directory);
+// Sets the write time to now
+void platform_touchFile(wchar const *path);
 
 void app_exitAbnormal();
 void app_onWindowClose();
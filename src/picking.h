@@ -0,0 +1,80 @@
+#pragma once
+#include "base.h"
+#include "lines.h"
+#include <algorithm>
+
+// Color under a scene point, answered from entities instead of reading the canvas back.
+// Entities are tested top-most first in the same order as findHoveredEntity, the live entity is drawn over all of them.
+
+struct ImagePixels {
+	u32 const *pixels = 0; // RGBA, rows go from the top. Null while the image is loading
+	v2u size = {};
+};
+
+// 'getPixels' returns ImagePixels of an ImageEntity
+template <class GetPixels>
+inline v3f pickSceneColor(Scene const *scene, v2f point, GetPixels &&getPixels) {
+	List<Entity const *> candidates;
+	for (auto &[id, e] : scene->entities) {
+		if (e.visible && inBounds(point, e.bounds)) {
+			candidates.push_back(&e);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [&](Entity const *a, Entity const *b) {
+		bool aLive = a->id == scene->liveEntityId;
+		bool bLive = b->id == scene->liveEntityId;
+		if (aLive != bLive)
+			return aLive;
+		return a->id > b->id;
+	});
+
+	// Images with alpha let entities under them through
+	v3f color = {};
+	f32 remaining = 1;
+	for (auto e : candidates) {
+		auto relativePoint = m2::rotation(e->rotation) * (point - e->position) + e->position;
+		switch (e->type) {
+			case Entity_pencil: {
+				auto &pencil = e->pencil;
+				if (findHoveredLine(pencil.lines.data(), pencil.lines.size(), pencil.position, relativePoint) != pencil.lines.size())
+					return color + pencil.color * remaining;
+			} break;
+			case Entity_line: {
+				auto &line = e->line;
+				if (findHoveredLine(&line.line, 1, line.position, relativePoint) != 1)
+					return color + line.color * remaining;
+			} break;
+			case Entity_grid: {
+				auto &grid = e->grid;
+				if (getGridLineDistance(grid, relativePoint - grid.position) < grid.thickness * 0.5f)
+					return color + grid.color * remaining;
+			} break;
+			case Entity_circle: {
+				auto &circle = e->circle;
+				auto lines = getCircleLines(circle);
+				if (findHoveredLine(lines.data(), CircleEntity::LINE_COUNT, circle.position, relativePoint) != CircleEntity::LINE_COUNT)
+					return color + circle.color * remaining;
+			} break;
+			case Entity_image: {
+				auto &image = e->image;
+				auto uv = map(relativePoint, image.position - image.size * 0.5f, image.position + image.size * 0.5f, 0, 1);
+				if (!inBounds(uv, aabbMinMax(V2f(0), V2f(1))))
+					break;
+				ImagePixels pixels = getPixels(image);
+				if (!pixels.pixels || !pixels.size.x || !pixels.size.y)
+					break;
+
+				u32 x = min((u32)(uv.x * pixels.size.x), pixels.size.x - 1);
+				u32 y = min((u32)((1 - uv.y) * pixels.size.y), pixels.size.y - 1);
+				u32 texel = pixels.pixels[y * pixels.size.x + x];
+				f32 alpha = (texel >> 24) / 255.0f;
+				color += V3f(texel & 0xFF, (texel >> 8) & 0xFF, (texel >> 16) & 0xFF) / 255.0f * alpha * remaining;
+				remaining *= 1 - alpha;
+				if (remaining <= 0)
+					return color;
+			} break;
+			default: INVALID_CODE_PATH();
+		}
+	}
+	return color + scene->canvasColor * remaining;
+}
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include "os_windows.h"
 #include "renderer.h"
+#include "lines.h"
+#include "batch.h"
 #include "../dep/tl/include/tl/d3d11.h"
 
 #define VERTS_PER_QUAD 6
@@ -27,9 +29,7 @@ DECLARE_CBUFFER(0, SceneConstantBufferData) { \
 	f32 sceneDrawThickness;					  \
 											  \
 	v2f sceneMousePos;						  \
-	v2f pad_;								  \
-											  \
-	v3f colorMenuColor;						  \
+	v2f sceneOffset;						  \
 }
 #define DECLARE_GLOBAL_CBUFFER				   \
 DECLARE_CBUFFER(1, GlobalConstantBufferData) { \
@@ -57,6 +57,8 @@ DECLARE_CBUFFER(3, ColorConstantBufferData) { \
 	f32 colorMenuAlpha;						  \
 	v3f colorMenuHueColor;					  \
 	f32 colorMenuHue;						  \
+											  \
+	v3f colorMenuColor;						  \
 }
 #define DECLARE_ENTITY_CBUFFER				   \
 DECLARE_CBUFFER(4, EntityConstantBufferData) { \
@@ -70,6 +72,17 @@ DECLARE_CBUFFER(4, EntityConstantBufferData) { \
 	v2f boundsMax;                             \
 											   \
 	m4 entityRotation;						   \
+											   \
+	v2f gridSize;							   \
+	v2u gridCellCount;						   \
+											   \
+	f32 gridThickness;						   \
+	u32 batchFirstVertex;					   \
+	u32 batchUseEntity;						   \
+	f32 imageMaxLevel;						   \
+											   \
+	v2f imageUvMin;							   \
+	v2f imageUvMax;							   \
 }
 
 DECLARE_SCENE_CBUFFER;
@@ -83,19 +96,45 @@ DECLARE_ENTITY_CBUFFER;
 struct LineData {
 	D3D11::StructuredBuffer buffer;
 	List<TransformedLine> transformedLines;
+
+	// Changes with the geometry, scene's stroke pool remeshes the entity when it differs from pooled version
+	u32 version = 0;
 };
 #define LINE_DATA(x) (*(LineData *)x)
 
 struct ImageData {
 	D3D11::Texture texture;
+	D3D11::Texture pendingTexture; // Being uploaded, replaces 'texture' when it's complete, see upload.h
+	List<ImageTile> tiles; // Drawn over the texture, see virtualtexture.h
+	AtlasPlacement atlas;  // Drawn from an atlas page instead of 'texture', see imageatlas.h
 };
 #define IMAGE_DATA(x) (*(ImageData *)x)
 
+// Textures of their own have every level padded by the texture's border, their sampled level is not clamped
+constexpr f32 imageUnclampedMaxLevel = 16;
+
 struct SceneData {
 	D3D11::TypedConstantBuffer<SceneConstantBufferData> constantBuffer;
 	SceneConstantBufferData constantBufferData;
+	// Allocated when the scene is drawn, released when the window is resized or CanvasPool evicts them
 	D3D11::RenderTexture canvasRT;
-	D3D11::RenderTexture canvasRTMS;
+	D3D11::RenderTexture canvasRTMS; // Only while multisampling is enabled
+	v2u canvasSize = {};
+
+	// Scene without the live entity, same sample count as the canvas it is copied to
+	D3D11::RenderTexture staticLayer;
+	u32 staticLayerSampleCount = 0;
+
+	// Copy of the resolved canvas, drawn back into the canvas with an offset when it scrolls
+	D3D11::RenderTexture scrollCopy;
+
+	StrokePool strokePool;
+	D3D11::StructuredBuffer poolBuffer;
+	u64 poolSyncFrame = 0; // Removed entities are dropped from the pool once per frame
+
+	// Indexed by pool slot, same contents as instanceBuffer
+	D3D11::StructuredBuffer instanceBuffer;
+	List<EntityInstance> instances;
 };
 #define SCENE_DATA(x) (*(SceneData *)x)
 
@@ -105,7 +144,7 @@ struct PieData {
 #define PIE_DATA(x) (*(PieData *)x)
 
 struct RendererImpl : Renderer, D3D11::State {
-	Shader lineShader, quadShader, blitShader, blitShaderMS, circleShader, pieSelShader, colorMenuShader, imageShader, imageOutlineShader, boundsShader;
+	Shader lineShader, gridShader, batchShader, quadShader, blitShader, blitShaderMS, circleShader, pieSelShader, colorMenuShader, imageShader, imageOutlineShader, boundsShader, atlasImageShader;
 	D3D11::StructuredBuffer uiSBuffer;
 	D3D11::Texture toolAtlas, unloadedTexture;
 	D3D11::Blend alphaBlend;
@@ -128,12 +167,36 @@ struct RendererImpl : Renderer, D3D11::State {
 	bool globalConstantBufferDirty = false;
 	bool wireframe = false;
 	bool vSync = true;
+	f32 pixelsPerUnit = 1;
+	u32 geometryVersionCounter = 0;
+	u64 frameCounter = 0;
+	DrawList frameDrawList;
+	List<StrokeVertex> meshScratch;
+	CanvasPool canvasPool;
+
+	ImageAtlas imageAtlas;
+	List<D3D11::Texture> atlasPages; // Same indices as imageAtlas.pages, null while a page is empty
+	D3D11::StructuredBuffer atlasInstanceBuffer;
+	List<AtlasImageInstance> atlasInstances;
+	List<u32> atlasBlockScratch;
 
 	RendererImpl();
 
-	void drawEntity(Entity const &action);
-	void repaintScene(Scene *scene);
-	void updatePieBuffer(PieMenu &menu);
+	u32 getGeometryVersion(Entity const &e);
+	void syncStrokePool(Scene *scene, DrawCommand const *commands, umm count);
+	void drawSceneEntities(Scene *scene, DrawCommand const *commands, umm count);
+	void drawEntity(Entity const &e, DrawCommand const &command);
+	void drawEntityBounds(Entity const &e);
+	void removeFromAtlas(ImageData &data);
+	D3D11::Texture &getAtlasPage(u32 index);
+	void beginScene(Scene *scene, bool partial, bool staticLayer);
+	void scrollScene(Scene *scene, v2s offset);
+	void releaseCanvas(Scene *scene);
+	void updateCanvasMemory(Scene *scene);
+	u32 getCanvasSampleCount();
+	void setClipRect(v2u min, v2u max);
+	D3D11::Rasterizer createClipRasterizer(D3D11_FILL_MODE fill, D3D11_CULL_MODE cull, bool multisample);
+	void endScene(Scene *scene);
 	
 	ID3D11VertexShader *createVertexShader(char const *src, umm srcSize, char const *name);
 	ID3D11PixelShader *createPixelShader(char const *src, umm srcSize, char const *name);
@@ -178,32 +241,10 @@ ID3D11PixelShader *RendererImpl::createPixelShader(char const *src, umm srcSize,
 	return result;
 }
 
-TransformedLine transform(Line line) {
-	TransformedLine result;
-	m2 rotation = m2::rotation(atan2(line.b.position - line.a.position));
-	result.a.transform = m2::scaling(line.a.thickness) * rotation;
-	result.b.transform = m2::scaling(line.b.thickness) * rotation;
-	result.a.position = line.a.position;
-	result.b.position = line.b.position;
-	return result;
-}
-
-List<TransformedLine> getTransformedGridLines(GridEntity const &grid) {
-	List<Line> lines = getGridLines(grid);
-	List<TransformedLine> result;
-	result.reserve(lines.size());
-	for (auto l : lines) {
-		result.push_back(transform(l));
-	}
-	return result;
-}
-
 Array<TransformedLine, CircleEntity::LINE_COUNT> getTransformedCircleLines(CircleEntity const &circle) {
 	auto lines = getCircleLines(circle);
 	Array<TransformedLine, CircleEntity::LINE_COUNT> result;
-	for (u32 i = 0; i < countof(lines); ++i) {
-		result[i] = transform(lines[i]);
-	}
+	transformLines(result.data(), lines.data(), CircleEntity::LINE_COUNT);
 	return result;
 }
 
@@ -213,6 +254,8 @@ Array<TransformedLine, CircleEntity::LINE_COUNT> getTransformedCircleLines(Circl
 #define v2f float2
 #define v3f float3
 #define v4f float4
+#define u32 uint
+#define v2u uint2
 #define m4 float4x4
 )" \
 STRINGIZE(DECLARE_SCENE_CBUFFER) \
@@ -221,8 +264,8 @@ STRINGIZE(DECLARE_PIE_CBUFFER) \
 STRINGIZE(DECLARE_COLOR_CBUFFER) \
 STRINGIZE(DECLARE_ENTITY_CBUFFER) \
 R"(
-float2 sceneToNDC(float2 p) { return (p - scenePosition) * sceneScale; }
-float2 sceneToNDC(float2 p, float2 offset) { return (p - scenePosition + offset) * sceneScale; }
+float2 sceneToNDC(float2 p) { return (p - scenePosition) * sceneScale + sceneOffset; }
+float2 sceneToNDC(float2 p, float2 offset) { return (p - scenePosition + offset) * sceneScale + sceneOffset; }
 float2 windowToNDC(float2 p) { return mul(matrixWindowToNDC, float4(p, 0, 1)).xy; }
 float4 getImagePosition(float2 v) {
 	return float4(sceneToNDC(entityPosition, mul(entityRotation, float4((v - 0.5f) * imageSize, 0, 1)).xy), 0, 1);
@@ -230,6 +273,47 @@ float4 getImagePosition(float2 v) {
 #undef DECLARE_CBUFFER
 )"
 
+#define LINE_VERTEX_SOURCE R"(
+#define VERTS_PER_LINE )" STRINGIZE(VERTS_PER_LINE) R"(
+
+struct Vertex {
+	float2 position;
+	float t;
+};
+
+#define maxx 0.5f
+#define SIN(x) (sin((x) / 180.0f * 3.1415926535897932384626433832795f) * maxx)
+#define COS(x) (cos((x) / 180.0f * 3.1415926535897932384626433832795f) * maxx)
+#define CS(x) {COS(x),SIN(x)}
+
+#define HALF(x, a, b)								      \
+	{CS(x+270), a}, {CS(x+90), a}, {CS(x+270), b},        \
+															\
+	{CS(x+180), a}, {CS(x+90), a}, {CS(x+270), a},	      \
+															\
+	{CS(x+135), a}, {CS(x+ 90), a}, {CS(x+180), a},	      \
+	{CS(x+225), a}, {CS(x+180), a}, {CS(x+270), a},	      \
+															\
+	{CS(x+112.5), a}, {CS(x+ 90), a}, {CS(x+135), a},     \
+	{CS(x+157.5), a}, {CS(x+135), a}, {CS(x+180), a},     \
+	{CS(x+202.5), a}, {CS(x+180), a}, {CS(x+225), a},     \
+	{CS(x+247.5), a}, {CS(x+225), a}, {CS(x+270), a},     \
+															\
+	{CS(x+101.25), a}, {CS(x+90   ), a}, {CS(x+112.5), a},\
+	{CS(x+123.75), a}, {CS(x+112.5), a}, {CS(x+135  ), a},\
+	{CS(x+146.25), a}, {CS(x+135  ), a}, {CS(x+157.5), a},\
+	{CS(x+168.75), a}, {CS(x+157.5), a}, {CS(x+180  ), a},\
+	{CS(x+191.25), a}, {CS(x+180  ), a}, {CS(x+202.5), a},\
+	{CS(x+213.75), a}, {CS(x+202.5), a}, {CS(x+225  ), a},\
+	{CS(x+236.25), a}, {CS(x+225  ), a}, {CS(x+247.5), a},\
+	{CS(x+258.75), a}, {CS(x+247.5), a}, {CS(x+270  ), a}
+
+static const Vertex vertexBuffer[] = {
+	HALF(  0, 0, 1),
+	HALF(180, 1, 0),
+};
+)"
+
 extern HWND mainWindow;
 
 
@@ -241,14 +325,23 @@ R_initScene {
 	scene->renderData = data;
 }
 R_releaseScene {
-	release(SCENE_DATA(scene->renderData).canvasRT); 
-	release(SCENE_DATA(scene->renderData).canvasRTMS); 
+	releaseCanvas(scene);
 	release(SCENE_DATA(scene->renderData).constantBuffer); 
+	release(SCENE_DATA(scene->renderData).poolBuffer); 
+	release(SCENE_DATA(scene->renderData).instanceBuffer); 
+	SCENE_DATA(scene->renderData).~SceneData();
 	DEALLOCATE(TL_DEFAULT_ALLOCATOR, scene->renderData);
 	scene->renderData = 0;
 }
 R_resize {
 	resizeBackBuffer(clientSize.x, clientSize.y);
+
+	// All scenes get needResize, canvases are allocated again when a scene is drawn
+	for (auto &scene : scenes) {
+		if (scene.renderData) {
+			releaseCanvas(&scene);
+		}
+	}
 }
 R_initPencilEntity {
 	pencil.renderData = construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, LineData, 1, 0));
@@ -257,7 +350,7 @@ R_initLineEntity {
 	line.renderData = construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, LineData, 1, 0));
 }
 R_initGridEntity {
-	grid.renderData = construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, LineData, 1, 0));
+	// Grid lines are generated in the vertex shader, nothing to store
 }
 R_initCircleEntity {
 	circle.renderData = construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, LineData, 1, 0));
@@ -269,39 +362,57 @@ R_createImageData {
 }
 R_initPencilEntityData{
 	List<TransformedLine> transformedLines;
-	transformedLines.reserve(pencil.lines.size());
-	for (auto line : pencil.lines) {
-		transformedLines.push_back(transform(line));
-	}
+	transformedLines.resize(pencil.lines.size());
+	transformLines(transformedLines.data(), pencil.lines.data(), pencil.lines.size());
 	initConstantLineArray(pencil.renderData, transformedLines.data(), transformedLines.size());
+	LINE_DATA(pencil.renderData).version = ++geometryVersionCounter;
 }
 R_initLineEntityData{
 	TransformedLine transformedLine = transform(line.line);
 	initConstantLineArray(line.renderData, &transformedLine, 1);
+	LINE_DATA(line.renderData).version = ++geometryVersionCounter;
 }
 R_initGridEntityData{
-	auto lines = getTransformedGridLines(grid);
-	initConstantLineArray(grid.renderData, lines.data(), lines.size());
 }
 R_initCircleEntityData{
 	initConstantLineArray(circle.renderData, getTransformedCircleLines(circle).data(), CircleEntity::LINE_COUNT);
+	LINE_DATA(circle.renderData).version = ++geometryVersionCounter;
 }
+// Swatch color is in the color menu's constant buffer, which is uploaded whenever the menu is drawn.
+// Scene's buffer is only uploaded when the scene is repainted, which dragging a color does not need.
 R_onColorMenuOpen{
 	switch (target) {
 		case ColorMenuTarget_draw:
-			SCENE_DATA(currentScene->renderData).constantBufferData.colorMenuColor = currentScene->drawColor;
+			colorConstantBufferData.colorMenuColor = currentScene->drawColor;
 			break;
 		case ColorMenuTarget_canvas:
-			SCENE_DATA(currentScene->renderData).constantBufferData.colorMenuColor = currentScene->canvasColor;
+			colorConstantBufferData.colorMenuColor = currentScene->canvasColor;
 			break;
 	}
 }
 R_setColorMenuColor{
-	SCENE_DATA(scene->renderData).constantBufferData.colorMenuColor = rgb;
+	colorConstantBufferData.colorMenuColor = rgb;
 }
 R_repaint{
 	SCOPED_LOCK(immediateContextMutex);
 
+	FrameInfo info;
+	info.clientSize = clientSize;
+	info.mousePosBL = mousePosBL;
+	info.minWindowDim = minWindowDim;
+	info.needRepaint = needRepaint;
+	info.drawCursor = drawCursor;
+	info.drawCursorCircle = drawCursorCircle;
+	recordFrame(frameDrawList, info);
+	needRepaint = false;
+
+	execute(frameDrawList);
+	debugPoints.clear();
+}
+R_execute{
+	SCOPED_LOCK(immediateContextMutex);
+	++frameCounter;
+
 	if (windowSizeDirty) {
 		windowSizeDirty = false;
 		globalConstantBufferDirty = true;
@@ -314,142 +425,143 @@ R_repaint{
 	}
 
 	setViewport(0, 0, clientSize.x, clientSize.y);
+	setClipRect({}, clientSize);
 
-	if (shouldRepaint(currentScene)) {
-		repaintScene(currentScene);
-	}
-	if (playingSceneShiftAnimation) {
-		if (shouldRepaint(previousScene)) {
-			repaintScene(previousScene);
+	if (!list.commands.size())
+		return;
+
+	canvasPool.beginFrame();
+	for (auto &command : list.commands) {
+		switch (command.type) {
+			case DrawCommand_beginScene: canvasPool.use(scenes + command.beginScene.sceneIndex); break;
+			case DrawCommand_blitScene:  canvasPool.use(scenes + command.blitScene.sceneIndex); break;
 		}
 	}
 
-	if (needRepaint) {
-		needRepaint = false;
-
-		setRenderTarget(backBuffer);
-		setShader(blitShader.vs);
-		setShader(blitShader.ps);
-		setRasterizer(defaultRasterizerNoMs);
-		setBlend();
-
-		if (playingSceneShiftAnimation) {
-			if (currentScene > previousScene)
-				setViewport(lerp(0.0f, -(f32)clientSize.x, sceneShiftT), 0, clientSize.x, clientSize.y);
-			else
-				setViewport(lerp(0.0f, clientSize.x, sceneShiftT), 0, clientSize.x, clientSize.y);
-
-			setShaderResource(SCENE_DATA(previousScene->renderData).canvasRT, 'P', 0);
-			draw(3);
+	for (umm commandIndex = 0; commandIndex < list.commands.size(); ++commandIndex) {
+		auto &command = list.commands[commandIndex];
+		switch (command.type) {
+			case DrawCommand_beginScene: {
+				beginScene(scenes + command.beginScene.sceneIndex, command.beginScene.partial, command.beginScene.staticLayer);
+			} break;
+			case DrawCommand_useStaticLayer: {
+				Scene *scene = scenes + command.useStaticLayer.sceneIndex;
+				auto &sceneData = SCENE_DATA(scene->renderData);
+				auto &canvas = isMultisampleEnabled() ? sceneData.canvasRTMS : sceneData.canvasRT;
+				if (sceneData.staticLayerSampleCount == getCanvasSampleCount()) {
+					immediateContext->CopyResource(canvas.tex, sceneData.staticLayer.tex);
+				} else {
+					// Multisampling was switched, layer will be redrawn next frame
+					clearRenderTarget(canvas, V4f(scene->canvasColor, 1.0f).data());
+					scene->staticLayerValid = false;
+				}
+				setRenderTarget(canvas);
+				setClipRect({}, clientSize);
+			} break;
+			case DrawCommand_scrollScene: {
+				scrollScene(scenes + command.scrollScene.sceneIndex, command.scrollScene.offset);
+			} break;
+			case DrawCommand_clipScene: {
+				setClipRect(command.clipScene.min, command.clipScene.max);
 
-			if (currentScene > previousScene)
-				setViewport(lerp(clientSize.x, 0.0f, sceneShiftT), 0, clientSize.x, clientSize.y);
-			else
-				setViewport(lerp(-(f32)clientSize.x, 0.0f, sceneShiftT), 0, clientSize.x, clientSize.y);
-		}
-		else {
-			setViewport(clientSize.x, clientSize.y);
-		}
+				EntityConstantBufferData data = {};
+				data.entityColor = scenes[command.clipScene.sceneIndex].canvasColor;
+				updateConstantBuffer(entityConstantBuffer, &data);
 
-		setShaderResource(SCENE_DATA(currentScene->renderData).canvasRT, 'P', 0);
-		draw(3);
-		setBlend(alphaBlend);
-
-		StaticList<Quad, 256> quads;
-
-		auto makeQuad = [](v2f position, v2f size, v2u uv, v2u uvSize, v4f color) {
-			Quad q;
-			q.position = position;
-			q.position.y -= size.y;
-			q.size = size;
-			q.color = color;
-			setUv(q, uv, uvSize);
-			return q;
-		};
-		auto pushShadowedQuad = [&](v2f position, v2f size, v2u uv, v2u uvSize, v4f color, f32 shadowSize = 2.0f) {
-			auto quad = makeQuad(position, size, uv, uvSize, color);
-			auto shadow = quad;
-			shadow.position += v2f{ 1,-2 };
-			shadow.color.xyz *= 0;
-			quads.push_back(shadow);
-			quads.push_back(quad);
-		};
-		auto pushQuad = [&](v2f position, v2f size, v2u uv, v2u uvSize, v4f color) {
-			quads.push_back(makeQuad(position, size, uv, uvSize, color));
-		};
-		auto drawPieMenu = [&](PieMenu& menu) {
-			updatePieBuffer(menu);
-			if (menu.animValue) {
-				setConstantBuffer(PIE_DATA(menu.renderData).constantBuffer, 'V', 2);
+				setTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+				setShader(blitShader.vs);
+				setShader(lineShader.ps);
+				setRasterizer(defaultRasterizer);
+				draw(3);
+			} break;
+			case DrawCommand_entity: {
+				// Consecutive entities of a scene are batched together
+				umm end = commandIndex + 1;
+				while (end < list.commands.size() && list.commands[end].type == DrawCommand_entity) {
+					++end;
+				}
+				drawSceneEntities(scenes + command.entity.sceneIndex, list.commands.data() + commandIndex, end - commandIndex);
+				commandIndex = end - 1;
+			} break;
+			case DrawCommand_endScene: {
+				endScene(scenes + command.endScene.sceneIndex);
+			} break;
+			case DrawCommand_blitScene: {
+				auto &blit = command.blitScene;
+				auto &scene = scenes[blit.sceneIndex];
+				setRenderTarget(backBuffer);
+				setShader(blitShader.vs);
+				setShader(blitShader.ps);
+				setRasterizer(defaultRasterizerNoMs);
+				setBlend();
+				bool scaled = blit.canvasScale != 1 || blit.canvasOffset != v2f{};
+				if (scaled) {
+					// Canvas drawn at another zoom is stretched over its rect in the window, the rest is canvas color
+					clearRenderTarget(backBuffer, V4f(scene.canvasColor, 1.0f).data());
+					v2f min = -blit.canvasOffset / blit.canvasScale;
+					v2f size = (v2f)clientSize / blit.canvasScale;
+					setViewport(blit.viewportX + min.x, (f32)clientSize.y - (min.y + size.y), size.x, size.y);
+				} else {
+					setViewport(blit.viewportX, 0, clientSize.x, clientSize.y);
+				}
+				setShaderResource(SCENE_DATA(scene.renderData).canvasRT, 'P', 0);
+				draw(3);
+				setBlend(alphaBlend);
+				if (scaled) {
+					setViewport(0, 0, clientSize.x, clientSize.y);
+				}
+			} break;
+			case DrawCommand_pieMenu: {
+				PieConstantBufferData data;
+				data.piePos = command.pieMenu.position;
+				data.pieSize = command.pieMenu.size;
+				data.pieAlpha = command.pieMenu.alpha;
+				data.pieAngle = command.pieMenu.angle;
+				updateConstantBuffer(PIE_DATA(mainPieMenu.renderData).constantBuffer, &data);
+
+				setConstantBuffer(PIE_DATA(mainPieMenu.renderData).constantBuffer, 'V', 2);
 				setShader(pieSelShader.vs);
 				setShader(pieSelShader.ps);
-
 				draw(PIE_SEL_VERT_COUNT);
-
-				for (u32 i = 0; i < menu.items.size(); ++i) {
-					v2f offset = m2::rotation(map(i, 0.0f, menu.items.size(), 0.0f, pi * 2)) * V2f(-pieMenuSize, 0);
-					auto& item = menu.items[i];
-					v2f size = V2f(toolImageSize);
-					v2f position = round(menu.position + offset * menu.animValue + v2f{ -1, 1 } *size * 0.5f);
-					v4f color = V4f(1, 1, 1, menu.animValue);
-
-					pushQuad(position - size * 0.5f * v2f{ 1,-1 }, size * 2, { 2, 2 }, { 2, 2 }, V4f(V3f(0.5f), menu.animValue));
-					pushShadowedQuad(position, size, item.uv, { 1,1 }, color);
-
-					//position.x += size.x * 0.5f;
-					//position.y -= size.y * 0.5f;
-					//size *= 0.5f;
-					if (item.type == PieMenuItem_toolColor) {
-						pushShadowedQuad(position, size, { 2, 0 }, { 1,1 }, color);
-					}
-					else if (item.type == PieMenuItem_canvasColor) {
-						pushShadowedQuad(position, size, { 3, 1 }, { 1,1 }, color);
-					}
-				}
-			}
-		};
-
-		drawPieMenu(mainPieMenu);
-		//drawPieMenu(toolPieMenu);
-		//drawPieMenu(canvasPieMenu);
-
-		if (drawCursorCircle) {
-			setShader(circleShader.vs);
-			setShader(circleShader.ps);
-			setRasterizer(defaultRasterizer);
-			draw(CIRCLE_VERTEX_COUNT);
-		}
-		if (drawCursor) {
-			pushShadowedQuad((v2f)mousePosBL, V2f(toolImageSize), getUv(currentScene->tool), { 1,1 }, V4f(1));
-		}
-		updateStructuredBuffer(uiSBuffer, quads.size(), sizeof(Quad), quads.data());
-		setShader(quadShader.vs);
-		setShader(quadShader.ps);
-		setShaderResource(uiSBuffer, 'V', 0);
-		setShaderResource(toolAtlas, 'P', 0);
-		setRasterizer(defaultRasterizerNoMs);
-		draw(quads.size() * VERTS_PER_QUAD);
-
-		if (colorMenuAnimValue) {
-			colorConstantBufferData.colorMenuSize = minWindowDim * 0.2f;
-			colorConstantBufferData.colorMenuPosition = v2f{ colorMenuPositionTL.x, clientSize.y - colorMenuPositionTL.y };
-			colorConstantBufferData.colorMenuAlpha = colorMenuAnimValue;
-			colorConstantBufferData.colorMenuHueColor = hsvToRgb(colorMenuHue, 1, 1);
-			colorConstantBufferData.colorMenuHue = colorMenuHue;
-			updateConstantBuffer(colorConstantBuffer, &colorConstantBufferData);
-
-			setShader(colorMenuShader.vs);
-			setShader(colorMenuShader.ps);
-			setRasterizer(defaultRasterizer);
-			draw(9);
+			} break;
+			case DrawCommand_cursorCircle: {
+				setShader(circleShader.vs);
+				setShader(circleShader.ps);
+				setRasterizer(defaultRasterizer);
+				draw(CIRCLE_VERTEX_COUNT);
+			} break;
+			case DrawCommand_quads: {
+				u32 quadCount = min(command.quads.quadCount, (u32)(uiSBuffer.size / sizeof(Quad)));
+				updateStructuredBuffer(uiSBuffer, quadCount, sizeof(Quad), list.quads.data() + command.quads.firstQuad);
+				setShader(quadShader.vs);
+				setShader(quadShader.ps);
+				setShaderResource(uiSBuffer, 'V', 0);
+				setShaderResource(toolAtlas, 'P', 0);
+				setRasterizer(defaultRasterizerNoMs);
+				draw(quadCount * VERTS_PER_QUAD);
+			} break;
+			case DrawCommand_colorMenu: {
+				colorConstantBufferData.colorMenuSize = command.colorMenu.size;
+				colorConstantBufferData.colorMenuPosition = command.colorMenu.position;
+				colorConstantBufferData.colorMenuAlpha = command.colorMenu.alpha;
+				colorConstantBufferData.colorMenuHueColor = command.colorMenu.hueColor;
+				colorConstantBufferData.colorMenuHue = command.colorMenu.hue;
+				updateConstantBuffer(colorConstantBuffer, &colorConstantBufferData);
+
+				setShader(colorMenuShader.vs);
+				setShader(colorMenuShader.ps);
+				setRasterizer(defaultRasterizer);
+				draw(9);
+			} break;
+			case DrawCommand_present: {
+				swapChain->Present(vSync, 0);
+			} break;
+			default: INVALID_CODE_PATH();
 		}
-
-		swapChain->Present(vSync, 0);
-	}
-	else {
-		Sleep(16);
 	}
-	debugPoints.clear();
+}
+R_getLastFrame{
+	return frameDrawList;
 }
 R_initConstantLineArray{
 	LINE_DATA(renderData).buffer = createStructuredBuffer(D3D11_USAGE_IMMUTABLE, count, sizeof(TransformedLine), data);
@@ -491,10 +603,17 @@ R_releaseCircle {
 }
 R_releaseImageData {
 	auto &data = IMAGE_DATA(renderData);
+	if (data.pendingTexture.tex) {
+		release(data.pendingTexture);
+		data.pendingTexture = {};
+	}
+	// Textures are only written on the main thread, see upload.h, so nothing writes to a released image
 	if (data.texture.srv != unloadedTexture.srv) {
 		release(data.texture); 
-		DEALLOCATE(TL_DEFAULT_ALLOCATOR, renderData);
 	}
+	removeFromAtlas(data);
+	data.~ImageData();
+	DEALLOCATE(TL_DEFAULT_ALLOCATOR, renderData);
 }
 R_releaseEntity{
 	switch (action.type) {
@@ -511,30 +630,6 @@ R_releaseEntity{
 R_switchRasterizer{
 	wireframe = !wireframe;
 }
-R_pickColor{
-	if (device3) {
-		SCOPED_LOCK(immediateContextMutex);
-
-		DHR(immediateContext->Map(SCENE_DATA(currentScene->renderData).canvasRT.tex, 0, D3D11_MAP_READ, 0, 0));
-		D3D11_BOX box = {};
-		box.left = mousePosTL.x;
-		box.top = mousePosTL.y;
-		box.right = box.left + 1;
-		box.bottom = box.top + 1;
-		box.back = 1;
-		struct {
-			u8 r, g, b, _;
-		} pixel;
-		device3->ReadFromSubresource(&pixel, 1, 1, SCENE_DATA(currentScene->renderData).canvasRT.tex, 0, &box);
-		immediateContext->Unmap(SCENE_DATA(currentScene->renderData).canvasRT.tex, 0);
-		currentScene->drawColor.x = pixel.r / 255.0f;
-		currentScene->drawColor.y = pixel.g / 255.0f;
-		currentScene->drawColor.z = pixel.b / 255.0f;
-		currentScene->drawColorDirty = true;
-	} else {
-		LOG("How to read from texture on device1?");
-	}
-}
 R_resizeLineArray{
 	u32 bufferElemCount = LINE_DATA(renderData).buffer.size / sizeof(TransformedLine);
 	if (count > bufferElemCount) {
@@ -547,20 +642,21 @@ R_updateLineArray{
 }
 R_updateLines{
 	List<TransformedLine> transformedLines;
-	while (count--) {
-		transformedLines.push_back(transform(*data++));
-	}
+	transformedLines.resize(count);
+	transformLines(transformedLines.data(), data, count);
 	updateLineArray(renderData, transformedLines.data(), transformedLines.size(), firstElem);
+	LINE_DATA(renderData).version = ++geometryVersionCounter;
 }
 R_updateGridLines{
-	List<TransformedLine> lines = getTransformedGridLines(grid);
-	updateLineArray(grid.renderData, lines.data(), lines.size(), 0);
+	// Grid parameters are read from the entity in drawEntity
 }
 R_updateCircleLines{
 	updateLineArray(circle.renderData, getTransformedCircleLines(circle).data(), CircleEntity::LINE_COUNT, 0);
+	LINE_DATA(circle.renderData).version = ++geometryVersionCounter;
 }
 R_freeze{
 	LINE_DATA(pencil.renderData).transformedLines = {};
+	LINE_DATA(pencil.renderData).version = ++geometryVersionCounter;
 }
 R_resizePencilLineArray{
 	resizeLineArray(pencil.renderData, LINE_DATA(pencil.renderData).transformedLines.data(), LINE_DATA(pencil.renderData).transformedLines.size());
@@ -568,9 +664,88 @@ R_resizePencilLineArray{
 R_updateLastElement{
 	updateLineArray(pencil.renderData, LINE_DATA(pencil.renderData).transformedLines.end() - 1, 1, LINE_DATA(pencil.renderData).transformedLines.size() - 1);
 }
-R_setTexture{
+R_beginTexture{
+	SCOPED_LOCK(immediateContextMutex);
+	auto &pending = IMAGE_DATA(image).pendingTexture;
+	if (pending.tex) {
+		release(pending);
+		pending = {};
+	}
+
+	// Every level comes from the CPU, see mips.h. Levels are filled in pieces by updateTexture.
+	D3D11_TEXTURE2D_DESC desc = {};
+	desc.Width = mips.size().x;
+	desc.Height = mips.size().y;
+	desc.MipLevels = (UINT)mips.levels.size();
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	desc.SampleDesc = {1, 0};
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	DHR(device->CreateTexture2D(&desc, 0, &pending.tex));
+}
+R_updateTexture{
+	SCOPED_LOCK(immediateContextMutex);
+	auto &mipLevel = mips.levels[level];
+	D3D11_BOX box = {0, firstRow, 0, mipLevel.size.x, firstRow + rowCount, 1};
+	u32 pitch = mipLevel.size.x * sizeof(u32);
+	immediateContext->UpdateSubresource(IMAGE_DATA(image).pendingTexture.tex, level, &box, mips.level(level) + (umm)firstRow * mipLevel.size.x, pitch, 0);
+}
+R_endTexture{
 	SCOPED_LOCK(immediateContextMutex);
-	IMAGE_DATA(image).texture = State::createTexture(width, height, DXGI_FORMAT_R8G8B8A8_UNORM, data, true);
+	auto &data = IMAGE_DATA(image);
+	removeFromAtlas(data);
+	// Replaced when a larger resolution is decoded
+	if (data.texture.srv != unloadedTexture.srv) {
+		release(data.texture);
+	}
+	data.texture = data.pendingTexture;
+	data.pendingTexture = {};
+	DHR(device->CreateShaderResourceView(data.texture.tex, 0, &data.texture.srv));
+}
+R_setImageTiles{
+	SCOPED_LOCK(immediateContextMutex);
+	auto &data = IMAGE_DATA(image);
+	data.tiles.clear();
+	data.tiles.resize(count);
+	memcpy(data.tiles.data(), tiles, count * sizeof(ImageTile));
+}
+R_setAtlasImage{
+	SCOPED_LOCK(immediateContextMutex);
+	auto &data = IMAGE_DATA(image);
+	removeFromAtlas(data);
+
+	if (!imageAtlas.place(mips.size(), data.atlas)) {
+		beginTexture(image, mips);
+		for (u32 i = 0; i < mips.levels.size(); ++i) {
+			updateTexture(image, mips, i, 0, mips.levels[i].size.y);
+		}
+		endTexture(image);
+		return;
+	}
+
+	if (data.pendingTexture.tex) {
+		release(data.pendingTexture);
+		data.pendingTexture = {};
+	}
+	if (data.texture.srv != unloadedTexture.srv) {
+		release(data.texture);
+	}
+	data.texture = unloadedTexture;
+
+	auto &placement = data.atlas;
+	auto &page = getAtlasPage(placement.page);
+	for (u32 level = 0; level < placement.levelCount; ++level) {
+		copyAtlasBlock(mips, placement, level, atlasBlockScratch);
+		v2u position = {placement.position.x >> level, placement.position.y >> level};
+		v2u size = {placement.blockSize.x >> level, placement.blockSize.y >> level};
+		D3D11_BOX box = {position.x, position.y, 0, position.x + size.x, position.y + size.y, 1};
+		immediateContext->UpdateSubresource(page.tex, level, &box, atlasBlockScratch.data(), size.x * sizeof(u32), 0);
+	}
+}
+R_getImageAtlasStats{
+	SCOPED_LOCK(immediateContextMutex);
+	return imageAtlas.getStats();
 }
 R_updatePaintCursor{
 	globalConstantBufferData.windowMousePos = windowMousePos;
@@ -579,10 +754,18 @@ R_updatePaintCursor{
 	globalConstantBufferDirty = true;
 } 
 R_isLoaded {
-	return IMAGE_DATA(image.renderData).texture.srv != unloadedTexture.srv;
+	auto &data = IMAGE_DATA(image.renderData);
+	return data.texture.srv != unloadedTexture.srv || data.atlas.page != noAtlasPage;
 }
 R_setUnloadedTexture{
-	IMAGE_DATA(imageData).texture = unloadedTexture;
+	SCOPED_LOCK(immediateContextMutex);
+	auto &texture = IMAGE_DATA(imageData).texture;
+	// Evicted by the image cache
+	if (texture.srv && texture.srv != unloadedTexture.srv) {
+		release(texture);
+	}
+	texture = unloadedTexture;
+	removeFromAtlas(IMAGE_DATA(imageData));
 }
 R_update{
 	SCENE_DATA(scene->renderData).constantBufferData.sceneDrawThickness = getDrawThickness(scene);
@@ -613,6 +796,15 @@ R_isMultisampleEnabled {
 R_setVSync {
 	vSync = enable;
 }
+R_getCanvasStats {
+	SCOPED_LOCK(immediateContextMutex);
+	return canvasPool.stats;
+}
+R_setCanvasBudget {
+	SCOPED_LOCK(immediateContextMutex);
+	canvasPool.stats.budget = bytes;
+	canvasPool.trim([&](Scene *scene) { releaseCanvas(scene); });
+}
 R_shutdown {
 	release(PIE_DATA(mainPieMenu.renderData).constantBuffer);
 	DEALLOCATE(TL_DEFAULT_ALLOCATOR, mainPieMenu.renderData);
@@ -684,9 +876,7 @@ RendererImpl::RendererImpl() {
 
 	
 	work.push([&]  {
-		char vertexShaderSourceData[] = SHADER_COMMON_SOURCE R"(
-#define VERTS_PER_LINE )" STRINGIZE(VERTS_PER_LINE) R"(
-
+		char vertexShaderSourceData[] = SHADER_COMMON_SOURCE LINE_VERTEX_SOURCE R"(
 struct Point {
 	float2x2 transform;
 	float2 position;
@@ -696,10 +886,6 @@ struct Line {
 };
 StructuredBuffer<Line> lines : register(t0);
 
-struct Vertex {
-	float2 position;
-	float t;
-};
 struct Out {
 	float4 position : SV_Position;
 };
@@ -707,37 +893,6 @@ struct In {
 	uint id : SV_VertexId;
 };
 
-#define maxx 0.5f
-#define SIN(x) (sin((x) / 180.0f * 3.1415926535897932384626433832795f) * maxx)
-#define COS(x) (cos((x) / 180.0f * 3.1415926535897932384626433832795f) * maxx)
-#define CS(x) {COS(x),SIN(x)}
-
-#define HALF(x, a, b)								      \
-	{CS(x+270), a}, {CS(x+90), a}, {CS(x+270), b},        \
-															\
-	{CS(x+180), a}, {CS(x+90), a}, {CS(x+270), a},	      \
-															\
-	{CS(x+135), a}, {CS(x+ 90), a}, {CS(x+180), a},	      \
-	{CS(x+225), a}, {CS(x+180), a}, {CS(x+270), a},	      \
-															\
-	{CS(x+112.5), a}, {CS(x+ 90), a}, {CS(x+135), a},     \
-	{CS(x+157.5), a}, {CS(x+135), a}, {CS(x+180), a},     \
-	{CS(x+202.5), a}, {CS(x+180), a}, {CS(x+225), a},     \
-	{CS(x+247.5), a}, {CS(x+225), a}, {CS(x+270), a},     \
-															\
-	{CS(x+101.25), a}, {CS(x+90   ), a}, {CS(x+112.5), a},\
-	{CS(x+123.75), a}, {CS(x+112.5), a}, {CS(x+135  ), a},\
-	{CS(x+146.25), a}, {CS(x+135  ), a}, {CS(x+157.5), a},\
-	{CS(x+168.75), a}, {CS(x+157.5), a}, {CS(x+180  ), a},\
-	{CS(x+191.25), a}, {CS(x+180  ), a}, {CS(x+202.5), a},\
-	{CS(x+213.75), a}, {CS(x+202.5), a}, {CS(x+225  ), a},\
-	{CS(x+236.25), a}, {CS(x+225  ), a}, {CS(x+247.5), a},\
-	{CS(x+258.75), a}, {CS(x+247.5), a}, {CS(x+270  ), a}
-
-static const Vertex vertexBuffer[] = {
-	HALF(  0, 0, 1),
-	HALF(180, 1, 0),
-};
 float4 main(in In i) : SV_Position {
 	Out o;
 	Vertex vertex = vertexBuffer[i.id % VERTS_PER_LINE];
@@ -759,6 +914,94 @@ float4 main() : SV_Target {
 		lineShader.vs = createVertexShader(vertexShaderSourceData, vertexShaderSourceSize, "line_vs");
 		lineShader.ps = createPixelShader(pixelShaderSourceData, pixelShaderSourceSize, "line_ps");
 	});
+	work.push([&]  {
+		// Same as line shader, but lines are generated from grid parameters
+		char vertexShaderSourceData[] = SHADER_COMMON_SOURCE LINE_VERTEX_SOURCE R"(
+float4 main(in uint id : SV_VertexId) : SV_Position {
+	Vertex vertex = vertexBuffer[id % VERTS_PER_LINE];
+	uint lineIndex = id / VERTS_PER_LINE;
+
+	float2 a, b;
+	if (lineIndex <= gridCellCount.x) {
+		a.x = b.x = (float)lineIndex / gridCellCount.x * gridSize.x;
+		a.y = 0;
+		b.y = gridSize.y;
+	} else {
+		lineIndex -= gridCellCount.x + 1;
+		a.y = b.y = (float)lineIndex / gridCellCount.y * gridSize.y;
+		a.x = 0;
+		b.x = gridSize.x;
+	}
+
+	float2 direction = b - a;
+	float directionLength = length(direction);
+	direction = directionLength > 0 ? direction / directionLength : float2(1, 0);
+	float2x2 transform = float2x2(
+		direction.x, -direction.y,
+		direction.y,  direction.x
+	) * gridThickness;
+
+	float2 position = lerp(a, b, vertex.t);
+	return float4(sceneToNDC(mul(entityRotation, float4(mul(transform, vertex.position * thicknessMult) + position, 0, 1)).xy + entityPosition), 0, 1);
+}
+)";
+		u32 const vertexShaderSourceSize = sizeof(vertexShaderSourceData);
+		gridShader.vs = createVertexShader(vertexShaderSourceData, vertexShaderSourceSize, "grid_vs");
+	});
+	work.push([&]  {
+		// Line-like entities from scene's stroke pool, see batch.h
+		char vertexShaderSourceData[] = SHADER_COMMON_SOURCE R"(
+struct BatchVertex {
+	float2 center;
+	float2 offset;
+	uint instance;
+};
+struct EntityInstance {
+	float2x2 rotation;
+	float3 color;
+	float thicknessMult;
+	float2 position;
+	float2 pad_;
+};
+StructuredBuffer<BatchVertex> vertices : register(t0);
+StructuredBuffer<EntityInstance> instances : register(t1);
+
+struct Out {
+	float3 color : COLOR;
+	float4 position : SV_Position;
+};
+
+Out main(in uint id : SV_VertexId) {
+	Out o;
+	BatchVertex vertex = vertices[id + batchFirstVertex];
+	if (batchUseEntity) {
+		float2 position = vertex.center + vertex.offset * thicknessMult;
+		o.position = float4(sceneToNDC(mul(entityRotation, float4(position, 0, 1)).xy + entityPosition), 0, 1);
+		o.color = entityColor;
+	} else if (vertex.instance == 0xFFFFFFFF) { // hiddenInstance
+		// Removed mesh, collapse
+		o.position = 0;
+		o.color = 0;
+	} else {
+		EntityInstance instance = instances[vertex.instance];
+		float2 position = vertex.center + vertex.offset * instance.thicknessMult;
+		o.position = float4(sceneToNDC(mul(instance.rotation, position) + instance.position), 0, 1);
+		o.color = instance.color;
+	}
+	return o;
+}
+)";
+		u32 const vertexShaderSourceSize = sizeof(vertexShaderSourceData);
+
+		char pixelShaderSourceData[] = SHADER_COMMON_SOURCE R"(
+float4 main(in float3 color : COLOR) : SV_Target {
+	return float4(color, 1.0f);
+}
+)";
+		u32 const pixelShaderSourceSize = sizeof(pixelShaderSourceData);
+		batchShader.vs = createVertexShader(vertexShaderSourceData, vertexShaderSourceSize, "batch_vs");
+		batchShader.ps = createPixelShader(pixelShaderSourceData, pixelShaderSourceSize, "batch_ps");
+	});
 	work.push([&]  {
 		char vertexShaderSourceData[] = SHADER_COMMON_SOURCE R"(
 struct Out {
@@ -1069,26 +1312,59 @@ static const float2 vertexData[] = {
 	{1, 1},
 	{1, 0},
 };
-void main(out float2 uv : UV, out float4 position : SV_Position, in uint id : SV_VertexId) {
+void main(out float2 uv : UV, out nointerpolation float maxLevel : MAX_LEVEL, out float4 position : SV_Position, in uint id : SV_VertexId) {
 	float2 v = vertexData[id];
-	uv = v;
-	uv.y = 1 - uv.y;
+	uv = lerp(imageUvMin, imageUvMax, float2(v.x, 1 - v.y));
+	maxLevel = imageMaxLevel;
 	position = getImagePosition(v);
 }
 )";
 		u32 const vertexShaderSourceSize = sizeof(vertexShaderSourceData);
 
+		// Images on atlas pages are only padded for their first few levels, see getAtlasLevelCount
 		char pixelShaderSourceData[] = SHADER_COMMON_SOURCE R"(
 Texture2D image : register(t0);
 SamplerState samplerState;
-float4 main(in float2 uv : UV) : SV_Target {
-	return image.Sample(samplerState, uv);
+float4 main(in float2 uv : UV, in nointerpolation float maxLevel : MAX_LEVEL) : SV_Target {
+	return image.SampleLevel(samplerState, uv, min(image.CalculateLevelOfDetail(samplerState, uv), maxLevel));
 }
 )";
 		u32 const pixelShaderSourceSize = sizeof(pixelShaderSourceData);
 		imageShader.vs = createVertexShader(vertexShaderSourceData, vertexShaderSourceSize, "image_vs");
 		imageShader.ps = createPixelShader(pixelShaderSourceData, pixelShaderSourceSize, "image_ps");
 	});
+	work.push([&]  {
+		// Runs of images on one atlas page, drawn with image_ps, see imageatlas.h
+		char vertexShaderSourceData[] = SHADER_COMMON_SOURCE R"(
+struct AtlasImageInstance {
+	float2x2 rotation;
+	float2 position;
+	float2 size;
+	float2 uvMin;
+	float2 uvMax;
+	float maxLevel;
+};
+StructuredBuffer<AtlasImageInstance> instances : register(t0);
+
+static const float2 vertexData[] = {
+	{0, 0},
+	{0, 1},
+	{1, 0},
+	{0, 1},
+	{1, 1},
+	{1, 0},
+};
+void main(out float2 uv : UV, out nointerpolation float maxLevel : MAX_LEVEL, out float4 position : SV_Position, in uint id : SV_VertexId) {
+	AtlasImageInstance instance = instances[batchFirstVertex + id / 6];
+	float2 v = vertexData[id % 6];
+	uv = lerp(instance.uvMin, instance.uvMax, float2(v.x, 1 - v.y));
+	maxLevel = instance.maxLevel;
+	position = float4(sceneToNDC(instance.position, mul(instance.rotation, (v - 0.5f) * instance.size)), 0, 1);
+}
+)";
+		u32 const vertexShaderSourceSize = sizeof(vertexShaderSourceData);
+		atlasImageShader.vs = createVertexShader(vertexShaderSourceData, vertexShaderSourceSize, "atlasImage_vs");
+	});
 	work.push([&]  {
 		char vertexShaderSourceData[] = SHADER_COMMON_SOURCE R"(
 static const float2 vertexData[] = {
@@ -1182,12 +1458,12 @@ float4 main() : SV_Target {
 	uiSBuffer = createStructuredBuffer(D3D11_USAGE_DYNAMIC, 256, sizeof(Quad));
 	
 	work.push([&] {
-		defaultRasterizerNoMs   = createRasterizer(D3D11_FILL_SOLID, D3D11_CULL_BACK);
-		defaultRasterizerMs     = createRasterizer(D3D11_FILL_SOLID, D3D11_CULL_BACK, true, true);
-		wireframeRasterizerNoMs = createRasterizer(D3D11_FILL_WIREFRAME, D3D11_CULL_BACK);
-		wireframeRasterizerMs   = createRasterizer(D3D11_FILL_WIREFRAME, D3D11_CULL_BACK, true, true);
-		doubleRasterizerNoMs    = createRasterizer(D3D11_FILL_SOLID, D3D11_CULL_NONE);
-		doubleRasterizerMs      = createRasterizer(D3D11_FILL_SOLID, D3D11_CULL_NONE, true, true);
+		defaultRasterizerNoMs   = createClipRasterizer(D3D11_FILL_SOLID, D3D11_CULL_BACK, false);
+		defaultRasterizerMs     = createClipRasterizer(D3D11_FILL_SOLID, D3D11_CULL_BACK, true);
+		wireframeRasterizerNoMs = createClipRasterizer(D3D11_FILL_WIREFRAME, D3D11_CULL_BACK, false);
+		wireframeRasterizerMs   = createClipRasterizer(D3D11_FILL_WIREFRAME, D3D11_CULL_BACK, true);
+		doubleRasterizerNoMs    = createClipRasterizer(D3D11_FILL_SOLID, D3D11_CULL_NONE, false);
+		doubleRasterizerMs      = createClipRasterizer(D3D11_FILL_SOLID, D3D11_CULL_NONE, true);
 		setMultisampleEnabled(true);
 	});
 	
@@ -1200,7 +1476,229 @@ float4 main() : SV_Target {
 #undef R_DECORATE
 #undef ADD_IMPL
 }
-void RendererImpl::drawEntity(Entity const &e) {
+// Returns zero for entities that are not pooled: grids, images and the stroke that is being drawn,
+// its lines change every frame so they are drawn one by one.
+u32 RendererImpl::getGeometryVersion(Entity const &e) {
+	switch (e.type) {
+		case Entity_pencil: {
+			auto &lineData = LINE_DATA(e.pencil.renderData);
+			return lineData.transformedLines.size() ? 0 : lineData.version;
+		}
+		case Entity_line:   return LINE_DATA(e.line.renderData).version;
+		case Entity_circle: return LINE_DATA(e.circle.renderData).version;
+		default: return 0;
+	}
+}
+// Remeshes entities whose geometry changed since they were pooled and uploads changed vertices.
+// A scene is drawn once per clip rect, the whole pool is only walked on the first of those.
+void RendererImpl::syncStrokePool(Scene *scene, DrawCommand const *commands, umm count) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+	auto &pool = sceneData.strokePool;
+
+	f32 scale = getStrokeMeshScale(pixelsPerUnit);
+	if (pool.scale != scale) {
+		pool.reset(scale);
+	}
+	if (sceneData.poolSyncFrame != frameCounter) {
+		sceneData.poolSyncFrame = frameCounter;
+		if (pool.needsCompaction()) {
+			pool.reset(scale);
+		}
+
+		// Removed entities
+		for (auto it = pool.ranges.begin(); it != pool.ranges.end();) {
+			if (scene->entities.find(it->first) == scene->entities.end()) {
+				it = pool.remove(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	for (umm i = 0; i < count; ++i) {
+		auto it = scene->entities.find(commands[i].entity.id);
+		if (it == scene->entities.end())
+			continue;
+		auto &e = it->second;
+
+		u32 version = getGeometryVersion(e);
+		if (!version)
+			continue;
+		auto range = pool.find(e.id);
+		if (range && range->version == version)
+			continue;
+
+		meshScratch.clear();
+		meshEntity(meshScratch, e, scale);
+		pool.put(e.id, version, meshScratch.data(), (u32)meshScratch.size());
+	}
+
+	if (pool.dirtyBegin < pool.dirtyEnd) {
+		u32 capacity = sceneData.poolBuffer.size / sizeof(BatchVertex);
+		if (pool.vertices.size() > capacity) {
+			// Leave some room so appending doesn't recreate the buffer every time
+			release(sceneData.poolBuffer);
+			sceneData.poolBuffer = createStructuredBuffer(D3D11_USAGE_DEFAULT, pool.vertices.size() * 3 / 2 + 1024, sizeof(BatchVertex), 0);
+			updateStructuredBuffer(sceneData.poolBuffer, pool.vertices.size(), sizeof(BatchVertex), pool.vertices.data(), 0);
+		} else {
+			updateStructuredBuffer(sceneData.poolBuffer, pool.dirtyEnd - pool.dirtyBegin, sizeof(BatchVertex), pool.vertices.data() + pool.dirtyBegin, pool.dirtyBegin);
+		}
+	}
+	pool.clearDirty();
+}
+// Draws entity commands between beginScene and endScene. Pooled entities that are next to each other
+// in the pool are drawn with one draw call, their parameters come from the instance table.
+// Runs of images on the same atlas page are drawn with one draw call too.
+void RendererImpl::drawSceneEntities(Scene *scene, DrawCommand const *commands, umm count) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+	auto &pool = sceneData.strokePool;
+
+	syncStrokePool(scene, commands, count);
+
+	auto findEntity = [&](DrawCommand const &command) -> Entity const * {
+		auto it = scene->entities.find(command.entity.id);
+		return it == scene->entities.end() ? 0 : &it->second;
+	};
+
+	auto plan = planBatches(commands, count, [&](DrawCommand const &command) -> PoolRange const * {
+		auto e = findEntity(command);
+		if (!e || !getGeometryVersion(*e))
+			return 0;
+		return pool.find(e->id);
+	}, [&](DrawCommand const &command) {
+		auto e = findEntity(command);
+		// Outlines and tiles are drawn by drawEntity
+		if (!e || e->type != Entity_image || command.entity.outline)
+			return noAtlasPage;
+		auto &imageData = IMAGE_DATA(e->image.renderData);
+		return imageData.tiles.size() ? noAtlasPage : imageData.atlas.page;
+	});
+
+	// Only entries that differ from what the buffer holds are uploaded, slots of new entities start out zeroed
+	auto &instances = sceneData.instances;
+	u32 dirtyBegin = ~0u;
+	u32 dirtyEnd = 0;
+	if (instances.size() < pool.slotCount) {
+		u32 oldSize = (u32)instances.size();
+		instances.resize(pool.slotCount);
+		memset(instances.data() + oldSize, 0, (pool.slotCount - oldSize) * sizeof(EntityInstance));
+		dirtyBegin = oldSize;
+		dirtyEnd = pool.slotCount;
+	}
+	for (auto &batch : plan.batches) {
+		if (batch.kind != DrawBatch_pooled)
+			continue;
+		for (u32 i = batch.firstCommand; i < batch.firstCommand + batch.commandCount; ++i) {
+			auto &command = commands[i].entity;
+			auto range = pool.find(command.id);
+			if (!range)
+				continue;
+			m4 rotation = m4::rotationZ(-command.rotation);
+			f32 const *r = (f32 const *)&rotation;
+
+			EntityInstance instance = {};
+			instance.rotation = {r[0], r[1], r[4], r[5]};
+			instance.color = command.color;
+			instance.thicknessMult = command.thicknessMult;
+			instance.position = command.position;
+
+			if (memcmp(&instances[range->slot], &instance, sizeof(instance)) == 0)
+				continue;
+			instances[range->slot] = instance;
+			dirtyBegin = min(dirtyBegin, range->slot);
+			dirtyEnd = max(dirtyEnd, range->slot + 1);
+		}
+	}
+	if (instances.size()) {
+		u32 capacity = sceneData.instanceBuffer.size / sizeof(EntityInstance);
+		if (instances.size() > capacity) {
+			release(sceneData.instanceBuffer);
+			sceneData.instanceBuffer = createStructuredBuffer(D3D11_USAGE_DEFAULT, instances.size() * 3 / 2 + 256, sizeof(EntityInstance), 0);
+			dirtyBegin = 0;
+			dirtyEnd = (u32)instances.size();
+		}
+		if (dirtyBegin < dirtyEnd) {
+			updateStructuredBuffer(sceneData.instanceBuffer, dirtyEnd - dirtyBegin, sizeof(EntityInstance), instances.data() + dirtyBegin, dirtyBegin);
+		}
+	}
+
+	atlasInstances.resize(plan.atlasInstanceCount);
+	for (auto &batch : plan.batches) {
+		if (batch.kind != DrawBatch_atlasImages)
+			continue;
+		for (u32 i = 0; i < batch.commandCount; ++i) {
+			auto &command = commands[batch.firstCommand + i].entity;
+			auto &image = findEntity(commands[batch.firstCommand + i])->image;
+			m4 rotation = m4::rotationZ(-command.rotation);
+			f32 const *r = (f32 const *)&rotation;
+			auto &atlas = IMAGE_DATA(image.renderData).atlas;
+			auto uvRect = getAtlasUvRect(atlas);
+
+			auto &instance = atlasInstances[batch.firstVertex + i];
+			instance.rotation = {r[0], r[1], r[4], r[5]};
+			instance.position = command.position;
+			instance.size = image.size;
+			instance.uvMin = uvRect.min;
+			instance.uvMax = uvRect.max;
+			instance.maxLevel = (f32)(atlas.levelCount - 1);
+		}
+	}
+	if (atlasInstances.size()) {
+		u32 capacity = atlasInstanceBuffer.size / sizeof(AtlasImageInstance);
+		if (atlasInstances.size() > capacity) {
+			release(atlasInstanceBuffer);
+			atlasInstanceBuffer = createStructuredBuffer(D3D11_USAGE_DEFAULT, atlasInstances.size() * 3 / 2 + 256, sizeof(AtlasImageInstance), 0);
+		}
+		updateStructuredBuffer(atlasInstanceBuffer, atlasInstances.size(), sizeof(AtlasImageInstance), atlasInstances.data(), 0);
+	}
+
+	for (auto &batch : plan.batches) {
+		auto &first = commands[batch.firstCommand];
+		if (batch.kind == DrawBatch_entity) {
+			if (auto e = findEntity(first)) {
+				drawEntity(*e, first);
+			}
+			continue;
+		}
+
+		setTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		EntityConstantBufferData data = {};
+		data.batchFirstVertex = batch.firstVertex;
+		if (batch.kind == DrawBatch_atlasImages) {
+			setShader(atlasImageShader.vs);
+			setShader(imageShader.ps);
+			setRasterizer(doubleRasterizer);
+			setShaderResource(atlasInstanceBuffer, 'V', 0);
+			setShaderResource(atlasPages[batch.atlasPage], 'P', 0);
+		} else {
+			setShader(batchShader.vs);
+			setShader(batchShader.ps);
+			setRasterizer(wireframe ? wireframeRasterizer : defaultRasterizer);
+			setShaderResource(sceneData.poolBuffer, 'V', 0);
+			setShaderResource(sceneData.instanceBuffer, 'V', 1);
+
+			data.batchUseEntity = batch.kind == DrawBatch_pooledSingle;
+			if (data.batchUseEntity) {
+				data.entityRotation = m4::rotationZ(-first.entity.rotation);
+				data.entityPosition = first.entity.position;
+				data.entityColor = first.entity.color;
+				data.thicknessMult = first.entity.thicknessMult;
+			}
+		}
+		updateConstantBuffer(entityConstantBuffer, &data);
+		draw(batch.vertexCount);
+
+		for (u32 i = batch.firstCommand; i < batch.firstCommand + batch.commandCount; ++i) {
+			if (commands[i].entity.drawBounds) {
+				if (auto e = findEntity(commands[i])) {
+					drawEntityBounds(*e);
+				}
+			}
+		}
+	}
+}
+// Draws one entity with parameters recorded in the command
+void RendererImpl::drawEntity(Entity const &e, DrawCommand const &command) {
 	SCOPED_LOCK(immediateContextMutex);
 	
 	setTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
@@ -1208,8 +1706,12 @@ void RendererImpl::drawEntity(Entity const &e) {
 		case Entity_none:
 			INVALID_CODE_PATH();
 			break;
+		case Entity_grid: {
+			setShader(gridShader.vs);
+			setShader(lineShader.ps);
+			setRasterizer(wireframe ? wireframeRasterizer : defaultRasterizer);
+		} break;
 		case Entity_circle:
-		case Entity_grid:
 		case Entity_line:
 		case Entity_pencil: {
 			setShader(lineShader.vs);
@@ -1223,48 +1725,24 @@ void RendererImpl::drawEntity(Entity const &e) {
 	}
 
 	EntityConstantBufferData data;
-	data.entityRotation = m4::rotationZ(-e.rotation);
-	data.entityPosition = e.position;
-	data.thicknessMult = 1.0f;
+	data.entityRotation = m4::rotationZ(-command.entity.rotation);
+	data.entityPosition = command.entity.position;
+	data.entityColor = command.entity.color;
+	data.thicknessMult = command.entity.thicknessMult;
 	data.boundsMin = e.bounds.min;
 	data.boundsMax = e.bounds.max;
-
-	if (e.hovered && e.type != Entity_image) {
-		data.entityColor = V3f(1);
-		updateConstantBuffer(entityConstantBuffer, &data);
-
-		switch (e.type) {
-			case Entity_pencil: {
-				setShaderResource(LINE_DATA(e.pencil.renderData).buffer, 'V', 0);
-				draw(e.pencil.lines.size() * VERTS_PER_LINE);
-			} break;
-			case Entity_line: {
-				setShaderResource(LINE_DATA(e.line.renderData).buffer, 'V', 0);
-				draw(VERTS_PER_LINE);
-			} break;
-			case Entity_grid: {
-				u32 lineCount = e.grid.cellCount.x + e.grid.cellCount.y + 2;
-				setShaderResource(LINE_DATA(e.grid.renderData).buffer, 'V', 0);
-				draw(lineCount * VERTS_PER_LINE);
-			} break;
-			case Entity_circle: {
-				setShaderResource(LINE_DATA(e.circle.renderData).buffer, 'V', 0);
-				draw(e.circle.LINE_COUNT * VERTS_PER_LINE);
-			} break;
-		}
-		data.thicknessMult = 0.8f;
+	if (e.type == Entity_grid) {
+		data.gridSize = e.grid.size;
+		data.gridCellCount = e.grid.cellCount;
+		data.gridThickness = e.grid.thickness;
 	}
-	
-	switch (e.type) {
-		case Entity_pencil: data.entityColor = e.pencil.color; break;
-		case Entity_line:   data.entityColor = e.line.color;   break;
-		case Entity_grid:   data.entityColor = e.grid.color;   break;
-		case Entity_circle: data.entityColor = e.circle.color; break;
-		case Entity_image: {
-			auto &image = e.image;
-			data.imageSize = image.size;
-			break;
-		}
+	if (e.type == Entity_image) {
+		auto &atlas = IMAGE_DATA(e.image.renderData).atlas;
+		auto uvRect = atlas.page == noAtlasPage ? aabbMinMax(V2f(0), V2f(1)) : getAtlasUvRect(atlas);
+		data.imageSize = e.image.size;
+		data.imageUvMin = uvRect.min;
+		data.imageUvMax = uvRect.max;
+		data.imageMaxLevel = atlas.page == noAtlasPage ? imageUnclampedMaxLevel : (f32)(atlas.levelCount - 1);
 	}
 	updateConstantBuffer(entityConstantBuffer, &data);
 
@@ -1278,9 +1756,7 @@ void RendererImpl::drawEntity(Entity const &e) {
 			draw(VERTS_PER_LINE);
 		} break;
 		case Entity_grid: {
-			u32 lineCount = e.grid.cellCount.x + e.grid.cellCount.y + 2;
-			setShaderResource(LINE_DATA(e.grid.renderData).buffer, 'V', 0);
-			draw(lineCount * VERTS_PER_LINE);
+			draw(getGridLineCount(e.grid) * VERTS_PER_LINE);
 		} break;
 		case Entity_circle: {
 			setShaderResource(LINE_DATA(e.circle.renderData).buffer, 'V', 0);
@@ -1288,10 +1764,27 @@ void RendererImpl::drawEntity(Entity const &e) {
 		} break;
 		case Entity_image: {
 			auto &image = e.image;
-			setShaderResource(IMAGE_DATA(image.renderData).texture, 'P', 0);
+			auto &imageData = IMAGE_DATA(image.renderData);
+			if (imageData.atlas.page != noAtlasPage) {
+				setShaderResource(atlasPages[imageData.atlas.page], 'P', 0);
+			} else {
+				setShaderResource(imageData.texture, 'P', 0);
+			}
 			setRasterizer(doubleRasterizer);
 			draw(6);
-			if (image.hovered) {
+			// Each tile is drawn as an image covering its part of the entity
+			if (imageData.tiles.size()) {
+				auto tileData = data;
+				tileData.imageMaxLevel = imageUnclampedMaxLevel;
+				for (auto &tile : imageData.tiles) {
+					getImageTileQuad(command.entity.position, command.entity.rotation, image.size, tile.rect, tileData.entityPosition, tileData.imageSize);
+					updateConstantBuffer(entityConstantBuffer, &tileData);
+					setShaderResource(IMAGE_DATA(tile.renderData).texture, 'P', 0);
+					draw(6);
+				}
+				updateConstantBuffer(entityConstantBuffer, &data);
+			}
+			if (command.entity.outline) {
 				setTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
 				setShader(imageOutlineShader.vs);
 				setShader(imageOutlineShader.ps);
@@ -1302,47 +1795,108 @@ void RendererImpl::drawEntity(Entity const &e) {
 		default: INVALID_CODE_PATH();
 	}
 
-	if (drawBounds) {
-		setTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
-		setShader(boundsShader.vs);
-		setShader(boundsShader.ps);
-		setRasterizer(defaultRasterizer);
-		draw(8);
+	if (command.entity.drawBounds) {
+		drawEntityBounds(e);
 	}
 }
-void RendererImpl::updatePieBuffer(PieMenu &menu) {
-	if (menu.animValue) {
-		PieConstantBufferData data;
-		data.piePos = menu.position;
-		data.pieSize = pieMenuSize;
-		data.pieAlpha = menu.animValue * menu.handAlphaValue;
-		data.pieAngle = menu.angle;
-		updateConstantBuffer(PIE_DATA(menu.renderData).constantBuffer, &data);
+// Releases the page's texture when it was the last image on it. A fragmented page is compacted: its blocks are
+// copied into room on other pages, or into a new texture for the page when they don't fit there.
+void RendererImpl::removeFromAtlas(ImageData &data) {
+	SCOPED_LOCK(immediateContextMutex);
+	u32 page = data.atlas.page;
+	if (page == noAtlasPage)
+		return;
+	if (imageAtlas.remove(data.atlas)) {
+		release(atlasPages[page]);
+		atlasPages[page] = {};
+		return;
 	}
+	if (!imageAtlas.needsCompaction(page))
+		return;
+
+	auto source = atlasPages[page];
+	atlasPages[page] = {};
+	imageAtlas.compact(page, [&](AtlasPlacement const &from, AtlasPlacement const &to) {
+		auto &destination = getAtlasPage(to.page);
+		for (u32 level = 0; level < from.levelCount; ++level) {
+			D3D11_BOX box = {from.position.x >> level, from.position.y >> level, 0, (from.position.x + from.blockSize.x) >> level, (from.position.y + from.blockSize.y) >> level, 1};
+			immediateContext->CopySubresourceRegion(destination.tex, level, to.position.x >> level, to.position.y >> level, 0, source.tex, level, &box);
+		}
+	});
+	release(source);
+}
+// Texture of an atlas page, created when the first block is put on it.
+// Texels outside of blocks are never sampled, the texture is created without them.
+D3D11::Texture &RendererImpl::getAtlasPage(u32 index) {
+	atlasPages.resize(imageAtlas.pages.size());
+	auto &page = atlasPages[index];
+	if (!page.tex) {
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width = imageAtlasPageSize;
+		desc.Height = imageAtlasPageSize;
+		desc.MipLevels = imageAtlasLevelCount;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc = {1, 0};
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		DHR(device->CreateTexture2D(&desc, 0, &page.tex));
+		DHR(device->CreateShaderResourceView(page.tex, 0, &page.srv));
+	}
+	return page;
+}
+void RendererImpl::drawEntityBounds(Entity const &e) {
+	EntityConstantBufferData data = {};
+	data.boundsMin = e.bounds.min;
+	data.boundsMax = e.bounds.max;
+	updateConstantBuffer(entityConstantBuffer, &data);
+
+	setTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+	setShader(boundsShader.vs);
+	setShader(boundsShader.ps);
+	setRasterizer(defaultRasterizer);
+	draw(8);
+}
+u32 RendererImpl::getCanvasSampleCount() {
+	return isMultisampleEnabled() ? msaaSampleCount : 1;
 }
-void RendererImpl::repaintScene(Scene *scene) {
+void RendererImpl::beginScene(Scene *scene, bool partial, bool staticLayer) {
 	scene->needRepaint = false;
-	needRepaint = true;
+	scene->liveEntityDirty = false;
+	scene->dirtyTiles.clear();
+	updateCanvasCamera(scene);
 	
 	auto &sceneData = SCENE_DATA(scene->renderData);
 
 	if (scene->needResize) {
 		scene->needResize = false;
-		D3D11::release(sceneData.canvasRT);
-		D3D11::release(sceneData.canvasRTMS);
-		sceneData.canvasRT = createRenderTexture(clientSize.x, clientSize.y, 1, DXGI_FORMAT_R8G8B8A8_UNORM, D3D11_CPU_ACCESS_READ);
-		sceneData.canvasRTMS = createRenderTexture(clientSize.x, clientSize.y, msaaSampleCount, DXGI_FORMAT_R8G8B8A8_UNORM);
+		releaseCanvas(scene);
+		sceneData.canvasRT = createRenderTexture(clientSize.x, clientSize.y, 1, DXGI_FORMAT_R8G8B8A8_UNORM);
+		sceneData.canvasSize = clientSize;
+		scene->dirtyTiles.resize(clientSize);
+	}
+	if (isMultisampleEnabled() != (sceneData.canvasRTMS.tex != 0)) {
+		if (sceneData.canvasRTMS.tex) {
+			D3D11::release(sceneData.canvasRTMS);
+		} else {
+			sceneData.canvasRTMS = createRenderTexture(clientSize.x, clientSize.y, msaaSampleCount, DXGI_FORMAT_R8G8B8A8_UNORM);
+			// Only dirty tiles were recorded, canvas is redrawn fully next frame
+			scene->needRepaint = partial;
+			partial = false;
+		}
 	}
 
 	if (scene->matrixSceneToNDCDirty) {
 		scene->matrixSceneToNDCDirty = false;
 		scene->constantBufferDirty = true;
-		sceneData.constantBufferData.scenePosition = scene->cameraPosition;
+		// Relative to the canvas origin, which moves by whole pixels while the canvas scrolls
+		sceneData.constantBufferData.scenePosition = scene->canvasOrigin;
 		sceneData.constantBufferData.sceneScale = reciprocal(scene->cameraDistance) / (v2f)clientSize * 2.0f;
+		sceneData.constantBufferData.sceneOffset = getCanvasOriginOffset(scene) / (v2f)clientSize * 2.0f;
 		//scene->constantBufferData.matrixSceneToNDC = m4::scaling(reciprocal(scene->cameraDistance)) * m4::scaling(2.0f / (v2f)clientSize, 1) * m4::translation(-scene->cameraPosition, 0);
 	}
-	if (scene->drawColorDirty) {
-		scene->drawColorDirty = false;
+	// drawColorDirty is consumed by the main loop before the scene is drawn
+	if (memcmp(&sceneData.constantBufferData.sceneDrawColor, &scene->drawColor, sizeof(scene->drawColor)) != 0) {
 		sceneData.constantBufferData.sceneDrawColor = scene->drawColor;
 		scene->constantBufferDirty = true;
 	}
@@ -1352,28 +1906,108 @@ void RendererImpl::repaintScene(Scene *scene) {
 		updateConstantBuffer(sceneData.constantBuffer, &sceneData.constantBufferData);
 	} 
 
+	pixelsPerUnit = reciprocal(scene->cameraDistance);
+
 	{
-		auto &rt = isMultisampleEnabled() ? sceneData.canvasRTMS : sceneData.canvasRT;
-		clearRenderTarget(rt, V4f(scene->canvasColor, 1.0f).data());
-		setRenderTarget(rt);
+		auto *rt = isMultisampleEnabled() ? &sceneData.canvasRTMS : &sceneData.canvasRT;
+		if (staticLayer) {
+			scene->staticLayerValid = true;
+
+			u32 sampleCount = getCanvasSampleCount();
+			if (sceneData.staticLayerSampleCount != sampleCount) {
+				D3D11::release(sceneData.staticLayer);
+				sceneData.staticLayer = createRenderTexture(clientSize.x, clientSize.y, sampleCount, DXGI_FORMAT_R8G8B8A8_UNORM);
+				sceneData.staticLayerSampleCount = sampleCount;
+
+				// Only dirty tiles were recorded, new layer is redrawn fully next frame
+				scene->staticLayerValid = !partial;
+				partial = false;
+			}
+			rt = &sceneData.staticLayer;
+		}
+		updateCanvasMemory(scene);
+
+		// Partial repaint keeps previous contents, dirty parts are cleared by clipScene commands
+		if (!partial) {
+			clearRenderTarget(*rt, V4f(scene->canvasColor, 1.0f).data());
+		}
+		setRenderTarget(*rt);
 	}
 	setConstantBuffer(sceneData.constantBuffer, 'V', 0);
 	setConstantBuffer(sceneData.constantBuffer, 'P', 0);
 	
 	setBlend(alphaBlend);
-
-	for (auto &[id, entity] : scene->entities) {
-		if (entity.visible)
-			drawEntity(entity);
+}
+// Scrolled scenes have no live entity, so the target is the canvas. Resolved canvas holds the previous frame,
+// its copy is drawn into the canvas at a whole pixel offset. With multisampling every sample of a pixel
+// gets the resolved color, which resolves to the same value again.
+void RendererImpl::scrollScene(Scene *scene, v2s offset) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+	if (!sceneData.scrollCopy.tex) {
+		sceneData.scrollCopy = createRenderTexture(clientSize.x, clientSize.y, 1, DXGI_FORMAT_R8G8B8A8_UNORM);
+		updateCanvasMemory(scene);
 	}
-	//{
-	//	SCOPED_LOCK(currentNetEntity.mutex);
-	//	drawEntity(currentNetEntity.action);
-	//}
-	//for (Entity *action : scene->extraEntitysToDraw) {
-	//	drawEntity(*action);
-	//}
-	
+	immediateContext->CopyResource(sceneData.scrollCopy.tex, sceneData.canvasRT.tex);
+
+	setRenderTarget(isMultisampleEnabled() ? sceneData.canvasRTMS : sceneData.canvasRT);
+	setClipRect({}, clientSize);
+	setTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	setShader(blitShader.vs);
+	setShader(blitShader.ps);
+	setRasterizer(defaultRasterizerNoMs);
+	setBlend();
+	setViewport(offset.x, -offset.y, clientSize.x, clientSize.y);
+	setShaderResource(sceneData.scrollCopy, 'P', 0);
+	draw(3);
+
+	setViewport(0, 0, clientSize.x, clientSize.y);
+	setBlend(alphaBlend);
+}
+void RendererImpl::releaseCanvas(Scene *scene) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+	D3D11::release(sceneData.canvasRT);
+	D3D11::release(sceneData.canvasRTMS);
+	D3D11::release(sceneData.staticLayer);
+	D3D11::release(sceneData.scrollCopy);
+	sceneData.staticLayerSampleCount = 0;
+	sceneData.canvasSize = {};
+	canvasPool.setBytes(scene, 0);
+}
+// Counts every texture of the scene that has the size of the canvas, then evicts other scenes if over budget
+void RendererImpl::updateCanvasMemory(Scene *scene) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+	u64 sampleCount = (sceneData.canvasRT.tex ? 1 : 0) + (sceneData.canvasRTMS.tex ? msaaSampleCount : 0) + sceneData.staticLayerSampleCount + (sceneData.scrollCopy.tex ? 1 : 0);
+	canvasPool.setBytes(scene, (u64)sceneData.canvasSize.x * sceneData.canvasSize.y * sizeof(u32) * sampleCount);
+	canvasPool.trim([&](Scene *evicted) { releaseCanvas(evicted); });
+}
+// All rasterizers have scissor test enabled, clip rect is the whole window unless a part of a scene is repainted
+D3D11::Rasterizer RendererImpl::createClipRasterizer(D3D11_FILL_MODE fill, D3D11_CULL_MODE cull, bool multisample) {
+	D3D11_RASTERIZER_DESC desc = {};
+	desc.FillMode = fill;
+	desc.CullMode = cull;
+	desc.DepthClipEnable = true;
+	desc.ScissorEnable = true;
+	desc.MultisampleEnable = multisample;
+	desc.AntialiasedLineEnable = multisample;
+
+	D3D11::Rasterizer result;
+	DHR(device->CreateRasterizerState(&desc, &result.raster));
+	return result;
+}
+// Takes canvas pixels with bottom left origin
+void RendererImpl::setClipRect(v2u min, v2u max) {
+	D3D11_RECT rect;
+	rect.left = min.x;
+	rect.right = max.x;
+	rect.top = clientSize.y - max.y;
+	rect.bottom = clientSize.y - min.y;
+	immediateContext->RSSetScissorRects(1, &rect);
+}
+void RendererImpl::endScene(Scene *scene) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+
+	setClipRect({}, clientSize);
+
 	setBlend();
 	setTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	
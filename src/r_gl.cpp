@@ -21,6 +21,7 @@ HDC clientDc;
 
 struct RendererImpl : Renderer {
 	RecursiveMutex mutex;
+	DrawList frameDrawList;
 	RendererImpl();
 
 #define R_DECORATE(ret, name, args, params) ret name args;
@@ -68,6 +69,11 @@ R_repaint{
 		INVALID_CODE_PATH("SwapBuffers failed");
 	}
 }
+R_execute{
+}
+R_getLastFrame{
+	return frameDrawList;
+}
 R_initConstantLineArray{
 }
 R_initDynamicLineArray{
@@ -88,8 +94,6 @@ R_releaseEntity{
 }
 R_switchRasterizer{
 }
-R_pickColor{
-}
 R_resizeLineArray{
 }
 R_updateLineArray{
@@ -106,7 +110,18 @@ R_resizePencilLineArray{
 }
 R_updateLastElement{
 }
-R_setTexture{
+R_beginTexture{
+}
+R_updateTexture{
+}
+R_endTexture{
+}
+R_setImageTiles{
+}
+R_setAtlasImage{
+}
+R_getImageAtlasStats{
+	return {};
 }
 R_updatePaintCursor{
 } 
@@ -131,6 +146,11 @@ R_isMultisampleEnabled {
 }
 R_setVSync {
 }
+R_getCanvasStats {
+	return {};
+}
+R_setCanvasBudget {
+}
 R_shutdown {
 	DEALLOCATE(TL_DEFAULT_ALLOCATOR, this);
 }
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include "platform.h"
+#include "renderer.h"
+#include "r_null.h"
+
+// Null renderer. Every call made by the app is counted with the size of its arguments,
+// buffers and textures are tracked by size as r_d3d11.cpp would create them, and renderData
+// is real allocations so leaks and double releases show up. No platform or GPU calls.
+
+struct RendererImpl : Renderer {
+	RecursiveMutex mutex;
+	DrawList frameDrawList;
+	NullRendererStats stats;
+	CanvasPool canvasPool;
+	ImageAtlas imageAtlas;
+	u32 atlasPageCount = 0; // With images, each one counted as a buffer
+
+	bool wireframe = false;
+	bool multisample = true;
+	bool vSync = true;
+
+	RendererImpl();
+
+	void recordCall(NullCall call, umm argumentBytes);
+	void *allocate(NullAllocationType type);
+	void release(void *data);
+	NullAllocation &get(void *data);
+	void createBuffer(NullAllocation &allocation, umm size);
+	void releaseBuffer(NullAllocation &allocation);
+	void removeFromAtlas(NullAllocation &allocation);
+	void countAtlasPages();
+	void upload(umm size);
+	void beginScene(Scene *scene, bool staticLayer);
+	void releaseCanvas(Scene *scene);
+
+#define R_DECORATE(ret, name, args, params) ret name args;
+	R_all
+#undef R_DECORATE
+};
+
+template <class ...Args>
+static umm argumentSize(Args const &...) {
+	return (sizeof(Args) + ... + 0);
+}
+
+#define R_DECORATE(ret, name, args, params) ret RendererImpl::name args
+R_initScene {
+	scene->renderData = allocate(NullAllocation_scene);
+}
+R_releaseScene {
+	canvasPool.setBytes(scene, 0);
+	release(scene->renderData);
+	scene->renderData = 0;
+}
+R_resize {
+	for (auto &scene : scenes) {
+		if (scene.renderData) {
+			releaseCanvas(&scene);
+		}
+	}
+}
+R_initPencilEntity {
+	pencil.renderData = allocate(NullAllocation_lines);
+}
+R_initLineEntity {
+	line.renderData = allocate(NullAllocation_lines);
+}
+R_initGridEntity {
+	// Grid lines are generated in the vertex shader, nothing to store
+}
+R_initCircleEntity {
+	circle.renderData = allocate(NullAllocation_lines);
+}
+R_createImageData {
+	return allocate(NullAllocation_image);
+}
+R_initPencilEntityData{
+	initConstantLineArray(pencil.renderData, 0, pencil.lines.size());
+	upload(pencil.lines.size() * sizeof(TransformedLine));
+}
+R_initLineEntityData{
+	initConstantLineArray(line.renderData, 0, 1);
+	upload(sizeof(TransformedLine));
+}
+R_initGridEntityData{
+}
+R_initCircleEntityData{
+	initConstantLineArray(circle.renderData, 0, CircleEntity::LINE_COUNT);
+	upload(CircleEntity::LINE_COUNT * sizeof(TransformedLine));
+}
+R_onColorMenuOpen{
+}
+R_setColorMenuColor{
+}
+R_repaint{
+	SCOPED_LOCK(mutex);
+
+	FrameInfo info;
+	info.clientSize = clientSize;
+	info.mousePosBL = mousePosBL;
+	info.minWindowDim = minWindowDim;
+	info.needRepaint = needRepaint;
+	info.drawCursor = drawCursor;
+	info.drawCursorCircle = drawCursorCircle;
+	recordFrame(frameDrawList, info);
+	needRepaint = false;
+
+	execute(frameDrawList);
+	debugPoints.clear();
+}
+R_execute{
+	SCOPED_LOCK(mutex);
+
+	if (!list.commands.size()) {
+		++stats.emptyFrameCount;
+		return;
+	}
+
+	canvasPool.beginFrame();
+	for (auto &command : list.commands) {
+		switch (command.type) {
+			case DrawCommand_beginScene: canvasPool.use(scenes + command.beginScene.sceneIndex); break;
+			case DrawCommand_blitScene:  canvasPool.use(scenes + command.blitScene.sceneIndex); break;
+		}
+	}
+
+	for (auto &command : list.commands) {
+		++stats.commandCounts[command.type];
+		switch (command.type) {
+			case DrawCommand_beginScene: beginScene(scenes + command.beginScene.sceneIndex, command.beginScene.staticLayer); break;
+			case DrawCommand_quads:      upload(command.quads.quadCount * sizeof(Quad)); break;
+			case DrawCommand_present:    ++stats.frameCount; break;
+		}
+	}
+}
+R_getLastFrame{
+	return frameDrawList;
+}
+R_initConstantLineArray{
+	createBuffer(get(renderData), count * sizeof(TransformedLine));
+	if (data) {
+		upload(count * sizeof(TransformedLine));
+	}
+}
+R_initDynamicLineArray{
+	createBuffer(get(renderData), count * sizeof(TransformedLine));
+	if (data) {
+		upload(count * sizeof(TransformedLine));
+	}
+}
+R_reinitDynamicLineArray{
+	initDynamicLineArray(renderData, data, count);
+}
+R_releasePencil {
+	if (action.renderData) {
+		release(action.renderData);
+		action.renderData = 0;
+	}
+}
+R_releaseLine {
+	if (action.renderData) {
+		release(action.renderData);
+		action.renderData = 0;
+	}
+}
+R_releaseGrid {
+	if (action.renderData) {
+		release(action.renderData);
+		action.renderData = 0;
+	}
+}
+R_releaseCircle {
+	if (action.renderData) {
+		release(action.renderData);
+		action.renderData = 0;
+	}
+}
+R_releaseImageData {
+	SCOPED_LOCK(mutex);
+	release(renderData);
+}
+R_releaseEntity{
+	switch (action.type) {
+		case Entity_pencil: releasePencil(action.pencil); break;
+		case Entity_line:   releaseLine(action.line); break;
+		case Entity_grid:   releaseGrid(action.grid); break;
+		case Entity_circle: releaseCircle(action.circle); break;
+		case Entity_image:
+			break;
+
+		default: INVALID_CODE_PATH();
+	}
+}
+R_switchRasterizer{
+	wireframe = !wireframe;
+}
+R_resizeLineArray{
+	auto &allocation = get(renderData);
+	umm bufferElemCount = allocation.bufferSize / sizeof(TransformedLine);
+	if (count > bufferElemCount) {
+		createBuffer(allocation, (bufferElemCount + pencilLineBufferDefElemCount) * sizeof(TransformedLine));
+		upload(count * sizeof(TransformedLine));
+	}
+}
+R_updateLineArray{
+	upload(count * sizeof(TransformedLine));
+}
+R_updateLines{
+	updateLineArray(renderData, 0, count, firstElem);
+}
+R_updateGridLines{
+}
+R_updateCircleLines{
+	updateLineArray(circle.renderData, 0, CircleEntity::LINE_COUNT, 0);
+}
+R_freeze{
+	get(pencil.renderData).lineCount = 0;
+}
+R_resizePencilLineArray{
+	resizeLineArray(pencil.renderData, 0, get(pencil.renderData).lineCount);
+}
+R_updateLastElement{
+	updateLineArray(pencil.renderData, 0, 1, get(pencil.renderData).lineCount - 1);
+}
+R_beginTexture{
+	SCOPED_LOCK(mutex);
+	get(image).pendingBytes = mips.bytes();
+}
+R_updateTexture{
+	upload((umm)rowCount * mips.levels[level].size.x * sizeof(u32));
+}
+R_endTexture{
+	SCOPED_LOCK(mutex);
+	auto &allocation = get(image);
+	removeFromAtlas(allocation);
+	createBuffer(allocation, allocation.pendingBytes);
+	allocation.pendingBytes = 0;
+	allocation.loaded = true;
+}
+R_setImageTiles{
+	// Tiles are images of their own, their textures are counted by endTexture
+}
+R_setAtlasImage{
+	SCOPED_LOCK(mutex);
+	auto &allocation = get(image);
+	releaseBuffer(allocation);
+	removeFromAtlas(allocation);
+	allocation.loaded = true;
+	if (!imageAtlas.place(mips.size(), allocation.atlas)) {
+		createBuffer(allocation, mips.bytes());
+		upload(mips.bytes());
+		return;
+	}
+	countAtlasPages();
+	v2u blockSize = allocation.atlas.blockSize;
+	for (u32 level = 0; level < allocation.atlas.levelCount; ++level) {
+		upload((umm)(blockSize.x >> level) * (blockSize.y >> level) * sizeof(u32));
+	}
+}
+R_getImageAtlasStats{
+	SCOPED_LOCK(mutex);
+	return imageAtlas.getStats();
+}
+R_updatePaintCursor{
+}
+R_isLoaded {
+	SCOPED_LOCK(mutex);
+	return get(image.renderData).loaded;
+}
+R_setUnloadedTexture{
+	SCOPED_LOCK(mutex);
+	auto &allocation = get(imageData);
+	releaseBuffer(allocation);
+	removeFromAtlas(allocation);
+	allocation.loaded = false;
+}
+R_update{
+}
+R_onLinePushed{
+	++get(pencil.renderData).lineCount;
+}
+R_onLinePopped{
+	--get(pencil.renderData).lineCount;
+}
+R_getMutex {
+	return mutex;
+}
+R_setMultisampleEnabled {
+	multisample = enable;
+}
+R_isMultisampleEnabled {
+	return multisample;
+}
+R_setVSync {
+	vSync = enable;
+}
+R_getCanvasStats {
+	SCOPED_LOCK(mutex);
+	return canvasPool.stats;
+}
+R_setCanvasBudget {
+	SCOPED_LOCK(mutex);
+	canvasPool.stats.budget = bytes;
+	canvasPool.trim([&](Scene *scene) { releaseCanvas(scene); });
+}
+R_shutdown {
+	stats.log();
+	stats.logLeaks();
+	nullRendererStats = 0;
+	this->~RendererImpl();
+	DEALLOCATE(TL_DEFAULT_ALLOCATOR, this);
+}
+#undef R_DECORATE
+
+Renderer *createRenderer() {
+	return construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, RendererImpl, 1, 0));
+}
+
+RendererImpl::RendererImpl() {
+	nullRendererStats = &stats;
+
+	// Calls made by the app are counted here, calls between entry points inside this file are not
+#define ADD_IMPL(...) (RendererImpl *impl, __VA_ARGS__)
+#define R_DECORATE(ret, name, args, params) CONCAT(_, name) = [] ADD_IMPL args -> ret { impl->recordCall(CONCAT(NullCall_, name), argumentSize params); return impl->name params; };
+	R_all
+#undef R_DECORATE
+#undef ADD_IMPL
+}
+void RendererImpl::recordCall(NullCall call, umm argumentBytes) {
+	SCOPED_LOCK(mutex);
+	++stats.calls[call].count;
+	stats.calls[call].argumentBytes += argumentBytes;
+}
+void *RendererImpl::allocate(NullAllocationType type) {
+	SCOPED_LOCK(mutex);
+	auto data = ALLOCATE_T(TL_DEFAULT_ALLOCATOR, u64, 1, 0);
+	*data = stats.allocationCounter++;
+
+	NullAllocation allocation = {};
+	allocation.type = type;
+	allocation.serial = *data;
+	stats.allocations.emplace(data, allocation);
+	return data;
+}
+void RendererImpl::release(void *data) {
+	SCOPED_LOCK(mutex);
+	auto it = stats.allocations.find(data);
+	if (it == stats.allocations.end()) {
+		++stats.invalidReleaseCount;
+		LOG("Null renderer: release of unknown renderData");
+		return;
+	}
+	releaseBuffer(it->second);
+	removeFromAtlas(it->second);
+	stats.allocations.erase(it);
+	DEALLOCATE(TL_DEFAULT_ALLOCATOR, data);
+}
+NullAllocation &RendererImpl::get(void *data) {
+	SCOPED_LOCK(mutex);
+	auto it = stats.allocations.find(data);
+	ASSERT(it != stats.allocations.end(), "Null renderer: renderData was not allocated or already released");
+	return it->second;
+}
+void RendererImpl::createBuffer(NullAllocation &allocation, umm size) {
+	releaseBuffer(allocation);
+	allocation.bufferSize = size;
+	++stats.createdBufferCount;
+	stats.bufferBytes += size;
+	stats.peakBufferBytes = max(stats.peakBufferBytes, stats.bufferBytes);
+}
+void RendererImpl::releaseBuffer(NullAllocation &allocation) {
+	if (!allocation.bufferSize)
+		return;
+	++stats.releasedBufferCount;
+	stats.bufferBytes -= allocation.bufferSize;
+	allocation.bufferSize = 0;
+}
+// Fragmented pages are compacted like r_d3d11.cpp does, blocks are copied on the GPU so nothing is uploaded
+void RendererImpl::removeFromAtlas(NullAllocation &allocation) {
+	u32 page = allocation.atlas.page;
+	if (page == noAtlasPage)
+		return;
+	if (!imageAtlas.remove(allocation.atlas) && imageAtlas.needsCompaction(page)) {
+		imageAtlas.compact(page, [](AtlasPlacement const &, AtlasPlacement const &) {});
+	}
+	countAtlasPages();
+}
+// Pages with images are counted as one buffer each
+void RendererImpl::countAtlasPages() {
+	u32 pageCount = imageAtlas.getStats().pageCount;
+	if (pageCount > atlasPageCount) {
+		stats.createdBufferCount += pageCount - atlasPageCount;
+		stats.bufferBytes += (pageCount - atlasPageCount) * imageAtlasPageBytes;
+		stats.peakBufferBytes = max(stats.peakBufferBytes, stats.bufferBytes);
+	} else {
+		stats.releasedBufferCount += atlasPageCount - pageCount;
+		stats.bufferBytes -= (atlasPageCount - pageCount) * imageAtlasPageBytes;
+	}
+	atlasPageCount = pageCount;
+}
+void RendererImpl::upload(umm size) {
+	SCOPED_LOCK(mutex);
+	stats.uploadedBytes += size;
+}
+// Clears the same flags as the other renderers, a canvas is created when the scene is resized
+void RendererImpl::beginScene(Scene *scene, bool staticLayer) {
+	scene->needRepaint = false;
+	scene->liveEntityDirty = false;
+	scene->matrixSceneToNDCDirty = false;
+	scene->constantBufferDirty = false;
+	scene->dirtyTiles.clear();
+	updateCanvasCamera(scene);
+	if (staticLayer) {
+		scene->staticLayerValid = true;
+	}
+
+	if (scene->needResize) {
+		scene->needResize = false;
+		scene->dirtyTiles.resize(clientSize);
+		createBuffer(get(scene->renderData), clientSize.x * clientSize.y * sizeof(u32));
+		canvasPool.setBytes(scene, clientSize.x * clientSize.y * sizeof(u32));
+		canvasPool.trim([&](Scene *evicted) { releaseCanvas(evicted); });
+	}
+}
+void RendererImpl::releaseCanvas(Scene *scene) {
+	releaseBuffer(get(scene->renderData));
+	canvasPool.setBytes(scene, 0);
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "renderer.h"
+#include <unordered_map>
+#include <algorithm>
+
+// Null renderer, see r_null.cpp. Draws nothing, only counts what a GPU renderer would do,
+// so the app loop can be profiled and checked for leaks without a window or a GPU.
+// Stats are reached through nullRendererStats, which is null when another renderer is linked.
+
+enum NullCall {
+#define R_DECORATE(ret, name, args, params) CONCAT(NullCall_, name),
+	R_all
+#undef R_DECORATE
+	NullCall_count,
+};
+
+inline constexpr char const *nullCallNames[] = {
+#define R_DECORATE(ret, name, args, params) #name,
+	R_all
+#undef R_DECORATE
+};
+
+enum NullAllocationType : u8 {
+	NullAllocation_scene,
+	NullAllocation_lines,
+	NullAllocation_image,
+};
+
+inline constexpr char const *nullAllocationTypeNames[] = {
+	"scene",
+	"lines",
+	"image",
+};
+
+struct NullAllocation {
+	NullAllocationType type;
+	u64 serial;       // Allocation order, stable between runs of the same input
+	umm bufferSize;   // Bytes of the buffer or texture that would exist on the GPU
+	umm lineCount;    // CPU side copy of pencil lines, same as LineData::transformedLines in r_d3d11.cpp
+	umm pendingBytes; // Texture being uploaded, see R_beginTexture
+	bool loaded;      // Image received its texture
+	AtlasPlacement atlas; // Image is drawn from an atlas page, whose bytes are counted once for all of its images
+};
+
+struct NullCallStats {
+	u64 count;
+	u64 argumentBytes; // Sum of sizeof of arguments, referenced data is counted in uploadedBytes
+};
+
+struct NullRendererStats {
+	NullCallStats calls[NullCall_count] = {};
+	u64 commandCounts[DrawCommand_count] = {};
+
+	u64 frameCount = 0;      // Executed lists with a present command
+	u64 emptyFrameCount = 0; // Executed empty lists, the main loop waits for input after them
+
+	u64 uploadedBytes = 0;
+	u64 createdBufferCount = 0;
+	u64 releasedBufferCount = 0;
+	u64 bufferBytes = 0;     // Currently alive
+	u64 peakBufferBytes = 0;
+
+	u64 allocationCounter = 0;
+	u64 invalidReleaseCount = 0; // Pointer was never allocated or was already released
+
+	std::unordered_map<void *, NullAllocation> allocations; // Alive renderData
+
+	void reset() {
+		auto alive = std::move(allocations);
+		auto counter = allocationCounter;
+		auto bytes = bufferBytes;
+		*this = {};
+		allocations = std::move(alive);
+		allocationCounter = counter;
+		bufferBytes = bytes;
+		peakBufferBytes = bytes;
+	}
+	u64 totalCallCount() const {
+		u64 result = 0;
+		for (auto &call : calls) {
+			result += call.count;
+		}
+		return result;
+	}
+	// Logs renderData that was allocated but never released, returns their count
+	umm logLeaks() const {
+		List<NullAllocation> leaks;
+		for (auto &[data, allocation] : allocations) {
+			leaks.push_back(allocation);
+		}
+		std::sort(leaks.begin(), leaks.end(), [](NullAllocation const &a, NullAllocation const &b) { return a.serial < b.serial; });
+		for (auto &leak : leaks) {
+			LOG("Leaked % renderData #%, % buffer bytes", nullAllocationTypeNames[leak.type], leak.serial, leak.bufferSize);
+		}
+		return leaks.size();
+	}
+	void log() const {
+		LOG("Null renderer: % frames (% empty), % calls", frameCount, emptyFrameCount, totalCallCount());
+		for (u32 i = 0; i < NullCall_count; ++i) {
+			if (calls[i].count) {
+				LOG("  %: % calls, % argument bytes", nullCallNames[i], calls[i].count, calls[i].argumentBytes);
+			}
+		}
+		LOG("  uploaded % bytes, % buffers created, % released, % bytes alive, % peak",
+			uploadedBytes, createdBufferCount, releasedBufferCount, bufferBytes, peakBufferBytes);
+		LOG("  % renderData alive, % invalid releases", allocations.size(), invalidReleaseCount);
+	}
+};
+
+extern NullRendererStats *nullRendererStats;
@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include "os_windows.h"
+#include "renderer.h"
+#include "raster.h"
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <dwmapi.h>
+#pragma comment(lib, "gdi32")
+#pragma comment(lib, "dwmapi")
+
+// Software renderer, see raster.h. Geometry is read from entities when a frame is drawn,
+// so line arrays and other GPU-side copies are not needed.
+
+#define CIRCLE_WIDTH 2
+
+struct ImageData {
+	List<RasterTexture> levels; // Mip chain, the first level is the largest
+	List<RasterTexture> pendingLevels; // Being uploaded, replace 'levels' when they're complete, see upload.h
+	List<ImageTile> tiles;      // Drawn over the levels, see virtualtexture.h
+	bool loaded = false;
+};
+#define IMAGE_DATA(x) (*(ImageData *)x)
+
+struct SceneData {
+	RasterSurface canvas;      // Allocated when the scene is drawn, released on resize or by CanvasPool
+	RasterSurface staticLayer; // Scene without the live entity
+	v3f colorMenuColor = {};
+};
+#define SCENE_DATA(x) (*(SceneData *)x)
+
+struct RendererImpl : Renderer {
+	RecursiveMutex mutex;
+	DrawList frameDrawList;
+
+	RasterPool pool;
+	RasterPass pass;
+	RasterSurface backBuffer;
+	RasterSurface presentBuffer; // Back buffer in BGRA for GDI
+	RasterTexture toolAtlas;
+	CanvasPool canvasPool;
+
+	v2f windowMousePos = {};
+	v3f windowDrawColor = {};
+	f32 windowDrawThickness = 0;
+	bool wireframe = false;
+	bool antialiasing = true;
+	bool vSync = true;
+
+	RendererImpl();
+
+	void beginScene(Scene *scene, bool partial, bool staticLayer);
+	void releaseCanvas(Scene *scene);
+	void updateCanvasMemory(Scene *scene);
+	void pushEntities(Scene *scene, DrawCommand const *commands, umm count);
+	void pushPieMenu(DrawCommand const &command);
+	void pushColorMenu(DrawCommand const &command);
+	void present();
+
+#define R_DECORATE(ret, name, args, params) ret name args;
+	R_all
+#undef R_DECORATE
+};
+
+extern HWND mainWindow;
+
+static void setUnloaded(ImageData &data) {
+	data.levels = {};
+	data.levels.resize(1);
+	data.levels[0].texels.resize(1);
+	data.levels[0].texels[0] = 0xFF000000;
+	data.levels[0].size = {1, 1};
+	data.loaded = false;
+}
+
+#define R_DECORATE(ret, name, args, params) ret RendererImpl::name args
+R_initScene {
+	scene->renderData = construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, SceneData, 1, 0));
+}
+R_releaseScene {
+	releaseCanvas(scene);
+	SCENE_DATA(scene->renderData).~SceneData();
+	DEALLOCATE(TL_DEFAULT_ALLOCATOR, scene->renderData);
+	scene->renderData = 0;
+}
+R_resize {
+	SCOPED_LOCK(mutex);
+	backBuffer.resize(clientSize);
+	presentBuffer.resize(clientSize);
+
+	// All scenes get needResize, canvases are allocated again when a scene is drawn
+	for (auto &scene : scenes) {
+		if (scene.renderData) {
+			releaseCanvas(&scene);
+		}
+	}
+}
+R_initPencilEntity {
+}
+R_initLineEntity {
+}
+R_initGridEntity {
+}
+R_initCircleEntity {
+}
+R_createImageData {
+	auto data = construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, ImageData, 1, 0));
+	setUnloaded(*data);
+	return data;
+}
+R_initPencilEntityData{
+}
+R_initLineEntityData{
+}
+R_initGridEntityData{
+}
+R_initCircleEntityData{
+}
+R_onColorMenuOpen{
+	switch (target) {
+		case ColorMenuTarget_draw:
+			SCENE_DATA(currentScene->renderData).colorMenuColor = currentScene->drawColor;
+			break;
+		case ColorMenuTarget_canvas:
+			SCENE_DATA(currentScene->renderData).colorMenuColor = currentScene->canvasColor;
+			break;
+	}
+}
+R_setColorMenuColor{
+	SCENE_DATA(scene->renderData).colorMenuColor = rgb;
+}
+R_repaint{
+	SCOPED_LOCK(mutex);
+
+	FrameInfo info;
+	info.clientSize = clientSize;
+	info.mousePosBL = mousePosBL;
+	info.minWindowDim = minWindowDim;
+	info.needRepaint = needRepaint;
+	info.drawCursor = drawCursor;
+	info.drawCursorCircle = drawCursorCircle;
+	recordFrame(frameDrawList, info);
+	needRepaint = false;
+
+	execute(frameDrawList);
+	debugPoints.clear();
+}
+R_execute{
+	SCOPED_LOCK(mutex);
+
+	if (!list.commands.size())
+		return;
+
+	canvasPool.beginFrame();
+	for (auto &command : list.commands) {
+		switch (command.type) {
+			case DrawCommand_beginScene: canvasPool.use(scenes + command.beginScene.sceneIndex); break;
+			case DrawCommand_blitScene:  canvasPool.use(scenes + command.blitScene.sceneIndex); break;
+		}
+	}
+
+	pass.antialiasing = antialiasing;
+
+	for (umm commandIndex = 0; commandIndex < list.commands.size(); ++commandIndex) {
+		auto &command = list.commands[commandIndex];
+		switch (command.type) {
+			case DrawCommand_beginScene: {
+				beginScene(scenes + command.beginScene.sceneIndex, command.beginScene.partial, command.beginScene.staticLayer);
+			} break;
+			case DrawCommand_useStaticLayer: {
+				auto &sceneData = SCENE_DATA(scenes[command.useStaticLayer.sceneIndex].renderData);
+				pass.begin(pool, sceneData.canvas);
+				pass.pushCopy(sceneData.staticLayer, 0);
+			} break;
+			case DrawCommand_scrollScene: {
+				pass.flush(pool);
+				scrollSurface(*pass.target, command.scrollScene.offset);
+			} break;
+			case DrawCommand_clipScene: {
+				pass.setClip(command.clipScene.min, command.clipScene.max);
+				pass.pushFill(packColor(scenes[command.clipScene.sceneIndex].canvasColor));
+			} break;
+			case DrawCommand_entity: {
+				umm end = commandIndex + 1;
+				while (end < list.commands.size() && list.commands[end].type == DrawCommand_entity) {
+					++end;
+				}
+				pushEntities(scenes + command.entity.sceneIndex, list.commands.data() + commandIndex, end - commandIndex);
+				commandIndex = end - 1;
+			} break;
+			case DrawCommand_endScene: {
+				pass.flush(pool);
+				pass.resetClip();
+			} break;
+			case DrawCommand_blitScene: {
+				auto &blit = command.blitScene;
+				auto &scene = scenes[blit.sceneIndex];
+				pass.begin(pool, backBuffer);
+				if (blit.canvasScale != 1 || blit.canvasOffset != v2f{}) {
+					pass.pushScaledCopy(SCENE_DATA(scene.renderData).canvas, blit.canvasScale, blit.canvasOffset, packColor(scene.canvasColor));
+				} else {
+					pass.pushCopy(SCENE_DATA(scene.renderData).canvas, (s32)roundf(blit.viewportX));
+				}
+			} break;
+			case DrawCommand_pieMenu: {
+				pushPieMenu(command);
+			} break;
+			case DrawCommand_cursorCircle: {
+				f32 thickness = windowDrawThickness;
+				pass.pushRing(windowMousePos, thickness * 0.5f, max(thickness - (1 << (CIRCLE_WIDTH + 1)), 0.0f) * 0.5f, windowDrawColor);
+			} break;
+			case DrawCommand_quads: {
+				for (u32 i = 0; i < command.quads.quadCount; ++i) {
+					pass.pushQuad(toolAtlas, list.quads[command.quads.firstQuad + i]);
+				}
+			} break;
+			case DrawCommand_colorMenu: {
+				pushColorMenu(command);
+			} break;
+			case DrawCommand_present: {
+				pass.flush(pool);
+				present();
+			} break;
+			default: INVALID_CODE_PATH();
+		}
+	}
+}
+R_getLastFrame{
+	return frameDrawList;
+}
+R_initConstantLineArray{
+}
+R_initDynamicLineArray{
+}
+R_reinitDynamicLineArray{
+}
+R_releasePencil {
+}
+R_releaseLine {
+}
+R_releaseGrid {
+}
+R_releaseCircle {
+}
+R_releaseImageData {
+	SCOPED_LOCK(mutex);
+	IMAGE_DATA(renderData).~ImageData();
+	DEALLOCATE(TL_DEFAULT_ALLOCATOR, renderData);
+}
+R_releaseEntity{
+}
+R_switchRasterizer{
+	wireframe = !wireframe;
+}
+R_resizeLineArray{
+}
+R_updateLineArray{
+}
+R_updateLines{
+}
+R_updateGridLines{
+}
+R_updateCircleLines{
+}
+R_freeze{
+}
+R_resizePencilLineArray{
+}
+R_updateLastElement{
+}
+R_beginTexture{
+	SCOPED_LOCK(mutex);
+	auto &levels = IMAGE_DATA(image).pendingLevels;
+	levels.resize(mips.levels.size());
+	for (u32 i = 0; i < mips.levels.size(); ++i) {
+		auto size = mips.levels[i].size;
+		levels[i].size = size;
+		levels[i].texels.resize(size.x * size.y);
+	}
+}
+R_updateTexture{
+	SCOPED_LOCK(mutex);
+	auto &texture = IMAGE_DATA(image).pendingLevels[level];
+	umm offset = (umm)firstRow * texture.size.x;
+	memcpy(texture.texels.data() + offset, mips.level(level) + offset, (umm)rowCount * texture.size.x * sizeof(u32));
+}
+R_endTexture{
+	SCOPED_LOCK(mutex);
+	auto &data = IMAGE_DATA(image);
+	data.levels = std::move(data.pendingLevels);
+	data.pendingLevels = {};
+	data.loaded = true;
+}
+R_setImageTiles{
+	SCOPED_LOCK(mutex);
+	auto &data = IMAGE_DATA(image);
+	data.tiles.clear();
+	data.tiles.resize(count);
+	memcpy(data.tiles.data(), tiles, count * sizeof(ImageTile));
+}
+R_setAtlasImage{
+	// Sampling a texture of its own costs the same here, the atlas only saves texture binds and draws on the GPU
+	beginTexture(image, mips);
+	for (u32 i = 0; i < mips.levels.size(); ++i) {
+		updateTexture(image, mips, i, 0, mips.levels[i].size.y);
+	}
+	endTexture(image);
+}
+R_getImageAtlasStats{
+	return {};
+}
+R_updatePaintCursor{
+	this->windowMousePos = windowMousePos;
+	this->windowDrawColor = windowDrawColor;
+	this->windowDrawThickness = TL::round(windowDrawThickness);
+}
+R_isLoaded {
+	return IMAGE_DATA(image.renderData).loaded;
+}
+R_setUnloadedTexture{
+	SCOPED_LOCK(mutex);
+	setUnloaded(IMAGE_DATA(imageData));
+}
+R_update{
+}
+R_onLinePushed{
+}
+R_onLinePopped{
+}
+R_getMutex {
+	return mutex;
+}
+R_setMultisampleEnabled {
+	antialiasing = enable;
+}
+R_isMultisampleEnabled {
+	return antialiasing;
+}
+R_setVSync {
+	vSync = enable;
+}
+R_getCanvasStats {
+	SCOPED_LOCK(mutex);
+	return canvasPool.stats;
+}
+R_setCanvasBudget {
+	SCOPED_LOCK(mutex);
+	canvasPool.stats.budget = bytes;
+	canvasPool.trim([&](Scene *scene) { releaseCanvas(scene); });
+}
+R_shutdown {
+	pool.deinit();
+	this->~RendererImpl();
+	DEALLOCATE(TL_DEFAULT_ALLOCATOR, this);
+}
+#undef R_DECORATE
+
+Renderer *createRenderer() {
+	return construct(ALLOCATE_T(TL_DEFAULT_ALLOCATOR, RendererImpl, 1, 0));
+}
+
+RendererImpl::RendererImpl() {
+	pool.init(getRasterWorkerCount());
+
+	static constexpr u32 atlasData[] {
+#include "atlas.h"
+	};
+	static constexpr u32 atlasSize = 256;
+	static_assert(countof(atlasData) == atlasSize * atlasSize);
+	toolAtlas.size = {atlasSize, atlasSize};
+	toolAtlas.texels.resize(countof(atlasData));
+	memcpy(toolAtlas.texels.data(), atlasData, sizeof(atlasData));
+
+#define ADD_IMPL(...) (RendererImpl *impl, __VA_ARGS__)
+#define R_DECORATE(ret, name, args, params) CONCAT(_, name) = [] ADD_IMPL args -> ret { return impl->name params; };
+	R_all
+#undef R_DECORATE
+#undef ADD_IMPL
+}
+void RendererImpl::releaseCanvas(Scene *scene) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+	sceneData.canvas = {};
+	sceneData.staticLayer = {};
+	canvasPool.setBytes(scene, 0);
+}
+// Evicts other scenes if over budget
+void RendererImpl::updateCanvasMemory(Scene *scene) {
+	auto &sceneData = SCENE_DATA(scene->renderData);
+	canvasPool.setBytes(scene, (sceneData.canvas.pixels.size() + sceneData.staticLayer.pixels.size()) * sizeof(u32));
+	canvasPool.trim([&](Scene *evicted) { releaseCanvas(evicted); });
+}
+void RendererImpl::beginScene(Scene *scene, bool partial, bool staticLayer) {
+	scene->needRepaint = false;
+	scene->liveEntityDirty = false;
+	scene->matrixSceneToNDCDirty = false;
+	scene->constantBufferDirty = false;
+	scene->dirtyTiles.clear();
+	updateCanvasCamera(scene);
+
+	auto &sceneData = SCENE_DATA(scene->renderData);
+
+	if (scene->needResize) {
+		scene->needResize = false;
+		sceneData.canvas.resize(clientSize);
+		scene->dirtyTiles.resize(clientSize);
+	}
+
+	RasterSurface *target = &sceneData.canvas;
+	if (staticLayer) {
+		scene->staticLayerValid = true;
+		if (sceneData.staticLayer.size != sceneData.canvas.size) {
+			sceneData.staticLayer.resize(sceneData.canvas.size);
+
+			// Only dirty tiles were recorded, new layer is redrawn fully next frame
+			scene->staticLayerValid = !partial;
+			partial = false;
+		}
+		target = &sceneData.staticLayer;
+	}
+	updateCanvasMemory(scene);
+
+	pass.begin(pool, *target);
+
+	// Partial repaint keeps previous contents, dirty parts are cleared by clipScene commands
+	if (!partial) {
+		pass.pushFill(packColor(scene->canvasColor));
+	}
+}
+void RendererImpl::pushEntities(Scene *scene, DrawCommand const *commands, umm count) {
+	RasterView view = getRasterView(scene, pass.target->size);
+	List<RasterImageTile> tiles;
+
+	for (umm i = 0; i < count; ++i) {
+		auto it = scene->entities.find(commands[i].entity.id);
+		if (it == scene->entities.end())
+			continue;
+		auto &e = it->second;
+
+		RasterTexture const *texture = 0;
+		tiles.clear();
+		if (e.type == Entity_image) {
+			// Level with about one texel per pixel, sampleTexture is bilinear only
+			auto getLevel = [&](List<RasterTexture> const &levels, v2f shownSize) {
+				f32 shownWidth = max(absolute(shownSize.x) / scene->cameraDistance, 1.0f);
+				f32 shownHeight = max(absolute(shownSize.y) / scene->cameraDistance, 1.0f);
+				f32 texelsPerPixel = min(levels[0].size.x / shownWidth, levels[0].size.y / shownHeight);
+				u32 level = texelsPerPixel >= 2 ? min((u32)log2f(texelsPerPixel), (u32)levels.size() - 1) : 0;
+				return &levels[level];
+			};
+			auto &data = IMAGE_DATA(e.image.renderData);
+			texture = getLevel(data.levels, e.image.size);
+			for (auto &tile : data.tiles) {
+				tiles.push_back({getLevel(IMAGE_DATA(tile.renderData).levels, (tile.rect.max - tile.rect.min) * e.image.size), tile.rect});
+			}
+		}
+		pushEntity(pass, view, e, commands[i], texture, wireframe, {tiles.data(), tiles.size()});
+	}
+}
+// Same fan as the pie selection vertex shader in r_d3d11.cpp
+void RendererImpl::pushPieMenu(DrawCommand const &command) {
+	auto &pie = command.pieMenu;
+	auto deg = [](f32 x) { return x / 180.0f * pi; };
+	constexpr f32 innerRadius = 0.05f;
+	v2f inner[] = {
+		{-cosf(deg(0)),    sinf(deg(0))},
+		{-cosf(deg(33.7f)), sinf(deg(33.7f))},
+		{-cosf(deg(67.5f)), sinf(deg(67.5f))},
+	};
+	v2f outline[] = {
+		inner[0] * innerRadius,
+		inner[1] * innerRadius,
+		inner[2] * innerRadius,
+		{cosf(deg(22)),  sinf(deg(22))},
+		{cosf(deg(11)),  sinf(deg(11))},
+		{cosf(deg(0)),   sinf(deg(0))},
+		{cosf(deg(11)), -sinf(deg(11))},
+		{cosf(deg(22)), -sinf(deg(22))},
+		v2f{inner[2].x, -inner[2].y} * innerRadius,
+		v2f{inner[1].x, -inner[1].y} * innerRadius,
+		v2f{inner[0].x, -inner[0].y} * innerRadius,
+	};
+
+	f32 c = cosf(pie.angle);
+	f32 s = sinf(pie.angle);
+	auto toWindow = [&](v2f v) {
+		return pie.position + v2f{c * v.x - s * v.y, s * v.x + c * v.y} * pie.size * 1.5f;
+	};
+	v4f centerColor = V4f(1, 1, 1, 0.5f * pie.alpha);
+	v4f edgeColor = V4f(1, 1, 1, 0);
+	for (u32 i = 0; i + 1 < countof(outline); ++i) {
+		v2f p[3] = {pie.position, toWindow(outline[i]), toWindow(outline[i + 1])};
+		v4f attribute[3] = {centerColor, edgeColor, edgeColor};
+		pass.pushTriangle(p, attribute, RasterShading_vertexColor);
+	}
+}
+// Same triangles as the color menu shaders in r_d3d11.cpp
+void RendererImpl::pushColorMenu(DrawCommand const &command) {
+	auto &menu = command.colorMenu;
+	f32 c30 = cosf(pi / 6);
+	v2f corners[3] = {{0, 1}, {c30, -0.5f}, {-c30, -0.5f}};
+	auto pushTriangle = [&](f32 scale, v4f const (&attribute)[3], RasterShading shading, v3f color) {
+		v2f p[3];
+		for (u32 i = 0; i < 3; ++i) {
+			p[i] = menu.position + corners[i] * scale * menu.size;
+		}
+		pass.pushTriangle(p, attribute, shading, color, menu.alpha);
+	};
+
+	v4f hues[3] = {V4f(1, 0, 0, 0), V4f(0, 1, 0, 0), V4f(0, 0, 1, 0)};
+	pushTriangle(1.0f, hues, RasterShading_hue, {});
+
+	v4f none[3] = {};
+	pushTriangle(0.8f, none, RasterShading_solid, SCENE_DATA(currentScene->renderData).colorMenuColor);
+
+	v4f saturationValue[3] = {V4f(1, 1, 0, 0), V4f(0, 1, 0, 0), V4f(0.5f, 0, 1, 0)};
+	pushTriangle(SV_TRIANGLE_SIZE, saturationValue, RasterShading_saturationValue, menu.hueColor);
+}
+void RendererImpl::present() {
+	// RGBA to BGRA, rows are split between workers
+	u32 rowsPerItem = canvasTileSize;
+	pool.run((backBuffer.size.y + rowsPerItem - 1) / rowsPerItem, [&](u32 item, u32 worker) {
+		u32 firstRow = item * rowsPerItem;
+		u32 endRow = min(firstRow + rowsPerItem, backBuffer.size.y);
+		__m128i greenAlpha = _mm_set1_epi32(0xFF00FF00);
+		__m128i byteMask = _mm_set1_epi32(0xFF);
+		for (u32 y = firstRow; y < endRow; ++y) {
+			auto src = (__m128i const *)backBuffer.row(y);
+			auto dst = (__m128i *)presentBuffer.row(y);
+			for (u32 x = 0; x < backBuffer.stride; x += 4) {
+				__m128i p = _mm_loadu_si128(src++);
+				__m128i r = _mm_and_si128(p, byteMask);
+				__m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), byteMask);
+				_mm_storeu_si128(dst++, _mm_or_si128(_mm_and_si128(p, greenAlpha), _mm_or_si128(_mm_slli_epi32(r, 16), b)));
+			}
+		}
+	});
+
+	// Positive height means bottom-up rows, same as the surface
+	BITMAPINFO info = {};
+	info.bmiHeader.biSize = sizeof(info.bmiHeader);
+	info.bmiHeader.biWidth = presentBuffer.stride;
+	info.bmiHeader.biHeight = presentBuffer.size.y;
+	info.bmiHeader.biPlanes = 1;
+	info.bmiHeader.biBitCount = 32;
+	info.bmiHeader.biCompression = BI_RGB;
+
+	HDC dc = GetDC(mainWindow);
+	SetDIBitsToDevice(dc, 0, 0, presentBuffer.size.x, presentBuffer.size.y, 0, 0, 0, presentBuffer.size.y, presentBuffer.pixels.data(), &info, DIB_RGB_COLORS);
+	ReleaseDC(mainWindow, dc);
+
+	if (vSync) {
+		DwmFlush();
+	}
+}
@@ -0,0 +1,951 @@
+#pragma once
+#include "base.h"
+#include "drawlist.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <emmintrin.h>
+
+// CPU rasterizer of the software renderer (r_soft.cpp).
+// Shapes of a pass are binned into canvasTileSize tiles and tiles are rasterized in parallel by RasterPool.
+// Coverage is computed analytically for 4 pixels at a time with SSE2.
+// Surfaces are RGBA like the D3D11 render targets, row 0 is the bottom row, same as canvas pixels in tiles.h.
+
+struct RasterSurface {
+	List<u32> pixels;
+	v2u size = {};
+	u32 stride = 0; // Multiple of 4, so a group of 4 pixels never crosses a tile or a row
+
+	void resize(v2u newSize) {
+		if (size == newSize)
+			return;
+		size = newSize;
+		stride = (size.x + 3) & ~3u;
+		pixels.resize(stride * size.y);
+	}
+	u32 *row(u32 y) { return pixels.data() + y * stride; }
+	u32 const *row(u32 y) const { return pixels.data() + y * stride; }
+};
+
+// Moves contents by whole pixels, exposed parts keep old pixels
+inline void scrollSurface(RasterSurface &surface, v2s offset) {
+	s32 width = (s32)surface.size.x - absolute(offset.x);
+	s32 height = (s32)surface.size.y - absolute(offset.y);
+	if (width <= 0 || height <= 0)
+		return;
+	u32 srcX = (u32)max(-offset.x, 0);
+	u32 dstX = (u32)max(offset.x, 0);
+	u32 srcY = (u32)max(-offset.y, 0);
+	u32 dstY = (u32)max(offset.y, 0);
+
+	// Rows are visited away from the direction of movement so none is overwritten before it is read
+	for (s32 i = 0; i < height; ++i) {
+		u32 row = offset.y > 0 ? height - 1 - i : i;
+		memmove(surface.row(dstY + row) + dstX, surface.row(srcY + row) + srcX, width * sizeof(u32));
+	}
+}
+
+struct RasterTexture {
+	List<u32> texels; // Row 0 is the top row, as decoded
+	v2u size = {};
+};
+
+inline u32 packColor(v3f color) {
+	auto channel = [](f32 v) { return (u32)(clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f); };
+	return channel(color.x) | (channel(color.y) << 8) | (channel(color.z) << 16) | 0xFF000000;
+}
+inline v3f unpackColor(u32 color) {
+	return V3f(color & 0xFF, (color >> 8) & 0xFF, (color >> 16) & 0xFF) / 255.0f;
+}
+
+enum RasterShapeKind : u8 {
+	RasterShape_fill,       // Opaque color
+	RasterShape_copy,       // Opaque copy of another surface shifted horizontally
+	RasterShape_scaledCopy, // Opaque bilinear copy of another surface, scaled and shifted
+	RasterShape_capsule,    // Segment with round caps, radius changes linearly along it
+	RasterShape_ring,       // Paint cursor
+	RasterShape_image,      // Rotated textured rectangle
+	RasterShape_quad,       // Axis aligned textured rectangle, UI
+	RasterShape_triangle,
+};
+
+enum RasterShading : u8 {
+	RasterShading_vertexColor,     // Interpolated rgba
+	RasterShading_solid,           // 'color' and 'alpha'
+	RasterShading_hue,             // Interpolated rgb divided by its maximum, outer triangle of the color menu
+	RasterShading_saturationValue, // lerp(1, color, x) * y, inner triangle of the color menu
+};
+
+struct RasterShape {
+	RasterShapeKind kind;
+	CanvasRect rect; // Pixels the shape may touch, clipped to the target and the clip rect
+	union {
+		struct {
+			u32 color;
+		} fill;
+		struct {
+			RasterSurface const *source;
+			s32 offsetX;
+		} copy;
+		struct {
+			RasterSurface const *source;
+			f32 scale;  // Target pixel p samples source at p * scale + offset
+			v2f offset;
+			u32 background; // Where the source doesn't reach
+		} scaledCopy;
+		struct {
+			v2f a, b;
+			f32 ra, rb;
+			v3f color;
+		} capsule;
+		struct {
+			v2f center;
+			f32 outerRadius, innerRadius;
+			v3f color;
+		} ring;
+		struct {
+			v2f center;
+			v2f toLocalX, toLocalY; // Pixel offset from the center to [-0.5, 0.5] image space
+			v2f pixelSize;
+			RasterTexture const *texture;
+		} image;
+		struct {
+			v2f position, size;
+			v2f uvMin, uvMax;
+			v4f color;
+			RasterTexture const *texture;
+		} quad;
+		struct {
+			v2f p[3];
+			v4f attribute[3];
+			v3f color;
+			f32 alpha;
+			RasterShading shading;
+		} triangle;
+	};
+};
+
+//
+// Work-stealing pool
+//
+
+constexpr u32 maxRasterWorkerCount = 64;
+
+// Items are split evenly between workers up front. A worker takes items from the front of its own range,
+// when it runs out it steals from the back of the others' ranges.
+struct alignas(64) RasterWorkerQueue {
+	std::atomic<u64> range; // First item in low 32 bits, end in high 32 bits
+
+	static u64 pack(u32 begin, u32 end) { return begin | ((u64)end << 32); }
+
+	bool pop(u32 &item) {
+		u64 current = range.load(std::memory_order_relaxed);
+		for (;;) {
+			u32 begin = (u32)current;
+			u32 end = (u32)(current >> 32);
+			if (begin >= end)
+				return false;
+			if (range.compare_exchange_weak(current, pack(begin + 1, end))) {
+				item = begin;
+				return true;
+			}
+		}
+	}
+	bool steal(u32 &item) {
+		u64 current = range.load(std::memory_order_relaxed);
+		for (;;) {
+			u32 begin = (u32)current;
+			u32 end = (u32)(current >> 32);
+			if (begin >= end)
+				return false;
+			if (range.compare_exchange_weak(current, pack(begin, end - 1))) {
+				item = end - 1;
+				return true;
+			}
+		}
+	}
+};
+
+// Persistent threads, the thread that calls run() is worker zero
+struct RasterPool {
+	RasterWorkerQueue queues[maxRasterWorkerCount];
+	std::thread threads[maxRasterWorkerCount];
+	u32 workerCount = 0;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	u32 generation = 0;
+	u32 busyCount = 0;
+	bool stopping = false;
+
+	void (*job)(void *context, u32 item, u32 worker) = 0;
+	void *jobContext = 0;
+
+	std::atomic<u32> stealCount = 0;
+
+	void init(u32 count) {
+		workerCount = clamp(count, 1u, maxRasterWorkerCount);
+		for (u32 i = 1; i < workerCount; ++i) {
+			threads[i] = std::thread([this, i] {
+				u32 seenGeneration = 0;
+				for (;;) {
+					{
+						std::unique_lock lock(mutex);
+						wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+						if (stopping)
+							return;
+						seenGeneration = generation;
+					}
+					work(i);
+					{
+						std::unique_lock lock(mutex);
+						if (--busyCount == 0) {
+							done.notify_one();
+						}
+					}
+				}
+			});
+		}
+	}
+	void deinit() {
+		{
+			std::unique_lock lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (u32 i = 1; i < workerCount; ++i) {
+			threads[i].join();
+		}
+		workerCount = 0;
+	}
+	void work(u32 worker) {
+		u32 item;
+		while (queues[worker].pop(item)) {
+			job(jobContext, item, worker);
+		}
+		for (u32 i = 1; i < workerCount; ++i) {
+			auto &victim = queues[(worker + i) % workerCount];
+			while (victim.steal(item)) {
+				stealCount.fetch_add(1, std::memory_order_relaxed);
+				job(jobContext, item, worker);
+			}
+		}
+	}
+	// Calls fn(item, worker) for every item in [0, itemCount) and waits for completion
+	template <class Fn>
+	void run(u32 itemCount, Fn &&fn) {
+		if (!itemCount)
+			return;
+
+		using FnType = std::remove_reference_t<Fn>;
+		job = [](void *context, u32 item, u32 worker) { (*(FnType *)context)(item, worker); };
+		jobContext = (void *)&fn;
+
+		for (u32 i = 0; i < workerCount; ++i) {
+			queues[i].range = RasterWorkerQueue::pack(
+				(u32)((u64)itemCount * i / workerCount),
+				(u32)((u64)itemCount * (i + 1) / workerCount)
+			);
+		}
+		if (workerCount > 1) {
+			{
+				std::unique_lock lock(mutex);
+				busyCount = workerCount - 1;
+				++generation;
+			}
+			wake.notify_all();
+		}
+
+		work(0);
+
+		if (workerCount > 1) {
+			std::unique_lock lock(mutex);
+			done.wait(lock, [&] { return busyCount == 0; });
+		}
+	}
+};
+
+inline u32 getRasterWorkerCount() {
+	return max(std::thread::hardware_concurrency(), 1u);
+}
+
+//
+// Kernels
+//
+
+FORCEINLINE __m128 rasterClamp01(__m128 v) {
+	return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+FORCEINLINE __m128 rasterAbs(__m128 v) {
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+FORCEINLINE bool rasterAnyCovered(__m128 coverage) {
+	return _mm_movemask_ps(_mm_cmpgt_ps(coverage, _mm_setzero_ps())) != 0;
+}
+// Antialiased coverage from signed distance to the edge in pixels, or a hard edge at pixel centers
+FORCEINLINE __m128 rasterCoverage(__m128 distance, bool antialiasing) {
+	if (antialiasing)
+		return rasterClamp01(_mm_add_ps(distance, _mm_set1_ps(0.5f)));
+	return _mm_and_ps(_mm_cmpge_ps(distance, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+// dst + (src - dst) * alpha for 4 RGBA pixels, color channels are in [0, 255]. Result is opaque.
+FORCEINLINE __m128i rasterBlend(__m128i dst, __m128 r, __m128 g, __m128 b, __m128 alpha) {
+	__m128i byteMask = _mm_set1_epi32(0xFF);
+	__m128 dr = _mm_cvtepi32_ps(_mm_and_si128(dst, byteMask));
+	__m128 dg = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(dst, 8), byteMask));
+	__m128 db = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(dst, 16), byteMask));
+	dr = _mm_add_ps(dr, _mm_mul_ps(_mm_sub_ps(r, dr), alpha));
+	dg = _mm_add_ps(dg, _mm_mul_ps(_mm_sub_ps(g, dg), alpha));
+	db = _mm_add_ps(db, _mm_mul_ps(_mm_sub_ps(b, db), alpha));
+	__m128i result = _mm_cvtps_epi32(dr);
+	result = _mm_or_si128(result, _mm_slli_epi32(_mm_cvtps_epi32(dg), 8));
+	result = _mm_or_si128(result, _mm_slli_epi32(_mm_cvtps_epi32(db), 16));
+	return _mm_or_si128(result, _mm_set1_epi32(0xFF000000));
+}
+
+// Calls shade(x, y, inside, pixels) for every group of 4 pixels in 'rect'.
+// x and y are pixel centers, lanes outside of the rect have zero 'inside' mask.
+template <class Shade>
+FORCEINLINE void rasterizeGroups(RasterSurface &target, CanvasRect rect, Shade &&shade) {
+	__m128 laneCenters = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	__m128i laneIndices = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i rectMin = _mm_set1_epi32((s32)rect.min.x - 1);
+	__m128i rectMax = _mm_set1_epi32((s32)rect.max.x);
+	u32 firstX = rect.min.x & ~3u;
+	for (u32 y = rect.min.y; y < rect.max.y; ++y) {
+		u32 *row = target.row(y);
+		__m128 py = _mm_set1_ps(y + 0.5f);
+		for (u32 x = firstX; x < rect.max.x; x += 4) {
+			__m128i xi = _mm_add_epi32(_mm_set1_epi32((s32)x), laneIndices);
+			__m128 inside = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(xi, rectMin), _mm_cmplt_epi32(xi, rectMax)));
+			__m128 px = _mm_add_ps(_mm_set1_ps((f32)x), laneCenters);
+
+			__m128i *pixels = (__m128i *)(row + x);
+			__m128i value = _mm_loadu_si128(pixels);
+			shade(px, py, inside, value);
+			_mm_storeu_si128(pixels, value);
+		}
+	}
+}
+
+// Bilinear, clamped to edges. 'v' is 0 at the first row. Returns channels in [0, 255].
+inline v4f sampleTexture(RasterTexture const &texture, f32 u, f32 v) {
+	f32 x = u * texture.size.x - 0.5f;
+	f32 y = v * texture.size.y - 0.5f;
+	f32 fx0 = floorf(x);
+	f32 fy0 = floorf(y);
+	f32 tx = x - fx0;
+	f32 ty = y - fy0;
+	s32 maxX = (s32)texture.size.x - 1;
+	s32 maxY = (s32)texture.size.y - 1;
+	s32 x0 = clamp((s32)fx0, 0, maxX);
+	s32 y0 = clamp((s32)fy0, 0, maxY);
+	s32 x1 = clamp((s32)fx0 + 1, 0, maxX);
+	s32 y1 = clamp((s32)fy0 + 1, 0, maxY);
+	auto texel = [&](s32 tx, s32 ty) {
+		u32 c = texture.texels[ty * texture.size.x + tx];
+		return V4f(c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF, c >> 24);
+	};
+	return lerp(lerp(texel(x0, y0), texel(x1, y0), tx), lerp(texel(x0, y1), texel(x1, y1), tx), ty);
+}
+
+// Lerps all four channels at once, 't' is from 0 to 256
+inline u32 lerpPacked(u32 a, u32 b, u32 t) {
+	u32 rb = ((((a & 0xFF00FF) * (256 - t)) + ((b & 0xFF00FF) * t)) >> 8) & 0xFF00FF;
+	u32 ga = ((((a >> 8) & 0xFF00FF) * (256 - t)) + (((b >> 8) & 0xFF00FF) * t)) & 0xFF00FF00;
+	return rb | ga;
+}
+
+// Draws the part of the shape that is inside of 'rect'
+inline void rasterizeShape(RasterSurface &target, RasterShape const &shape, CanvasRect rect, bool antialiasing) {
+	switch (shape.kind) {
+		case RasterShape_fill: {
+			__m128i color = _mm_set1_epi32((s32)shape.fill.color);
+			rasterizeGroups(target, rect, [&](__m128, __m128, __m128 inside, __m128i &pixels) {
+				__m128i mask = _mm_castps_si128(inside);
+				pixels = _mm_or_si128(_mm_and_si128(mask, color), _mm_andnot_si128(mask, pixels));
+			});
+		} break;
+		case RasterShape_copy: {
+			auto &source = *shape.copy.source;
+			for (u32 y = rect.min.y; y < rect.max.y; ++y) {
+				memcpy(target.row(y) + rect.min.x, source.row(y) + rect.min.x - shape.copy.offsetX, (rect.max.x - rect.min.x) * sizeof(u32));
+			}
+		} break;
+		case RasterShape_scaledCopy: {
+			auto &s = shape.scaledCopy;
+			auto &source = *s.source;
+			s32 maxX = (s32)source.size.x - 1;
+			s32 maxY = (s32)source.size.y - 1;
+			for (u32 y = rect.min.y; y < rect.max.y; ++y) {
+				u32 *row = target.row(y);
+				f32 sy = (y + 0.5f) * s.scale + s.offset.y;
+				if (sy < 0 || sy >= source.size.y) {
+					for (u32 x = rect.min.x; x < rect.max.x; ++x) {
+						row[x] = s.background;
+					}
+					continue;
+				}
+				sy -= 0.5f;
+				s32 y0 = (s32)floorf(sy);
+				u32 ty = (u32)((sy - y0) * 256);
+				u32 const *row0 = source.row(clamp(y0, 0, maxY));
+				u32 const *row1 = source.row(clamp(y0 + 1, 0, maxY));
+				for (u32 x = rect.min.x; x < rect.max.x; ++x) {
+					f32 sx = (x + 0.5f) * s.scale + s.offset.x;
+					if (sx < 0 || sx >= source.size.x) {
+						row[x] = s.background;
+						continue;
+					}
+					sx -= 0.5f;
+					s32 x0 = (s32)floorf(sx);
+					u32 tx = (u32)((sx - x0) * 256);
+					s32 a = clamp(x0, 0, maxX);
+					s32 b = clamp(x0 + 1, 0, maxX);
+					row[x] = lerpPacked(lerpPacked(row0[a], row0[b], tx), lerpPacked(row1[a], row1[b], tx), ty);
+				}
+			}
+		} break;
+		case RasterShape_capsule: {
+			auto &s = shape.capsule;
+			v2f ab = s.b - s.a;
+			f32 lengthSquared = dot(ab, ab);
+			__m128 ax = _mm_set1_ps(s.a.x);
+			__m128 ay = _mm_set1_ps(s.a.y);
+			__m128 abx = _mm_set1_ps(ab.x);
+			__m128 aby = _mm_set1_ps(ab.y);
+			__m128 invLengthSquared = _mm_set1_ps(lengthSquared > 0 ? 1.0f / lengthSquared : 0.0f);
+			__m128 ra = _mm_set1_ps(s.ra);
+			__m128 radiusDelta = _mm_set1_ps(s.rb - s.ra);
+			__m128 r = _mm_set1_ps(s.color.x * 255.0f);
+			__m128 g = _mm_set1_ps(s.color.y * 255.0f);
+			__m128 b = _mm_set1_ps(s.color.z * 255.0f);
+			rasterizeGroups(target, rect, [&](__m128 px, __m128 py, __m128 inside, __m128i &pixels) {
+				__m128 dx = _mm_sub_ps(px, ax);
+				__m128 dy = _mm_sub_ps(py, ay);
+				__m128 t = rasterClamp01(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, abx), _mm_mul_ps(dy, aby)), invLengthSquared));
+				__m128 ex = _mm_sub_ps(dx, _mm_mul_ps(abx, t));
+				__m128 ey = _mm_sub_ps(dy, _mm_mul_ps(aby, t));
+				__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)));
+				__m128 radius = _mm_add_ps(ra, _mm_mul_ps(radiusDelta, t));
+				__m128 coverage = _mm_and_ps(rasterCoverage(_mm_sub_ps(radius, distance), antialiasing), inside);
+				if (rasterAnyCovered(coverage)) {
+					pixels = rasterBlend(pixels, r, g, b, coverage);
+				}
+			});
+		} break;
+		case RasterShape_ring: {
+			auto &s = shape.ring;
+			__m128 cx = _mm_set1_ps(s.center.x);
+			__m128 cy = _mm_set1_ps(s.center.y);
+			__m128 outer = _mm_set1_ps(s.outerRadius);
+			__m128 inner = _mm_set1_ps(s.innerRadius);
+			__m128 invWidth = _mm_set1_ps(s.outerRadius > s.innerRadius ? 1.0f / (s.outerRadius - s.innerRadius) : 0.0f);
+			__m128 r = _mm_set1_ps(s.color.x * 255.0f);
+			__m128 g = _mm_set1_ps(s.color.y * 255.0f);
+			__m128 b = _mm_set1_ps(s.color.z * 255.0f);
+			__m128 white = _mm_set1_ps(255.0f);
+			rasterizeGroups(target, rect, [&](__m128 px, __m128 py, __m128 inside, __m128i &pixels) {
+				__m128 dx = _mm_sub_ps(px, cx);
+				__m128 dy = _mm_sub_ps(py, cy);
+				__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+				__m128 coverage = rasterCoverage(_mm_sub_ps(outer, distance), antialiasing);
+				if (s.innerRadius > 0) {
+					coverage = _mm_mul_ps(coverage, rasterCoverage(_mm_sub_ps(distance, inner), antialiasing));
+				}
+				coverage = _mm_and_ps(coverage, inside);
+				if (!rasterAnyCovered(coverage))
+					return;
+
+				// Same as the D3D11 cursor shader: black outer and white inner outline
+				__m128 across = rasterClamp01(_mm_mul_ps(_mm_sub_ps(outer, distance), invWidth));
+				__m128 outline = _mm_max_ps(_mm_sub_ps(_mm_mul_ps(rasterAbs(_mm_sub_ps(across, _mm_set1_ps(0.5f))), _mm_set1_ps(4.0f)), _mm_set1_ps(1.0f)), _mm_setzero_ps());
+				__m128 gray = _mm_mul_ps(across, white);
+				pixels = rasterBlend(pixels,
+					_mm_add_ps(r, _mm_mul_ps(_mm_sub_ps(gray, r), outline)),
+					_mm_add_ps(g, _mm_mul_ps(_mm_sub_ps(gray, g), outline)),
+					_mm_add_ps(b, _mm_mul_ps(_mm_sub_ps(gray, b), outline)),
+					coverage
+				);
+			});
+		} break;
+		case RasterShape_image: {
+			auto &s = shape.image;
+			__m128 cx = _mm_set1_ps(s.center.x);
+			__m128 cy = _mm_set1_ps(s.center.y);
+			__m128 lxx = _mm_set1_ps(s.toLocalX.x);
+			__m128 lxy = _mm_set1_ps(s.toLocalX.y);
+			__m128 lyx = _mm_set1_ps(s.toLocalY.x);
+			__m128 lyy = _mm_set1_ps(s.toLocalY.y);
+			__m128 width = _mm_set1_ps(s.pixelSize.x);
+			__m128 height = _mm_set1_ps(s.pixelSize.y);
+			__m128 half = _mm_set1_ps(0.5f);
+			rasterizeGroups(target, rect, [&](__m128 px, __m128 py, __m128 inside, __m128i &pixels) {
+				__m128 dx = _mm_sub_ps(px, cx);
+				__m128 dy = _mm_sub_ps(py, cy);
+				__m128 u = _mm_add_ps(_mm_mul_ps(dx, lxx), _mm_mul_ps(dy, lxy));
+				__m128 v = _mm_add_ps(_mm_mul_ps(dx, lyx), _mm_mul_ps(dy, lyy));
+				__m128 edge = _mm_min_ps(
+					_mm_mul_ps(_mm_sub_ps(half, rasterAbs(u)), width),
+					_mm_mul_ps(_mm_sub_ps(half, rasterAbs(v)), height)
+				);
+				__m128 coverage = _mm_and_ps(rasterCoverage(edge, antialiasing), inside);
+				if (!rasterAnyCovered(coverage))
+					return;
+
+				alignas(16) f32 us[4], vs[4], coverages[4];
+				alignas(16) f32 r[4], g[4], b[4], a[4];
+				_mm_store_ps(us, u);
+				_mm_store_ps(vs, v);
+				_mm_store_ps(coverages, coverage);
+				for (u32 i = 0; i < 4; ++i) {
+					if (coverages[i] > 0) {
+						// Texture rows go from the top
+						v4f texel = sampleTexture(*s.texture, us[i] + 0.5f, 0.5f - vs[i]);
+						r[i] = texel.x;
+						g[i] = texel.y;
+						b[i] = texel.z;
+						a[i] = coverages[i] * texel.w * (1.0f / 255.0f);
+					} else {
+						r[i] = g[i] = b[i] = a[i] = 0;
+					}
+				}
+				pixels = rasterBlend(pixels, _mm_load_ps(r), _mm_load_ps(g), _mm_load_ps(b), _mm_load_ps(a));
+			});
+		} break;
+		case RasterShape_quad: {
+			auto &s = shape.quad;
+			__m128 minX = _mm_set1_ps(s.position.x);
+			__m128 minY = _mm_set1_ps(s.position.y);
+			__m128 maxX = _mm_set1_ps(s.position.x + s.size.x);
+			__m128 maxY = _mm_set1_ps(s.position.y + s.size.y);
+			v2f uvScale = (s.uvMax - s.uvMin) / s.size;
+			rasterizeGroups(target, rect, [&](__m128 px, __m128 py, __m128 inside, __m128i &pixels) {
+				__m128 covered = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(px, minX), _mm_cmplt_ps(px, maxX)), _mm_and_ps(_mm_cmpge_ps(py, minY), _mm_cmplt_ps(py, maxY)));
+				__m128 coverage = _mm_and_ps(_mm_and_ps(covered, inside), _mm_set1_ps(1.0f));
+				if (!rasterAnyCovered(coverage))
+					return;
+
+				alignas(16) f32 xs[4], coverages[4];
+				alignas(16) f32 r[4], g[4], b[4], a[4];
+				_mm_store_ps(xs, px);
+				_mm_store_ps(coverages, coverage);
+				f32 v = s.uvMin.y + (_mm_cvtss_f32(py) - s.position.y) * uvScale.y;
+				for (u32 i = 0; i < 4; ++i) {
+					if (coverages[i] > 0) {
+						v4f texel = sampleTexture(*s.texture, s.uvMin.x + (xs[i] - s.position.x) * uvScale.x, v);
+						r[i] = texel.x * s.color.x;
+						g[i] = texel.y * s.color.y;
+						b[i] = texel.z * s.color.z;
+						a[i] = texel.w * s.color.w * (1.0f / 255.0f);
+					} else {
+						r[i] = g[i] = b[i] = a[i] = 0;
+					}
+				}
+				pixels = rasterBlend(pixels, _mm_load_ps(r), _mm_load_ps(g), _mm_load_ps(b), _mm_load_ps(a));
+			});
+		} break;
+		case RasterShape_triangle: {
+			auto &s = shape.triangle;
+			f32 area = cross(s.p[1] - s.p[0], s.p[2] - s.p[0]);
+			if (area == 0)
+				break;
+
+			// Barycentric weight of every vertex as a plane: w = x * dx + y * dy + c
+			__m128 wdx[3], wdy[3], wc[3];
+			for (u32 i = 0; i < 3; ++i) {
+				v2f from = s.p[(i + 1) % 3];
+				v2f to = s.p[(i + 2) % 3];
+				f32 dx = -(to.y - from.y) / area;
+				f32 dy = (to.x - from.x) / area;
+				wdx[i] = _mm_set1_ps(dx);
+				wdy[i] = _mm_set1_ps(dy);
+				wc[i] = _mm_set1_ps(-dx * from.x - dy * from.y);
+			}
+			__m128 attributes[3][4];
+			for (u32 i = 0; i < 3; ++i) {
+				for (u32 j = 0; j < 4; ++j) {
+					attributes[i][j] = _mm_set1_ps(s.attribute[i].s[j]);
+				}
+			}
+			__m128 colorR = _mm_set1_ps(s.color.x * 255.0f);
+			__m128 colorG = _mm_set1_ps(s.color.y * 255.0f);
+			__m128 colorB = _mm_set1_ps(s.color.z * 255.0f);
+			__m128 towardsR = _mm_set1_ps(s.color.x - 1);
+			__m128 towardsG = _mm_set1_ps(s.color.y - 1);
+			__m128 towardsB = _mm_set1_ps(s.color.z - 1);
+			__m128 alpha = _mm_set1_ps(s.alpha);
+			__m128 one = _mm_set1_ps(1.0f);
+			__m128 white = _mm_set1_ps(255.0f);
+
+			// Pie menu is a fan of triangles with shared edges, antialiasing would show the seams
+			rasterizeGroups(target, rect, [&](__m128 px, __m128 py, __m128 inside, __m128i &pixels) {
+				__m128 w[3];
+				for (u32 i = 0; i < 3; ++i) {
+					w[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, wdx[i]), _mm_mul_ps(py, wdy[i])), wc[i]);
+				}
+				__m128 covered = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w[0], _mm_setzero_ps()), _mm_cmpge_ps(w[1], _mm_setzero_ps())), _mm_cmpge_ps(w[2], _mm_setzero_ps()));
+				covered = _mm_and_ps(covered, inside);
+				if (!_mm_movemask_ps(covered))
+					return;
+
+				auto interpolate = [&](u32 channel) {
+					return _mm_add_ps(_mm_add_ps(_mm_mul_ps(w[0], attributes[0][channel]), _mm_mul_ps(w[1], attributes[1][channel])), _mm_mul_ps(w[2], attributes[2][channel]));
+				};
+				__m128 r = _mm_setzero_ps(), g = r, b = r, a = alpha;
+				switch (s.shading) {
+					case RasterShading_vertexColor: {
+						r = _mm_mul_ps(interpolate(0), white);
+						g = _mm_mul_ps(interpolate(1), white);
+						b = _mm_mul_ps(interpolate(2), white);
+						a = interpolate(3);
+					} break;
+					case RasterShading_solid: {
+						r = colorR;
+						g = colorG;
+						b = colorB;
+					} break;
+					case RasterShading_hue: {
+						r = interpolate(0);
+						g = interpolate(1);
+						b = interpolate(2);
+						__m128 scale = _mm_div_ps(white, _mm_max_ps(_mm_max_ps(_mm_max_ps(r, g), b), _mm_set1_ps(1e-6f)));
+						r = _mm_mul_ps(r, scale);
+						g = _mm_mul_ps(g, scale);
+						b = _mm_mul_ps(b, scale);
+					} break;
+					case RasterShading_saturationValue: {
+						__m128 saturation = interpolate(0);
+						__m128 value = _mm_mul_ps(interpolate(1), white);
+						r = _mm_mul_ps(_mm_add_ps(one, _mm_mul_ps(towardsR, saturation)), value);
+						g = _mm_mul_ps(_mm_add_ps(one, _mm_mul_ps(towardsG, saturation)), value);
+						b = _mm_mul_ps(_mm_add_ps(one, _mm_mul_ps(towardsB, saturation)), value);
+					} break;
+					default: INVALID_CODE_PATH();
+				}
+				a = _mm_and_ps(rasterClamp01(a), covered);
+				pixels = rasterBlend(pixels, r, g, b, a);
+			});
+		} break;
+		default: INVALID_CODE_PATH();
+	}
+}
+
+//
+// Pass
+//
+
+// Bounding box of a long diagonal segment covers many tiles the segment does not touch
+inline bool capsuleTouchesTile(RasterShape const &shape, v2u tile) {
+	auto &s = shape.capsule;
+	f32 halfTile = canvasTileSize * 0.5f;
+	v2f center = (v2f)(tile * canvasTileSize) + halfTile;
+	v2f ab = s.b - s.a;
+	f32 lengthSquared = dot(ab, ab);
+	f32 t = lengthSquared > 0 ? clamp(dot(center - s.a, ab) / lengthSquared, 0.0f, 1.0f) : 0.0f;
+	f32 radius = max(s.ra, s.rb) + 1;
+	f32 reach = radius + halfTile * 1.41422f;
+	v2f closest = s.a + ab * t - center;
+	return dot(closest, closest) <= reach * reach;
+}
+
+// Entity commands are converted to canvas pixels with the scene's camera
+struct RasterView {
+	v2f origin = {};       // Scene::canvasOrigin
+	v2f originOffset = {}; // Whole canvas pixels from the camera to the origin
+	f32 cameraDistance = 1;
+	v2f canvasSize = {};
+
+	// Positions relative to the origin are rounded to 1/256 pixel, adding whole pixels to them is exact.
+	// So the canvas scrolled by whole pixels is the same as a redrawn one.
+	v2f toCanvas(v2f p) const { return round((p - origin) / cameraDistance * 256.0f) / 256.0f + (canvasSize * 0.5f + originOffset); }
+};
+
+inline RasterView getRasterView(Scene const *scene, v2u canvasSize) {
+	RasterView view;
+	view.origin = scene->canvasOrigin;
+	view.originOffset = getCanvasOriginOffset(scene);
+	view.cameraDistance = scene->cameraDistance;
+	view.canvasSize = (v2f)canvasSize;
+	return view;
+}
+
+struct RasterStats {
+	u32 passCount = 0;
+	u32 shapeCount = 0;
+	u32 binnedShapeCount = 0; // Sum of tiles touched by every shape
+	u32 tileCount = 0;        // Tiles that had something to draw
+	u32 stealCount = 0;
+};
+
+// Shapes drawn into one surface. Nothing is drawn until flush.
+struct RasterPass {
+	RasterSurface *target = 0;
+	CanvasRect clip = {};
+	bool antialiasing = true;
+	List<RasterShape> shapes;
+
+	// Shape indices of every tile, counting sort
+	List<u32> binOffsets;
+	List<u32> binCursors;
+	List<u32> binnedShapes;
+	List<u32> activeTiles;
+
+	RasterStats stats;
+
+	// Flushes shapes of the previous target if it changes
+	void begin(RasterPool &pool, RasterSurface &newTarget) {
+		if (target != &newTarget) {
+			flush(pool);
+		}
+		target = &newTarget;
+		resetClip();
+	}
+	void setClip(v2u min, v2u max) {
+		clip.min = TL::min(min, target->size);
+		clip.max = TL::min(max, target->size);
+	}
+	void resetClip() {
+		clip = {{}, target->size};
+	}
+
+	// 'boundsMin' and 'boundsMax' are pixel coordinates of the area the shape can change
+	void push(RasterShape &shape, v2f boundsMin, v2f boundsMax) {
+		f32 x0 = max(floorf(boundsMin.x), (f32)clip.min.x);
+		f32 y0 = max(floorf(boundsMin.y), (f32)clip.min.y);
+		f32 x1 = min(ceilf(boundsMax.x), (f32)clip.max.x);
+		f32 y1 = min(ceilf(boundsMax.y), (f32)clip.max.y);
+		if (!(x0 < x1 && y0 < y1))
+			return;
+		shape.rect = {{(u32)x0, (u32)y0}, {(u32)x1, (u32)y1}};
+		shapes.push_back(shape);
+	}
+
+	void pushFill(u32 color) {
+		RasterShape shape;
+		shape.kind = RasterShape_fill;
+		shape.fill.color = color;
+		push(shape, (v2f)clip.min, (v2f)clip.max);
+	}
+	void pushCopy(RasterSurface const &source, s32 offsetX) {
+		RasterShape shape;
+		shape.kind = RasterShape_copy;
+		shape.copy.source = &source;
+		shape.copy.offsetX = offsetX;
+		push(shape, v2f{(f32)offsetX, 0}, v2f{(f32)((s32)source.size.x + offsetX), (f32)source.size.y});
+	}
+	void pushScaledCopy(RasterSurface const &source, f32 scale, v2f offset, u32 background) {
+		RasterShape shape;
+		shape.kind = RasterShape_scaledCopy;
+		shape.scaledCopy.source = &source;
+		shape.scaledCopy.scale = scale;
+		shape.scaledCopy.offset = offset;
+		shape.scaledCopy.background = background;
+		push(shape, (v2f)clip.min, (v2f)clip.max);
+	}
+	void pushCapsule(v2f a, v2f b, f32 ra, f32 rb, v3f color) {
+		RasterShape shape;
+		shape.kind = RasterShape_capsule;
+		shape.capsule.a = a;
+		shape.capsule.b = b;
+		shape.capsule.ra = ra;
+		shape.capsule.rb = rb;
+		shape.capsule.color = color;
+		f32 margin = max(ra, rb) + 1;
+		push(shape, TL::min(a, b) - margin, TL::max(a, b) + margin);
+	}
+	void pushRing(v2f center, f32 outerRadius, f32 innerRadius, v3f color) {
+		RasterShape shape;
+		shape.kind = RasterShape_ring;
+		shape.ring.center = center;
+		shape.ring.outerRadius = outerRadius;
+		shape.ring.innerRadius = innerRadius;
+		shape.ring.color = color;
+		push(shape, center - (outerRadius + 1), center + (outerRadius + 1));
+	}
+	// 'axisX' and 'axisY' go from the center to the right and top edges, in pixels
+	void pushImage(RasterTexture const &texture, v2f center, v2f axisX, v2f axisY) {
+		f32 determinant = cross(axisX, axisY);
+		if (determinant == 0)
+			return;
+
+		RasterShape shape;
+		shape.kind = RasterShape_image;
+		shape.image.center = center;
+		shape.image.toLocalX = v2f{axisY.y, -axisY.x} / determinant * 0.5f;
+		shape.image.toLocalY = v2f{-axisX.y, axisX.x} / determinant * 0.5f;
+		shape.image.pixelSize = {length(axisX) * 2, length(axisY) * 2};
+		shape.image.texture = &texture;
+		v2f extent = {absolute(axisX.x) + absolute(axisY.x) + 1, absolute(axisX.y) + absolute(axisY.y) + 1};
+		push(shape, center - extent, center + extent);
+	}
+	void pushQuad(RasterTexture const &texture, Quad const &quad) {
+		if (quad.size.x <= 0 || quad.size.y <= 0)
+			return;
+		RasterShape shape;
+		shape.kind = RasterShape_quad;
+		shape.quad.position = quad.position;
+		shape.quad.size = quad.size;
+		shape.quad.uvMin = quad.uvMin;
+		shape.quad.uvMax = quad.uvMax;
+		shape.quad.color = quad.color;
+		shape.quad.texture = &texture;
+		push(shape, quad.position, quad.position + quad.size);
+	}
+	void pushTriangle(v2f const (&p)[3], v4f const (&attribute)[3], RasterShading shading, v3f color = {}, f32 alpha = 1) {
+		RasterShape shape;
+		shape.kind = RasterShape_triangle;
+		for (u32 i = 0; i < 3; ++i) {
+			shape.triangle.p[i] = p[i];
+			shape.triangle.attribute[i] = attribute[i];
+		}
+		shape.triangle.shading = shading;
+		shape.triangle.color = color;
+		shape.triangle.alpha = alpha;
+		push(shape, TL::min(TL::min(p[0], p[1]), p[2]), TL::max(TL::max(p[0], p[1]), p[2]));
+	}
+
+	// Bins shapes into tiles and draws tiles in parallel, shapes keep their order inside of a tile
+	void flush(RasterPool &pool) {
+		if (!shapes.size())
+			return;
+
+		v2u tileCount = (target->size + (canvasTileSize - 1)) / canvasTileSize;
+		u32 totalTileCount = tileCount.x * tileCount.y;
+
+		auto forEachTile = [&](RasterShape const &shape, auto &&fn) {
+			v2u first = shape.rect.min / canvasTileSize;
+			v2u last = (shape.rect.max - 1) / canvasTileSize;
+			for (u32 y = first.y; y <= last.y; ++y) {
+				for (u32 x = first.x; x <= last.x; ++x) {
+					if (shape.kind == RasterShape_capsule && !capsuleTouchesTile(shape, {x, y}))
+						continue;
+					fn(y * tileCount.x + x);
+				}
+			}
+		};
+
+		binOffsets.resize(totalTileCount + 1);
+		memset(binOffsets.data(), 0, binOffsets.size() * sizeof(u32));
+		for (auto &shape : shapes) {
+			forEachTile(shape, [&](u32 tile) { ++binOffsets[tile + 1]; });
+		}
+		activeTiles.clear();
+		for (u32 tile = 0; tile < totalTileCount; ++tile) {
+			if (binOffsets[tile + 1]) {
+				activeTiles.push_back(tile);
+			}
+			binOffsets[tile + 1] += binOffsets[tile];
+		}
+
+		binnedShapes.resize(binOffsets[totalTileCount]);
+		binCursors.resize(totalTileCount);
+		memcpy(binCursors.data(), binOffsets.data(), totalTileCount * sizeof(u32));
+		for (u32 index = 0; index < shapes.size(); ++index) {
+			forEachTile(shapes[index], [&](u32 tile) { binnedShapes[binCursors[tile]++] = index; });
+		}
+
+		u32 stealCountBefore = pool.stealCount;
+		pool.run((u32)activeTiles.size(), [&](u32 item, u32 worker) {
+			u32 tile = activeTiles[item];
+			CanvasRect tileRect;
+			tileRect.min = v2u{tile % tileCount.x, tile / tileCount.x} * canvasTileSize;
+			tileRect.max = TL::min(tileRect.min + canvasTileSize, target->size);
+			for (u32 i = binOffsets[tile]; i < binOffsets[tile + 1]; ++i) {
+				auto &shape = shapes[binnedShapes[i]];
+				CanvasRect rect;
+				rect.min = TL::max(tileRect.min, shape.rect.min);
+				rect.max = TL::min(tileRect.max, shape.rect.max);
+				rasterizeShape(*target, shape, rect, antialiasing);
+			}
+		});
+
+		stats.passCount += 1;
+		stats.shapeCount += (u32)shapes.size();
+		stats.binnedShapeCount += (u32)binnedShapes.size();
+		stats.tileCount += (u32)activeTiles.size();
+		stats.stealCount += pool.stealCount - stealCountBefore;
+		shapes.clear();
+	}
+};
+
+//
+// Entities
+//
+
+// Tile of a large image drawn over its texture, 'rect' is the part of the image it covers, see virtualtexture.h
+struct RasterImageTile {
+	RasterTexture const *texture;
+	aabb<v2f> rect;
+};
+
+// Pushes shapes of an entity command, same geometry the D3D11 renderer draws.
+// 'texture' is the image's texture, null for other entities.
+inline void pushEntity(RasterPass &pass, RasterView const &view, Entity const &e, DrawCommand const &command, RasterTexture const *texture, bool wireframe, Span<RasterImageTile const> tiles = {}) {
+	auto &c = command.entity;
+	m2 rotation = m2::rotation(-c.rotation);
+	f32 pixelsPerUnit = 1.0f / view.cameraDistance;
+
+	auto pushLines = [&](Line const *lines, umm count) {
+		for (umm i = 0; i < count; ++i) {
+			auto &line = lines[i];
+			v2f a = view.toCanvas(rotation * line.a.position + c.position);
+			v2f b = view.toCanvas(rotation * line.b.position + c.position);
+			if (wireframe) {
+				pass.pushCapsule(a, b, 0.5f, 0.5f, c.color);
+			} else {
+				f32 scale = 0.5f * c.thicknessMult * pixelsPerUnit;
+				pass.pushCapsule(a, b, line.a.thickness * scale, line.b.thickness * scale, c.color);
+			}
+		}
+	};
+	auto pushOutline = [&](v2f a, v2f b) {
+		pass.pushCapsule(a, b, 0.5f, 0.5f, V3f(1));
+	};
+
+	switch (e.type) {
+		case Entity_pencil: pushLines(e.pencil.lines.data(), e.pencil.lines.size()); break;
+		case Entity_line:   pushLines(&e.line.line, 1); break;
+		case Entity_circle: pushLines(getCircleLines(e.circle).data(), CircleEntity::LINE_COUNT); break;
+		case Entity_grid: {
+			u32 lineCount = getGridLineCount(e.grid);
+			for (u32 i = 0; i < lineCount; ++i) {
+				Line line = getGridLine(e.grid, i);
+				pushLines(&line, 1);
+			}
+		} break;
+		case Entity_image: {
+			if (!texture)
+				break;
+			v2f center = view.toCanvas(c.position);
+			v2f axisX = rotation * v2f{e.image.size.x * 0.5f, 0} * pixelsPerUnit;
+			v2f axisY = rotation * v2f{0, e.image.size.y * 0.5f} * pixelsPerUnit;
+			pass.pushImage(*texture, center, axisX, axisY);
+			for (auto &tile : tiles) {
+				auto &rect = tile.rect;
+				v2f tileCenter = center + axisX * (rect.min.x + rect.max.x - 1) + axisY * (rect.min.y + rect.max.y - 1);
+				pass.pushImage(*tile.texture, tileCenter, axisX * (rect.max.x - rect.min.x), axisY * (rect.max.y - rect.min.y));
+			}
+
+			if (c.outline) {
+				auto corner = [&](f32 x, f32 y) { return center + axisX * (x * 2 - 1) + axisY * (y * 2 - 1); };
+				for (f32 t : {0.0f, 0.1f, 0.9f, 1.0f}) {
+					pushOutline(corner(t, 0), corner(t, 1));
+					pushOutline(corner(0, t), corner(1, t));
+				}
+			}
+		} break;
+		default: INVALID_CODE_PATH();
+	}
+
+	if (c.drawBounds) {
+		v2f min = view.toCanvas(e.bounds.min);
+		v2f max = view.toCanvas(e.bounds.max);
+		pushOutline(min, {max.x, min.y});
+		pushOutline({max.x, min.y}, max);
+		pushOutline(max, {min.x, max.y});
+		pushOutline({min.x, max.y}, min);
+	}
+}
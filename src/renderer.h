@@ -1,9 +1,16 @@
 #pragma once
 #include "base.h"
+#include "drawlist.h"
+#include "canvaspool.h"
+#include "mips.h"
+#include "virtualtexture.h"
+#include "imageatlas.h"
 
 #define R_initScene					R_DECORATE(void, initScene, (Scene *scene), (scene))
 #define R_resize					R_DECORATE(void, resize, (), ())
 #define R_repaint					R_DECORATE(void, repaint, (bool drawCursor, bool drawCursorCircle), (drawCursor, drawCursorCircle))
+#define R_execute					R_DECORATE(void, execute, (DrawList const &list), (list))
+#define R_getLastFrame				R_DECORATE(DrawList const &, getLastFrame, (), ())
 #define R_initConstantLineArray		R_DECORATE(void, initConstantLineArray, (void *renderData, TransformedLine const *data, umm count), (renderData, data, count))
 #define R_initDynamicLineArray		R_DECORATE(void, initDynamicLineArray, (void *renderData, TransformedLine const *data, umm count), (renderData, data, count))
 #define R_reinitDynamicLineArray	R_DECORATE(void, reinitDynamicLineArray, (void* renderData, TransformedLine const* data, umm count), (renderData, data, count))
@@ -14,7 +21,6 @@
 #define R_releaseImageData			R_DECORATE(void, releaseImageData, (void *renderData), (renderData))
 #define R_releaseEntity				R_DECORATE(void, releaseEntity, (Entity& action), (action))
 #define R_switchRasterizer			R_DECORATE(void, switchRasterizer, (), ())
-#define R_pickColor					R_DECORATE(void, pickColor, (), ())
 #define R_resizeLineArray			R_DECORATE(void, resizeLineArray, (void *renderData, TransformedLine const *data, umm count), (renderData, data, count))
 #define R_updateLineArray			R_DECORATE(void, updateLineArray, (void *renderData, TransformedLine const *data, umm count, umm firstElem), (renderData, data, count, firstElem))
 #define R_updateLines				R_DECORATE(void, updateLines, (void* renderData, Line const* data, umm count, umm firstElem), (renderData, data, count, firstElem))
@@ -23,7 +29,12 @@
 #define R_freeze					R_DECORATE(void, freeze, (PencilEntity& pencil), (pencil))
 #define R_resizePencilLineArray		R_DECORATE(void, resizePencilLineArray, (PencilEntity& pencil), (pencil))
 #define R_updateLastElement			R_DECORATE(void, updateLastElement, (PencilEntity& pencil), (pencil))
-#define R_setTexture				R_DECORATE(void, setTexture, (void *image, void const *data, u32 width, u32 height), (image, data, width, height))
+#define R_beginTexture				R_DECORATE(void, beginTexture, (void *image, MipChain const &mips), (image, mips))
+#define R_updateTexture				R_DECORATE(void, updateTexture, (void *image, MipChain const &mips, u32 level, u32 firstRow, u32 rowCount), (image, mips, level, firstRow, rowCount))
+#define R_endTexture				R_DECORATE(void, endTexture, (void *image), (image))
+#define R_setImageTiles				R_DECORATE(void, setImageTiles, (void *image, ImageTile const *tiles, umm count), (image, tiles, count))
+#define R_setAtlasImage				R_DECORATE(void, setAtlasImage, (void *image, MipChain const &mips), (image, mips))
+#define R_getImageAtlasStats		R_DECORATE(ImageAtlasStats, getImageAtlasStats, (), ())
 #define R_updatePaintCursor			R_DECORATE(void, updatePaintCursor, (Scene* scene, v2f windowMousePos, v3f windowDrawColor, f32 windowDrawThickness), (scene, windowMousePos, windowDrawColor, windowDrawThickness))
 #define R_initPencilEntity			R_DECORATE(void, initPencilEntity, (PencilEntity& pencil), (pencil))
 #define R_initLineEntity			R_DECORATE(void, initLineEntity, (LineEntity& line), (line))
@@ -46,6 +57,8 @@
 #define R_isMultisampleEnabled		R_DECORATE(bool, isMultisampleEnabled, (), ())
 #define R_setVSync					R_DECORATE(void, setVSync, (bool enable), (enable))
 #define R_releaseScene				R_DECORATE(void, releaseScene, (Scene *scene), (scene))
+#define R_getCanvasStats			R_DECORATE(CanvasStats, getCanvasStats, (), ())
+#define R_setCanvasBudget			R_DECORATE(void, setCanvasBudget, (u64 bytes), (bytes))
 #define R_shutdown					R_DECORATE(void, shutdown, (), ())
 //#define R_debugSaveRenderTarget		R_DECORATE(void, debugSaveRenderTarget, (), ())
 
@@ -53,6 +66,8 @@
 R_initScene				 \
 R_resize				 \
 R_repaint				 \
+R_execute				 \
+R_getLastFrame			 \
 R_initConstantLineArray	 \
 R_initDynamicLineArray	 \
 R_reinitDynamicLineArray \
@@ -63,7 +78,6 @@ R_releaseCircle			 \
 R_releaseImageData		 \
 R_releaseEntity			 \
 R_switchRasterizer		 \
-R_pickColor				 \
 R_resizeLineArray		 \
 R_updateLineArray		 \
 R_updateLines			 \
@@ -72,7 +86,12 @@ R_updateCircleLines		 \
 R_freeze				 \
 R_resizePencilLineArray	 \
 R_updateLastElement		 \
-R_setTexture			 \
+R_beginTexture			 \
+R_updateTexture			 \
+R_endTexture			 \
+R_setImageTiles			 \
+R_setAtlasImage			 \
+R_getImageAtlasStats	 \
 R_updatePaintCursor		 \
 R_initPencilEntity		 \
 R_initLineEntity		 \
@@ -95,6 +114,8 @@ R_setMultisampleEnabled  \
 R_isMultisampleEnabled	 \
 R_setVSync				 \
 R_releaseScene			 \
+R_getCanvasStats		 \
+R_setCanvasBudget		 \
 R_shutdown				 \
 //R_debugSaveRenderTarget
 
@@ -0,0 +1,125 @@
+#pragma once
+#include "base.h"
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Decides when the main loop runs the next frame. While something is presented or animated
+// frames follow each other, paced by vsync or frameInterval. Otherwise the loop blocks until
+// input arrives, another thread calls wake() or a timer set with wakeAt() expires.
+
+struct FrameSchedulerStats {
+	u64 frameCount = 0;
+	u64 idleWaitCount = 0;  // Blocked until woken
+	u64 timedWaitCount = 0; // Blocked until the next frame or a timer
+	f64 totalSeconds = 0;
+	f64 waitSeconds = 0;
+
+	u64 wakeCount = 0;
+	f64 wakeLatencyTotal = 0; // Seconds between wake() and the start of the frame that handled it
+	f64 wakeLatencyMax = 0;
+
+	f64 idleFraction() const { return totalSeconds ? waitSeconds / totalSeconds : 0; }
+	f64 averageWakeLatency() const { return wakeCount ? wakeLatencyTotal / wakeCount : 0; }
+};
+
+struct FrameScheduler {
+	using Clock = std::chrono::steady_clock;
+
+	// Platform wait, returns on input, wakeUp or timeout. Negative timeout waits forever.
+	// Without it the scheduler waits on its own condition variable, which only wake() signals.
+	void (*waitForEvents)(f64 timeoutSeconds) = 0;
+	void (*wakeUp)() = 0;
+
+	f64 frameInterval = 1.0 / 60;
+	FrameSchedulerStats stats;
+
+	Clock::time_point frameStart = {};
+	Clock::time_point timer = Clock::time_point::max();
+	std::atomic<s64> wakeRequestTime = 0; // Earliest wake() since the last frame, 0 if none
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool wakePending = false;
+
+	static s64 ticks(Clock::time_point time) { return time.time_since_epoch().count(); }
+	static f64 seconds(Clock::duration duration) { return std::chrono::duration<f64>(duration).count(); }
+
+	// Can be called from any thread
+	void wake() {
+		s64 now = ticks(Clock::now());
+		s64 expected = 0;
+		wakeRequestTime.compare_exchange_strong(expected, now);
+		if (wakeUp) {
+			wakeUp();
+		} else {
+			std::unique_lock lock(mutex);
+			wakePending = true;
+			condition.notify_one();
+		}
+	}
+	// Runs a frame no later than at time, kept until the next frame starts
+	void wakeAt(Clock::time_point time) {
+		if (time < timer) {
+			timer = time;
+		}
+	}
+	void beginFrame() {
+		auto now = Clock::now();
+		if (frameStart != Clock::time_point{}) {
+			stats.totalSeconds += seconds(now - frameStart);
+		}
+		frameStart = now;
+		++stats.frameCount;
+
+		s64 requestTime = wakeRequestTime.exchange(0);
+		if (requestTime) {
+			f64 latency = seconds(Clock::duration(ticks(now) - requestTime));
+			++stats.wakeCount;
+			stats.wakeLatencyTotal += latency;
+			stats.wakeLatencyMax = max(stats.wakeLatencyMax, latency);
+		}
+		if (timer <= now) {
+			timer = Clock::time_point::max();
+		}
+	}
+	// presented: the frame was drawn, next one is paced by vsync. Must only follow flags that the
+	// present consumes, otherwise a flag nobody clears keeps the loop presenting at vsync forever.
+	// animating: state changes without input, next frame runs after frameInterval.
+	void endFrame(bool presented, bool animating) {
+		if (presented)
+			return;
+
+		auto deadline = timer;
+		if (animating) {
+			auto nextFrame = frameStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>(frameInterval));
+			if (nextFrame < deadline) {
+				deadline = nextFrame;
+			}
+		}
+
+		auto waitBegin = Clock::now();
+		if (deadline <= waitBegin)
+			return;
+
+		if (deadline == Clock::time_point::max()) {
+			++stats.idleWaitCount;
+		} else {
+			++stats.timedWaitCount;
+		}
+
+		if (waitForEvents) {
+			waitForEvents(deadline == Clock::time_point::max() ? -1 : seconds(deadline - waitBegin));
+		} else {
+			std::unique_lock lock(mutex);
+			if (deadline == Clock::time_point::max()) {
+				condition.wait(lock, [&] { return wakePending; });
+			} else {
+				condition.wait_until(lock, deadline, [&] { return wakePending; });
+			}
+			wakePending = false;
+		}
+		stats.waitSeconds += seconds(Clock::now() - waitBegin);
+	}
+};
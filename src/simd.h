@@ -0,0 +1,66 @@
+#pragma once
+#include "base.h"
+
+#if COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+
+// MSVC allows AVX intrinsics anywhere, other compilers need them enabled per function
+#if COMPILER_MSVC
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+struct CpuFeatures {
+	bool sse41;
+	bool avx2;
+};
+
+inline CpuFeatures detectCpuFeatures() {
+	CpuFeatures result = {};
+
+	u32 regs[4] = {};
+	auto cpuid = [&](u32 leaf, u32 subleaf) {
+#if COMPILER_MSVC
+		__cpuidex((int *)regs, leaf, subleaf);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	};
+
+	cpuid(0, 0);
+	u32 maxLeaf = regs[0];
+
+	cpuid(1, 0);
+	result.sse41 = regs[2] & (1 << 19);
+	bool osxsave = regs[2] & (1 << 27);
+	bool avx     = regs[2] & (1 << 28);
+
+	// AVX state has to be enabled by the OS too
+	bool osAvx = false;
+	if (osxsave) {
+#if COMPILER_MSVC
+		u64 xcr0 = _xgetbv(0);
+#else
+		u32 xcr0Low, xcr0High;
+		__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+		u64 xcr0 = ((u64)xcr0High << 32) | xcr0Low;
+#endif
+		osAvx = (xcr0 & 6) == 6;
+	}
+
+	if (maxLeaf >= 7 && avx && osAvx) {
+		cpuid(7, 0);
+		result.avx2 = regs[1] & (1 << 5);
+	}
+	return result;
+}
+
+inline CpuFeatures const &getCpuFeatures() {
+	static CpuFeatures result = detectCpuFeatures();
+	return result;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "base.h"
+
+// Turns a pencil stroke into one triangle list.
+// Instead of two half-disks per line (VERTS_PER_LINE in the renderers) segments are connected
+// with round joins where direction changes, and round caps are added only at the ends.
+// Vertex position is center + offset * thicknessMult, so thickness can be scaled without remeshing.
+
+struct StrokeVertex {
+	v2f center;
+	v2f offset;
+};
+
+// Maximum distance in pixels between the tessellated arc and a real circle
+constexpr f32 strokeTolerance = 0.25f;
+constexpr u32 minCircleSegmentCount = 8;
+constexpr u32 maxCircleSegmentCount = 256;
+
+// Joints where stroke gets thinner than this are drawn as full disks
+constexpr f32 joinThicknessRatio = 0.95f;
+
+inline u32 getCircleSegmentCount(f32 screenRadius) {
+	if (screenRadius <= strokeTolerance)
+		return minCircleSegmentCount;
+	f32 step = 2 * acosf(1 - strokeTolerance / screenRadius);
+	return (u32)clamp((s32)ceilf(2 * pi / step), (s32)minCircleSegmentCount, (s32)maxCircleSegmentCount);
+}
+
+inline bool isDegenerate(Line const &line) {
+	return line.a.position == line.b.position;
+}
+
+// True if 'next' starts exactly where 'prev' ends, so there is no need for caps between them
+inline bool continues(Line const &prev, Line const &next) {
+	return prev.b.position == next.a.position && prev.b.thickness == next.a.thickness && !isDegenerate(next);
+}
+
+struct StrokeMesher {
+	List<StrokeVertex> *vertices;
+	f32 pixelsPerUnit;
+
+	// Triangles are emitted clockwise, same as line geometry, so back face culling keeps them
+	void pushTriangle(StrokeVertex a, StrokeVertex b, StrokeVertex c) {
+		v2f pa = a.center + a.offset;
+		v2f pb = b.center + b.offset;
+		v2f pc = c.center + c.offset;
+		if (cross(pb - pa, pc - pa) > 0) {
+			std::swap(b, c);
+		}
+		vertices->push_back(a);
+		vertices->push_back(b);
+		vertices->push_back(c);
+	}
+
+	void pushFan(v2f center, f32 radius, f32 startAngle, f32 sweep) {
+		u32 segmentCount = max(1u, (u32)ceilf(getCircleSegmentCount(radius * pixelsPerUnit) * absolute(sweep) / (2 * pi)));
+		v2f previous = v2f{cosf(startAngle), sinf(startAngle)} * radius;
+		for (u32 i = 1; i <= segmentCount; ++i) {
+			f32 angle = startAngle + sweep * i / segmentCount;
+			v2f current = v2f{cosf(angle), sinf(angle)} * radius;
+			pushTriangle({center, {}}, {center, previous}, {center, current});
+			previous = current;
+		}
+	}
+
+	void pushJoin(v2f center, f32 radius, v2f prevDirection, v2f direction) {
+		f32 turnCross = cross(prevDirection, direction);
+		f32 sweep = atan2f(turnCross, dot(prevDirection, direction));
+
+		// Straight enough, gap between segments is not visible
+		if (absolute(sweep) * radius * pixelsPerUnit < strokeTolerance)
+			return;
+
+		// Fill outer side of the turn
+		v2f normal = v2f{-prevDirection.y, prevDirection.x};
+		if (turnCross >= 0)
+			normal = -normal;
+		pushFan(center, radius, atan2f(normal.y, normal.x), sweep);
+	}
+
+	void pushStroke(Line const *lines, umm count) {
+		for (umm index = 0; index < count; ++index) {
+			Line const &line = lines[index];
+			f32 ra = line.a.thickness * 0.5f;
+			f32 rb = line.b.thickness * 0.5f;
+
+			if (isDegenerate(line)) {
+				pushFan(line.a.position, max(ra, rb), 0, 2 * pi);
+				continue;
+			}
+
+			v2f direction = normalize(line.b.position - line.a.position);
+			v2f normal = v2f{-direction.y, direction.x};
+
+			if (index != 0 && !isDegenerate(lines[index - 1]) && continues(lines[index - 1], line)) {
+				Line const &prev = lines[index - 1];
+
+				// Outer wedge is enough only if neighbouring segments are not thinner than the joint,
+				// otherwise they don't cover the inner part of it
+				f32 thinnest = min(prev.a.thickness, line.b.thickness) * 0.5f;
+				if (thinnest < ra * joinThicknessRatio) {
+					pushFan(line.a.position, ra, 0, 2 * pi);
+				} else {
+					pushJoin(line.a.position, ra, normalize(prev.b.position - prev.a.position), direction);
+				}
+			} else {
+				pushFan(line.a.position, ra, atan2f(normal.y, normal.x), pi);
+			}
+
+			StrokeVertex a0 = {line.a.position,  normal * ra};
+			StrokeVertex a1 = {line.a.position, -normal * ra};
+			StrokeVertex b0 = {line.b.position,  normal * rb};
+			StrokeVertex b1 = {line.b.position, -normal * rb};
+			pushTriangle(a0, a1, b0);
+			pushTriangle(b0, a1, b1);
+
+			if (index + 1 == count || !continues(line, lines[index + 1])) {
+				pushFan(line.b.position, rb, atan2f(-normal.y, -normal.x), pi);
+			}
+		}
+	}
+};
+
+// Appends triangles of a stroke to 'vertices'.
+// 'pixelsPerUnit' is the scale the mesh will be viewed at, it controls arc tessellation.
+inline void meshStroke(List<StrokeVertex> &vertices, Line const *lines, umm count, f32 pixelsPerUnit) {
+	StrokeMesher mesher;
+	mesher.vertices = &vertices;
+	mesher.pixelsPerUnit = pixelsPerUnit;
+	mesher.pushStroke(lines, count);
+}
+
+// Meshes are rebuilt only when zoom crosses a power of two
+inline f32 getStrokeMeshScale(f32 pixelsPerUnit) {
+	return exp2f(ceilf(log2f(pixelsPerUnit)));
+}
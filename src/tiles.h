@@ -0,0 +1,93 @@
+#pragma once
+#include "../dep/tl/include/tl/math.h"
+#include "../dep/tl/include/tl/list.h"
+
+// Canvas is split into square tiles. Changes mark tiles they touch and only those are repainted.
+// Coordinates are canvas pixels with origin in the bottom left corner, same as mousePosBL.
+
+constexpr u32 canvasTileSize = 64;
+
+// Pixel rectangle, max is exclusive
+struct CanvasRect {
+	v2u min;
+	v2u max;
+};
+
+struct TileMask {
+	v2u canvasSize = {};
+	v2u tileCount = {};
+	List<u8> tiles;
+	u32 dirtyCount = 0;
+
+	void resize(v2u newCanvasSize) {
+		if (canvasSize == newCanvasSize)
+			return;
+		canvasSize = newCanvasSize;
+		tileCount = (canvasSize + (canvasTileSize - 1)) / canvasTileSize;
+		tiles.resize(tileCount.x * tileCount.y);
+		clear();
+	}
+	void clear() {
+		memset(tiles.data(), 0, tiles.size());
+		dirtyCount = 0;
+	}
+	bool any() const { return dirtyCount != 0; }
+	u32 totalCount() const { return tileCount.x * tileCount.y; }
+
+	// Marks tiles touched by pixel rectangle, parts outside of the canvas are ignored
+	void add(v2f min, v2f max) {
+		if (!tiles.size() || !(min.x < max.x && min.y < max.y))
+			return;
+		if (max.x <= 0 || max.y <= 0 || min.x >= canvasSize.x || min.y >= canvasSize.y)
+			return;
+
+		v2u first = (v2u)TL::max(min, V2f(0)) / canvasTileSize;
+		v2u last = TL::min((v2u)TL::min(max, (v2f)canvasSize - 1) / canvasTileSize, tileCount - 1);
+		for (u32 y = first.y; y <= last.y; ++y) {
+			for (u32 x = first.x; x <= last.x; ++x) {
+				u8 &tile = tiles[y * tileCount.x + x];
+				dirtyCount += !tile;
+				tile = 1;
+			}
+		}
+	}
+	// Dirty tiles merged into rectangles: runs in a row are merged first,
+	// then runs that span the same columns in consecutive rows.
+	List<CanvasRect> getRects() const {
+		List<CanvasRect> result;
+		List<umm> open, nextOpen; // Rects that end at the current row
+		for (u32 y = 0; y < tileCount.y; ++y) {
+			nextOpen.clear();
+			for (u32 x = 0; x < tileCount.x;) {
+				if (!tiles[y * tileCount.x + x]) {
+					++x;
+					continue;
+				}
+				u32 runBegin = x;
+				while (x < tileCount.x && tiles[y * tileCount.x + x]) {
+					++x;
+				}
+
+				umm index = result.size();
+				for (auto i : open) {
+					if (result[i].min.x == runBegin && result[i].max.x == x) {
+						index = i;
+						break;
+					}
+				}
+				if (index == result.size()) {
+					result.push_back({{runBegin, y}, {x, y + 1}});
+				} else {
+					result[index].max.y = y + 1;
+				}
+				nextOpen.push_back(index);
+			}
+			std::swap(open, nextOpen);
+		}
+		for (auto &rect : result) {
+			rect.min = TL::min(rect.min * canvasTileSize, canvasSize);
+			rect.max = TL::min(rect.max * canvasTileSize, canvasSize);
+		}
+		return result;
+	}
+};
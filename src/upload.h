@@ -0,0 +1,74 @@
+#pragma once
+#include "renderer.h"
+
+// Decoded textures are uploaded on the main thread between frames instead of on the decode workers, so creating
+// a large texture does not take the renderer's lock while a frame is drawn. Uploads are split into pieces of rows,
+// each frame uploads pieces until its byte or time budget is used up. An image keeps drawing its previous texture
+// until the last piece of its new one is uploaded, see R_beginTexture.
+
+constexpr u64 defaultTextureUploadBytesPerFrame = 32 * 1024 * 1024;
+constexpr f64 defaultTextureUploadSecondsPerFrame = 0.004;
+// Budgets are checked between pieces, so a frame goes over them by at most one piece. Images that go into the
+// atlas are one piece each, see imageatlas.h.
+constexpr u64 textureUploadPieceBytes = 512 * 1024;
+
+struct TextureUploadStats {
+	u64 bytesPerFrame = defaultTextureUploadBytesPerFrame;
+	f64 secondsPerFrame = defaultTextureUploadSecondsPerFrame;
+	u32 backlogCount = 0; // Decoded images waiting for their textures
+	u64 backlogBytes = 0; // Texels of them not uploaded yet
+	u64 lastFrameBytes = 0;
+	f64 lastFrameSeconds = 0;
+	f64 peakFrameSeconds = 0;
+	u64 uploadedBytes = 0;
+	u64 uploadedCount = 0; // Completed textures
+};
+
+// Texture of 'renderData' being uploaded from 'mips', which stays alive until it is done
+struct TextureUpload {
+	void *renderData = 0;
+	MipChain const *mips = 0;
+	u32 level = 0;
+	u32 row = 0; // Next row of 'level', rows are uploaded from the top
+	bool atlas = false; // Drawn from the renderer's atlas instead of a texture of its own
+
+	bool done() const { return level == mips->levels.size(); }
+	u64 remainingBytes() const {
+		if (done())
+			return 0;
+		return (mips->texelCount() - mips->levels[level].offset - (umm)row * mips->levels[level].size.x) * sizeof(u32);
+	}
+};
+
+// Uploads rows of 'upload' up to about textureUploadPieceBytes, small levels are uploaded together.
+// Returns the uploaded bytes.
+inline u64 uploadTexturePiece(Renderer *renderer, TextureUpload &upload) {
+	auto &mips = *upload.mips;
+	if (upload.atlas) {
+		renderer->setAtlasImage(upload.renderData, mips);
+		upload.level = (u32)mips.levels.size();
+		return mips.bytes();
+	}
+	if (upload.level == 0 && upload.row == 0) {
+		renderer->beginTexture(upload.renderData, mips);
+	}
+
+	u64 bytes = 0;
+	while (!upload.done() && bytes < textureUploadPieceBytes) {
+		v2u size = mips.levels[upload.level].size;
+		u64 rowBytes = size.x * sizeof(u32);
+		u32 rowCount = (u32)clamp((textureUploadPieceBytes - bytes) / rowBytes, (u64)1, (u64)(size.y - upload.row));
+		renderer->updateTexture(upload.renderData, mips, upload.level, upload.row, rowCount);
+		bytes += rowCount * rowBytes;
+		upload.row += rowCount;
+		if (upload.row == size.y) {
+			upload.row = 0;
+			++upload.level;
+		}
+	}
+
+	if (upload.done()) {
+		renderer->endTexture(upload.renderData);
+	}
+	return bytes;
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "base.h"
+#include "mips.h"
+
+// Images larger than minVirtualTextureSize are drawn from tiles instead of one texture. Their full resolution
+// chain is kept in the disk cache (diskcache.h) and mapped when tiles are needed, or kept in memory when it could
+// not be stored, so the file is decoded once either way. A small level of it is the
+// image's own texture, shown while tiles load. Tiles of the level matching the zoom that intersect the view
+// are copied out of the mapping on the decode workers and drawn over it, tiles out of view are released.
+
+constexpr u32 minVirtualTextureSize = 8192;
+constexpr u32 virtualTextureTileSize = 512;
+// Largest side of the level that is the image's own texture
+constexpr u32 virtualTextureBaseSize = 1024;
+// Tiles out of view kept per image, so panning back does not load them again
+constexpr u32 virtualTextureSpareTileCount = 16;
+
+// Part of an image drawn with its own texture, see R_setImageTiles
+struct ImageTile {
+	void *renderData;
+	aabb<v2f> rect; // In [0, 1] with y going up, same as uv in pickSceneColor
+};
+
+inline bool needsVirtualTexture(v2u size) {
+	return max(size.x, size.y) > minVirtualTextureSize;
+}
+// Full resolution chain of an image that is drawn from tiles
+inline bool isVirtualTexture(MipChain const &mips) {
+	return mips.levels.size() && mips.size() == mips.sourceSize && needsVirtualTexture(mips.sourceSize);
+}
+
+inline v2u getMipLevelSize(v2u size, u32 level) {
+	for (u32 i = 0; i < level; ++i) {
+		size = getHalfSize(size);
+	}
+	return size;
+}
+// Level whose textures are shown at 'shownSize' window pixels with at least one texel per pixel
+inline u32 getVirtualTextureLevel(v2u sourceSize, u32 shownSize) {
+	return getMipSkipCount(sourceSize, shownSize);
+}
+// First level that is not larger than virtualTextureBaseSize, tiles are not needed from it on
+inline u32 getVirtualTextureBaseLevel(v2u sourceSize) {
+	u32 level = 0;
+	for (v2u size = sourceSize; max(size.x, size.y) > virtualTextureBaseSize; size = getHalfSize(size)) {
+		++level;
+	}
+	return level;
+}
+
+// Level in the top byte, then rows and columns of tiles, rows go from the top
+inline u64 makeTileKey(u32 level, v2u index) {
+	return ((u64)level << 56) | ((u64)index.y << 28) | index.x;
+}
+inline u32 getTileLevel(u64 key) {
+	return (u32)(key >> 56);
+}
+inline v2u getTileIndex(u64 key) {
+	return {(u32)key & 0xFFFFFFF, (u32)(key >> 28) & 0xFFFFFFF};
+}
+
+inline aabb<v2f> getTileRect(v2u sourceSize, u64 key) {
+	v2f size = (v2f)getMipLevelSize(sourceSize, getTileLevel(key));
+	v2u index = getTileIndex(key);
+	v2f min = (v2f)(index * virtualTextureTileSize) / size;
+	v2f max = TL::min((v2f)((index + 1u) * virtualTextureTileSize) / size, V2f(1));
+	return aabbMinMax(v2f{min.x, 1 - max.y}, v2f{max.x, 1 - min.y});
+}
+
+// Part of the image entity inside 'view', empty when they do not intersect
+inline aabb<v2f> getImageViewRect(Entity const &e, aabb<v2f> view) {
+	auto &image = e.image;
+	m2 rotation = m2::rotation(e.rotation);
+	v2f corners[] = {view.min, {view.max.x, view.min.y}, view.max, {view.min.x, view.max.y}};
+	v2f min = V2f(1), max = V2f(0);
+	for (auto corner : corners) {
+		v2f relativePoint = rotation * (corner - e.position) + e.position;
+		v2f uv = map(relativePoint, image.position - image.size * 0.5f, image.position + image.size * 0.5f, 0, 1);
+		min = TL::min(min, uv);
+		max = TL::max(max, uv);
+	}
+	return aabbMinMax(TL::max(min, V2f(0)), TL::min(max, V2f(1)));
+}
+
+// Appends keys of tiles of 'level' that intersect 'rect'
+inline void getTilesInRect(List<u64> &keys, v2u sourceSize, u32 level, aabb<v2f> rect) {
+	if (!(rect.min.x < rect.max.x && rect.min.y < rect.max.y))
+		return;
+
+	v2u size = getMipLevelSize(sourceSize, level);
+	v2u tileCount = (size + (virtualTextureTileSize - 1)) / virtualTextureTileSize;
+	f32 tileSize = (f32)virtualTextureTileSize;
+	u32 firstX = (u32)(rect.min.x * size.x / tileSize);
+	u32 firstY = (u32)((1 - rect.max.y) * size.y / tileSize);
+	u32 endX = min((u32)ceilf(rect.max.x * size.x / tileSize), tileCount.x);
+	u32 endY = min((u32)ceilf((1 - rect.min.y) * size.y / tileSize), tileCount.y);
+	for (u32 y = firstY; y < endY; ++y) {
+		for (u32 x = firstX; x < endX; ++x) {
+			keys.push_back(makeTileKey(level, {x, y}));
+		}
+	}
+}
+
+// Tile's texels copied out of its level of the full resolution chain, with mips of its own
+inline MipChain copyTile(MipChain const &mips, u64 key) {
+	u32 level = getTileLevel(key);
+	v2u levelSize = mips.levels[level].size;
+	v2u first = getTileIndex(key) * virtualTextureTileSize;
+	v2u size = {min(virtualTextureTileSize, levelSize.x - first.x), min(virtualTextureTileSize, levelSize.y - first.y)};
+
+	List<u32> texels;
+	texels.resize((umm)size.x * size.y);
+	for (u32 y = 0; y < size.y; ++y) {
+		memcpy(texels.data() + (umm)y * size.x, mips.level(level) + (umm)(first.y + y) * levelSize.x + first.x, size.x * sizeof(u32));
+	}
+	return buildMipChain(texels.data(), size, 0);
+}
+
+// Levels of the full resolution chain from the base level, pointing into its texels
+inline MipChain getVirtualTextureBase(MipChain const &mips) {
+	u32 first = min(getVirtualTextureBaseLevel(mips.sourceSize), (u32)mips.levels.size() - 1);
+	umm firstOffset = mips.levels[first].offset;
+
+	MipChain base;
+	base.sourceSize = mips.sourceSize;
+	for (u32 i = first; i < mips.levels.size(); ++i) {
+		base.levels.push_back({mips.levels[i].offset - firstOffset, mips.levels[i].size});
+	}
+	base.mappedTexels = mips.texelData() + firstOffset;
+	base.mappedTexelCount = mips.texelCount() - firstOffset;
+	return base;
+}
+
+// Center and size of the part 'rect' of an image, so a tile is drawn the same way as a whole image
+inline void getImageTileQuad(v2f position, f32 rotation, v2f size, aabb<v2f> rect, v2f &tilePosition, v2f &tileSize) {
+	v2f center = (rect.min + rect.max) * 0.5f;
+	tilePosition = position + m2::rotation(-rotation) * ((center - 0.5f) * size);
+	tileSize = (rect.max - rect.min) * size;
+}